@@ -37,8 +37,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <netinet/in.h>
+#include <stddef.h>
 #include <assert.h>
 
 #include <infiniband/umad.h>
@@ -56,6 +58,12 @@ static unsigned startlid, endlid;
 
 static int brief, dump_all, multicast;
 
+static unsigned max_smps = 64, max_switch_smps = 4;
+
+static char *binary_file_name;
+static FILE *binary_file;
+static uint32_t binary_count;
+
 static char *node_name_map_file = NULL;
 static nn_map_t *node_name_map = NULL;
 
@@ -104,23 +112,28 @@ static int dump_mlid(char *str, int strlen, unsigned mlid, unsigned nports,
 	return i * 2;
 }
 
-static __be16 mft[16][IB_MLIDS_IN_BLOCK];
-
-static void dump_multicast_tables(ibnd_node_t *node, unsigned startl,
-				  unsigned endl, struct ibmad_port *mad_port)
+/*
+ * Forwarding tables are read for many switches at once, see read_tables().
+ * Each switch has a list of SMP blocks to read; a block is an LFT block or
+ * one chunk of 16 ports of an MFT block.
+ */
+struct ft_switch {
+	ibnd_node_t *node;
+	unsigned startl, endl;
+	unsigned startblock;
+	unsigned chunks;	/* MFT: blocks per 32 mlids */
+	unsigned nblocks;
+	unsigned next;		/* next block to send */
+	unsigned done;
+	unsigned inflight;
+	uint8_t *data;		/* nblocks * IB_SMP_DATA_SIZE */
+};
+
+static void setup_multicast_tables(struct ft_switch *sw, unsigned startl,
+				   unsigned endl)
 {
-	ib_portid_t *portid = &node->path_portid;
-	char str[512];
-	char *s;
-	uint64_t nodeguid;
-	uint32_t mod;
-	unsigned block, i, j, e, nports, cap, chunks, startblock, lastblock,
-	    top;
-	char *mapnd = NULL;
-	int n = 0;
-
-	nports = node->numports;
-	nodeguid = node->guid;
+	ibnd_node_t *node = sw->node;
+	unsigned cap, top;
 
 	mad_decode_field(node->switchinfo, IB_SW_MCAST_FDB_CAP_F, &cap);
 	mad_decode_field(node->switchinfo, IB_SW_MCAST_FDB_TOP_F, &top);
@@ -148,6 +161,38 @@ static void dump_multicast_tables(ibnd_node_t *node, unsigned startl,
 		endl = IB_MAX_MCAST_LID;
 	}
 
+	sw->startl = startl;
+	sw->endl = endl;
+	sw->chunks = ALIGN(node->numports + 1, 16) / 16;
+	sw->startblock = startl / IB_MLIDS_IN_BLOCK;
+	if (endl >= startl)
+		sw->nblocks = (endl / IB_MLIDS_IN_BLOCK - sw->startblock + 1) *
+		    sw->chunks;
+}
+
+static uint32_t multicast_block_mod(struct ft_switch *sw, unsigned b)
+{
+	unsigned block = sw->startblock + b / sw->chunks;
+
+	return (block - IB_MIN_MCAST_LID / IB_MLIDS_IN_BLOCK) |
+	    ((b % sw->chunks) << 28);
+}
+
+static void dump_multicast_tables(struct ft_switch *sw)
+{
+	ibnd_node_t *node = sw->node;
+	ib_portid_t *portid = &node->path_portid;
+	char str[512];
+	char *s;
+	uint64_t nodeguid;
+	unsigned block, i, e, nports, cap, top;
+	unsigned startl = sw->startl, endl = sw->endl;
+	char *mapnd = NULL;
+	int n = 0;
+
+	nports = node->numports;
+	nodeguid = node->guid;
+
 	mapnd = remap_node_name(node_name_map, nodeguid, node->nodedesc);
 
 	printf("Multicast mlids [0x%x-0x%x] of switch %s guid 0x%016" PRIx64
@@ -170,34 +215,17 @@ static void dump_multicast_tables(ibnd_node_t *node, unsigned startl,
 		printf("     Ports: %s\n", str);
 		printf(" MLid\n");
 	}
-	if (ibverbose)
+	if (ibverbose) {
+		mad_decode_field(node->switchinfo, IB_SW_MCAST_FDB_CAP_F, &cap);
+		mad_decode_field(node->switchinfo, IB_SW_MCAST_FDB_TOP_F, &top);
 		printf("Switch multicast mlid capability is %d top is 0x%x\n",
 		       cap, top);
+	}
 
-	chunks = ALIGN(nports + 1, 16) / 16;
-
-	startblock = startl / IB_MLIDS_IN_BLOCK;
-	lastblock = endl / IB_MLIDS_IN_BLOCK;
-	for (block = startblock; block <= lastblock; block++) {
-		for (j = 0; j < chunks; j++) {
-			int status;
-			mod = (block - IB_MIN_MCAST_LID / IB_MLIDS_IN_BLOCK)
-			    | (j << 28);
-
-			DEBUG("reading block %x chunk %d mod %x", block, j,
-			      mod);
-			if (!smp_query_status_via
-			    (mft + j, portid, IB_ATTR_MULTICASTFORWTBL, mod, 0,
-			     &status, mad_port)) {
-				fprintf(stderr, "SubnGet(MFT) failed on switch "
-						"'%s' %s Node GUID 0x%"PRIx64
-						" SMA LID %d; MAD status 0x%x "
-						"AM 0x%x\n",
-						mapnd, portid2str(portid),
-						node->guid, node->smalid,
-						status, mod);
-			}
-		}
+	for (block = sw->startblock; sw->nblocks &&
+	     block <= endl / IB_MLIDS_IN_BLOCK; block++) {
+		__be16 (*mft)[IB_MLIDS_IN_BLOCK] = (void *)(sw->data +
+		    (block - sw->startblock) * sw->chunks * IB_SMP_DATA_SIZE);
 
 		i = block * IB_MLIDS_IN_BLOCK;
 		e = i + IB_MLIDS_IN_BLOCK;
@@ -291,17 +319,41 @@ static int dump_lid(char *str, int str_len, int lid, int valid,
 	return rc;
 }
 
-static void dump_unicast_tables(ibnd_node_t *node, int startl, int endl,
-				struct ibmad_port *mad_port,
-				ibnd_fabric_t *fabric)
+static void setup_unicast_tables(struct ft_switch *sw, unsigned startl,
+				 unsigned endl)
 {
+	unsigned top;
+
+	mad_decode_field(sw->node->switchinfo, IB_SW_LINEAR_FDB_TOP_F, &top);
+
+	if (!endl || endl > top)
+		endl = top;
+
+	if (endl > IB_MAX_UCAST_LID) {
+		IBWARN("illegal lft top %d, truncate to %d", endl,
+		       IB_MAX_UCAST_LID);
+		endl = IB_MAX_UCAST_LID;
+	}
+
+	sw->startl = startl;
+	sw->endl = endl;
+	sw->startblock = startl / IB_SMP_DATA_SIZE;
+	if (endl >= startl)
+		sw->nblocks = ALIGN(endl, IB_SMP_DATA_SIZE) / IB_SMP_DATA_SIZE -
+		    sw->startblock;
+}
+
+static void dump_unicast_tables(struct ft_switch *sw, ibnd_fabric_t *fabric)
+{
+	ibnd_node_t *node = sw->node;
 	ib_portid_t * portid = &node->path_portid;
-	char lft[IB_SMP_DATA_SIZE] = { 0 };
+	uint8_t *lft;
 	char str[200];
 	uint64_t nodeguid;
 	int block, i, e, top;
 	unsigned nports;
-	int n = 0, startblock, endblock;
+	int n = 0, endblock;
+	int startl = sw->startl, endl = sw->endl;
 	char *mapnd = NULL;
 	int last_port_lid = 0, base_port_lid = 0;
 	uint64_t portguid = 0;
@@ -310,15 +362,6 @@ static void dump_unicast_tables(ibnd_node_t *node, int startl, int endl,
 	nodeguid = node->guid;
 	nports = node->numports;
 
-	if (!endl || endl > top)
-		endl = top;
-
-	if (endl > IB_MAX_UCAST_LID) {
-		IBWARN("illegal lft top %d, truncate to %d", endl,
-		       IB_MAX_UCAST_LID);
-		endl = IB_MAX_UCAST_LID;
-	}
-
 	mapnd = remap_node_name(node_name_map, nodeguid, node->nodedesc);
 
 	printf("Unicast lids [0x%x-0x%x] of switch %s guid 0x%016" PRIx64
@@ -329,20 +372,9 @@ static void dump_unicast_tables(ibnd_node_t *node, int startl, int endl,
 
 	printf("  Lid  Out   Destination\n");
 	printf("       Port     Info \n");
-	startblock = startl / IB_SMP_DATA_SIZE;
-	endblock = ALIGN(endl, IB_SMP_DATA_SIZE) / IB_SMP_DATA_SIZE;
-	for (block = startblock; block < endblock; block++) {
-		int status;
-		DEBUG("reading block %d", block);
-		if (!smp_query_status_via(lft, portid, IB_ATTR_LINEARFORWTBL, block,
-				   0, &status, mad_port)) {
-			fprintf(stderr, "SubnGet(LFT) failed on switch "
-					"'%s' %s Node GUID 0x%"PRIx64
-					" SMA LID %d; MAD status 0x%x AM 0x%x\n",
-					mapnd, portid2str(portid),
-					node->guid, node->smalid,
-					status, block);
-		}
+	endblock = sw->startblock + sw->nblocks;
+	for (block = sw->startblock; block < endblock; block++) {
+		lft = sw->data + (block - sw->startblock) * IB_SMP_DATA_SIZE;
 		i = block * IB_SMP_DATA_SIZE;
 		e = i + IB_SMP_DATA_SIZE;
 		if (i < startl)
@@ -367,19 +399,260 @@ static void dump_unicast_tables(ibnd_node_t *node, int startl, int endl,
 	free(mapnd);
 }
 
-static void dump_node(ibnd_node_t *node, struct ibmad_port *mad_port,
-		      ibnd_fabric_t *fabric)
+static void write_binary_lft(struct ft_switch *sw)
 {
+	struct ibdiag_lft_file_rec rec = {
+		.guid = htole64(sw->node->guid),
+		.first_lid = htole32(sw->startblock * IB_SMP_DATA_SIZE),
+		.nlids = htole32(sw->nblocks * IB_SMP_DATA_SIZE),
+	};
+
+	if (fwrite(&rec, sizeof(rec), 1, binary_file) != 1 ||
+	    (sw->nblocks && fwrite(sw->data, sw->nblocks * IB_SMP_DATA_SIZE, 1,
+				   binary_file) != 1))
+		IBEXIT("writing '%s' failed: %s", binary_file_name,
+		       strerror(errno));
+	binary_count++;
+}
+
+static void open_binary_file(void)
+{
+	struct ibdiag_lft_file_hdr hdr = {
+		.magic = IBDIAG_LFT_FILE_MAGIC,
+		.version = htole32(IBDIAG_LFT_FILE_VERSION),
+	};
+
+	binary_file = fopen(binary_file_name, "w");
+	if (!binary_file)
+		IBEXIT("can't open '%s': %s", binary_file_name,
+		       strerror(errno));
+	if (fwrite(&hdr, sizeof(hdr), 1, binary_file) != 1)
+		IBEXIT("writing '%s' failed: %s", binary_file_name,
+		       strerror(errno));
+}
+
+static void close_binary_file(void)
+{
+	uint32_t count = htole32(binary_count);
+
+	if (fseek(binary_file, offsetof(struct ibdiag_lft_file_hdr, nswitches),
+		  SEEK_SET) ||
+	    fwrite(&count, sizeof(count), 1, binary_file) != 1 ||
+	    fclose(binary_file))
+		IBEXIT("writing '%s' failed: %s", binary_file_name,
+		       strerror(errno));
+	binary_file = NULL;
+}
+
+struct ft_inflight {
+	uint32_t trid;
+	struct ft_switch *sw;	/* NULL if the slot is free */
+	unsigned block;
+};
+
+static void block_failed(struct ft_switch *sw, unsigned b, int status)
+{
+	char *mapnd = remap_node_name(node_name_map, sw->node->guid,
+				      sw->node->nodedesc);
+
+	fprintf(stderr, "SubnGet(%s) failed on switch '%s' %s Node GUID 0x%"
+		PRIx64 " SMA LID %d; MAD status 0x%x AM 0x%x\n",
+		multicast ? "MFT" : "LFT", mapnd,
+		portid2str(&sw->node->path_portid), sw->node->guid,
+		sw->node->smalid, status,
+		multicast ? multicast_block_mod(sw, b) : sw->startblock + b);
+	free(mapnd);
+
+	/* unset LFT entries are not shown, neither are empty MFT entries */
+	memset(sw->data + b * IB_SMP_DATA_SIZE, multicast ? 0 : 0xff,
+	       IB_SMP_DATA_SIZE);
+}
+
+static int send_block(struct ft_switch *sw, struct ft_inflight *slot)
+{
+	uint8_t buf[1024];
+	ib_portid_t portid = sw->node->path_portid;
+	ib_rpc_t rpc = { 0 };
+	int len, agent;
+
+	rpc.method = IB_MAD_METHOD_GET;
+	rpc.attr.id = multicast ? IB_ATTR_MULTICASTFORWTBL :
+	    IB_ATTR_LINEARFORWTBL;
+	rpc.attr.mod = multicast ? multicast_block_mod(sw, sw->next) :
+	    sw->startblock + sw->next;
+	rpc.datasz = IB_SMP_DATA_SIZE;
+	rpc.dataoffs = IB_SMP_DATA_OFFS;
+	rpc.mkey = ibd_mkey;
+
+	if ((portid.lid <= 0) ||
+	    (portid.drpath.drslid == 0xffff) ||
+	    (portid.drpath.drdlid == 0xffff))
+		rpc.mgtclass = IB_SMI_DIRECT_CLASS;	/* direct SMI */
+	else
+		rpc.mgtclass = IB_SMI_CLASS;	/* Lid routed SMI */
+	portid.sl = 0;
+	portid.qp = 0;
+
+	memset(buf, 0, umad_size() + IB_MAD_SIZE);
+	slot->sw = sw;
+	slot->block = sw->next++;
+	sw->inflight++;
+
+	agent = mad_rpc_class_agent(srcport, rpc.mgtclass);
+	if ((len = mad_build_pkt(buf, &rpc, &portid, NULL, NULL)) < 0 ||
+	    umad_send(mad_rpc_portid(srcport), agent, buf, len,
+		      mad_get_timeout(srcport, 0),
+		      mad_get_retries(srcport)) < 0) {
+		IBWARN("send failed; %s", strerror(errno));
+		return -1;
+	}
+
+	slot->trid = (uint32_t) rpc.trid;
+	return 0;
+}
+
+static void complete_block(struct ft_inflight *slot, uint8_t *mad, int status)
+{
+	struct ft_switch *sw = slot->sw;
+
+	if (status)
+		block_failed(sw, slot->block, status);
+	else
+		memcpy(sw->data + slot->block * IB_SMP_DATA_SIZE,
+		       mad + IB_SMP_DATA_OFFS, IB_SMP_DATA_SIZE);
+
+	sw->inflight--;
+	sw->done++;
+	slot->sw = NULL;
+}
+
+/*
+ * Read the tables of all switches keeping up to max_smps SMPs in flight,
+ * but no more than max_switch_smps to a single switch.  Switches are
+ * printed in order, each as soon as it and all switches before it are done,
+ * so only the tables of about max_smps switches are held in memory.
+ */
+static void read_tables(struct ft_switch *sws, unsigned nsw,
+			ibnd_fabric_t *fabric)
+{
+	uint8_t rbuf[1024];
+	struct ft_inflight *slots;
+	unsigned head = 0, i, inflight = 0;
+	int len, status, timeout;
+	uint32_t trid;
+	uint8_t *mad;
+
+	slots = calloc(max_smps, sizeof(*slots));
+	if (!slots)
+		IBEXIT("out of memory");
+
+	/* every request completes by itself, through a response or timeout */
+	timeout = mad_get_timeout(srcport, 0) * (mad_get_retries(srcport) + 1)
+	    + 1000;
+
+	while (head < nsw) {
+		for (i = head; i < nsw && i < head + max_smps &&
+		     inflight < max_smps; i++) {
+			struct ft_switch *sw = &sws[i];
+
+			if (sw->nblocks && !sw->data) {
+				sw->data = malloc(sw->nblocks *
+						  IB_SMP_DATA_SIZE);
+				if (!sw->data)
+					IBEXIT("out of memory");
+			}
+
+			while (sw->next < sw->nblocks &&
+			       sw->inflight < max_switch_smps &&
+			       inflight < max_smps) {
+				struct ft_inflight *slot = slots;
+
+				while (slot->sw)
+					slot++;
+				if (send_block(sw, slot)) {
+					complete_block(slot, NULL, -1);
+					continue;
+				}
+				inflight++;
+			}
+		}
+
+		if (sws[head].done == sws[head].nblocks) {
+			if (multicast)
+				dump_multicast_tables(&sws[head]);
+			else {
+				dump_unicast_tables(&sws[head], fabric);
+				if (binary_file)
+					write_binary_lft(&sws[head]);
+			}
+			free(sws[head].data);
+			sws[head].data = NULL;
+			head++;
+			continue;
+		}
+
+		len = IB_MAD_SIZE;
+		if (umad_recv(mad_rpc_portid(srcport), rbuf, &len, timeout) < 0) {
+			IBWARN("recv failed: %s", strerror(errno));
+			/* give up on everything that is still outstanding */
+			for (i = 0; i < max_smps; i++)
+				if (slots[i].sw)
+					complete_block(&slots[i], NULL, -1);
+			inflight = 0;
+			continue;
+		}
+
+		mad = umad_get_mad(rbuf);
+		trid = (uint32_t) mad_get_field64(mad, 0, IB_MAD_TRID_F);
+		for (i = 0; i < max_smps; i++)
+			if (slots[i].sw && slots[i].trid == trid)
+				break;
+		if (i == max_smps)
+			continue;	/* late response to a timed out request */
+
+		status = umad_status(rbuf);
+		if (!status)
+			status = mad_get_field(mad, 0, IB_DRSMP_STATUS_F);
+		complete_block(&slots[i], mad, status);
+		inflight--;
+	}
+
+	free(slots);
+}
+
+static void process_switch(ibnd_node_t *node, void *user_data)
+{
+	struct ft_switch **sw = user_data;
+
+	(*sw)->node = node;
 	if (multicast)
-		dump_multicast_tables(node, startlid, endlid, mad_port);
+		setup_multicast_tables(*sw, startlid, endlid);
 	else
-		dump_unicast_tables(node, startlid, endlid,
-						mad_port, fabric);
+		setup_unicast_tables(*sw, startlid, endlid);
+	(*sw)++;
 }
 
-static void process_switch(ibnd_node_t *node, void *fabric)
+static void count_switch(ibnd_node_t *node, void *user_data)
 {
-	dump_node(node, srcport, (ibnd_fabric_t *)fabric);
+	(*(unsigned *)user_data)++;
+}
+
+static void dump_tables(ibnd_fabric_t *fabric)
+{
+	struct ft_switch *sws, *sw;
+	unsigned nsw = 0;
+
+	ibnd_iter_nodes_type(fabric, count_switch, IB_NODE_SWITCH, &nsw);
+	sws = calloc(nsw ? nsw : 1, sizeof(*sws));
+	if (!sws)
+		IBEXIT("out of memory");
+
+	sw = sws;
+	ibnd_iter_nodes_type(fabric, process_switch, IB_NODE_SWITCH, &sw);
+
+	read_tables(sws, nsw, fabric);
+
+	free(sws);
 }
 
 static int process_opt(void *context, int ch)
@@ -394,11 +667,24 @@ static int process_opt(void *context, int ch)
 	case 'n':
 		brief++;
 		break;
+	case 'w':
+		max_smps = strtoul(optarg, NULL, 0);
+		if (!max_smps)
+			IBEXIT("invalid window '%s'", optarg);
+		break;
+	case 'b':
+		binary_file_name = optarg;
+		break;
 	case 1:
 		node_name_map_file = strdup(optarg);
 		if (node_name_map_file == NULL)
 			IBEXIT("out of memory, strdup for node_name_map_file name failed");
 		break;
+	case 2:
+		max_switch_smps = strtoul(optarg, NULL, 0);
+		if (!max_switch_smps)
+			IBEXIT("invalid per switch limit '%s'", optarg);
+		break;
 	default:
 		return -1;
 	}
@@ -420,6 +706,12 @@ int main(int argc, char **argv)
 		 "do not try to resolve destinations"},
 		{"Multicast", 'M', 0, NULL, "show multicast forwarding tables"},
 		{"node-name-map", 1, 1, "<file>", "node name map file"},
+		{"window", 'w', 1, "<num>",
+		 "number of SMPs kept in flight (default 64)"},
+		{"per_switch", 2, 1, "<num>",
+		 "number of SMPs kept in flight to one switch (default 4)"},
+		{"binary", 'b', 1, "<file>",
+		 "also write the unicast tables to a binary file"},
 		{}
 	};
 	char usage_args[] = "[<dest dr_path|lid|guid> [<startlid> [<endlid>]]]";
@@ -433,6 +725,8 @@ int main(int argc, char **argv)
 		"-M\t# dump all non empty mlids of switch with lid 4",
 		"-M 0xc010 0xc020\t# same, but with range",
 		"-M -n\t# simple dump format",
+		" -- Binary output:",
+		"-b lfts.bin\t# dump unicast tables and save them to lfts.bin",
 		NULL,
 	};
 
@@ -447,6 +741,9 @@ int main(int argc, char **argv)
 	if (argc > 1)
 		endlid = strtoul(argv[1], NULL, 0);
 
+	if (binary_file_name && multicast)
+		IBEXIT("binary output is only supported for unicast tables");
+
 	node_name_map = open_node_name_map(node_name_map_file);
 
 	if (ibd_timeout)
@@ -477,7 +774,13 @@ int main(int argc, char **argv)
 			mad_rpc_set_timeout(srcport, ibd_timeout);
 		}
 
-		ibnd_iter_nodes_type(fabric, process_switch, IB_NODE_SWITCH, fabric);
+		if (binary_file_name)
+			open_binary_file();
+
+		dump_tables(fabric);
+
+		if (binary_file)
+			close_binary_file();
 
 		mad_rpc_close_port2(srcports);
 
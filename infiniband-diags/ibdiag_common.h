@@ -134,4 +134,25 @@ typedef struct match_rec {
 
 op_fn_t *match_op(const match_rec_t match_tbl[], char *name);
 
+/**
+ * Binary unicast forwarding table file, written by dump_fts -b and read by
+ * ibroutecheck.  All fields are little endian.  The header is followed by
+ * nswitches records, each followed by nlids output port bytes for the lids
+ * first_lid .. first_lid + nlids - 1 (nlids is a multiple of 64).
+ */
+#define IBDIAG_LFT_FILE_MAGIC "IBDLFTS"
+#define IBDIAG_LFT_FILE_VERSION 1
+
+struct ibdiag_lft_file_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t nswitches;
+};
+
+struct ibdiag_lft_file_rec {
+	uint64_t guid;
+	uint32_t first_lid;
+	uint32_t nlids;
+};
+
 #endif				/* _IBDIAG_COMMON_H_ */
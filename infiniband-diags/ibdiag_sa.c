@@ -98,14 +98,13 @@ void sa_free_handle(struct sa_handle * h)
 	free(h);
 }
 
-int sa_query(struct sa_handle * h, uint8_t method,
-		    uint16_t attr, uint32_t mod, uint64_t comp_mask,
-		    uint64_t sm_key, void *data, size_t datasz,
-		    struct sa_query_result *result)
+int sa_query_send(struct sa_handle *h, uint8_t method,
+		  uint16_t attr, uint32_t mod, uint64_t comp_mask,
+		  uint64_t sm_key, void *data, size_t datasz, uint32_t *trid)
 {
 	ib_rpc_t rpc;
-	void *umad, *mad, *new_umad;
-	int ret, offset, len = 256;
+	void *umad;
+	int ret, len = 256;
 
 	memset(&rpc, 0, sizeof(rpc));
 	rpc.mgtclass = IB_SA_CLASS;
@@ -128,13 +127,32 @@ int sa_query(struct sa_handle * h, uint8_t method,
 		xdump(stdout, "SA Request:\n", umad_get_mad(umad), len);
 
 	ret = umad_send(h->fd, h->agent, umad, len, ibd_timeout, 0);
+	free(umad);
 	if (ret < 0) {
 		IBWARN("umad_send failed: attr 0x%x: %s\n",
 			attr, strerror(errno));
-		free(umad);
 		return (-ret);
 	}
 
+	/* the kernel replaces the upper half of the TID with its own */
+	*trid = (uint32_t) rpc.trid;
+	return 0;
+}
+
+int sa_query_recv(struct sa_handle *h, struct sa_query_result *result)
+{
+	void *umad, *mad, *new_umad;
+	int ret, offset, len;
+	uint8_t method;
+
+	if (!h->recv_len)
+		h->recv_len = SA_DEFAULT_RECV_LEN;
+	len = h->recv_len;
+
+	umad = malloc(umad_size() + len);
+	if (!umad)
+		IBPANIC("cannot alloc mem for umad: %s\n", strerror(errno));
+
 recv_mad:
 	ret = umad_recv(h->fd, umad, &len, ibd_timeout);
 	if (ret < 0) {
@@ -148,16 +166,24 @@ recv_mad:
 			umad = new_umad;
 			goto recv_mad;
 		}
-		IBWARN("umad_recv failed: attr 0x%x: %s\n", attr,
-			strerror(errno));
+		IBWARN("umad_recv failed: %s\n", strerror(errno));
 		free(umad);
 		return (-ret);
 	}
 
-	if ((ret = umad_status(umad)))
-		return ret;
+	/* size the next receive for the largest response seen so far */
+	if (len > h->recv_len)
+		h->recv_len = len;
 
 	mad = umad_get_mad(umad);
+	result->trid = (uint32_t) mad_get_field64(mad, 0, IB_MAD_TRID_F);
+
+	result->umad_status = umad_status(umad);
+	if (result->umad_status) {
+		free(umad);
+		result->p_result_madw = NULL;
+		return 0;
+	}
 
 	if (ibdebug > 1)
 		xdump(stdout, "SA Response:\n", mad, len);
@@ -166,6 +192,7 @@ recv_mad:
 	offset = mad_get_field(mad, 0, IB_SA_ATTROFFS_F);
 	result->status = mad_get_field(mad, 0, IB_MAD_STATUS_F);
 	result->p_result_madw = mad;
+	result->rec_size = offset << 3;
 	if (result->status != IB_SA_MAD_STATUS_SUCCESS)
 		result->result_cnt = 0;
 	else if (method != IB_MAD_METHOD_GET_TABLE)
@@ -178,6 +205,26 @@ recv_mad:
 	return 0;
 }
 
+int sa_query(struct sa_handle * h, uint8_t method,
+		    uint16_t attr, uint32_t mod, uint64_t comp_mask,
+		    uint64_t sm_key, void *data, size_t datasz,
+		    struct sa_query_result *result)
+{
+	uint32_t trid;
+	int ret;
+
+	ret = sa_query_send(h, method, attr, mod, comp_mask, sm_key, data,
+			    datasz, &trid);
+	if (ret)
+		return ret;
+
+	/* drop any late response or timeout of an earlier query */
+	while (!(ret = sa_query_recv(h, result)) && result->trid != trid)
+		sa_free_result_mad(result);
+
+	return ret ? ret : result->umad_status;
+}
+
 void sa_free_result_mad(struct sa_query_result *result)
 {
 	if (result->p_result_madw) {
@@ -50,12 +50,19 @@ struct sa_handle {
 	int fd, agent;
 	ib_portid_t dport;
 	struct ibmad_port *srcport;
+	int recv_len;		/* largest response received so far */
 };
 
+/* initial receive buffer, large enough for most GetTable responses */
+#define SA_DEFAULT_RECV_LEN (64 * 1024)
+
 struct sa_query_result {
 	uint32_t status;
 	unsigned result_cnt;
 	void *p_result_madw;
+	unsigned rec_size;	/* distance between records of a GetTable */
+	uint32_t trid;		/* lower half of the TID of the response */
+	int umad_status;	/* errno of a failed send, no MAD is kept */
 };
 
 /* NOTE: umad_init must be called prior to sa_get_handle */
@@ -65,8 +72,22 @@ void sa_free_handle(struct sa_handle * h);
 int sa_query(struct sa_handle *h, uint8_t method,
 	     uint16_t attr, uint32_t mod, uint64_t comp_mask, uint64_t sm_key,
 	     void *data, size_t datasz, struct sa_query_result *result);
+/* Split form of sa_query, allows several queries to be outstanding at once.
+ * Responses are returned in arrival order, matched by result->trid.  A send
+ * that failed, e.g. timed out, comes back with its trid and umad_status set;
+ * sa_query_recv only fails when nothing could be received. */
+int sa_query_send(struct sa_handle *h, uint8_t method,
+		  uint16_t attr, uint32_t mod, uint64_t comp_mask,
+		  uint64_t sm_key, void *data, size_t datasz, uint32_t *trid);
+int sa_query_recv(struct sa_handle *h, struct sa_query_result *result);
 void sa_free_result_mad(struct sa_query_result *result);
 void *sa_get_query_rec(void *mad, unsigned i);
+
+/* walk the records of a result without decoding the MAD for each one */
+#define sa_for_each_rec(result, rec, i) \
+	for ((i) = 0, (rec) = sa_get_query_rec((result)->p_result_madw, 0); \
+	     (i) < (result)->result_cnt; \
+	     (i)++, (rec) = (void *)((uint8_t *)(rec) + (result)->rec_size))
 void sa_report_err(int status);
 
 /* Macros for setting query values and ComponentMasks */
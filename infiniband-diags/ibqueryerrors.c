@@ -309,10 +309,10 @@ static int print_summary(void)
 static void insert_lid2sl_table(struct sa_query_result *r)
 {
     unsigned int i;
-    for (i = 0; i < r->result_cnt; i++) {
-	    ib_path_rec_t *p_pr = (ib_path_rec_t *)sa_get_query_rec(r->p_result_madw, i);
+    ib_path_rec_t *p_pr;
+
+    sa_for_each_rec(r, p_pr, i)
 	    lid2sl_table[be16toh(p_pr->dlid)] = ib_path_rec_sl(p_pr);
-    }
 }
 
 static int path_record_query(ib_gid_t sgid,uint64_t dguid)
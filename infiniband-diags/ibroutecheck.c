@@ -0,0 +1,768 @@
+// SPDX-License-Identifier: (GPL-2.0 OR Linux-OpenIB)
+/*
+ * Offline check of the unicast routing of a subnet.  The topology comes from
+ * an ibnetdiscover cache and the LFTs from a dump_fts or ibroute dump, so a
+ * routing change can be validated without sending a single SMP.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <infiniband/mad.h>
+#include <infiniband/ibnetdisc.h>
+#include <util/node_name_map.h>
+
+#include "ibdiag_common.h"
+
+#define RC_NO_PORT		0xff
+#define RC_MAX_HOPS		64
+#define RC_MAX_EXAMPLES		10
+
+enum rc_bad_kind {
+	RC_UNREACHABLE,
+	RC_MISROUTED,
+	RC_LOOP,
+};
+
+static const char *const rc_bad_str[] = {
+	[RC_UNREACHABLE] = "unreachable",
+	[RC_MISROUTED] = "misrouted",
+	[RC_LOOP] = "loop",
+};
+
+struct rc_switch {
+	ibnd_node_t *node;
+	uint8_t *lft;		/* out port per LID */
+	unsigned lft_len;
+	unsigned chan;		/* channel id of port 0 */
+	size_t dep;		/* first bit in the dependency bitmap */
+	unsigned nsrc;		/* end ports attached */
+	int *peer;		/* per port: neighbour switch, -1 if none */
+};
+
+struct rc_dest {
+	uint16_t lid;
+	ibnd_port_t *port;	/* end port owning the LID */
+	int sw;			/* switch the end port is attached to */
+};
+
+struct rc_bad {
+	enum rc_bad_kind kind;
+	unsigned sw;
+	uint16_t lid;
+};
+
+/* results of one thread, merged once all threads are done */
+struct rc_result {
+	uint64_t *load;		/* paths per channel */
+	uint8_t *dep;		/* in port -> out port, per switch */
+	uint64_t routes;
+	uint64_t bad[RC_LOOP + 1];
+	struct rc_bad examples[RC_MAX_EXAMPLES];
+	unsigned nexamples;
+};
+
+struct rc_fabric {
+	ibnd_fabric_t *fabric;
+	struct rc_switch *sw;
+	unsigned nsw;
+	unsigned nchan;
+	size_t dep_bits;
+	struct rc_dest *dest;
+	unsigned ndest;
+	unsigned *src;		/* switches with end ports attached */
+	unsigned nsrc;
+	unsigned next_src;	/* work distribution between threads */
+};
+
+struct rc_guid_idx {
+	uint64_t guid;
+	unsigned idx;
+};
+
+static struct rc_guid_idx *sw_idx;
+
+static unsigned nthreads;
+static unsigned ntop = 10;
+static char *node_name_map_file = NULL;
+static nn_map_t *node_name_map = NULL;
+
+static int rc_guid_cmp(const void *a, const void *b)
+{
+	const struct rc_guid_idx *x = a, *y = b;
+
+	return x->guid < y->guid ? -1 : x->guid > y->guid;
+}
+
+static int rc_find_switch(struct rc_fabric *f, ibnd_node_t *node)
+{
+	struct rc_guid_idx key = { .guid = node->guid }, *e;
+
+	if (node->type != IB_NODE_SWITCH)
+		return -1;
+	e = bsearch(&key, sw_idx, f->nsw, sizeof(*sw_idx), rc_guid_cmp);
+	return e ? (int)e->idx : -1;
+}
+
+static void count_switch(ibnd_node_t *node, void *user_data)
+{
+	(*(unsigned *)user_data)++;
+}
+
+static void count_dests(ibnd_port_t *port, void *user_data)
+{
+	if (port->node->type != IB_NODE_SWITCH && port->base_lid)
+		*(unsigned *)user_data += 1 << port->lmc;
+}
+
+struct rc_build {
+	struct rc_fabric *f;
+	unsigned n;
+};
+
+static void add_switch(ibnd_node_t *node, void *user_data)
+{
+	struct rc_build *b = user_data;
+	struct rc_switch *sw = &b->f->sw[b->n];
+
+	sw->node = node;
+	sw_idx[b->n].guid = node->guid;
+	sw_idx[b->n].idx = b->n;
+	b->n++;
+}
+
+static void add_dests(ibnd_port_t *port, void *user_data)
+{
+	struct rc_build *b = user_data;
+	unsigned i;
+	int sw = -1;
+
+	if (port->node->type == IB_NODE_SWITCH || !port->base_lid)
+		return;
+
+	if (port->remoteport)
+		sw = rc_find_switch(b->f, port->remoteport->node);
+	if (sw >= 0)
+		b->f->sw[sw].nsrc++;
+
+	for (i = 0; i < (1U << port->lmc); i++) {
+		struct rc_dest *d = &b->f->dest[b->n++];
+
+		d->lid = port->base_lid + i;
+		d->port = port;
+		d->sw = sw;
+	}
+}
+
+static void build_fabric(struct rc_fabric *f)
+{
+	struct rc_build b = { .f = f };
+	unsigned i, p, nports;
+
+	ibnd_iter_nodes_type(f->fabric, count_switch, IB_NODE_SWITCH, &f->nsw);
+	if (!f->nsw)
+		IBEXIT("no switches in fabric");
+
+	f->sw = calloc(f->nsw, sizeof(*f->sw));
+	sw_idx = calloc(f->nsw, sizeof(*sw_idx));
+	if (!f->sw || !sw_idx)
+		IBEXIT("out of memory");
+
+	ibnd_iter_nodes_type(f->fabric, add_switch, IB_NODE_SWITCH, &b);
+	qsort(sw_idx, f->nsw, sizeof(*sw_idx), rc_guid_cmp);
+
+	for (i = 0; i < f->nsw; i++) {
+		struct rc_switch *sw = &f->sw[i];
+
+		nports = sw->node->numports + 1;
+		sw->chan = f->nchan;
+		f->nchan += nports;
+		sw->dep = f->dep_bits;
+		f->dep_bits += nports * nports;
+
+		sw->peer = malloc(nports * sizeof(*sw->peer));
+		if (!sw->peer)
+			IBEXIT("out of memory");
+		for (p = 0; p < nports; p++) {
+			ibnd_port_t *port = sw->node->ports[p];
+
+			sw->peer[p] = -1;
+			if (p && port && port->remoteport)
+				sw->peer[p] = rc_find_switch(f,
+						port->remoteport->node);
+		}
+	}
+
+	ibnd_iter_ports(f->fabric, count_dests, &f->ndest);
+	f->dest = calloc(f->ndest ? f->ndest : 1, sizeof(*f->dest));
+	if (!f->dest)
+		IBEXIT("out of memory");
+	b.n = 0;
+	ibnd_iter_ports(f->fabric, add_dests, &b);
+
+	f->src = calloc(f->nsw, sizeof(*f->src));
+	if (!f->src)
+		IBEXIT("out of memory");
+	for (i = 0; i < f->nsw; i++)
+		if (f->sw[i].nsrc)
+			f->src[f->nsrc++] = i;
+}
+
+static int set_lft(struct rc_switch *sw, unsigned lid, unsigned port)
+{
+	unsigned len;
+	uint8_t *lft;
+
+	if (lid > IB_MAX_UCAST_LID)
+		return -1;
+
+	if (lid >= sw->lft_len) {
+		len = ALIGN(lid + 1, IB_SMP_DATA_SIZE);
+		lft = realloc(sw->lft, len);
+		if (!lft)
+			IBEXIT("out of memory");
+		memset(lft + sw->lft_len, RC_NO_PORT, len - sw->lft_len);
+		sw->lft = lft;
+		sw->lft_len = len;
+	}
+
+	sw->lft[lid] = port > RC_NO_PORT ? RC_NO_PORT : port;
+	return 0;
+}
+
+/*
+ * Read a dump_fts -b file, returns the number of switches with an LFT.
+ */
+static unsigned load_lfts_binary(struct rc_fabric *f, FILE *fp,
+				 const char *file)
+{
+	struct ibdiag_lft_file_hdr hdr;
+	struct ibdiag_lft_file_rec rec;
+	struct rc_switch *sw;
+	unsigned i, first, nlids, nlfts = 0;
+	ibnd_node_t *node;
+	uint8_t *lft;
+	uint64_t guid;
+	int idx;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    le32toh(hdr.version) != IBDIAG_LFT_FILE_VERSION)
+		IBEXIT("unsupported LFT file '%s'", file);
+
+	for (i = 0; i < le32toh(hdr.nswitches); i++) {
+		if (fread(&rec, sizeof(rec), 1, fp) != 1)
+			IBEXIT("'%s' is truncated", file);
+		guid = le64toh(rec.guid);
+		first = le32toh(rec.first_lid);
+		nlids = le32toh(rec.nlids);
+		if (first % IB_SMP_DATA_SIZE || nlids % IB_SMP_DATA_SIZE ||
+		    first + nlids > IB_MAX_UCAST_LID + 1 ||
+		    first + nlids < first)
+			IBEXIT("invalid LFT of switch 0x%016" PRIx64 " in '%s'",
+			       guid, file);
+
+		node = ibnd_find_node_guid(f->fabric, guid);
+		idx = node ? rc_find_switch(f, node) : -1;
+		if (idx < 0) {
+			IBWARN("switch 0x%016" PRIx64
+			       " not in fabric, LFT ignored", guid);
+			if (fseek(fp, nlids, SEEK_CUR))
+				IBEXIT("'%s' is truncated", file);
+			continue;
+		}
+
+		sw = &f->sw[idx];
+		if (!sw->lft)
+			nlfts++;
+		if (first + nlids > sw->lft_len) {
+			lft = realloc(sw->lft, first + nlids);
+			if (!lft)
+				IBEXIT("out of memory");
+			memset(lft + sw->lft_len, RC_NO_PORT,
+			       first + nlids - sw->lft_len);
+			sw->lft = lft;
+			sw->lft_len = first + nlids;
+		}
+		if (nlids && fread(sw->lft + first, nlids, 1, fp) != 1)
+			IBEXIT("'%s' is truncated", file);
+	}
+
+	return nlfts;
+}
+
+/*
+ * Read the "Unicast lids ... guid 0x..." sections of a dump_fts or ibroute
+ * dump, anything else in the file is ignored.  Binary files written by
+ * dump_fts -b are recognized by their magic.
+ */
+static void load_lfts(struct rc_fabric *f, const char *file)
+{
+	struct rc_switch *sw = NULL;
+	unsigned lid, port, nlfts = 0;
+	ibnd_node_t *node;
+	uint64_t guid;
+	size_t n = 0;
+	char *line = NULL;
+	char magic[sizeof(IBDIAG_LFT_FILE_MAGIC)];
+	char *s;
+	FILE *fp;
+	int idx;
+
+	if (!(fp = fopen(file, "r")))
+		IBEXIT("cannot open '%s': %s", file, strerror(errno));
+
+	if (fread(magic, sizeof(magic), 1, fp) == 1 &&
+	    !memcmp(magic, IBDIAG_LFT_FILE_MAGIC, sizeof(magic))) {
+		rewind(fp);
+		nlfts = load_lfts_binary(f, fp, file);
+		goto done;
+	}
+	rewind(fp);
+
+	while (getline(&line, &n, fp) >= 0) {
+		if (!strncmp(line, "Unicast lids", 12)) {
+			sw = NULL;
+			if (!(s = strstr(line, " guid ")))
+				continue;
+			guid = strtoull(s + 6, NULL, 0);
+			node = ibnd_find_node_guid(f->fabric, guid);
+			idx = node ? rc_find_switch(f, node) : -1;
+			if (idx < 0) {
+				IBWARN("switch 0x%016" PRIx64
+				       " not in fabric, LFT ignored", guid);
+				continue;
+			}
+			sw = &f->sw[idx];
+			if (!sw->lft)
+				nlfts++;
+		} else if (!strncmp(line, "Multicast mlids", 15)) {
+			sw = NULL;
+		} else if (sw && sscanf(line, "0x%x %u", &lid, &port) == 2) {
+			if (set_lft(sw, lid, port))
+				IBWARN("invalid lid 0x%x in LFT of switch "
+				       "0x%016" PRIx64, lid, sw->node->guid);
+		}
+	}
+
+	free(line);
+done:
+	fclose(fp);
+
+	if (!nlfts)
+		IBEXIT("no LFTs found in '%s'", file);
+	if (nlfts < f->nsw)
+		IBWARN("%u of %u switches have no LFT", f->nsw - nlfts,
+		       f->nsw);
+}
+
+static void bad_route(struct rc_result *r, enum rc_bad_kind kind, uint64_t w,
+		      unsigned src, struct rc_dest *d)
+{
+	r->bad[kind] += w;
+	if (r->nexamples < RC_MAX_EXAMPLES) {
+		r->examples[r->nexamples].kind = kind;
+		r->examples[r->nexamples].sw = src;
+		r->examples[r->nexamples].lid = d->lid;
+		r->nexamples++;
+	}
+}
+
+/*
+ * Follow the LFTs from switch src to d.  All end ports attached to src share
+ * this path, so it is walked once and weighted by their number.
+ */
+static void route(struct rc_fabric *f, struct rc_result *r, unsigned src,
+		  struct rc_dest *d)
+{
+	uint64_t w = f->sw[src].nsrc - (d->sw == (int)src);
+	unsigned cur = src, hops = 0, out;
+	struct rc_switch *sw;
+	ibnd_port_t *port;
+	int in = -1;
+
+	if (!w)
+		return;
+
+	for (;;) {
+		sw = &f->sw[cur];
+		out = d->lid < sw->lft_len ? sw->lft[d->lid] : RC_NO_PORT;
+		if (!out) {
+			bad_route(r, RC_MISROUTED, w, src, d);
+			return;
+		}
+		if (out > sw->node->numports || !(port = sw->node->ports[out]) ||
+		    !port->remoteport) {
+			bad_route(r, RC_UNREACHABLE, w, src, d);
+			return;
+		}
+
+		r->load[sw->chan + out] += w;
+		if (in >= 0) {
+			size_t bit = sw->dep +
+			    in * (sw->node->numports + 1) + out;
+			r->dep[bit / 8] |= 1 << (bit % 8);
+		}
+
+		if (sw->peer[out] < 0) {
+			if (port->remoteport == d->port)
+				r->routes += w;
+			else
+				bad_route(r, RC_MISROUTED, w, src, d);
+			return;
+		}
+
+		if (++hops > RC_MAX_HOPS) {
+			bad_route(r, RC_LOOP, w, src, d);
+			return;
+		}
+		in = port->remoteport->portnum;
+		cur = sw->peer[out];
+	}
+}
+
+struct rc_thread {
+	pthread_t thread;
+	struct rc_fabric *f;
+	struct rc_result r;
+};
+
+static void *route_thread(void *arg)
+{
+	struct rc_thread *t = arg;
+	struct rc_fabric *f = t->f;
+	unsigned s, i;
+
+	while ((s = __atomic_fetch_add(&f->next_src, 1, __ATOMIC_RELAXED)) <
+	       f->nsrc)
+		for (i = 0; i < f->ndest; i++)
+			route(f, &t->r, f->src[s], &f->dest[i]);
+
+	return NULL;
+}
+
+static void alloc_result(struct rc_fabric *f, struct rc_result *r)
+{
+	r->load = calloc(f->nchan, sizeof(*r->load));
+	r->dep = calloc((f->dep_bits + 7) / 8, 1);
+	if (!r->load || !r->dep)
+		IBEXIT("out of memory");
+}
+
+static void free_result(struct rc_result *r)
+{
+	free(r->load);
+	free(r->dep);
+}
+
+static void merge_result(struct rc_fabric *f, struct rc_result *to,
+			 struct rc_result *from)
+{
+	unsigned i;
+	size_t b;
+
+	for (i = 0; i < f->nchan; i++)
+		to->load[i] += from->load[i];
+	for (b = 0; b < (f->dep_bits + 7) / 8; b++)
+		to->dep[b] |= from->dep[b];
+	to->routes += from->routes;
+	for (i = 0; i <= RC_LOOP; i++)
+		to->bad[i] += from->bad[i];
+	for (i = 0; i < from->nexamples && to->nexamples < RC_MAX_EXAMPLES;
+	     i++)
+		to->examples[to->nexamples++] = from->examples[i];
+}
+
+static void route_all(struct rc_fabric *f, struct rc_result *r)
+{
+	struct rc_thread *t;
+	unsigned i;
+
+	if (nthreads > f->nsrc)
+		nthreads = f->nsrc ? f->nsrc : 1;
+
+	t = calloc(nthreads, sizeof(*t));
+	if (!t)
+		IBEXIT("out of memory");
+
+	for (i = 0; i < nthreads; i++) {
+		t[i].f = f;
+		alloc_result(f, &t[i].r);
+		if (pthread_create(&t[i].thread, NULL, route_thread, &t[i]))
+			IBEXIT("cannot create thread");
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(t[i].thread, NULL);
+		merge_result(f, r, &t[i].r);
+		free_result(&t[i].r);
+	}
+
+	free(t);
+}
+
+static void print_chan(struct rc_fabric *f, unsigned s, unsigned p)
+{
+	ibnd_node_t *node = f->sw[s].node;
+	ibnd_port_t *remote = node->ports[p]->remoteport;
+	char *name, *rname;
+
+	name = remap_node_name(node_name_map, node->guid, node->nodedesc);
+	rname = remap_node_name(node_name_map, remote->node->guid,
+				remote->node->nodedesc);
+	printf("0x%016" PRIx64 " '%s' port %u -> 0x%016" PRIx64
+	       " '%s' port %d\n", node->guid, name, p, remote->node->guid,
+	       rname, remote->portnum);
+	free(name);
+	free(rname);
+}
+
+static uint64_t *sort_load;
+static unsigned *chan_sw;
+
+static int load_cmp(const void *a, const void *b)
+{
+	uint64_t x = sort_load[*(const unsigned *)a];
+	uint64_t y = sort_load[*(const unsigned *)b];
+
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void print_load(struct rc_fabric *f, struct rc_result *r)
+{
+	uint64_t min = UINT64_MAX, max = 0, sum = 0;
+	unsigned i, s, p, nlinks = 0, nused = 0;
+	unsigned *chans;
+
+	chans = calloc(f->nchan, sizeof(*chans));
+	if (!chans)
+		IBEXIT("out of memory");
+
+	for (s = 0; s < f->nsw; s++) {
+		for (p = 1; p <= f->sw[s].node->numports; p++) {
+			i = f->sw[s].chan + p;
+			if (f->sw[s].peer[p] >= 0) {
+				nlinks++;
+				sum += r->load[i];
+				if (r->load[i] < min)
+					min = r->load[i];
+				if (r->load[i] > max)
+					max = r->load[i];
+			}
+			if (r->load[i])
+				chans[nused++] = i;
+		}
+	}
+
+	if (nlinks)
+		printf("Switch to switch link load (paths): min %" PRIu64
+		       " max %" PRIu64 " average %" PRIu64 " over %u links\n",
+		       min, max, sum / nlinks, nlinks);
+
+	sort_load = r->load;
+	qsort(chans, nused, sizeof(*chans), load_cmp);
+
+	if (ntop && nused)
+		printf("Most loaded links:\n");
+	for (i = 0; i < ntop && i < nused; i++) {
+		s = chan_sw[chans[i]];
+		printf("%10" PRIu64 "  ", r->load[chans[i]]);
+		print_chan(f, s, chans[i] - f->sw[s].chan);
+	}
+
+	free(chans);
+}
+
+/*
+ * A credit loop is a cycle in the channel dependency graph: channel
+ * (s, p) depends on (t, r) if a route enters switch t through the far end
+ * of (s, p) and leaves it through r.  Only switch to switch channels can be
+ * part of a cycle.  Returns 1 if a loop was found.
+ */
+static int find_credit_loop(struct rc_fabric *f, struct rc_result *r)
+{
+	unsigned *stack, *next;
+	uint8_t *state;
+	unsigned depth, c, s, p, t, q, n, i;
+	int found = 0;
+
+	stack = calloc(f->nchan, sizeof(*stack));
+	next = calloc(f->nchan, sizeof(*next));
+	state = calloc(f->nchan, 1);
+	if (!stack || !next || !state)
+		IBEXIT("out of memory");
+
+	for (c = 0; c < f->nchan && !found; c++) {
+		s = chan_sw[c];
+		p = c - f->sw[s].chan;
+		if (!p || f->sw[s].peer[p] < 0 || state[c])
+			continue;
+
+		depth = 0;
+		stack[depth++] = c;
+		state[c] = 1;
+		next[c] = 1;
+
+		while (depth && !found) {
+			c = stack[depth - 1];
+			s = chan_sw[c];
+			p = c - f->sw[s].chan;
+			t = f->sw[s].peer[p];
+			q = f->sw[s].node->ports[p]->remoteport->portnum;
+
+			for (; next[c] <= f->sw[t].node->numports; next[c]++) {
+				size_t bit = f->sw[t].dep +
+				    q * (f->sw[t].node->numports + 1) + next[c];
+
+				if (f->sw[t].peer[next[c]] >= 0 &&
+				    r->dep[bit / 8] & (1 << (bit % 8)))
+					break;
+			}
+
+			if (next[c] > f->sw[t].node->numports) {
+				state[c] = 2;
+				depth--;
+				continue;
+			}
+
+			n = f->sw[t].chan + next[c]++;
+			if (state[n] == 1) {
+				printf("Credit loop found:\n");
+				for (i = 0; stack[i] != n; i++)
+					;
+				for (; i < depth; i++) {
+					printf("  ");
+					print_chan(f, chan_sw[stack[i]],
+						   stack[i] -
+						   f->sw[chan_sw[stack[i]]].chan);
+				}
+				found = 1;
+			} else if (!state[n]) {
+				state[n] = 1;
+				next[n] = 1;
+				stack[depth++] = n;
+			}
+		}
+	}
+
+	if (!found)
+		printf("No credit loops found\n");
+
+	free(stack);
+	free(next);
+	free(state);
+	return found;
+}
+
+static int process_opt(void *context, int ch)
+{
+	switch (ch) {
+	case 'j':
+		nthreads = strtoul(optarg, NULL, 0);
+		break;
+	case 'n':
+		ntop = strtoul(optarg, NULL, 0);
+		break;
+	case 1:
+		node_name_map_file = strdup(optarg);
+		if (node_name_map_file == NULL)
+			IBEXIT("out of memory, strdup for node_name_map_file name failed");
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct rc_fabric f = { 0 };
+	struct rc_result r = { 0 };
+	uint64_t nbad = 0;
+	unsigned i, s, p;
+	char *name;
+	int loop;
+
+	const struct ibdiag_opt opts[] = {
+		{"threads", 'j', 1, "<num>",
+		 "number of threads, default: number of online CPUs"},
+		{"top", 'n', 1, "<num>", "number of most loaded links to show"},
+		{"node-name-map", 1, 1, "<file>", "node name map file"},
+		{}
+	};
+	const char *usage_args = "<fabric.cache> <lft dump>";
+
+	ibdiag_process_opts(argc, argv, NULL, "CDdeGKLPsty", opts,
+			    process_opt, usage_args, NULL);
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 2)
+		ibdiag_show_usage();
+
+	if (!nthreads) {
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nthreads = ncpus > 0 ? ncpus : 1;
+	}
+
+	node_name_map = open_node_name_map(node_name_map_file);
+
+	if ((f.fabric = ibnd_load_fabric(argv[0], 0)) == NULL)
+		IBEXIT("loading cached fabric failed");
+
+	build_fabric(&f);
+	load_lfts(&f, argv[1]);
+
+	chan_sw = calloc(f.nchan, sizeof(*chan_sw));
+	if (!chan_sw)
+		IBEXIT("out of memory");
+	for (s = 0; s < f.nsw; s++)
+		for (p = 0; p <= f.sw[s].node->numports; p++)
+			chan_sw[f.sw[s].chan + p] = s;
+
+	alloc_result(&f, &r);
+	route_all(&f, &r);
+
+	printf("%u switches, %u destination LIDs, %u threads\n", f.nsw,
+	       f.ndest, nthreads);
+	printf("Routes OK: %" PRIu64 "\n", r.routes);
+	for (i = 0; i <= RC_LOOP; i++) {
+		printf("Routes %s: %" PRIu64 "\n", rc_bad_str[i], r.bad[i]);
+		nbad += r.bad[i];
+	}
+	for (i = 0; i < r.nexamples; i++) {
+		ibnd_node_t *node = f.sw[r.examples[i].sw].node;
+
+		name = remap_node_name(node_name_map, node->guid,
+				       node->nodedesc);
+		printf("  %s: from switch 0x%016" PRIx64 " '%s' to lid 0x%x\n",
+		       rc_bad_str[r.examples[i].kind], node->guid, name,
+		       r.examples[i].lid);
+		free(name);
+	}
+
+	print_load(&f, &r);
+	loop = find_credit_loop(&f, &r);
+
+	free_result(&r);
+	free(chan_sw);
+	for (s = 0; s < f.nsw; s++) {
+		free(f.sw[s].lft);
+		free(f.sw[s].peer);
+	}
+	free(f.sw);
+	free(f.dest);
+	free(f.src);
+	free(sw_idx);
+	ibnd_destroy_fabric(f.fabric);
+	close_node_name_map(node_name_map);
+
+	exit(nbad || loop ? 1 : 0);
+}
@@ -781,10 +781,10 @@ static void dump_results(struct sa_query_result *r,
 			 struct query_params *p)
 {
 	unsigned i;
-	for (i = 0; i < r->result_cnt; i++) {
-		void *data = sa_get_query_rec(r->p_result_madw, i);
+	void *data;
+
+	sa_for_each_rec(r, data, i)
 		dump_func(data, p);
-	}
 }
 
 /**
@@ -839,6 +839,66 @@ static int get_all_records(struct sa_handle * h, uint16_t attr_id,
 	return get_any_records(h, attr_id, 0, 0, NULL, 0, result);
 }
 
+/**
+ * Get all the records for several query types, with all the queries
+ * outstanding at the same time.
+ */
+static int get_all_records_multi(struct sa_handle * h, unsigned n,
+				 const uint16_t *attr_ids,
+				 struct sa_query_result *results)
+{
+	uint32_t trids[n];
+	struct sa_query_result r;
+	unsigned i, done = 0;
+	int ret;
+
+	memset(results, 0, n * sizeof(*results));
+
+	for (i = 0; i < n; i++) {
+		ret = sa_query_send(h, IB_MAD_METHOD_GET_TABLE, attr_ids[i], 0,
+				    0, ibd_sakey, NULL, 0, &trids[i]);
+		if (ret) {
+			fprintf(stderr, "Query SA failed: %s\n", strerror(ret));
+			return ret;
+		}
+	}
+
+	while (done < n) {
+		ret = sa_query_recv(h, &r);
+		if (ret) {
+			fprintf(stderr, "Query SA failed: %s\n", strerror(ret));
+			goto err;
+		}
+
+		for (i = 0; i < n && trids[i] != r.trid; i++)
+			;
+		if (i == n || results[i].p_result_madw) {
+			sa_free_result_mad(&r);
+			continue;
+		}
+		if (r.umad_status) {
+			ret = r.umad_status;
+			fprintf(stderr, "Query SA failed: %s\n", strerror(ret));
+			goto err;
+		}
+		results[i] = r;
+		done++;
+
+		if (r.status != IB_SA_MAD_STATUS_SUCCESS) {
+			sa_report_err(r.status);
+			ret = EIO;
+			goto err;
+		}
+	}
+
+	return 0;
+
+err:
+	for (i = 0; i < n; i++)
+		sa_free_result_mad(&results[i]);
+	return ret;
+}
+
 static int get_and_dump_all_records(struct sa_handle * h, uint16_t attr_id,
 				    void (*dump_func) (void *,
 						       struct query_params *p),
@@ -1104,30 +1164,22 @@ static int print_issm_records(struct sa_handle * h, struct query_params *p)
 static int print_multicast_member_records(struct sa_handle * h,
 					struct query_params *params)
 {
-	struct sa_query_result mc_group_result;
-	struct sa_query_result nr_result;
+	const uint16_t attr_ids[] = { IB_SA_ATTR_MCRECORD,
+				      IB_SA_ATTR_NODERECORD };
+	struct sa_query_result results[2];
+	ib_member_rec_t *rec;
 	int ret;
 	unsigned i;
 
-	ret = get_all_records(h, IB_SA_ATTR_MCRECORD, &mc_group_result);
+	ret = get_all_records_multi(h, 2, attr_ids, results);
 	if (ret)
 		return ret;
 
-	ret = get_all_records(h, IB_SA_ATTR_NODERECORD, &nr_result);
-	if (ret)
-		goto return_mc;
-
-	for (i = 0; i < mc_group_result.result_cnt; i++) {
-		ib_member_rec_t *rec = (ib_member_rec_t *)
-				sa_get_query_rec(mc_group_result.p_result_madw,
-					      i);
-		dump_multicast_member_record(rec, &nr_result, params);
-	}
-
-	sa_free_result_mad(&nr_result);
+	sa_for_each_rec(&results[0], rec, i)
+		dump_multicast_member_record(rec, &results[1], params);
 
-return_mc:
-	sa_free_result_mad(&mc_group_result);
+	sa_free_result_mad(&results[1]);
+	sa_free_result_mad(&results[0]);
 
 	return ret;
 }
@@ -35,6 +35,45 @@
 
 static LIST_HEAD(mapped_ports);		/* list of mapped ports */
 
+/* mapped ports hashed by local and by mapped tcp port */
+static struct list_head local_port_hash[IWPM_HASH_SIZE];
+static struct list_head mapped_port_hash[IWPM_HASH_SIZE];
+/* map tracking objects hashed by assochandle */
+static struct list_head map_req_hash[IWPM_HASH_SIZE];
+
+/**
+ * init_iwpm_hash_tables - Initialize the mapped port and map request hash tables
+ *
+ * Must be called before any mapping or map request is added
+ */
+void init_iwpm_hash_tables(void)
+{
+	int i;
+
+	for (i = 0; i < IWPM_HASH_SIZE; i++) {
+		list_head_init(&local_port_hash[i]);
+		list_head_init(&mapped_port_hash[i]);
+		list_head_init(&map_req_hash[i]);
+	}
+}
+
+/*
+ * All the candidates of a lookup (including the wild card ones)
+ * share the same tcp port, so hashing on the port alone keeps
+ * them in a single bucket
+ */
+static struct list_head *iwpm_port_bucket(struct sockaddr_storage *addr, int not_mapped)
+{
+	unsigned int idx = be16toh(get_sockaddr_port(addr)) & IWPM_HASH_MASK;
+
+	return (not_mapped) ? &local_port_hash[idx] : &mapped_port_hash[idx];
+}
+
+static struct list_head *iwpm_map_req_bucket(__u64 assochandle)
+{
+	return &map_req_hash[(assochandle * 0x9E3779B97F4A7C15ULL) >> (64 - IWPM_HASH_BITS)];
+}
+
 /**
  * create_iwpm_map_request - Create a new map request tracking object
  * @req_nlh: netlink header of the received client message
@@ -89,6 +128,7 @@ void add_iwpm_map_request(iwpm_mapping_request *iwpm_map_req)
 {
 	pthread_mutex_lock(&map_req_mutex);
 	list_add(&mapping_reqs, &iwpm_map_req->entry);
+	list_add(iwpm_map_req_bucket(iwpm_map_req->assochandle), &iwpm_map_req->hentry);
 	/* if not wake, signal the thread that a new request has been posted */
 	if (!wake)
 		pthread_cond_signal(&cond_req_complete);
@@ -109,6 +149,7 @@ void remove_iwpm_map_request(iwpm_mapping_request *iwpm_map_req)
 			iwpm_map_req->msg_type, iwpm_map_req->nlmsg_pid);
 	}
 	list_del(&iwpm_map_req->entry);
+	list_del(&iwpm_map_req->hentry);
 	if (iwpm_map_req->send_msg)
 		free(iwpm_map_req->send_msg);
 	free(iwpm_map_req);
@@ -129,8 +170,8 @@ int update_iwpm_map_request(__u64 assochandle, struct sockaddr_storage *src_addr
 	int ret = -EINVAL;
 
 	pthread_mutex_lock(&map_req_mutex);
-	/* look for a matching entry in the list */
-	list_for_each(&mapping_reqs, iwpm_map_req, entry) {
+	/* look for a matching entry in the hash bucket */
+	list_for_each(iwpm_map_req_bucket(assochandle), iwpm_map_req, hentry) {
 		if (assochandle == iwpm_map_req->assochandle &&
 				(msg_type & iwpm_map_req->msg_type) &&
 				check_same_sockaddr(src_addr, &iwpm_map_req->src_addr)) {
@@ -341,6 +382,8 @@ void add_iwpm_mapped_port(iwpm_mapped_port *iwpm_port)
 		return;
 	iwpm_debug(IWARP_PM_ALL_DBG, "add_iwpm_mapped_port: Adding a new mapping #%d\n", dbg_idx++);
 	list_add(&mapped_ports, &iwpm_port->entry);
+	list_add(iwpm_port_bucket(&iwpm_port->local_addr, 1), &iwpm_port->local_hentry);
+	list_add(iwpm_port_bucket(&iwpm_port->mapped_addr, 0), &iwpm_port->mapped_hentry);
 }
 
 /**
@@ -387,8 +430,8 @@ int check_same_sockaddr(struct sockaddr_storage *sockaddr_a, struct sockaddr_sto
  * @search_addr: IP address and port to search for in the list
  * @not_mapped: if set, compare local addresses, otherwise compare mapped addresses
  *
- * Compares the search_sockaddr to the addresses in the list,
- * to find a saved port object with the sockaddr or
+ * Compares the search_sockaddr to the addresses in the hash bucket
+ * of its tcp port, to find a saved port object with the sockaddr or
  * a wild card address with the same tcp port
  */
 iwpm_mapped_port *find_iwpm_mapping(struct sockaddr_storage *search_addr,
@@ -396,15 +439,29 @@ iwpm_mapped_port *find_iwpm_mapping(struct sockaddr_storage *search_addr,
 {
 	iwpm_mapped_port *iwpm_port, *saved_iwpm_port = NULL;
 	struct sockaddr_storage *current_addr;
-
-	list_for_each(&mapped_ports, iwpm_port, entry) {
-		current_addr = (not_mapped)? &iwpm_port->local_addr : &iwpm_port->mapped_addr;
-
-		if (get_sockaddr_port(search_addr) == get_sockaddr_port(current_addr)) {
-			if (check_same_sockaddr(search_addr, current_addr) ||
-					iwpm_port->wcard || is_wcard_ipaddr(search_addr)) {
-				saved_iwpm_port = iwpm_port;
-				goto find_mapping_exit;
+	struct list_head *bucket = iwpm_port_bucket(search_addr, not_mapped);
+	int search_wcard = is_wcard_ipaddr(search_addr);
+
+	if (not_mapped) {
+		list_for_each(bucket, iwpm_port, local_hentry) {
+			current_addr = &iwpm_port->local_addr;
+			if (get_sockaddr_port(search_addr) == get_sockaddr_port(current_addr)) {
+				if (check_same_sockaddr(search_addr, current_addr) ||
+						iwpm_port->wcard || search_wcard) {
+					saved_iwpm_port = iwpm_port;
+					goto find_mapping_exit;
+				}
+			}
+		}
+	} else {
+		list_for_each(bucket, iwpm_port, mapped_hentry) {
+			current_addr = &iwpm_port->mapped_addr;
+			if (get_sockaddr_port(search_addr) == get_sockaddr_port(current_addr)) {
+				if (check_same_sockaddr(search_addr, current_addr) ||
+						iwpm_port->wcard || search_wcard) {
+					saved_iwpm_port = iwpm_port;
+					goto find_mapping_exit;
+				}
 			}
 		}
 	}
@@ -417,20 +474,28 @@ find_mapping_exit:
  * @search_addr: IP address and port to search for in the list
  * @not_mapped: if set, compare local addresses, otherwise compare mapped addresses
  *
- * Compares the search_sockaddr to the addresses in the list,
- * to find a saved port object with the same sockaddr
+ * Compares the search_sockaddr to the addresses in the hash bucket
+ * of its tcp port, to find a saved port object with the same sockaddr
  */
 iwpm_mapped_port *find_iwpm_same_mapping(struct sockaddr_storage *search_addr,
 		int not_mapped)
 {
 	iwpm_mapped_port *iwpm_port, *saved_iwpm_port = NULL;
-	struct sockaddr_storage *current_addr;
+	struct list_head *bucket = iwpm_port_bucket(search_addr, not_mapped);
 
-	list_for_each(&mapped_ports, iwpm_port, entry) {
-		current_addr = (not_mapped)? &iwpm_port->local_addr : &iwpm_port->mapped_addr;
-		if (check_same_sockaddr(search_addr, current_addr)) {
-			saved_iwpm_port = iwpm_port;
-			goto find_same_mapping_exit;
+	if (not_mapped) {
+		list_for_each(bucket, iwpm_port, local_hentry) {
+			if (check_same_sockaddr(search_addr, &iwpm_port->local_addr)) {
+				saved_iwpm_port = iwpm_port;
+				goto find_same_mapping_exit;
+			}
+		}
+	} else {
+		list_for_each(bucket, iwpm_port, mapped_hentry) {
+			if (check_same_sockaddr(search_addr, &iwpm_port->mapped_addr)) {
+				saved_iwpm_port = iwpm_port;
+				goto find_same_mapping_exit;
+			}
 		}
 	}
 find_same_mapping_exit:
@@ -460,6 +525,8 @@ void remove_iwpm_mapped_port(iwpm_mapped_port *iwpm_port)
 	iwpm_debug(IWARP_PM_ALL_DBG, "remove_iwpm_mapped_port: index = %d\n", dbg_idx++);
 
 	list_del(&iwpm_port->entry);
+	list_del(&iwpm_port->local_hentry);
+	list_del(&iwpm_port->mapped_hentry);
 }
 
 void print_iwpm_mapped_ports(void)
@@ -515,6 +582,9 @@ void free_iwpm_mapped_ports(void)
 {
 	iwpm_mapped_port *iwpm_port;
 
-	while ((iwpm_port = list_pop(&mapped_ports, iwpm_mapped_port, entry)))
+	while ((iwpm_port = list_pop(&mapped_ports, iwpm_mapped_port, entry))) {
+		list_del(&iwpm_port->local_hentry);
+		list_del(&iwpm_port->mapped_hentry);
 		free_iwpm_port(iwpm_port);
+	}
 }
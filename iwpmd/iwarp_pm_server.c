@@ -1520,6 +1520,7 @@ int main(int argc, char *argv[])
 		fclose(fp);
 	}
 	memset(client_list, 0, sizeof(client_list));
+	init_iwpm_hash_tables();
 	pmv4_client_sock = -1;
 	pmv6_sock = -1;
 	pmv6_client_sock = pmv6_sock;
@@ -370,7 +370,7 @@ static int recv_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 		port->lmc = node->smalmc;
 	}
 
-	int rc1 = add_to_portguid_hash(port, f_int->fabric.portstbl);
+	int rc1 = add_to_portguid_hash(port, f_int);
 	if (rc1)
 		IBND_ERROR("Error Occurred when trying"
 			   " to insert new port guid 0x%016" PRIx64 " to DB\n",
@@ -477,7 +477,7 @@ static ibnd_node_t *create_node(smp_engine_t * engine, ib_portid_t * path,
 	rc->path_portid = *path;
 	memcpy(rc->info, node_info, sizeof(rc->info));
 
-	int rc1 = add_to_nodeguid_hash(rc, f_int->fabric.nodestbl);
+	int rc1 = add_to_nodeguid_hash(rc, f_int);
 	if (rc1)
 		IBND_ERROR("Error Occurred when trying"
 			   " to insert new node guid 0x%016" PRIx64 " to DB\n",
@@ -607,109 +607,148 @@ static int query_node_info(smp_engine_t * engine, ib_portid_t * portid,
 			 recv_node_info, (void *)cbdata);
 }
 
-ibnd_node_t *ibnd_find_node_guid(ibnd_fabric_t * fabric, uint64_t guid)
+static uint32_t guid_tbl_idx(struct guid_tbl *tbl, uint64_t guid)
 {
-	int hash = HASHGUID(guid) % HTSZ;
-	ibnd_node_t *node;
+	uint64_t h = guid * 0x9E3779B97F4A7C15ULL;
 
-	if (!fabric) {
-		IBND_DEBUG("fabric parameter NULL\n");
+	return (h ^ (h >> 32)) & (tbl->size - 1);
+}
+
+void *guid_tbl_find(struct guid_tbl *tbl, uint64_t guid)
+{
+	uint32_t idx;
+
+	if (!tbl->count)
 		return NULL;
-	}
 
-	for (node = fabric->nodestbl[hash]; node; node = node->htnext)
-		if (node->guid == guid)
-			return node;
+	for (idx = guid_tbl_idx(tbl, guid); tbl->entries[idx].obj;
+	     idx = (idx + 1) & (tbl->size - 1))
+		if (tbl->entries[idx].guid == guid)
+			return tbl->entries[idx].obj;
 
 	return NULL;
 }
 
-ibnd_node_t *ibnd_find_node_dr(ibnd_fabric_t * fabric, char *dr_str)
+static struct guid_tbl_entry *guid_tbl_slot(struct guid_tbl *tbl, uint64_t guid)
 {
-	ibnd_port_t *rc = ibnd_find_port_dr(fabric, dr_str);
-	return rc->node;
+	uint32_t idx;
+
+	for (idx = guid_tbl_idx(tbl, guid); tbl->entries[idx].obj;
+	     idx = (idx + 1) & (tbl->size - 1))
+		if (tbl->entries[idx].guid == guid)
+			break;
+
+	return &tbl->entries[idx];
 }
 
-int add_to_nodeguid_hash(ibnd_node_t * node, ibnd_node_t * hash[])
+static int guid_tbl_grow(struct guid_tbl *tbl)
 {
-	int rc = 0;
-	ibnd_node_t *tblnode;
-	int hash_idx = HASHGUID(node->guid) % HTSZ;
-
-	for (tblnode = hash[hash_idx]; tblnode; tblnode = tblnode->htnext) {
-		if (tblnode == node) {
-			IBND_ERROR("Duplicate Node: Node with guid 0x%016"
-				   PRIx64 " already exists in nodes DB\n",
-				   node->guid);
-			return 1;
-		}
+	struct guid_tbl old = *tbl;
+	uint32_t i;
+
+	tbl->size = old.size ? old.size * 2 : 256;
+	tbl->entries = calloc(tbl->size, sizeof(*tbl->entries));
+	if (!tbl->entries) {
+		*tbl = old;
+		return -ENOMEM;
 	}
-	node->htnext = hash[hash_idx];
-	hash[hash_idx] = node;
-	return rc;
+
+	for (i = 0; i < old.size; i++)
+		if (old.entries[i].obj)
+			*guid_tbl_slot(tbl, old.entries[i].guid) = old.entries[i];
+
+	free(old.entries);
+	return 0;
 }
 
-int add_to_portguid_hash(ibnd_port_t * port, ibnd_port_t * hash[])
+/*
+ * Returns 1 if obj is already in the table. Any other object with the
+ * same GUID (e.g. another port of the same switch) is replaced, so that
+ * a lookup returns the most recently added one.
+ */
+int guid_tbl_insert(struct guid_tbl *tbl, uint64_t guid, void *obj)
 {
-	int rc = 0;
-	ibnd_port_t *tblport;
-	int hash_idx = HASHGUID(port->guid) % HTSZ;
-
-	for (tblport = hash[hash_idx]; tblport; tblport = tblport->htnext) {
-		if (tblport == port) {
-			IBND_ERROR("Duplicate Port: Port with guid 0x%016"
-				   PRIx64 " already exists in ports DB\n",
-				   port->guid);
-			return 1;
-		}
+	struct guid_tbl_entry *entry;
+
+	if ((tbl->count + 1) * 2 > tbl->size && guid_tbl_grow(tbl))
+		return -ENOMEM;
+
+	entry = guid_tbl_slot(tbl, guid);
+	if (entry->obj == obj)
+		return 1;
+	if (!entry->obj)
+		tbl->count++;
+	entry->guid = guid;
+	entry->obj = obj;
+	return 0;
+}
+
+ibnd_node_t *ibnd_find_node_guid(ibnd_fabric_t * fabric, uint64_t guid)
+{
+	if (!fabric) {
+		IBND_DEBUG("fabric parameter NULL\n");
+		return NULL;
 	}
-	port->htnext = hash[hash_idx];
-	hash[hash_idx] = port;
-	return rc;
+
+	return guid_tbl_find(&((f_internal_t *)fabric)->node_tbl, guid);
 }
 
-struct lid2guid_item {
-	cl_map_item_t cl_map;
-	ibnd_port_t *port;
-};
+ibnd_node_t *ibnd_find_node_dr(ibnd_fabric_t * fabric, char *dr_str)
+{
+	ibnd_port_t *rc = ibnd_find_port_dr(fabric, dr_str);
+	return rc->node;
+}
 
-void create_lid2guid(f_internal_t *f_int)
+int add_to_nodeguid_hash(ibnd_node_t * node, f_internal_t * f_int)
 {
-	cl_qmap_init(&f_int->lid2guid);
+	int rc = guid_tbl_insert(&f_int->node_tbl, node->guid, node);
+
+	if (rc == 1)
+		IBND_ERROR("Duplicate Node: Node with guid 0x%016"
+			   PRIx64 " already exists in nodes DB\n",
+			   node->guid);
+	return rc ? 1 : 0;
 }
 
-void destroy_lid2guid(f_internal_t *f_int)
+int add_to_portguid_hash(ibnd_port_t * port, f_internal_t * f_int)
 {
-	cl_map_item_t *item;
+	int rc = guid_tbl_insert(&f_int->port_tbl, port->guid, port);
 
-	for (item = cl_qmap_head(&f_int->lid2guid); item != cl_qmap_end(&f_int->lid2guid);
-	     item = cl_qmap_head(&f_int->lid2guid)) {
-		cl_qmap_remove_item(&f_int->lid2guid, item);
-		free(container_of(item, struct lid2guid_item, cl_map));
-	}
+	if (rc == 1)
+		IBND_ERROR("Duplicate Port: Port with guid 0x%016"
+			   PRIx64 " already exists in ports DB\n",
+			   port->guid);
+	return rc ? 1 : 0;
+}
+
+void destroy_fabric_tables(f_internal_t *f_int)
+{
+	free(f_int->node_tbl.entries);
+	free(f_int->port_tbl.entries);
+	free(f_int->lid2port);
 }
 
 void add_to_portlid_hash(ibnd_port_t * port, f_internal_t *f_int)
 {
 	uint16_t base_lid = port->base_lid;
 	uint16_t lid_mask = ((1 << port->lmc) -1);
-	uint16_t lid = 0;
+	uint32_t lid = 0;
 	/* 0 < valid lid <= 0xbfff */
-	if (base_lid > 0 && base_lid <= 0xbfff) {
+	if (base_lid > 0 && base_lid <= IBND_MAX_UCAST_LID) {
+		if (!f_int->lid2port) {
+			f_int->lid2port = calloc(IBND_MAX_UCAST_LID + 1,
+						 sizeof(*f_int->lid2port));
+			if (!f_int->lid2port)
+				return;
+		}
 		/* We add the port for all lids
 		 * so it is easier to find any "random" lid specified */
-		for (lid = base_lid; lid <= (base_lid + lid_mask); lid++) {
-			struct lid2guid_item *item;
-
-			item = malloc(sizeof(*item));
-			if (item) {
-				item->port = port;
-				if (cl_qmap_insert(&f_int->lid2guid, lid,
-						   &item->cl_map) != &item->cl_map) {
-					/* Port is already in map, release item */
-					free(item);
-				}
-			}
+		for (lid = base_lid;
+		     lid <= (base_lid + lid_mask) && lid <= IBND_MAX_UCAST_LID;
+		     lid++) {
+			/* the first port added for a lid is kept */
+			if (!f_int->lid2port[lid])
+				f_int->lid2port[lid] = port;
 		}
 	}
 }
@@ -753,11 +792,7 @@ static int set_config(struct ibnd_config *config, struct ibnd_config *cfg)
 
 f_internal_t *allocate_fabric_internal(void)
 {
-	f_internal_t *f = calloc(1, sizeof(*f));
-	if (f)
-		create_lid2guid(f);
-
-	return (f);
+	return calloc(1, sizeof(f_internal_t));
 }
 
 ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
@@ -865,6 +900,7 @@ void ibnd_destroy_fabric(ibnd_fabric_t * fabric)
 	ibnd_node_t *node = NULL;
 	ibnd_node_t *next = NULL;
 	ibnd_chassis_t *ch, *ch_next;
+	f_internal_t *f_int = (f_internal_t *)fabric;
 
 	if (!fabric)
 		return;
@@ -875,13 +911,16 @@ void ibnd_destroy_fabric(ibnd_fabric_t * fabric)
 		free(ch);
 		ch = ch_next;
 	}
-	node = fabric->nodes;
+	node = f_int->node_pool ? NULL : fabric->nodes;
 	while (node) {
 		next = node->next;
 		destroy_node(node);
 		node = next;
 	}
-	destroy_lid2guid((f_internal_t *)fabric);
+	free(f_int->node_pool);
+	free(f_int->port_pool);
+	free(f_int->port_ptr_pool);
+	destroy_fabric_tables(f_int);
 	free(fabric);
 }
 
@@ -944,31 +983,20 @@ ibnd_port_t *ibnd_find_port_lid(ibnd_fabric_t * fabric,
 {
 	f_internal_t *f = (f_internal_t *)fabric;
 
-	cl_map_item_t *p_item = cl_qmap_get(&f->lid2guid, lid);
-
-	if (p_item == &f->lid2guid.nil)
+	if (!f->lid2port || lid > IBND_MAX_UCAST_LID)
 		return NULL;
 
-	return container_of(p_item,
-			    struct lid2guid_item, cl_map)
-		->port;
+	return f->lid2port[lid];
 }
 
 ibnd_port_t *ibnd_find_port_guid(ibnd_fabric_t * fabric, uint64_t guid)
 {
-	int hash = HASHGUID(guid) % HTSZ;
-	ibnd_port_t *port;
-
 	if (!fabric) {
 		IBND_DEBUG("fabric parameter NULL\n");
 		return NULL;
 	}
 
-	for (port = fabric->portstbl[hash]; port; port = port->htnext)
-		if (port->guid == guid)
-			return port;
-
-	return NULL;
+	return guid_tbl_find(&((f_internal_t *)fabric)->port_tbl, guid);
 }
 
 ibnd_port_t *ibnd_find_port_dr(ibnd_fabric_t * fabric, char *dr_str)
@@ -1015,7 +1043,7 @@ void ibnd_iter_ports(ibnd_fabric_t * fabric, ibnd_iter_port_func_t func,
 			void *user_data)
 {
 	int i = 0;
-	ibnd_port_t *cur = NULL;
+	ibnd_node_t *node = NULL;
 
 	if (!fabric) {
 		IBND_DEBUG("fabric parameter NULL\n");
@@ -1027,9 +1055,14 @@ void ibnd_iter_ports(ibnd_fabric_t * fabric, ibnd_iter_port_func_t func,
 		return;
 	}
 
-	for (i = 0; i<HTSZ; i++)
-		for (cur = fabric->portstbl[i]; cur; cur = cur->htnext)
-			func(cur, user_data);
+	/* every port is reachable from the ports array of its node */
+	for (node = fabric->nodes; node; node = node->next) {
+		if (!node->ports)
+			continue;
+		for (i = 0; i <= node->numports; i++)
+			if (node->ports[i])
+				func(node->ports[i], user_data);
+	}
 }
 
 int ibnd_get_agg_linkspeedext_field(void *cap_info, void *info,
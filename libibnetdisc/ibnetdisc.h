@@ -173,7 +173,7 @@ typedef struct ibnd_fabric {
 	unsigned maxhops_discovered;
 	unsigned total_mads_used;
 
-	/* internal use only */
+	/* internal use only, no longer used (kept for ABI compatibility) */
 	ibnd_node_t *nodestbl[HTSZ];
 	ibnd_port_t *portstbl[HTSZ];
 	ibnd_node_t *switches;
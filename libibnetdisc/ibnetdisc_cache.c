@@ -43,15 +43,39 @@
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <endian.h>
+#include <sys/mman.h>
 
 #include <infiniband/ibnetdisc.h>
+#include <ccan/build_assert.h>
 
 #include "internal.h"
 #include "chassis.h"
 
 /* For this caching lib, we always cache little endian */
 
-/* Cache format
+/* Cache format, version 2
+ *
+ * The file is written so that it can be mmapped and turned into a fabric
+ * without any searching.  All records have a fixed size, all multi byte
+ * fields are naturally aligned, and nodes and ports refer to each other
+ * by their index in the file instead of by GUID.
+ *
+ * struct ibnd_cache_hdr     - header, see below
+ * struct ibnd_cache_node    - node_count node records at node_off
+ * struct ibnd_cache_port    - port_count port records at port_off
+ * uint32_t[node_tbl_size]   - node GUID index at node_tbl_off
+ * uint32_t[port_tbl_size]   - port GUID index at port_tbl_off
+ *
+ * The GUID indices are the slots of the node and port guid_tbl of the
+ * fabric that was cached, holding record index + 1 (0 for a free slot).
+ * They are copied as is on load, so any change to the guid_tbl hash must
+ * bump the cache version.
+ *
+ * Version 1 caches (below) can still be loaded but are no longer written.
+ */
+
+/* Cache format, version 1
  *
  * Bytes 1-4 - magic number
  * Bytes 5-8 - version number
@@ -94,6 +118,51 @@
  * 1 byte - port num remotely connected to
  */
 
+struct ibnd_cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t node_count;
+	uint32_t port_count;
+	uint64_t from_node_guid;
+	uint32_t maxhops;
+	uint32_t from_node_idx;
+	uint32_t node_tbl_size;
+	uint32_t port_tbl_size;
+	uint64_t node_off;
+	uint64_t port_off;
+	uint64_t node_tbl_off;
+	uint64_t port_tbl_off;
+};
+
+struct ibnd_cache_node {
+	uint64_t guid;
+	uint16_t smalid;
+	uint8_t smalmc;
+	uint8_t smaenhsp0;
+	uint8_t type;
+	uint8_t numports;
+	uint8_t reserved[2];
+	uint8_t switchinfo[IB_SMP_DATA_SIZE];
+	uint8_t info[IB_SMP_DATA_SIZE];
+	uint8_t nodedesc[IB_SMP_DATA_SIZE];
+};
+
+#define IBND_CACHE_NO_REMOTE 0xFFFFFFFF
+
+struct ibnd_cache_port {
+	uint64_t guid;
+	uint32_t node_idx;
+	uint32_t remote_node_idx;	/* IBND_CACHE_NO_REMOTE if none */
+	uint16_t base_lid;
+	uint8_t portnum;
+	uint8_t ext_portnum;
+	uint8_t lmc;
+	uint8_t remote_portnum;
+	uint8_t reserved[2];
+	uint8_t info[IB_SMP_DATA_SIZE];
+	uint8_t ext_info[IB_SMP_DATA_SIZE];
+};
+
 /* Structs that hold cache info temporarily before
  * the real structs can be reconstructed.
  */
@@ -133,9 +202,8 @@ typedef struct ibnd_fabric_cache {
 
 #define IBND_FABRIC_CACHE_BUFLEN  4096
 #define IBND_FABRIC_CACHE_MAGIC   0x8FE7832B
-#define IBND_FABRIC_CACHE_VERSION 0x00000001
-
-#define IBND_FABRIC_CACHE_COUNT_OFFSET 8
+#define IBND_FABRIC_CACHE_VERSION 0x00000002
+#define IBND_FABRIC_CACHE_VERSION_1 0x00000001
 
 #define IBND_FABRIC_CACHE_HEADER_LEN   (28)
 #define IBND_NODE_CACHE_HEADER_LEN     (15 + IB_SMP_DATA_SIZE*3)
@@ -236,7 +304,7 @@ static int _load_header_info(int fd, ibnd_fabric_cache_t * fabric_cache,
 
 	offset += _unmarshall32(buf + offset, &version);
 
-	if (version != IBND_FABRIC_CACHE_VERSION) {
+	if (version != IBND_FABRIC_CACHE_VERSION_1) {
 		IBND_DEBUG("invalid fabric cache version\n");
 		return -1;
 	}
@@ -511,8 +579,7 @@ static int _fill_port(ibnd_fabric_cache_t * fabric_cache, ibnd_node_t * node,
 	/* achu: needed if user wishes to re-cache a loaded fabric.
 	 * Otherwise, mostly unnecessary to do this.
 	 */
-	int rc = add_to_portguid_hash(port_cache->port,
-				      fabric_cache->f_int->fabric.portstbl);
+	int rc = add_to_portguid_hash(port_cache->port, fabric_cache->f_int);
 	if (rc) {
 		IBND_DEBUG("Error Occurred when trying"
 			   " to insert new port guid 0x%016" PRIx64 " to DB\n",
@@ -541,9 +608,7 @@ static int _rebuild_nodes(ibnd_fabric_cache_t * fabric_cache)
 		fabric_cache->f_int->fabric.nodes = node;
 
 		int rc = add_to_nodeguid_hash(node_cache->node,
-					      fabric_cache->
-					      f_int->
-					      fabric.nodestbl);
+					      fabric_cache->f_int);
 		if (rc) {
 			IBND_DEBUG("Error Occurred when trying"
 				   " to insert new node guid 0x%016" PRIx64 " to DB\n",
@@ -617,6 +682,265 @@ static int _rebuild_ports(ibnd_fabric_cache_t * fabric_cache)
 	return 0;
 }
 
+static int _map_range_ok(uint64_t off, uint64_t count, size_t recsize,
+			 size_t len)
+{
+	if (off % sizeof(uint64_t) || off > len)
+		return 0;
+	return count <= (len - off) / recsize;
+}
+
+/*
+ * Install a prebuilt GUID index, whose slots hold record index + 1, for
+ * either nodes or ports.  At least one slot must stay free, otherwise a
+ * lookup of an unknown GUID would never terminate.
+ */
+static int _map_guid_tbl(struct guid_tbl *tbl, const uint32_t *slots,
+			 uint32_t size, ibnd_node_t *nodes,
+			 ibnd_port_t *ports, uint32_t count)
+{
+	uint32_t i, idx;
+
+	if (!size)
+		return 0;
+
+	if (size & (size - 1)) {
+		IBND_DEBUG("Cache invalid: bad guid index size\n");
+		return -1;
+	}
+
+	if (!(tbl->entries = calloc(size, sizeof(*tbl->entries)))) {
+		IBND_DEBUG("OOM: guid index\n");
+		return -1;
+	}
+	tbl->size = size;
+
+	for (i = 0; i < size; i++) {
+		idx = le32toh(slots[i]);
+		if (!idx)
+			continue;
+		if (idx > count || ++tbl->count >= size) {
+			IBND_DEBUG("Cache invalid: bad guid index\n");
+			return -1;
+		}
+		if (nodes) {
+			tbl->entries[i].guid = nodes[idx - 1].guid;
+			tbl->entries[i].obj = &nodes[idx - 1];
+		} else {
+			tbl->entries[i].guid = ports[idx - 1].guid;
+			tbl->entries[i].obj = &ports[idx - 1];
+		}
+	}
+
+	return 0;
+}
+
+static int _map_nodes(f_internal_t * f_int, const struct ibnd_cache_node *rec,
+		      uint32_t node_count)
+{
+	ibnd_node_t *nodes;
+	ibnd_port_t **port_ptrs;
+	size_t nptrs = 0;
+	uint32_t i;
+
+	for (i = 0; i < node_count; i++)
+		nptrs += rec[i].numports + 1;
+
+	nodes = calloc(node_count, sizeof(*nodes));
+	port_ptrs = calloc(nptrs, sizeof(*port_ptrs));
+	f_int->node_pool = nodes;
+	f_int->port_ptr_pool = port_ptrs;
+	if (!nodes || !port_ptrs) {
+		IBND_DEBUG("OOM: nodes\n");
+		return -1;
+	}
+
+	for (i = 0; i < node_count; i++) {
+		ibnd_node_t *node = &nodes[i];
+
+		node->guid = le64toh(rec[i].guid);
+		node->smalid = le16toh(rec[i].smalid);
+		node->smalmc = rec[i].smalmc;
+		node->smaenhsp0 = rec[i].smaenhsp0;
+		node->type = rec[i].type;
+		node->numports = rec[i].numports;
+		memcpy(node->switchinfo, rec[i].switchinfo, IB_SMP_DATA_SIZE);
+		memcpy(node->info, rec[i].info, IB_SMP_DATA_SIZE);
+		memcpy(node->nodedesc, rec[i].nodedesc, IB_SMP_DATA_SIZE);
+
+		node->ports = port_ptrs;
+		port_ptrs += node->numports + 1;
+
+		/* keep the order the nodes were cached in */
+		node->next = i + 1 < node_count ? &nodes[i + 1] : NULL;
+		add_to_type_list(node, f_int);
+	}
+
+	return 0;
+}
+
+static int _map_ports(f_internal_t * f_int, const struct ibnd_cache_port *rec,
+		      uint32_t node_count, uint32_t port_count)
+{
+	ibnd_node_t *nodes = f_int->node_pool;
+	ibnd_port_t *ports;
+	uint32_t i, idx;
+
+	if (!port_count)
+		return 0;
+
+	if (!(ports = calloc(port_count, sizeof(*ports)))) {
+		IBND_DEBUG("OOM: ports\n");
+		return -1;
+	}
+	f_int->port_pool = ports;
+
+	for (i = 0; i < port_count; i++) {
+		ibnd_port_t *port = &ports[i];
+
+		idx = le32toh(rec[i].node_idx);
+		if (idx >= node_count || rec[i].portnum > nodes[idx].numports ||
+		    nodes[idx].ports[rec[i].portnum]) {
+			IBND_DEBUG("Cache invalid: bad port %u\n", i);
+			return -1;
+		}
+
+		port->guid = le64toh(rec[i].guid);
+		port->portnum = rec[i].portnum;
+		port->ext_portnum = rec[i].ext_portnum;
+		port->base_lid = le16toh(rec[i].base_lid);
+		port->lmc = rec[i].lmc;
+		memcpy(port->info, rec[i].info, IB_SMP_DATA_SIZE);
+		memcpy(port->ext_info, rec[i].ext_info, IB_SMP_DATA_SIZE);
+		port->node = &nodes[idx];
+		port->node->ports[port->portnum] = port;
+
+		add_to_portlid_hash(port, f_int);
+	}
+
+	/* every port is placed, now the remote references can be resolved */
+	for (i = 0; i < port_count; i++) {
+		idx = le32toh(rec[i].remote_node_idx);
+		if (idx == IBND_CACHE_NO_REMOTE)
+			continue;
+		if (idx >= node_count ||
+		    rec[i].remote_portnum > nodes[idx].numports ||
+		    !nodes[idx].ports[rec[i].remote_portnum]) {
+			IBND_DEBUG("Cache invalid: cannot find remote port\n");
+			return -1;
+		}
+		ports[i].remoteport = nodes[idx].ports[rec[i].remote_portnum];
+	}
+
+	return 0;
+}
+
+static ibnd_fabric_t *_map_fabric(const void *map, size_t len)
+{
+	const struct ibnd_cache_hdr *hdr = map;
+	f_internal_t *f_int;
+	uint32_t node_count = le32toh(hdr->node_count);
+	uint32_t port_count = le32toh(hdr->port_count);
+	uint32_t node_tbl_size = le32toh(hdr->node_tbl_size);
+	uint32_t port_tbl_size = le32toh(hdr->port_tbl_size);
+	uint64_t node_off = le64toh(hdr->node_off);
+	uint64_t port_off = le64toh(hdr->port_off);
+	uint64_t node_tbl_off = le64toh(hdr->node_tbl_off);
+	uint64_t port_tbl_off = le64toh(hdr->port_tbl_off);
+	uint32_t from_idx = le32toh(hdr->from_node_idx);
+
+	/* the on disk layout must not depend on compiler padding */
+	BUILD_ASSERT(sizeof(struct ibnd_cache_hdr) == 72);
+	BUILD_ASSERT(sizeof(struct ibnd_cache_node) == 16 + 3 * IB_SMP_DATA_SIZE);
+	BUILD_ASSERT(sizeof(struct ibnd_cache_port) == 24 + 2 * IB_SMP_DATA_SIZE);
+
+	if (!_map_range_ok(node_off, node_count,
+			   sizeof(struct ibnd_cache_node), len) ||
+	    !_map_range_ok(port_off, port_count,
+			   sizeof(struct ibnd_cache_port), len) ||
+	    !_map_range_ok(node_tbl_off, node_tbl_size, sizeof(uint32_t), len) ||
+	    !_map_range_ok(port_tbl_off, port_tbl_size, sizeof(uint32_t), len)) {
+		IBND_DEBUG("Cache invalid: truncated\n");
+		return NULL;
+	}
+
+	if (from_idx >= node_count) {
+		IBND_DEBUG("Cache invalid: cannot find from node\n");
+		return NULL;
+	}
+
+	f_int = allocate_fabric_internal();
+	if (!f_int) {
+		IBND_DEBUG("OOM: fabric\n");
+		return NULL;
+	}
+
+	if (_map_nodes(f_int, (const void *)((const char *)map + node_off),
+		       node_count) < 0)
+		goto cleanup;
+
+	if (_map_ports(f_int, (const void *)((const char *)map + port_off),
+		       node_count, port_count) < 0)
+		goto cleanup;
+
+	if (_map_guid_tbl(&f_int->node_tbl,
+			  (const void *)((const char *)map + node_tbl_off),
+			  node_tbl_size, f_int->node_pool, NULL,
+			  node_count) < 0)
+		goto cleanup;
+
+	if (_map_guid_tbl(&f_int->port_tbl,
+			  (const void *)((const char *)map + port_tbl_off),
+			  port_tbl_size, NULL, f_int->port_pool,
+			  port_count) < 0)
+		goto cleanup;
+
+	f_int->fabric.nodes = f_int->node_pool;
+	f_int->fabric.from_node = &f_int->node_pool[from_idx];
+	f_int->fabric.maxhops_discovered = le32toh(hdr->maxhops);
+
+	if (group_nodes(&f_int->fabric))
+		goto cleanup;
+
+	return &f_int->fabric;
+
+cleanup:
+	ibnd_destroy_fabric(&f_int->fabric);
+	return NULL;
+}
+
+/*
+ * Returns 1 and the fabric (or NULL on error) in *fabric if file is a
+ * current version cache, 0 if it has to be read as a version 1 cache.
+ */
+static int _load_fabric_mapped(int fd, ibnd_fabric_t **fabric)
+{
+	const struct ibnd_cache_hdr *hdr;
+	struct stat statbuf;
+	void *map;
+	int rc = 0;
+
+	if (fstat(fd, &statbuf) < 0 ||
+	    statbuf.st_size < (off_t)sizeof(struct ibnd_cache_hdr))
+		return 0;
+
+	map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		IBND_DEBUG("mmap: %s\n", strerror(errno));
+		return 0;
+	}
+
+	hdr = map;
+	if (le32toh(hdr->magic) == IBND_FABRIC_CACHE_MAGIC &&
+	    le32toh(hdr->version) == IBND_FABRIC_CACHE_VERSION) {
+		*fabric = _map_fabric(map, statbuf.st_size);
+		rc = 1;
+	}
+
+	munmap(map, statbuf.st_size);
+	return rc;
+}
+
 ibnd_fabric_t *ibnd_load_fabric(const char *file, unsigned int flags)
 {
 	unsigned int node_count = 0;
@@ -624,6 +948,7 @@ ibnd_fabric_t *ibnd_load_fabric(const char *file, unsigned int flags)
 	ibnd_fabric_cache_t *fabric_cache = NULL;
 	f_internal_t *f_int = NULL;
 	ibnd_node_cache_t *node_cache = NULL;
+	ibnd_fabric_t *fabric = NULL;
 	int fd = -1;
 	unsigned int i;
 
@@ -637,6 +962,11 @@ ibnd_fabric_t *ibnd_load_fabric(const char *file, unsigned int flags)
 		return NULL;
 	}
 
+	if (_load_fabric_mapped(fd, &fabric)) {
+		close(fd);
+		return fabric;
+	}
+
 	fabric_cache =
 	    (ibnd_fabric_cache_t *) malloc(sizeof(ibnd_fabric_cache_t));
 	if (!fabric_cache) {
@@ -714,176 +1044,164 @@ static ssize_t ibnd_write(int fd, const void *buf, size_t count)
 	return count_done;
 }
 
-static size_t _marshall8(uint8_t * outbuf, uint8_t num)
-{
-	outbuf[0] = num;
-
-	return (sizeof(num));
-}
-
-static size_t _marshall16(uint8_t * outbuf, uint16_t num)
+static void _cache_node(struct ibnd_cache_node *rec, ibnd_node_t * node)
 {
-	outbuf[0] = num & 0x00FF;
-	outbuf[1] = (num & 0xFF00) >> 8;
-
-	return (sizeof(num));
+	rec->guid = htole64(node->guid);
+	rec->smalid = htole16(node->smalid);
+	rec->smalmc = node->smalmc;
+	rec->smaenhsp0 = (uint8_t) node->smaenhsp0;
+	rec->type = (uint8_t) node->type;
+	rec->numports = (uint8_t) node->numports;
+	memcpy(rec->switchinfo, node->switchinfo, IB_SMP_DATA_SIZE);
+	memcpy(rec->info, node->info, IB_SMP_DATA_SIZE);
+	memcpy(rec->nodedesc, node->nodedesc, IB_SMP_DATA_SIZE);
 }
 
-static size_t _marshall32(uint8_t * outbuf, uint32_t num)
+static void _cache_port(struct ibnd_cache_port *rec, ibnd_port_t * port,
+			uint32_t node_idx, uint32_t remote_node_idx)
 {
-	outbuf[0] = num & 0x000000FF;
-	outbuf[1] = (num & 0x0000FF00) >> 8;
-	outbuf[2] = (num & 0x00FF0000) >> 16;
-	outbuf[3] = (num & 0xFF000000) >> 24;
-
-	return (sizeof(num));
+	rec->guid = htole64(port->guid);
+	rec->node_idx = htole32(node_idx);
+	rec->remote_node_idx = htole32(remote_node_idx);
+	rec->base_lid = htole16(port->base_lid);
+	rec->portnum = (uint8_t) port->portnum;
+	rec->ext_portnum = (uint8_t) port->ext_portnum;
+	rec->lmc = port->lmc;
+	rec->remote_portnum =
+	    port->remoteport ? (uint8_t) port->remoteport->portnum : 0;
+	memcpy(rec->info, port->info, IB_SMP_DATA_SIZE);
+	memcpy(rec->ext_info, port->ext_info, IB_SMP_DATA_SIZE);
 }
 
-static size_t _marshall64(uint8_t * outbuf, uint64_t num)
+/* GUID tables used while caching map a GUID to its record index + 1 */
+static uint32_t _cache_idx(struct guid_tbl *tbl, uint64_t guid)
 {
-	outbuf[0] = (uint8_t) num;
-	outbuf[1] = (uint8_t) (num >> 8);
-	outbuf[2] = (uint8_t) (num >> 16);
-	outbuf[3] = (uint8_t) (num >> 24);
-	outbuf[4] = (uint8_t) (num >> 32);
-	outbuf[5] = (uint8_t) (num >> 40);
-	outbuf[6] = (uint8_t) (num >> 48);
-	outbuf[7] = (uint8_t) (num >> 56);
-
-	return (sizeof(num));
+	return (uintptr_t) guid_tbl_find(tbl, guid);
 }
 
-static size_t _marshall_buf(void *outbuf, const void *inbuf, unsigned int len)
+static int _cache_idx_add(struct guid_tbl *tbl, uint64_t guid, uint32_t idx)
 {
-	memcpy(outbuf, inbuf, len);
-
-	return len;
+	return guid_tbl_insert(tbl, guid, (void *)(uintptr_t) (idx + 1));
 }
 
-static int _cache_header_info(int fd, ibnd_fabric_t * fabric)
+static void _cache_guid_tbl(uint32_t *slots, struct guid_tbl *tbl)
 {
-	uint8_t buf[IBND_FABRIC_CACHE_BUFLEN];
-	size_t offset = 0;
-
-	/* Store magic number, version, and other important info */
-	/* For this caching lib, we always assume cached as little endian */
-
-	offset += _marshall32(buf + offset, IBND_FABRIC_CACHE_MAGIC);
-	offset += _marshall32(buf + offset, IBND_FABRIC_CACHE_VERSION);
-	/* save space for node count */
-	offset += _marshall32(buf + offset, 0);
-	/* save space for port count */
-	offset += _marshall32(buf + offset, 0);
-	offset += _marshall64(buf + offset, fabric->from_node->guid);
-	offset += _marshall32(buf + offset, fabric->maxhops_discovered);
-
-	if (ibnd_write(fd, buf, offset) < 0)
-		return -1;
+	uint32_t i;
 
-	return 0;
+	for (i = 0; i < tbl->size; i++)
+		slots[i] = htole32((uint32_t) (uintptr_t) tbl->entries[i].obj);
 }
 
-static int _cache_header_counts(int fd, unsigned int node_count,
-				unsigned int port_count)
+/*
+ * Lay the whole cache out in memory so it is written with a single
+ * write(), node_idx must already hold every node of the fabric.
+ */
+static int _cache_image(int fd, ibnd_fabric_t * fabric,
+			struct guid_tbl *node_idx, uint32_t node_count,
+			uint32_t port_count)
 {
-	uint8_t buf[IBND_FABRIC_CACHE_BUFLEN];
-	size_t offset = 0;
+	struct guid_tbl port_idx = { 0 };
+	struct ibnd_cache_hdr *hdr;
+	struct ibnd_cache_node *node_rec;
+	struct ibnd_cache_port *port_rec;
+	ibnd_node_t *node;
+	ibnd_port_t *port;
+	uint64_t node_off, port_off, node_tbl_off, port_tbl_off;
+	uint32_t n, p = 0, remote;
+	size_t len;
+	uint8_t *buf;
+	int rc = -1;
+	int i;
 
-	offset += _marshall32(buf + offset, node_count);
-	offset += _marshall32(buf + offset, port_count);
+	node_off = sizeof(*hdr);
+	port_off = node_off + (uint64_t) node_count * sizeof(*node_rec);
+	node_tbl_off = port_off + (uint64_t) port_count * sizeof(*port_rec);
 
-	if (lseek(fd, IBND_FABRIC_CACHE_COUNT_OFFSET, SEEK_SET) < 0) {
-		IBND_DEBUG("lseek: %s\n", strerror(errno));
-		return -1;
+	buf = NULL;
+	for (node = fabric->nodes; node; node = node->next) {
+		for (i = 0; node->ports && i <= node->numports; i++) {
+			if (!node->ports[i])
+				continue;
+			if (_cache_idx_add(&port_idx, node->ports[i]->guid,
+					   p++) < 0) {
+				IBND_DEBUG("OOM: port index\n");
+				goto cleanup;
+			}
+		}
 	}
 
-	if (ibnd_write(fd, buf, offset) < 0)
-		return -1;
+	port_tbl_off = node_tbl_off + node_idx->size * sizeof(uint32_t);
+	port_tbl_off = (port_tbl_off + 7) & ~7ULL;
+	len = port_tbl_off + port_idx.size * sizeof(uint32_t);
 
-	return 0;
-}
+	if (!(buf = calloc(1, len))) {
+		IBND_DEBUG("OOM: cache buffer\n");
+		goto cleanup;
+	}
 
-static int _cache_node(int fd, ibnd_node_t * node)
-{
-	uint8_t buf[IBND_FABRIC_CACHE_BUFLEN];
-	size_t offset = 0;
-	size_t ports_stored_offset = 0;
-	uint8_t ports_stored_count = 0;
-	int i;
+	hdr = (struct ibnd_cache_hdr *)buf;
+	hdr->magic = htole32(IBND_FABRIC_CACHE_MAGIC);
+	hdr->version = htole32(IBND_FABRIC_CACHE_VERSION);
+	hdr->node_count = htole32(node_count);
+	hdr->port_count = htole32(port_count);
+	hdr->from_node_guid = htole64(fabric->from_node->guid);
+	hdr->maxhops = htole32(fabric->maxhops_discovered);
+	hdr->from_node_idx =
+	    htole32(_cache_idx(node_idx, fabric->from_node->guid) - 1);
+	hdr->node_tbl_size = htole32(node_idx->size);
+	hdr->port_tbl_size = htole32(port_idx.size);
+	hdr->node_off = htole64(node_off);
+	hdr->port_off = htole64(port_off);
+	hdr->node_tbl_off = htole64(node_tbl_off);
+	hdr->port_tbl_off = htole64(port_tbl_off);
+
+	node_rec = (struct ibnd_cache_node *)(buf + node_off);
+	port_rec = (struct ibnd_cache_port *)(buf + port_off);
+	n = 0;
+	for (node = fabric->nodes; node; node = node->next, n++) {
+		_cache_node(&node_rec[n], node);
+
+		for (i = 0; node->ports && i <= node->numports; i++) {
+			port = node->ports[i];
+			if (!port)
+				continue;
 
-	offset += _marshall16(buf + offset, node->smalid);
-	offset += _marshall8(buf + offset, node->smalmc);
-	offset += _marshall8(buf + offset, (uint8_t) node->smaenhsp0);
-	offset += _marshall_buf(buf + offset, node->switchinfo,
-				IB_SMP_DATA_SIZE);
-	offset += _marshall64(buf + offset, node->guid);
-	offset += _marshall8(buf + offset, (uint8_t) node->type);
-	offset += _marshall8(buf + offset, (uint8_t) node->numports);
-	offset += _marshall_buf(buf + offset, node->info, IB_SMP_DATA_SIZE);
-	offset += _marshall_buf(buf + offset, node->nodedesc, IB_SMP_DATA_SIZE);
-	/* need to come back later and store number of stored ports
-	 * because port entries can be NULL or (in the case of switches)
-	 * there is an additional port 0 not accounted for in numports.
-	 */
-	ports_stored_offset = offset;
-	offset += sizeof(uint8_t);
-
-	for (i = 0; i <= node->numports; i++) {
-		if (node->ports[i]) {
-			offset += _marshall64(buf + offset,
-					      node->ports[i]->guid);
-			offset += _marshall8(buf + offset,
-					     (uint8_t) node->ports[i]->portnum);
-			ports_stored_count++;
+			remote = IBND_CACHE_NO_REMOTE;
+			if (port->remoteport) {
+				remote = _cache_idx(node_idx,
+						    port->remoteport->node->guid);
+				if (!remote--) {
+					IBND_DEBUG("remote node 0x%016" PRIx64
+						   " not in fabric\n",
+						   port->remoteport->node->guid);
+					goto cleanup;
+				}
+			}
+			_cache_port(port_rec++, port, n, remote);
 		}
 	}
 
-	/* go back and store number of port keys stored */
-	_marshall8(buf + ports_stored_offset, ports_stored_count);
-
-	if (ibnd_write(fd, buf, offset) < 0)
-		return -1;
-
-	return 0;
-}
+	_cache_guid_tbl((uint32_t *)(buf + node_tbl_off), node_idx);
+	_cache_guid_tbl((uint32_t *)(buf + port_tbl_off), &port_idx);
 
-static int _cache_port(int fd, ibnd_port_t * port)
-{
-	uint8_t buf[IBND_FABRIC_CACHE_BUFLEN];
-	size_t offset = 0;
+	if (ibnd_write(fd, buf, len) < 0)
+		goto cleanup;
 
-	offset += _marshall64(buf + offset, port->guid);
-	offset += _marshall8(buf + offset, (uint8_t) port->portnum);
-	offset += _marshall8(buf + offset, (uint8_t) port->ext_portnum);
-	offset += _marshall16(buf + offset, port->base_lid);
-	offset += _marshall8(buf + offset, port->lmc);
-	offset += _marshall_buf(buf + offset, port->info, IB_SMP_DATA_SIZE);
-	offset += _marshall64(buf + offset, port->node->guid);
-	if (port->remoteport) {
-		offset += _marshall8(buf + offset, 1);
-		offset += _marshall64(buf + offset, port->remoteport->guid);
-		offset += _marshall8(buf + offset, (uint8_t) port->remoteport->portnum);
-	} else {
-		offset += _marshall8(buf + offset, 0);
-		offset += _marshall64(buf + offset, 0);
-		offset += _marshall8(buf + offset, 0);
-	}
-
-	if (ibnd_write(fd, buf, offset) < 0)
-		return -1;
+	rc = 0;
 
-	return 0;
+cleanup:
+	free(buf);
+	free(port_idx.entries);
+	return rc;
 }
 
 int ibnd_cache_fabric(ibnd_fabric_t * fabric, const char *file,
 		      unsigned int flags)
 {
+	struct guid_tbl node_idx = { 0 };
 	struct stat statbuf;
 	ibnd_node_t *node = NULL;
-	ibnd_node_t *node_next = NULL;
 	unsigned int node_count = 0;
-	ibnd_port_t *port = NULL;
-	ibnd_port_t *port_next = NULL;
 	unsigned int port_count = 0;
 	int fd;
 	int i;
@@ -898,66 +1216,65 @@ int ibnd_cache_fabric(ibnd_fabric_t * fabric, const char *file,
 		return -1;
 	}
 
+	if (!fabric->from_node) {
+		IBND_DEBUG("fabric has no from node\n");
+		return -1;
+	}
+
+	for (node = fabric->nodes; node; node = node->next) {
+		if (_cache_idx(&node_idx, node->guid)) {
+			IBND_DEBUG("duplicate node guid 0x%016" PRIx64 "\n",
+				   node->guid);
+			free(node_idx.entries);
+			return -1;
+		}
+		if (_cache_idx_add(&node_idx, node->guid, node_count++) < 0) {
+			IBND_DEBUG("OOM: node index\n");
+			free(node_idx.entries);
+			return -1;
+		}
+		for (i = 0; node->ports && i <= node->numports; i++)
+			if (node->ports[i])
+				port_count++;
+	}
+
 	if (!(flags & IBND_CACHE_FABRIC_FLAG_NO_OVERWRITE)) {
 		if (!stat(file, &statbuf)) {
 			if (unlink(file) < 0) {
 				IBND_DEBUG("error removing '%s': %s\n",
 					   file, strerror(errno));
-				return -1;
+				goto cleanup_idx;
 			}
 		}
 	}
 	else {
 		if (!stat(file, &statbuf)) {
 			IBND_DEBUG("file '%s' already exists\n", file);
-			return -1;
+			goto cleanup_idx;
 		}
 	}
 
 	if ((fd = open(file, O_CREAT | O_EXCL | O_WRONLY, 0644)) < 0) {
 		IBND_DEBUG("open: %s\n", strerror(errno));
-		return -1;
+		goto cleanup_idx;
 	}
 
-	if (_cache_header_info(fd, fabric) < 0)
-		goto cleanup;
-
-	node = fabric->nodes;
-	while (node) {
-		node_next = node->next;
-
-		if (_cache_node(fd, node) < 0)
-			goto cleanup;
-
-		node_count++;
-		node = node_next;
-	}
-
-	for (i = 0; i < HTSZ; i++) {
-		port = fabric->portstbl[i];
-		while (port) {
-			port_next = port->htnext;
-
-			if (_cache_port(fd, port) < 0)
-				goto cleanup;
-
-			port_count++;
-			port = port_next;
-		}
-	}
-
-	if (_cache_header_counts(fd, node_count, port_count) < 0)
+	if (_cache_image(fd, fabric, &node_idx, node_count, port_count) < 0)
 		goto cleanup;
 
 	if (close(fd) < 0) {
 		IBND_DEBUG("close: %s\n", strerror(errno));
-		goto cleanup;
+		unlink(file);
+		goto cleanup_idx;
 	}
 
+	free(node_idx.entries);
 	return 0;
 
 cleanup:
 	unlink(file);
 	close(fd);
+cleanup_idx:
+	free(node_idx.entries);
 	return -1;
 }
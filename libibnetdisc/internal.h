@@ -57,13 +57,36 @@
 #define DEFAULT_TIMEOUT 1000
 #define DEFAULT_RETRIES 3
 
+/* unicast LIDs are 1 - 0xbfff */
+#define IBND_MAX_UCAST_LID 0xbfff
+
+/* Open addressing (linear probing) GUID table, grown at 50% load */
+struct guid_tbl_entry {
+	uint64_t guid;
+	void *obj;		/* NULL if the slot is free */
+};
+
+struct guid_tbl {
+	struct guid_tbl_entry *entries;
+	uint32_t size;		/* power of 2 */
+	uint32_t count;
+};
+
+void *guid_tbl_find(struct guid_tbl *tbl, uint64_t guid);
+int guid_tbl_insert(struct guid_tbl *tbl, uint64_t guid, void *obj);
+
 typedef struct f_internal {
 	ibnd_fabric_t fabric;
-	cl_qmap_t lid2guid;
+	struct guid_tbl node_tbl;
+	struct guid_tbl port_tbl;
+	ibnd_port_t **lid2port;	/* IBND_MAX_UCAST_LID + 1 entries */
+	/* set if ibnd_load_fabric allocated all nodes/ports in one go */
+	ibnd_node_t *node_pool;
+	ibnd_port_t *port_pool;
+	ibnd_port_t **port_ptr_pool;
 } f_internal_t;
 f_internal_t *allocate_fabric_internal(void);
-void create_lid2guid(f_internal_t *f_int);
-void destroy_lid2guid(f_internal_t *f_int);
+void destroy_fabric_tables(f_internal_t *f_int);
 void add_to_portlid_hash(ibnd_port_t * port, f_internal_t *f_int);
 
 typedef struct ibnd_scan {
@@ -105,9 +128,9 @@ int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
 int process_mads(smp_engine_t * engine);
 void smp_engine_destroy(smp_engine_t * engine);
 
-int add_to_nodeguid_hash(ibnd_node_t * node, ibnd_node_t * hash[]);
+int add_to_nodeguid_hash(ibnd_node_t * node, f_internal_t * f_int);
 
-int add_to_portguid_hash(ibnd_port_t * port, ibnd_port_t * hash[]);
+int add_to_portguid_hash(ibnd_port_t * port, f_internal_t * f_int);
 
 void add_to_type_list(ibnd_node_t * node, f_internal_t * fabric);
 
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: (GPL-2.0 OR Linux-OpenIB)
+/*
+ * Measure the load time of an ibnetdiscover cache file and the lookup and
+ * iteration throughput of the fabric loaded from it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include <infiniband/ibnetdisc.h>
+
+struct bench_data {
+	ibnd_fabric_t *fabric;
+	unsigned long count;
+	unsigned long misses;
+};
+
+static double now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void report(const char *what, unsigned long ops, double usec)
+{
+	printf("%-24s %10lu ops %12.1f usec %10.1f Mops/s\n", what, ops, usec,
+	       usec ? ops / usec : 0);
+}
+
+static void count_port(ibnd_port_t *port, void *user_data)
+{
+	struct bench_data *data = user_data;
+
+	data->count++;
+}
+
+static void count_node(ibnd_node_t *node, void *user_data)
+{
+	struct bench_data *data = user_data;
+
+	data->count++;
+}
+
+static void find_port_guid(ibnd_port_t *port, void *user_data)
+{
+	struct bench_data *data = user_data;
+
+	data->count++;
+	if (!ibnd_find_port_guid(data->fabric, port->guid))
+		data->misses++;
+}
+
+static void find_node_guid(ibnd_node_t *node, void *user_data)
+{
+	struct bench_data *data = user_data;
+
+	data->count++;
+	if (ibnd_find_node_guid(data->fabric, node->guid) != node)
+		data->misses++;
+}
+
+static void find_port_lid(ibnd_port_t *port, void *user_data)
+{
+	struct bench_data *data = user_data;
+
+	if (!port->base_lid)
+		return;
+	data->count++;
+	if (!ibnd_find_port_lid(data->fabric, port->base_lid))
+		data->misses++;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_data data = {};
+	int iters = argc > 2 ? atoi(argv[2]) : 10;
+	double start;
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <ibnetdiscover cache file> [iters]\n",
+			argv[0]);
+		return 1;
+	}
+
+	start = now_usec();
+	data.fabric = ibnd_load_fabric(argv[1], 0);
+	if (!data.fabric) {
+		fprintf(stderr, "failed to load %s\n", argv[1]);
+		return 1;
+	}
+	report("ibnd_load_fabric", 1, now_usec() - start);
+
+#define BENCH(name, iter, func) do { \
+		data.count = 0; \
+		start = now_usec(); \
+		for (i = 0; i < iters; i++) \
+			iter(data.fabric, func, &data); \
+		report(name, data.count, now_usec() - start); \
+	} while (0)
+
+	BENCH("ibnd_iter_nodes", ibnd_iter_nodes, count_node);
+	BENCH("ibnd_iter_ports", ibnd_iter_ports, count_port);
+	BENCH("ibnd_find_node_guid", ibnd_iter_nodes, find_node_guid);
+	BENCH("ibnd_find_port_guid", ibnd_iter_ports, find_port_guid);
+	BENCH("ibnd_find_port_lid", ibnd_iter_ports, find_port_lid);
+
+#undef BENCH
+
+	ibnd_destroy_fabric(data.fabric);
+
+	if (data.misses) {
+		printf("%lu lookups failed\n", data.misses);
+		return 1;
+	}
+
+	return 0;
+}
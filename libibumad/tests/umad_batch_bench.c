@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: (GPL-2.0 OR Linux-OpenIB)
+/*
+ * Compare umad_send()/umad_recv() against umad_send_batch()/umad_recv_batch().
+ *
+ * A SOCK_SEQPACKET socketpair stands in for the umad device: like the kernel
+ * it moves one MAD per write()/read(), keeps message boundaries and the
+ * ports are non blocking.  What is measured is the per MAD library and
+ * syscall overhead, not the fabric.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <infiniband/umad.h>
+#include <infiniband/umad_types.h>
+
+#define MAD_LEN 256
+/* a whole batch has to fit in the socket buffer */
+#define MAX_BATCH 64
+
+static int count = 100000;
+static int batch = 32;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void set_tid(void *umad, uint64_t tid)
+{
+	struct umad_hdr *hdr = umad_get_mad(umad);
+
+	hdr->tid = htobe64(tid);
+}
+
+static uint64_t get_tid(void *umad)
+{
+	struct umad_hdr *hdr = umad_get_mad(umad);
+
+	return be64toh(hdr->tid);
+}
+
+static int check(void *umad, int len, uint64_t *expect)
+{
+	if (len != MAD_LEN || get_tid(umad) != *expect) {
+		fprintf(stderr, "got tid %" PRIu64 " len %d, expected %" PRIu64
+			"\n", get_tid(umad), len, *expect);
+		return -1;
+	}
+	(*expect)++;
+	return 0;
+}
+
+static int run_single(int sfd, int rfd, void **umads)
+{
+	uint64_t sent = 0, expect = 0;
+	int i, n, len;
+
+	while (expect < count) {
+		for (i = 0; i < batch && sent < count; i++) {
+			set_tid(umads[i], sent++);
+			if (umad_send(sfd, 0, umads[i], MAD_LEN, 0, 0) < 0) {
+				perror("umad_send");
+				return -1;
+			}
+		}
+		for (n = i, i = 0; i < n; i++) {
+			len = MAD_LEN;
+			if (umad_recv(rfd, umads[i], &len, -1) < 0) {
+				perror("umad_recv");
+				return -1;
+			}
+			if (check(umads[i], len, &expect))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int run_batch(int sfd, int rfd, void **umads, int *lengths)
+{
+	uint64_t sent = 0, expect = 0;
+	int i, n, done, ret;
+
+	while (expect < count) {
+		for (n = 0; n < batch && sent < count; n++) {
+			set_tid(umads[n], sent++);
+			lengths[n] = MAD_LEN;
+		}
+		for (done = 0; done < n; done += ret) {
+			ret = umad_send_batch(sfd, 0, umads + done,
+					      lengths + done, n - done, 0, 0);
+			if (ret < 0) {
+				perror("umad_send_batch");
+				return -1;
+			}
+		}
+		for (done = 0; done < n; done += ret) {
+			for (i = done; i < n; i++)
+				lengths[i] = MAD_LEN;
+			ret = umad_recv_batch(rfd, umads + done,
+					      lengths + done, n - done, -1);
+			if (ret < 0) {
+				perror("umad_recv_batch");
+				return -1;
+			}
+			for (i = done; i < done + ret; i++)
+				if (check(umads[i], lengths[i], &expect))
+					return -1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	void **umads;
+	int *lengths;
+	double t, single, batched;
+	int sv[2], i, ch;
+
+	while ((ch = getopt(argc, argv, "n:b:")) != -1) {
+		switch (ch) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n count] [-b batch]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (count <= 0 || batch <= 0 || batch > MAX_BATCH) {
+		fprintf(stderr, "count must be positive, batch 1..%d\n",
+			MAX_BATCH);
+		return 1;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, sv)) {
+		perror("socketpair");
+		return 1;
+	}
+
+	/* one pool of batch umad buffers, each umad_size() + MAD_LEN */
+	umads = calloc(batch, sizeof(*umads));
+	lengths = calloc(batch, sizeof(*lengths));
+	if (!umads || !lengths)
+		return 1;
+	umads[0] = umad_alloc(batch, umad_size() + MAD_LEN);
+	if (!umads[0])
+		return 1;
+	for (i = 1; i < batch; i++)
+		umads[i] = (char *)umads[0] + i * (umad_size() + MAD_LEN);
+
+	t = now();
+	if (run_single(sv[0], sv[1], umads))
+		return 1;
+	single = now() - t;
+
+	t = now();
+	if (run_batch(sv[0], sv[1], umads, lengths))
+		return 1;
+	batched = now() - t;
+
+	printf("%d MADs, batch %d\n", count, batch);
+	printf("umad_send/umad_recv:             %8.1f ns/MAD\n",
+	       single * 1e9 / count);
+	printf("umad_send_batch/umad_recv_batch: %8.1f ns/MAD\n",
+	       batched * 1e9 / count);
+
+	umad_free(umads[0]);
+	free(lengths);
+	free(umads);
+	return 0;
+}
@@ -1026,6 +1026,97 @@ int umad_recv(int fd, void *umad, int *length, int timeout_ms)
 	return -errno;
 }
 
+int umad_send_batch(int fd, int agentid, void *umads[], const int lengths[],
+		    int num, int timeout_ms, int retries)
+{
+	struct ib_user_mad *mad;
+	int i, n;
+
+	TRACE("fd %d agentid %d num %d timeout %u",
+	      fd, agentid, num, timeout_ms);
+
+	if (!umads || !lengths || num <= 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	for (i = 0; i < num; i++) {
+		mad = umads[i];
+		mad->timeout_ms = timeout_ms;
+		mad->retries = retries;
+		mad->agent_id = agentid;
+
+		if (umaddebug > 1)
+			umad_dump(mad);
+
+		errno = 0;
+		n = write(fd, mad, lengths[i] + umad_size());
+		if (n != lengths[i] + umad_size())
+			break;
+	}
+
+	if (i)
+		return i;
+
+	DEBUG("write returned %d != sizeof umad %zu + length %d (%m)",
+	      n, umad_size(), lengths[0]);
+	if (!errno)
+		errno = EIO;
+	return -EIO;
+}
+
+int umad_recv_batch(int fd, void *umads[], int lengths[], int num,
+		    int timeout_ms)
+{
+	struct ib_user_mad *mad;
+	int i, n;
+
+	TRACE("fd %d num %d timeout %u", fd, num, timeout_ms);
+
+	if (!umads || !lengths || num <= 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	errno = 0;
+	if (timeout_ms && (n = dev_poll(fd, timeout_ms)) < 0) {
+		if (!errno)
+			errno = -n;
+		return n;
+	}
+
+	/* The port is non blocking, drain what is queued after one poll */
+	for (i = 0; i < num; i++) {
+		mad = umads[i];
+		n = read(fd, mad, umad_size() + lengths[i]);
+		if (n < 0)
+			break;
+
+		VALGRIND_MAKE_MEM_DEFINED(mad, umad_size() + lengths[i]);
+
+		if (n > umad_size() + lengths[i]) {
+			errno = EIO;
+			break;
+		}
+		DEBUG("mad received by agent %d length %d", mad->agent_id, n);
+		lengths[i] = n > umad_size() ? n - umad_size() : 0;
+	}
+
+	if (i)
+		return i;
+
+	if (errno == EWOULDBLOCK)
+		return -EWOULDBLOCK;
+
+	/* ENOSPC leaves the MAD queued and reports the length it needs */
+	if (errno == ENOSPC)
+		lengths[0] = mad->length - umad_size();
+	DEBUG("read failed (%m)");
+	if (!errno)
+		errno = EIO;
+	return -errno;
+}
+
 int umad_poll(int fd, int timeout_ms)
 {
 	TRACE("fd %d timeout %u", fd, timeout_ms);
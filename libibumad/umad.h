@@ -214,6 +214,10 @@ int umad_get_pkey(void *umad);
 int umad_send(int portid, int agentid, void *umad, int length,
 	      int timeout_ms, int retries);
 int umad_recv(int portid, void *umad, int *length, int timeout_ms);
+int umad_send_batch(int portid, int agentid, void *umads[],
+		    const int lengths[], int num, int timeout_ms, int retries);
+int umad_recv_batch(int portid, void *umads[], int lengths[], int num,
+		    int timeout_ms);
 int umad_poll(int portid, int timeout_ms);
 int umad_get_fd(int portid);
 
@@ -0,0 +1,972 @@
+/*
+ * Copyright (c) 2026 rdma-core contributors.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Loopback RC microbenchmarks.  Both ends of every connection live in this
+ * process and on the same port, so no out of band exchange is needed and
+ * the tests run on any device, including rxe and siw.
+ *
+ *  lat:  SEND ping-pong on one QP pair, latency percentiles
+ *  rate: RDMA WRITE streams on many QP pairs and threads, message rate
+ */
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <inttypes.h>
+#include <malloc.h>
+
+#include "pingpong.h"
+
+#include <ccan/minmax.h>
+
+#define MAX_SIZES	32
+#define POLL_BATCH	16
+
+enum {
+	TEST_LAT,
+	TEST_RATE,
+};
+
+static const char *const test_str[] = {
+	[TEST_LAT] = "lat",
+	[TEST_RATE] = "rate",
+};
+
+struct bench_pair {
+	unsigned		 idx;
+	struct ibv_qp		*qp;	/* requester */
+	struct ibv_qp_ex	*qpx;
+	struct ibv_qp		*rqp;	/* responder */
+	struct ibv_cq		*rcq;	/* responder CQ, used by lat */
+	char			*buf;	/* requester buffer */
+	char			*rbuf;	/* responder buffer */
+	uint64_t		 posted;
+	uint64_t		 completed;
+	uint64_t		 last_signaled;
+	struct ibv_send_wr	*wrs;
+	struct ibv_sge		*sges;
+};
+
+struct bench_ctx;
+
+struct bench_thread {
+	pthread_t		 thread;
+	struct bench_ctx	*ctx;
+	struct ibv_cq		*cq;
+	struct bench_pair	**pairs;
+	unsigned		 npairs;
+	int			 err;
+};
+
+struct bench_ctx {
+	struct ibv_context	*context;
+	struct ibv_pd		*pd;
+	struct ibv_mr		*mr;
+	char			*buf;
+	size_t			 slot;	/* per QP buffer size */
+	struct ibv_port_attr	 portinfo;
+	union ibv_gid		 gid;
+	struct bench_pair	*pairs;
+	struct bench_thread	*threads;
+	pthread_barrier_t	 barrier;
+	unsigned		 max_inline;
+};
+
+/* Options */
+static int ib_port = 1;
+static int gidx = -1;
+static enum ibv_mtu mtu;
+static int test = TEST_LAT;
+static unsigned sizes[MAX_SIZES] = { 8 };
+static unsigned nsizes = 1;
+static unsigned iters = 10000;
+static unsigned warmup = 100;
+static unsigned nqps = 1;
+static unsigned nthreads = 1;
+static unsigned post_list = 1;
+static unsigned cq_mod = 1;
+static unsigned tx_depth = 128;
+static unsigned inline_size;
+static int use_new_send;
+static int json;
+static double max_p99;
+static double min_rate;
+
+/* Current message size */
+static unsigned size;
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int connect_qp(struct bench_ctx *ctx, struct ibv_qp *qp,
+		      uint32_t dest_qpn)
+{
+	struct ibv_qp_attr attr = {
+		.qp_state		= IBV_QPS_INIT,
+		.pkey_index		= 0,
+		.port_num		= ib_port,
+		.qp_access_flags	= IBV_ACCESS_REMOTE_WRITE,
+	};
+
+	if (ibv_modify_qp(qp, &attr,
+			  IBV_QP_STATE              |
+			  IBV_QP_PKEY_INDEX         |
+			  IBV_QP_PORT               |
+			  IBV_QP_ACCESS_FLAGS)) {
+		fprintf(stderr, "Failed to modify QP to INIT\n");
+		return 1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.qp_state		= IBV_QPS_RTR;
+	attr.path_mtu		= mtu;
+	attr.dest_qp_num	= dest_qpn;
+	attr.rq_psn		= 0;
+	attr.max_dest_rd_atomic	= 1;
+	attr.min_rnr_timer	= 12;
+	attr.ah_attr.dlid	= ctx->portinfo.lid;
+	attr.ah_attr.port_num	= ib_port;
+	if (gidx >= 0) {
+		attr.ah_attr.is_global = 1;
+		attr.ah_attr.grh.hop_limit = 1;
+		attr.ah_attr.grh.dgid = ctx->gid;
+		attr.ah_attr.grh.sgid_index = gidx;
+	}
+	if (ibv_modify_qp(qp, &attr,
+			  IBV_QP_STATE              |
+			  IBV_QP_AV                 |
+			  IBV_QP_PATH_MTU           |
+			  IBV_QP_DEST_QPN           |
+			  IBV_QP_RQ_PSN             |
+			  IBV_QP_MAX_DEST_RD_ATOMIC |
+			  IBV_QP_MIN_RNR_TIMER)) {
+		fprintf(stderr, "Failed to modify QP to RTR\n");
+		return 1;
+	}
+
+	attr.qp_state	    = IBV_QPS_RTS;
+	attr.timeout	    = 14;
+	attr.retry_cnt	    = 7;
+	attr.rnr_retry	    = 7;
+	attr.sq_psn	    = 0;
+	attr.max_rd_atomic  = 1;
+	if (ibv_modify_qp(qp, &attr,
+			  IBV_QP_STATE              |
+			  IBV_QP_TIMEOUT            |
+			  IBV_QP_RETRY_CNT          |
+			  IBV_QP_RNR_RETRY          |
+			  IBV_QP_SQ_PSN             |
+			  IBV_QP_MAX_QP_RD_ATOMIC)) {
+		fprintf(stderr, "Failed to modify QP to RTS\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static struct ibv_qp *create_qp(struct bench_ctx *ctx, struct ibv_cq *cq)
+{
+	struct ibv_qp_init_attr_ex init_attr = {
+		.send_cq = cq,
+		.recv_cq = cq,
+		.cap	 = {
+			.max_send_wr  = tx_depth,
+			.max_recv_wr  = tx_depth,
+			.max_send_sge = 1,
+			.max_recv_sge = 1,
+			.max_inline_data = inline_size,
+		},
+		.qp_type = IBV_QPT_RC,
+		.comp_mask = IBV_QP_INIT_ATTR_PD,
+		.pd = ctx->pd,
+	};
+	struct ibv_qp *qp;
+
+	if (use_new_send) {
+		init_attr.comp_mask |= IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
+		init_attr.send_ops_flags = IBV_QP_EX_WITH_SEND |
+					   IBV_QP_EX_WITH_RDMA_WRITE;
+	}
+
+	qp = ibv_create_qp_ex(ctx->context, &init_attr);
+	if (!qp) {
+		fprintf(stderr, "Couldn't create QP\n");
+		return NULL;
+	}
+
+	ctx->max_inline = init_attr.cap.max_inline_data;
+	return qp;
+}
+
+static struct bench_ctx *init_ctx(struct ibv_device *ib_dev)
+{
+	struct bench_ctx *ctx;
+	unsigned i, max_size = 0, per_thread;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	for (i = 0; i < nsizes; i++)
+		max_size = max(max_size, sizes[i]);
+	ctx->slot = (max(max_size, 64u) + 63) & ~63u;
+
+	ctx->context = ibv_open_device(ib_dev);
+	if (!ctx->context) {
+		fprintf(stderr, "Couldn't get context for %s\n",
+			ibv_get_device_name(ib_dev));
+		return NULL;
+	}
+
+	if (pp_get_port_info(ctx->context, ib_port, &ctx->portinfo)) {
+		fprintf(stderr, "Couldn't get port info\n");
+		return NULL;
+	}
+	if (ctx->portinfo.link_layer == IBV_LINK_LAYER_ETHERNET && gidx < 0)
+		gidx = 0;
+	if (gidx >= 0 && ibv_query_gid(ctx->context, ib_port, gidx,
+				       &ctx->gid)) {
+		fprintf(stderr, "Can't read sgid of index %d\n", gidx);
+		return NULL;
+	}
+	if (!mtu)
+		mtu = ctx->portinfo.active_mtu;
+
+	ctx->pd = ibv_alloc_pd(ctx->context);
+	if (!ctx->pd) {
+		fprintf(stderr, "Couldn't allocate PD\n");
+		return NULL;
+	}
+
+	ctx->buf = memalign(sysconf(_SC_PAGESIZE), 2 * nqps * ctx->slot);
+	if (!ctx->buf) {
+		fprintf(stderr, "Couldn't allocate work buf.\n");
+		return NULL;
+	}
+	memset(ctx->buf, 0x7b, 2 * nqps * ctx->slot);
+
+	ctx->mr = ibv_reg_mr(ctx->pd, ctx->buf, 2 * nqps * ctx->slot,
+			     IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+	if (!ctx->mr) {
+		fprintf(stderr, "Couldn't register MR\n");
+		return NULL;
+	}
+
+	ctx->pairs = calloc(nqps, sizeof(*ctx->pairs));
+	ctx->threads = calloc(nthreads, sizeof(*ctx->threads));
+	if (!ctx->pairs || !ctx->threads)
+		return NULL;
+
+	/* QP pairs are dealt out to the threads, each thread has one CQ */
+	per_thread = (nqps + nthreads - 1) / nthreads;
+	for (i = 0; i < nthreads; i++) {
+		struct bench_thread *t = &ctx->threads[i];
+
+		t->ctx = ctx;
+		t->cq = ibv_create_cq(ctx->context, per_thread * tx_depth * 2,
+				      NULL, NULL, 0);
+		t->pairs = calloc(per_thread, sizeof(*t->pairs));
+		if (!t->cq || !t->pairs) {
+			fprintf(stderr, "Couldn't create CQ\n");
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < nqps; i++) {
+		struct bench_pair *p = &ctx->pairs[i];
+		struct bench_thread *t = &ctx->threads[i % nthreads];
+
+		p->idx = i;
+		p->buf = ctx->buf + 2 * i * ctx->slot;
+		p->rbuf = p->buf + ctx->slot;
+		p->rcq = ibv_create_cq(ctx->context, tx_depth * 2, NULL, NULL,
+				       0);
+		if (!p->rcq) {
+			fprintf(stderr, "Couldn't create CQ\n");
+			return NULL;
+		}
+		p->qp = create_qp(ctx, t->cq);
+		p->rqp = create_qp(ctx, p->rcq);
+		if (!p->qp || !p->rqp)
+			return NULL;
+		if (use_new_send) {
+			p->qpx = ibv_qp_to_qp_ex(p->qp);
+			if (!p->qpx) {
+				fprintf(stderr, "Couldn't get extended QP\n");
+				return NULL;
+			}
+		}
+		if (connect_qp(ctx, p->qp, p->rqp->qp_num) ||
+		    connect_qp(ctx, p->rqp, p->qp->qp_num))
+			return NULL;
+
+		p->wrs = calloc(post_list, sizeof(*p->wrs));
+		p->sges = calloc(post_list, sizeof(*p->sges));
+		if (!p->wrs || !p->sges)
+			return NULL;
+
+		t->pairs[t->npairs++] = p;
+	}
+
+	return ctx;
+}
+
+static void close_ctx(struct bench_ctx *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < nqps; i++) {
+		struct bench_pair *p = &ctx->pairs[i];
+
+		if (p->qp)
+			ibv_destroy_qp(p->qp);
+		if (p->rqp)
+			ibv_destroy_qp(p->rqp);
+		if (p->rcq)
+			ibv_destroy_cq(p->rcq);
+		free(p->wrs);
+		free(p->sges);
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (ctx->threads[i].cq)
+			ibv_destroy_cq(ctx->threads[i].cq);
+		free(ctx->threads[i].pairs);
+	}
+	if (ctx->mr)
+		ibv_dereg_mr(ctx->mr);
+	if (ctx->pd)
+		ibv_dealloc_pd(ctx->pd);
+	if (ctx->context)
+		ibv_close_device(ctx->context);
+	free(ctx->pairs);
+	free(ctx->threads);
+	free(ctx->buf);
+	free(ctx);
+}
+
+static int send_flags(struct bench_ctx *ctx)
+{
+	return size && size <= ctx->max_inline ? IBV_SEND_INLINE : 0;
+}
+
+/*
+ * Post n WRs on the requester QP of p, as one list for ibv_post_send() or
+ * between one ibv_wr_start()/ibv_wr_complete() pair.  Every cq_mod'th WR
+ * and the last one of a run are signaled, the wr_id of a signaled WR
+ * carries the pair and the number of WRs its completion stands for.
+ */
+static int post_list_wrs(struct bench_ctx *ctx, struct bench_pair *p,
+			 unsigned n, enum ibv_wr_opcode opcode, char *buf,
+			 uint64_t total)
+{
+	int flags = send_flags(ctx);
+	uint64_t raddr = (uintptr_t)p->rbuf;
+	struct ibv_send_wr *bad_wr;
+	unsigned i;
+
+	if (use_new_send)
+		ibv_wr_start(p->qpx);
+
+	for (i = 0; i < n; i++) {
+		uint64_t seq = ++p->posted;
+		int wr_flags = flags;
+		uint64_t wr_id = 0;
+
+		if (seq % cq_mod == 0 || seq == total) {
+			wr_flags |= IBV_SEND_SIGNALED;
+			wr_id = (uint64_t)p->idx << 32 | (seq - p->last_signaled);
+			p->last_signaled = seq;
+		}
+
+		if (use_new_send) {
+			p->qpx->wr_id = wr_id;
+			p->qpx->wr_flags = wr_flags;
+			if (opcode == IBV_WR_RDMA_WRITE)
+				ibv_wr_rdma_write(p->qpx, ctx->mr->rkey, raddr);
+			else
+				ibv_wr_send(p->qpx);
+			if (wr_flags & IBV_SEND_INLINE)
+				ibv_wr_set_inline_data(p->qpx, buf, size);
+			else
+				ibv_wr_set_sge(p->qpx, ctx->mr->lkey,
+					       (uintptr_t)buf, size);
+			continue;
+		}
+
+		p->sges[i].addr = (uintptr_t)buf;
+		p->sges[i].length = size;
+		p->sges[i].lkey = ctx->mr->lkey;
+		p->wrs[i].wr_id = wr_id;
+		p->wrs[i].next = i + 1 < n ? &p->wrs[i + 1] : NULL;
+		p->wrs[i].sg_list = &p->sges[i];
+		p->wrs[i].num_sge = 1;
+		p->wrs[i].opcode = opcode;
+		p->wrs[i].send_flags = wr_flags;
+		p->wrs[i].wr.rdma.remote_addr = raddr;
+		p->wrs[i].wr.rdma.rkey = ctx->mr->rkey;
+	}
+
+	if (use_new_send)
+		return ibv_wr_complete(p->qpx);
+	return ibv_post_send(p->qp, p->wrs, &bad_wr);
+}
+
+static int post_recv(struct bench_ctx *ctx, struct ibv_qp *qp, char *buf,
+		     unsigned n)
+{
+	struct ibv_sge list = {
+		.addr	= (uintptr_t)buf,
+		.length = ctx->slot,
+		.lkey	= ctx->mr->lkey
+	};
+	struct ibv_recv_wr wr = {
+		.wr_id	    = 0,
+		.sg_list    = &list,
+		.num_sge    = 1,
+	};
+	struct ibv_recv_wr *bad_wr;
+	unsigned i;
+
+	for (i = 0; i < n; i++)
+		if (ibv_post_recv(qp, &wr, &bad_wr))
+			return 1;
+	return 0;
+}
+
+/* Wait for a receive on cq, reposting it; send completions are skipped */
+static int wait_recv(struct bench_ctx *ctx, struct ibv_cq *cq,
+		     struct ibv_qp *qp, char *buf)
+{
+	struct ibv_wc wc;
+	int ne;
+
+	for (;;) {
+		do {
+			ne = ibv_poll_cq(cq, 1, &wc);
+		} while (ne == 0);
+		if (ne < 0) {
+			fprintf(stderr, "poll CQ failed %d\n", ne);
+			return 1;
+		}
+		if (wc.status != IBV_WC_SUCCESS) {
+			fprintf(stderr, "Failed status %s (%d)\n",
+				ibv_wc_status_str(wc.status), wc.status);
+			return 1;
+		}
+		if (wc.opcode & IBV_WC_RECV)
+			return post_recv(ctx, qp, buf, 1);
+	}
+}
+
+/* The responder sends one reply at a time, always signaled */
+static int post_reply(struct bench_ctx *ctx, struct bench_pair *p)
+{
+	struct ibv_sge list = {
+		.addr	= (uintptr_t)p->rbuf,
+		.length = size,
+		.lkey	= ctx->mr->lkey
+	};
+	struct ibv_send_wr wr = {
+		.sg_list    = &list,
+		.num_sge    = 1,
+		.opcode     = IBV_WR_SEND,
+		.send_flags = send_flags(ctx) | IBV_SEND_SIGNALED,
+	};
+	struct ibv_send_wr *bad_wr;
+
+	return ibv_post_send(p->rqp, &wr, &bad_wr);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *v, unsigned n, double p)
+{
+	unsigned i = p * n;
+
+	return v[i < n ? i : n - 1];
+}
+
+static int run_lat(struct bench_ctx *ctx, int *gate_failed)
+{
+	struct bench_pair *p = &ctx->pairs[0];
+	struct ibv_cq *cq = ctx->threads[0].cq;
+	unsigned i, total = warmup + iters;
+	double *lat, t, sum = 0;
+
+	lat = calloc(iters, sizeof(*lat));
+	if (!lat)
+		return 1;
+
+	p->posted = p->last_signaled = 0;
+	for (i = 0; i < total; i++) {
+		t = now_us();
+		if (post_list_wrs(ctx, p, 1, IBV_WR_SEND, p->buf, total)) {
+			fprintf(stderr, "Couldn't post send\n");
+			goto err;
+		}
+		if (wait_recv(ctx, p->rcq, p->rqp, p->rbuf))
+			goto err;
+
+		if (post_reply(ctx, p)) {
+			fprintf(stderr, "Couldn't post send\n");
+			goto err;
+		}
+		if (wait_recv(ctx, cq, p->qp, p->buf))
+			goto err;
+
+		if (i >= warmup) {
+			lat[i - warmup] = (now_us() - t) / 2;
+			sum += lat[i - warmup];
+		}
+	}
+
+	qsort(lat, iters, sizeof(*lat), cmp_double);
+
+	if (json)
+		printf("{\"test\":\"lat\",\"device\":\"%s\",\"port\":%d,"
+		       "\"api\":\"%s\",\"size\":%u,\"inline\":%s,"
+		       "\"cq_mod\":%u,\"iters\":%u,\"min_us\":%.3f,"
+		       "\"avg_us\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,"
+		       "\"p999_us\":%.3f,\"max_us\":%.3f}\n",
+		       ibv_get_device_name(ctx->context->device), ib_port,
+		       use_new_send ? "wr" : "post_send", size,
+		       send_flags(ctx) ? "true" : "false", cq_mod, iters,
+		       lat[0], sum / iters, percentile(lat, iters, 0.5),
+		       percentile(lat, iters, 0.99),
+		       percentile(lat, iters, 0.999), lat[iters - 1]);
+	else
+		printf("%8u %6s %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", size,
+		       send_flags(ctx) ? "yes" : "no", lat[0], sum / iters,
+		       percentile(lat, iters, 0.5),
+		       percentile(lat, iters, 0.99),
+		       percentile(lat, iters, 0.999), lat[iters - 1]);
+
+	if (max_p99 && percentile(lat, iters, 0.99) > max_p99)
+		*gate_failed = 1;
+
+	free(lat);
+	return 0;
+
+err:
+	free(lat);
+	return 1;
+}
+
+static void *rate_thread(void *arg)
+{
+	struct bench_thread *t = arg;
+	struct bench_ctx *ctx = t->ctx;
+	struct ibv_wc wc[POLL_BATCH];
+	uint64_t done = 0, total;
+	unsigned i;
+	int ne;
+
+	total = (uint64_t)t->npairs * iters;
+	pthread_barrier_wait(&ctx->barrier);
+
+	while (done < total) {
+		for (i = 0; i < t->npairs; i++) {
+			struct bench_pair *p = t->pairs[i];
+
+			while (p->posted < iters &&
+			       p->posted - p->completed < tx_depth) {
+				unsigned n = min_t(uint64_t, post_list,
+						   min(iters - p->posted,
+						       tx_depth - (p->posted -
+								   p->completed)));
+
+				if (post_list_wrs(ctx, p, n, IBV_WR_RDMA_WRITE,
+						  p->buf, iters)) {
+					fprintf(stderr, "Couldn't post send\n");
+					t->err = 1;
+					goto out;
+				}
+			}
+		}
+
+		ne = ibv_poll_cq(t->cq, POLL_BATCH, wc);
+		if (ne < 0) {
+			fprintf(stderr, "poll CQ failed %d\n", ne);
+			t->err = 1;
+			goto out;
+		}
+		for (i = 0; i < ne; i++) {
+			struct bench_pair *p;
+			uint64_t n = wc[i].wr_id & 0xffffffff;
+
+			if (wc[i].status != IBV_WC_SUCCESS) {
+				fprintf(stderr, "Failed status %s (%d)\n",
+					ibv_wc_status_str(wc[i].status),
+					wc[i].status);
+				t->err = 1;
+				goto out;
+			}
+			p = &ctx->pairs[wc[i].wr_id >> 32];
+			p->completed += n;
+			done += n;
+		}
+	}
+out:
+	return NULL;
+}
+
+static int run_rate(struct bench_ctx *ctx, int *gate_failed)
+{
+	double t0, secs, rate;
+	unsigned i;
+	int err = 0;
+
+	for (i = 0; i < nqps; i++) {
+		ctx->pairs[i].posted = 0;
+		ctx->pairs[i].completed = 0;
+		ctx->pairs[i].last_signaled = 0;
+	}
+
+	if (pthread_barrier_init(&ctx->barrier, NULL, nthreads + 1))
+		return 1;
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&ctx->threads[i].thread, NULL, rate_thread,
+				   &ctx->threads[i])) {
+			fprintf(stderr, "Couldn't create thread\n");
+			exit(1);
+		}
+	pthread_barrier_wait(&ctx->barrier);
+	t0 = now_us();
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(ctx->threads[i].thread, NULL);
+		err |= ctx->threads[i].err;
+	}
+	secs = (now_us() - t0) / 1e6;
+	pthread_barrier_destroy(&ctx->barrier);
+	if (err)
+		return 1;
+
+	rate = (double)nqps * iters / secs;
+	if (json)
+		printf("{\"test\":\"rate\",\"device\":\"%s\",\"port\":%d,"
+		       "\"api\":\"%s\",\"size\":%u,\"inline\":%s,\"qps\":%u,"
+		       "\"threads\":%u,\"post_list\":%u,\"cq_mod\":%u,"
+		       "\"tx_depth\":%u,\"iters\":%u,\"secs\":%.6f,"
+		       "\"msg_rate\":%.0f,\"bw_MBps\":%.2f}\n",
+		       ibv_get_device_name(ctx->context->device), ib_port,
+		       use_new_send ? "wr" : "post_send", size,
+		       send_flags(ctx) ? "true" : "false", nqps, nthreads,
+		       post_list, cq_mod, tx_depth, iters, secs, rate,
+		       rate * size / 1e6);
+	else
+		printf("%8u %6s %12.0f %12.2f %10.3f\n", size,
+		       send_flags(ctx) ? "yes" : "no", rate, rate * size / 1e6,
+		       secs);
+
+	if (min_rate && rate < min_rate)
+		*gate_failed = 1;
+	return 0;
+}
+
+static int parse_sizes(char *arg)
+{
+	char *tok, *save;
+
+	nsizes = 0;
+	for (tok = strtok_r(arg, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		if (nsizes == MAX_SIZES)
+			return 1;
+		sizes[nsizes++] = strtoul(tok, NULL, 0);
+	}
+	return !nsizes;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage:\n");
+	printf("  %s [options]   run a loopback benchmark on one port\n", argv0);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -d, --ib-dev=<dev>      use IB device <dev> (default first device found)\n");
+	printf("  -i, --ib-port=<port>    use port <port> of IB device (default 1)\n");
+	printf("  -g, --gid-idx=<idx>     local port gid index (default 0 on Ethernet)\n");
+	printf("  -m, --mtu=<size>        path MTU (default port active MTU)\n");
+	printf("  -t, --test=<lat|rate>   benchmark to run (default lat)\n");
+	printf("  -s, --size=<list>       comma separated message sizes (default 8)\n");
+	printf("  -n, --iters=<iters>     messages per QP (default 10000)\n");
+	printf("  -w, --warmup=<iters>    lat: unmeasured exchanges first (default 100)\n");
+	printf("  -q, --qps=<num>         rate: number of QP pairs (default 1)\n");
+	printf("  -T, --threads=<num>     rate: number of threads (default 1)\n");
+	printf("  -b, --post-list=<num>   rate: WRs posted per call (default 1)\n");
+	printf("  -c, --cq-mod=<num>      signal every <num>th WR (default 1)\n");
+	printf("  -r, --tx-depth=<num>    send queue depth (default 128)\n");
+	printf("  -I, --inline=<size>     max inline data, smaller messages are sent inline (default 0)\n");
+	printf("  -N, --new_send          use new post send WR API\n");
+	printf("  -J, --json              print one JSON object per result\n");
+	printf("  -P, --max-p99=<usec>    lat: fail if p99 latency is above <usec>\n");
+	printf("  -R, --min-rate=<msgs>   rate: fail if message rate is below <msgs>/s\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct ibv_device      **dev_list;
+	struct ibv_device	*ib_dev;
+	struct bench_ctx	*ctx;
+	char			*ib_devname = NULL;
+	int			 gate_failed = 0;
+	int			 rc = 0;
+	unsigned		 i;
+
+	while (1) {
+		int c;
+
+		static struct option long_options[] = {
+			{ .name = "ib-dev",    .has_arg = 1, .val = 'd' },
+			{ .name = "ib-port",   .has_arg = 1, .val = 'i' },
+			{ .name = "gid-idx",   .has_arg = 1, .val = 'g' },
+			{ .name = "mtu",       .has_arg = 1, .val = 'm' },
+			{ .name = "test",      .has_arg = 1, .val = 't' },
+			{ .name = "size",      .has_arg = 1, .val = 's' },
+			{ .name = "iters",     .has_arg = 1, .val = 'n' },
+			{ .name = "warmup",    .has_arg = 1, .val = 'w' },
+			{ .name = "qps",       .has_arg = 1, .val = 'q' },
+			{ .name = "threads",   .has_arg = 1, .val = 'T' },
+			{ .name = "post-list", .has_arg = 1, .val = 'b' },
+			{ .name = "cq-mod",    .has_arg = 1, .val = 'c' },
+			{ .name = "tx-depth",  .has_arg = 1, .val = 'r' },
+			{ .name = "inline",    .has_arg = 1, .val = 'I' },
+			{ .name = "new_send",  .has_arg = 0, .val = 'N' },
+			{ .name = "json",      .has_arg = 0, .val = 'J' },
+			{ .name = "max-p99",   .has_arg = 1, .val = 'P' },
+			{ .name = "min-rate",  .has_arg = 1, .val = 'R' },
+			{}
+		};
+
+		c = getopt_long(argc, argv, "d:i:g:m:t:s:n:w:q:T:b:c:r:I:NJP:R:",
+				long_options, NULL);
+
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'd':
+			ib_devname = strdupa(optarg);
+			break;
+
+		case 'i':
+			ib_port = strtol(optarg, NULL, 0);
+			if (ib_port < 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+
+		case 'g':
+			gidx = strtol(optarg, NULL, 0);
+			break;
+
+		case 'm':
+			mtu = pp_mtu_to_enum(strtol(optarg, NULL, 0));
+			if (mtu == 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+
+		case 't':
+			if (!strcmp(optarg, "lat"))
+				test = TEST_LAT;
+			else if (!strcmp(optarg, "rate"))
+				test = TEST_RATE;
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+
+		case 's':
+			if (parse_sizes(optarg)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'w':
+			warmup = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'q':
+			nqps = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'T':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'b':
+			post_list = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'c':
+			cq_mod = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'r':
+			tx_depth = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'I':
+			inline_size = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'N':
+			use_new_send = 1;
+			break;
+
+		case 'J':
+			json = 1;
+			break;
+
+		case 'P':
+			max_p99 = strtod(optarg, NULL);
+			break;
+
+		case 'R':
+			min_rate = strtod(optarg, NULL);
+			break;
+
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!iters || !nqps || !nthreads || !post_list || !cq_mod ||
+	    !tx_depth || cq_mod > tx_depth || post_list > tx_depth) {
+		fprintf(stderr, "iters, qps, threads, post-list, cq-mod and "
+			"tx-depth must be positive, cq-mod and post-list at "
+			"most tx-depth\n");
+		return 1;
+	}
+	if (test == TEST_LAT && (nqps > 1 || nthreads > 1)) {
+		fprintf(stderr, "lat uses a single QP pair and thread\n");
+		return 1;
+	}
+	if (nthreads > nqps) {
+		fprintf(stderr, "need at least one QP pair per thread\n");
+		return 1;
+	}
+
+	dev_list = ibv_get_device_list(NULL);
+	if (!dev_list) {
+		perror("Failed to get IB devices list");
+		return 1;
+	}
+
+	if (!ib_devname) {
+		ib_dev = *dev_list;
+		if (!ib_dev) {
+			fprintf(stderr, "No IB devices found\n");
+			return 1;
+		}
+	} else {
+		for (i = 0; dev_list[i]; ++i)
+			if (!strcmp(ibv_get_device_name(dev_list[i]), ib_devname))
+				break;
+		ib_dev = dev_list[i];
+		if (!ib_dev) {
+			fprintf(stderr, "IB device %s not found\n", ib_devname);
+			return 1;
+		}
+	}
+
+	ctx = init_ctx(ib_dev);
+	if (!ctx)
+		return 1;
+
+	if (test == TEST_LAT &&
+	    (post_recv(ctx, ctx->pairs[0].qp, ctx->pairs[0].buf, tx_depth) ||
+	     post_recv(ctx, ctx->pairs[0].rqp, ctx->pairs[0].rbuf, tx_depth))) {
+		fprintf(stderr, "Couldn't post receive\n");
+		return 1;
+	}
+
+	if (!json) {
+		printf("# %s on %s port %d, %s, cq-mod %u, max inline %u\n",
+		       test_str[test], ibv_get_device_name(ib_dev), ib_port,
+		       use_new_send ? "ibv_wr_*" : "ibv_post_send", cq_mod,
+		       ctx->max_inline);
+		if (test == TEST_LAT)
+			printf("#   size inline    min_us    avg_us    p50_us    p99_us   p999_us    max_us\n");
+		else
+			printf("# %u QP pairs, %u threads, post list %u, tx depth %u\n"
+			       "#   size inline     msgs/sec       MB/sec       secs\n",
+			       nqps, nthreads, post_list, tx_depth);
+	}
+
+	for (i = 0; i < nsizes && !rc; i++) {
+		size = sizes[i];
+		if (test == TEST_LAT)
+			rc = run_lat(ctx, &gate_failed);
+		else
+			rc = run_rate(ctx, &gate_failed);
+	}
+
+	close_ctx(ctx);
+	ibv_free_device_list(dev_list);
+
+	if (rc)
+		return 1;
+	return gate_failed ? 2 : 0;
+}
@@ -72,6 +72,12 @@ static inline void fastlock_acquire(fastlock_t *lock)
 	if (atomic_fetch_add(&lock->cnt, 1) > 0)
 		sem_wait(&lock->sem);
 }
+static inline int fastlock_tryacquire(fastlock_t *lock)
+{
+	int cnt = 0;
+
+	return atomic_compare_exchange_strong(&lock->cnt, &cnt, 1);
+}
 static inline void fastlock_release(fastlock_t *lock)
 {
 	if (atomic_fetch_sub(&lock->cnt, 1) > 1)
@@ -78,6 +78,8 @@ static inline int rs_socket(int f, int t, int p)
 	use_rs ? rrecvfrom(s,b,l,f,a,al) : recvfrom(s,b,l,f,a,al)
 #define rs_sendto(s,b,l,f,a,al) \
 	use_rs ? rsendto(s,b,l,f,a,al)   : sendto(s,b,l,f,a,al)
+#define rs_recvmsg(s,m,f)  use_rs ? rrecvmsg(s,m,f)  : recvmsg(s,m,f)
+#define rs_sendmsg(s,m,f)  use_rs ? rsendmsg(s,m,f)  : sendmsg(s,m,f)
 #define rs_poll(f,n,t)	  use_rs ? rpoll(f,n,t)	   : poll(f,n,t)
 #define rs_fcntl(s,c,p)   use_rs ? rfcntl(s,c,p)   : fcntl(s,c,p)
 #define rs_setsockopt(s,l,n,v,ol) \
@@ -0,0 +1,938 @@
+// SPDX-License-Identifier: (GPL-2.0 OR Linux-OpenIB)
+/*
+ * rsocket benchmark.  A client runs one test against an rsbench server and
+ * reports latency percentiles or throughput, optionally as JSON.  With -L
+ * the server runs in the same process, so a single command measures a
+ * loopback path, e.g. over an rxe or siw device.
+ *
+ * The client tells the server what to do in a small hello message, so the
+ * server needs no test options.  The server always serves streams and
+ * echoes datagrams on the same port.
+ *
+ * With -V the bw test cuts every message into that many iovecs on both
+ * sides, to measure rsendmsg/rrecvmsg against plain rsend/rrecv.
+ *
+ * The idle test opens the connections with a short keep-alive time and
+ * leaves them idle, reporting the CPU time the process spent meanwhile.
+ * With rsockets that is the cost of the service threads, which send the
+ * keep-alives and watch the connections, as the connection count grows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/tcp.h>
+
+#include <rdma/rdma_cma.h>
+#include <rdma/rsocket.h>
+#include <util/compiler.h>
+#include <ccan/minmax.h>
+#include "common.h"
+
+enum {
+	TEST_LAT,
+	TEST_BW,
+	TEST_DGRAM,
+	TEST_IOMAP,
+	TEST_IDLE,
+	TEST_MAX
+};
+
+static const char *const test_str[] = {
+	[TEST_LAT]	= "lat",
+	[TEST_BW]	= "bw",
+	[TEST_DGRAM]	= "dgram",
+	[TEST_IOMAP]	= "iomap",
+	[TEST_IDLE]	= "idle",
+};
+
+struct bench_hello {
+	__be32 test;
+	__be32 size;
+	__be32 iters;
+	__be32 iovcnt;
+};
+
+#define MAX_IOV 64
+
+enum sock_state {
+	ST_SEND,	/* lat: message, bw/iomap: whole transfer */
+	ST_RECV,	/* lat: reply */
+	ST_NOTIFY,	/* iomap: tell the server the writes are done */
+	ST_ACK,		/* bw/iomap: wait for the server's ack */
+	ST_DONE,
+};
+
+struct bench_sock {
+	int fd;
+	enum sock_state state;
+	uint64_t offset;
+	uint64_t start;
+	unsigned done;
+	uint64_t *lat;
+	char *buf;
+};
+
+static int test = TEST_LAT;
+static int size = 64;
+static int iters = 10000;
+static int nsock = 1;
+static int iovcnt = 1;
+static int zcopy;
+static int idle_secs = 10;
+static int keepidle = 1;
+static int use_poll = 1;
+static int loopback;
+static int json;
+static double max_p99;
+static double min_gbps;
+static char *dst_addr;
+static char *src_addr;
+static const char *port = "7472";
+static pthread_barrier_t server_ready;
+
+static void set_options(int fd)
+{
+	int val = 1;
+
+	rs_setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *) &val,
+		      sizeof(val));
+	if (use_rs)
+		rsetsockopt(fd, SOL_RDMA, RDMA_IOMAPSIZE, (void *) &val,
+			    sizeof(val));
+}
+
+static int send_all(int fd, const void *buf, size_t len)
+{
+	ssize_t ret;
+	size_t off;
+
+	for (off = 0; off < len; off += ret) {
+		ret = rs_send(fd, (const char *)buf + off, len - off, 0);
+		if (ret <= 0) {
+			perror("rsend");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t len)
+{
+	ssize_t ret;
+	size_t off;
+
+	for (off = 0; off < len; off += ret) {
+		ret = rs_recv(fd, (char *)buf + off, len - off, 0);
+		if (ret <= 0) {
+			if (ret)
+				perror("rrecv");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Describe buf[off, off + len) as it falls in a message of msg_size bytes
+ * cut into cnt equal iovecs.
+ */
+static int build_iov(struct iovec *iov, char *buf, int msg_size, int cnt,
+		     uint64_t off, uint64_t len)
+{
+	uint64_t seg = (msg_size + cnt - 1) / cnt, end = off + len, next;
+	int n;
+
+	for (n = 0; off < end; n++, off = next) {
+		next = min_t(uint64_t, (off / seg + 1) * seg, end);
+		iov[n].iov_base = buf + off;
+		iov[n].iov_len = next - off;
+	}
+	return n;
+}
+
+static ssize_t xfer_iov(int fd, char *buf, int msg_size, int cnt,
+			uint64_t off, uint64_t len, int flags, int send)
+{
+	struct iovec iov[MAX_IOV];
+	struct msghdr msg = {
+		.msg_iov = iov,
+	};
+
+	msg.msg_iovlen = build_iov(iov, buf, msg_size, cnt, off, len);
+	return send ? rs_sendmsg(fd, &msg, flags) : rs_recvmsg(fd, &msg, flags);
+}
+
+static int recv_all_iov(int fd, char *buf, int msg_size, int cnt,
+			uint64_t len)
+{
+	ssize_t ret;
+	uint64_t off;
+
+	for (off = 0; off < len; off += ret) {
+		ret = xfer_iov(fd, buf, msg_size, cnt, off, len - off, 0, 0);
+		if (ret <= 0) {
+			if (ret)
+				perror("rrecvmsg");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Server side
+ */
+static void *serve_stream(void *arg)
+{
+	int fd = (int)(uintptr_t)arg;
+	struct bench_hello hello;
+	uint64_t left, chunk;
+	off_t offset = 0;
+	char *buf = NULL;
+	char ack = 0;
+	int t, sz, n, cnt;
+
+	if (recv_all(fd, &hello, sizeof(hello)))
+		goto out;
+	t = be32toh(hello.test);
+	sz = be32toh(hello.size);
+	n = be32toh(hello.iters);
+	cnt = be32toh(hello.iovcnt);
+	if (t >= TEST_MAX || t == TEST_DGRAM || sz <= 0 || n <= 0 ||
+	    cnt <= 0 || cnt > MAX_IOV || cnt > sz)
+		goto out;
+
+	buf = malloc(sz);
+	if (!buf)
+		goto out;
+
+	if (t == TEST_IOMAP) {
+		offset = riomap(fd, buf, sz, PROT_WRITE, 0, 0);
+		if (offset == -1) {
+			perror("riomap");
+			goto out;
+		}
+	}
+	if (send_all(fd, &ack, 1))
+		goto out;
+
+	switch (t) {
+	case TEST_LAT:
+		while (n--)
+			if (recv_all(fd, buf, sz) || send_all(fd, buf, sz))
+				goto out;
+		break;
+	case TEST_BW:
+		for (left = (uint64_t)sz * n; left; left -= chunk) {
+			chunk = min_t(uint64_t, left, sz);
+			if (cnt > 1 ? recv_all_iov(fd, buf, sz, cnt, chunk) :
+				      recv_all(fd, buf, chunk))
+				goto out;
+		}
+		send_all(fd, &ack, 1);
+		break;
+	case TEST_IOMAP:
+		if (!recv_all(fd, &ack, 1))
+			send_all(fd, &ack, 1);
+		riounmap(fd, buf, sz);
+		break;
+	case TEST_IDLE:
+		/* returns once the client closes the connection */
+		recv_all(fd, &ack, 1);
+		break;
+	}
+out:
+	rs_shutdown(fd, SHUT_RDWR);
+	rs_close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void *serve_dgram(void *arg)
+{
+	int fd = (int)(uintptr_t)arg;
+	union socket_addr addr;
+	socklen_t addrlen;
+	char buf[65536];
+	ssize_t ret;
+
+	for (;;) {
+		addrlen = sizeof(addr);
+		ret = rs_recvfrom(fd, buf, sizeof(buf), 0, &addr.sa, &addrlen);
+		if (ret < 0) {
+			perror("rrecvfrom");
+			break;
+		}
+		rs_sendto(fd, buf, ret, 0, &addr.sa, addrlen);
+	}
+	return NULL;
+}
+
+static int server_socket(struct addrinfo *ai, int type)
+{
+	int fd, val = 1;
+
+	fd = rs_socket(ai->ai_family, type, 0);
+	if (fd < 0)
+		return fd;
+
+	rs_setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+	if (type == SOCK_STREAM)
+		set_options(fd);
+	if (rs_bind(fd, ai->ai_addr, ai->ai_addrlen)) {
+		perror("rbind");
+		goto err;
+	}
+	/* the rs_* macros need parentheses inside an expression */
+	if (type == SOCK_STREAM && (rs_listen(fd, 128))) {
+		perror("rlisten");
+		goto err;
+	}
+	return fd;
+err:
+	rs_close(fd);
+	return -1;
+}
+
+static void *run_server(void *arg)
+{
+	struct addrinfo hints = {
+		.ai_flags = AI_PASSIVE | AI_NUMERICSERV,
+	}, *ai;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int lfd, dfd, fd, ret;
+
+	ret = getaddrinfo(src_addr, port, &hints, &ai);
+	if (ret) {
+		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret));
+		exit(1);
+	}
+
+	lfd = server_socket(ai, SOCK_STREAM);
+	dfd = server_socket(ai, SOCK_DGRAM);
+	freeaddrinfo(ai);
+	if (lfd < 0)
+		exit(1);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (dfd >= 0)
+		pthread_create(&thread, &attr, serve_dgram,
+			       (void *)(uintptr_t)dfd);
+
+	if (loopback)
+		pthread_barrier_wait(&server_ready);
+
+	for (;;) {
+		fd = rs_accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			perror("raccept");
+			break;
+		}
+		set_options(fd);
+		if (pthread_create(&thread, &attr, serve_stream,
+				   (void *)(uintptr_t)fd)) {
+			rs_close(fd);
+			break;
+		}
+	}
+	rs_close(lfd);
+	return NULL;
+}
+
+/*
+ * Client side
+ */
+static uint64_t xfer_len(struct bench_sock *s)
+{
+	return test == TEST_LAT ? size : (uint64_t)size * iters;
+}
+
+/*
+ * Do one send or receive call on s.  Blocking sockets run until the call
+ * completes, non blocking ones return on EAGAIN and are called again when
+ * rpoll reports the socket ready.  Returns -1 on error.
+ */
+static int step(struct bench_sock *s)
+{
+	uint64_t len = xfer_len(s), chunk;
+	int flags = use_poll ? MSG_DONTWAIT : 0;
+	ssize_t ret = 0;
+	char byte = 0;
+
+	switch (s->state) {
+	case ST_SEND:
+		if (test == TEST_LAT && !s->offset)
+			s->start = gettime_ns();
+		/* bw and iomap send the same buffer over and over */
+		chunk = min_t(uint64_t, size - s->offset % size,
+			      len - s->offset);
+		if (test == TEST_IOMAP)
+			ret = riowrite(s->fd, s->buf + s->offset % size, chunk,
+				       s->offset % size, flags);
+		else if (iovcnt > 1)
+			ret = xfer_iov(s->fd, s->buf, size, iovcnt,
+				       s->offset % size, chunk, flags, 1);
+		else
+			ret = rs_send(s->fd, s->buf + s->offset % size, chunk,
+				      flags);
+		if (ret <= 0)
+			break;
+		s->offset += ret;
+		if (s->offset == len) {
+			s->offset = 0;
+			s->state = test == TEST_LAT ? ST_RECV :
+				   test == TEST_IOMAP ? ST_NOTIFY : ST_ACK;
+		}
+		return 0;
+	case ST_RECV:
+		ret = rs_recv(s->fd, s->buf + s->offset, size - s->offset,
+			      flags);
+		if (ret <= 0)
+			break;
+		s->offset += ret;
+		if (s->offset == size) {
+			s->lat[s->done++] = gettime_ns() - s->start;
+			s->offset = 0;
+			s->state = s->done == iters ? ST_DONE : ST_SEND;
+		}
+		return 0;
+	case ST_NOTIFY:
+		ret = rs_send(s->fd, &byte, 1, flags);
+		if (ret <= 0)
+			break;
+		s->state = ST_ACK;
+		return 0;
+	case ST_ACK:
+		ret = rs_recv(s->fd, &byte, 1, flags);
+		if (ret <= 0)
+			break;
+		s->state = ST_DONE;
+		return 0;
+	case ST_DONE:
+		return 0;
+	}
+
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+	if (ret == 0)
+		fprintf(stderr, "connection closed by server\n");
+	else
+		perror(test == TEST_IOMAP && s->state == ST_SEND ?
+		       "riowrite" : "rsend/rrecv");
+	return -1;
+}
+
+static void *run_block(void *arg)
+{
+	struct bench_sock *s = arg;
+
+	while (s->state != ST_DONE)
+		if (step(s))
+			return (void *)1;
+	return NULL;
+}
+
+static int run_poll(struct bench_sock *socks)
+{
+	struct pollfd *fds;
+	int i, n, ret = 0;
+
+	fds = calloc(nsock, sizeof(*fds));
+	if (!fds)
+		return -1;
+
+	for (;;) {
+		for (i = n = 0; i < nsock; i++) {
+			if (socks[i].state == ST_DONE)
+				continue;
+			fds[n].fd = socks[i].fd;
+			fds[n].events = socks[i].state == ST_SEND ||
+					socks[i].state == ST_NOTIFY ?
+					POLLOUT : POLLIN;
+			fds[n].revents = 0;
+			n++;
+		}
+		if (!n)
+			break;
+
+		ret = rs_poll(fds, n, -1);
+		if (ret < 0) {
+			perror("rpoll");
+			break;
+		}
+
+		/* fds[] holds the unfinished sockets in order */
+		for (i = n = 0; i < nsock; i++) {
+			if (socks[i].state == ST_DONE)
+				continue;
+			if (fds[n++].revents && step(&socks[i])) {
+				ret = -1;
+				goto out;
+			}
+		}
+		ret = 0;
+	}
+out:
+	free(fds);
+	return ret;
+}
+
+static int connect_sock(struct bench_sock *s, struct addrinfo *ai)
+{
+	struct bench_hello hello = {
+		.test = htobe32(test),
+		.size = htobe32(size),
+		.iters = htobe32(iters),
+		.iovcnt = htobe32(iovcnt),
+	};
+	char ready;
+
+	s->fd = rs_socket(ai->ai_family, SOCK_STREAM, 0);
+	if (s->fd < 0)
+		return -1;
+	set_options(s->fd);
+	if (rs_connect(s->fd, ai->ai_addr, ai->ai_addrlen)) {
+		perror("rconnect");
+		return -1;
+	}
+	if (send_all(s->fd, &hello, sizeof(hello)) ||
+	    recv_all(s->fd, &ready, 1))
+		return -1;
+	if (zcopy && riomap(s->fd, s->buf, size, PROT_NONE, 0, -1) == -1) {
+		perror("riomap");
+		return -1;
+	}
+	if (use_poll)
+		rs_fcntl(s->fd, F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+static int run_dgram(struct bench_sock *s, struct addrinfo *ai,
+		     unsigned *lost)
+{
+	struct pollfd fds;
+	ssize_t ret;
+
+	s->fd = rs_socket(ai->ai_family, SOCK_DGRAM, 0);
+	if (s->fd < 0)
+		return -1;
+
+	fds.fd = s->fd;
+	fds.events = POLLIN;
+	while (s->done < iters) {
+		s->start = gettime_ns();
+		ret = rs_sendto(s->fd, s->buf, size, 0, ai->ai_addr,
+				ai->ai_addrlen);
+		if (ret != size) {
+			perror("rsendto");
+			return -1;
+		}
+		ret = rs_poll(&fds, 1, 1000);
+		if (ret < 0) {
+			perror("rpoll");
+			return -1;
+		}
+		if (!ret) {
+			(*lost)++;
+			if (*lost > (unsigned)iters / 10 + 10) {
+				fprintf(stderr, "too many lost datagrams\n");
+				return -1;
+			}
+			continue;
+		}
+		ret = rs_recvfrom(s->fd, s->buf, size, 0, NULL, NULL);
+		if (ret != size) {
+			perror("rrecvfrom");
+			return -1;
+		}
+		s->lat[s->done++] = gettime_ns() - s->start;
+	}
+	return 0;
+}
+
+static double cpu_ms(const struct rusage *ru)
+{
+	return ru->ru_utime.tv_sec * 1e3 + ru->ru_utime.tv_usec / 1e3 +
+	       ru->ru_stime.tv_sec * 1e3 + ru->ru_stime.tv_usec / 1e3;
+}
+
+/*
+ * The main thread sleeps, so the CPU time of the process is what the
+ * library (and with -L the server) spent on the idle connections.
+ */
+static int run_idle(struct bench_sock *socks)
+{
+	const char *api = use_rs ? "rsocket" : "socket";
+	struct rusage before, after;
+	uint64_t start, ns;
+	double ms;
+	int i, val = 1;
+
+	for (i = 0; i < nsock; i++) {
+		if ((rs_setsockopt(socks[i].fd, IPPROTO_TCP, TCP_KEEPIDLE,
+				   (void *) &keepidle, sizeof(keepidle))) ||
+		    (rs_setsockopt(socks[i].fd, SOL_SOCKET, SO_KEEPALIVE,
+				   (void *) &val, sizeof(val)))) {
+			perror("rsetsockopt keepalive");
+			return -1;
+		}
+	}
+
+	getrusage(RUSAGE_SELF, &before);
+	start = gettime_ns();
+	sleep(idle_secs);
+	ns = gettime_ns() - start;
+	getrusage(RUSAGE_SELF, &after);
+	ms = cpu_ms(&after) - cpu_ms(&before);
+
+	if (json)
+		printf("{\"test\":\"%s\",\"api\":\"%s\",\"sockets\":%d,"
+		       "\"keepidle\":%d,\"secs\":%.3f,\"cpu_ms\":%.3f,"
+		       "\"cpu_pct\":%.3f,\"us_per_sock_sec\":%.3f}\n",
+		       test_str[test], api, nsock, keepidle, ns / 1e9, ms,
+		       ms * 1e8 / ns, ms * 1e12 / ns / nsock);
+	else
+		printf("%-6s %-7s %7d %8d %8.3f %10.3f %7.3f %14.3f\n",
+		       test_str[test], api, nsock, keepidle, ns / 1e9, ms,
+		       ms * 1e8 / ns, ms * 1e12 / ns / nsock);
+	return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double pct_us(const uint64_t *v, uint64_t n, double p)
+{
+	uint64_t i = p * n;
+
+	return v[i < n ? i : n - 1] / 1000.0;
+}
+
+static int report(struct bench_sock *socks, uint64_t ns, unsigned lost)
+{
+	const char *api = use_rs ? "rsocket" : "socket";
+	const char *mode = use_poll ? "poll" : "block";
+	uint64_t *lat, n = 0, sum = 0;
+	double gbps, p99;
+	int i;
+
+	if (test == TEST_BW || test == TEST_IOMAP) {
+		gbps = (double)size * iters * nsock * 8 / ns;
+		if (json)
+			printf("{\"test\":\"%s\",\"api\":\"%s\",\"mode\":\"%s\","
+			       "\"size\":%d,\"iovcnt\":%d,\"zcopy\":%d,"
+			       "\"sockets\":%d,\"iters\":%d,"
+			       "\"secs\":%.6f,\"msg_rate\":%.0f,"
+			       "\"gbps\":%.3f}\n", test_str[test], api, mode,
+			       size, iovcnt, zcopy, nsock, iters, ns / 1e9,
+			       (double)iters * nsock * 1e9 / ns, gbps);
+		else
+			printf("%-6s %-7s %-5s %8d %6d %7d %8d %10.3f %12.0f %8.3f\n",
+			       test_str[test], api, mode, size, iovcnt, nsock,
+			       iters,
+			       ns / 1e9, (double)iters * nsock * 1e9 / ns,
+			       gbps);
+		return min_gbps && gbps < min_gbps;
+	}
+
+	lat = malloc(sizeof(*lat) * iters * nsock);
+	if (!lat)
+		return -1;
+	for (i = 0; i < nsock; i++) {
+		memcpy(lat + n, socks[i].lat, sizeof(*lat) * socks[i].done);
+		n += socks[i].done;
+	}
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+	qsort(lat, n, sizeof(*lat), cmp_u64);
+
+	/* one way latency, half of the round trip */
+	for (i = 0; i < n; i++)
+		lat[i] /= 2;
+	sum /= 2;
+	p99 = pct_us(lat, n, 0.99);
+
+	if (json)
+		printf("{\"test\":\"%s\",\"api\":\"%s\",\"mode\":\"%s\","
+		       "\"size\":%d,\"sockets\":%d,\"iters\":%d,\"lost\":%u,"
+		       "\"min_us\":%.3f,\"avg_us\":%.3f,\"p50_us\":%.3f,"
+		       "\"p99_us\":%.3f,\"p999_us\":%.3f,\"max_us\":%.3f}\n",
+		       test_str[test], api, mode, size, nsock, iters, lost,
+		       lat[0] / 1000.0, sum / 1000.0 / n, pct_us(lat, n, 0.5),
+		       p99, pct_us(lat, n, 0.999), lat[n - 1] / 1000.0);
+	else
+		printf("%-6s %-7s %-5s %8d %7d %8d %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+		       test_str[test], api, mode, size, nsock, iters,
+		       lat[0] / 1000.0, sum / 1000.0 / n, pct_us(lat, n, 0.5),
+		       p99, pct_us(lat, n, 0.999), lat[n - 1] / 1000.0);
+	free(lat);
+	return max_p99 && p99 > max_p99;
+}
+
+static int run_client(void)
+{
+	struct addrinfo hints = {
+		.ai_flags = AI_NUMERICSERV,
+	}, *ai;
+	struct bench_sock *socks;
+	pthread_t *threads = NULL;
+	unsigned lost = 0;
+	uint64_t start;
+	void *res;
+	int i, ret;
+
+	ret = getaddrinfo(dst_addr, port, &hints, &ai);
+	if (ret) {
+		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret));
+		return -1;
+	}
+
+	socks = calloc(nsock, sizeof(*socks));
+	if (!socks)
+		return -1;
+	for (i = 0; i < nsock; i++) {
+		socks[i].buf = malloc(size);
+		socks[i].lat = calloc(iters, sizeof(*socks[i].lat));
+		if (!socks[i].buf || !socks[i].lat)
+			return -1;
+		format_buf(socks[i].buf, size);
+		socks[i].fd = -1;
+	}
+
+	if (!json) {
+		if (test == TEST_IDLE)
+			printf("%-6s %-7s %7s %8s %8s %10s %7s %14s\n",
+			       "test", "api", "sockets", "keepidle", "secs",
+			       "cpu_ms", "cpu_%", "us/sock/sec");
+		else if (test == TEST_BW || test == TEST_IOMAP)
+			printf("%-6s %-7s %-5s %8s %6s %7s %8s %10s %12s %8s\n",
+			       "test", "api", "mode", "size", "iovcnt", "sockets",
+			       "iters", "secs", "msgs/sec", "Gb/sec");
+		else
+			printf("%-6s %-7s %-5s %8s %7s %8s %9s %9s %9s %9s %9s %9s\n",
+			       "test", "api", "mode", "size", "sockets",
+			       "iters", "min_us", "avg_us", "p50_us", "p99_us",
+			       "p999_us", "max_us");
+	}
+
+	if (test == TEST_DGRAM) {
+		start = gettime_ns();
+		ret = run_dgram(&socks[0], ai, &lost);
+		goto done;
+	}
+
+	for (i = 0; i < nsock; i++) {
+		ret = connect_sock(&socks[i], ai);
+		if (ret)
+			goto out;
+	}
+
+	if (test == TEST_IDLE) {
+		ret = run_idle(socks);
+		goto out;
+	}
+
+	start = gettime_ns();
+	if (use_poll) {
+		ret = run_poll(socks);
+	} else {
+		threads = calloc(nsock, sizeof(*threads));
+		if (!threads) {
+			ret = -1;
+			goto out;
+		}
+		for (i = 0; i < nsock; i++)
+			pthread_create(&threads[i], NULL, run_block, &socks[i]);
+		for (i = 0; i < nsock; i++) {
+			pthread_join(threads[i], &res);
+			if (res)
+				ret = -1;
+		}
+	}
+done:
+	if (!ret)
+		ret = report(socks, gettime_ns() - start, lost);
+out:
+	for (i = 0; i < nsock; i++) {
+		if (socks[i].fd >= 0) {
+			if (test != TEST_DGRAM)
+				rs_shutdown(socks[i].fd, SHUT_RDWR);
+			rs_close(socks[i].fd);
+		}
+		free(socks[i].buf);
+		free(socks[i].lat);
+	}
+	free(threads);
+	free(socks);
+	freeaddrinfo(ai);
+	return ret;
+}
+
+static void usage(const char *argv0)
+{
+	printf("usage: %s\n", argv0);
+	printf("\t[-s server_address]\trun as client, connect to server\n");
+	printf("\t[-b bind_address]\n");
+	printf("\t[-p port_number]\t(default %s)\n", port);
+	printf("\t[-L]\t\t\trun the server in this process, loopback\n");
+	printf("\t[-t test]\t\tlat, bw, dgram, iomap or idle (default lat)\n");
+	printf("\t[-S transfer_size]\t(default 64)\n");
+	printf("\t[-C transfer_count]\tmessages per socket (default 10000)\n");
+	printf("\t[-c sockets]\t\tconcurrent connections (default 1)\n");
+	printf("\t[-V iovcnt]\t\tbw: iovecs per message, 1-%d (default 1)\n",
+	       MAX_IOV);
+	printf("\t[-Z]\t\t\tbw: riomap the send buffer for zero copy\n");
+	printf("\t[-D seconds]\t\tidle: time to stay idle (default 10)\n");
+	printf("\t[-K seconds]\t\tidle: keep-alive time (default 1)\n");
+	printf("\t[-m poll|block]\tnon blocking sockets with rpoll, or blocking\n");
+	printf("\t\t\t\tcalls with one thread per socket (default poll)\n");
+	printf("\t[-T s]\t\t\tuse standard sockets, e.g. with librspreload\n");
+	printf("\t[-J]\t\t\tprint results as JSON\n");
+	printf("\t[-P usec]\t\tfail if p99 latency is above usec\n");
+	printf("\t[-R gbps]\t\tfail if throughput is below gbps\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t server;
+	int op, ret, i;
+
+	while ((op = getopt(argc, argv, "s:b:p:Lt:S:C:c:V:ZD:K:m:T:JP:R:")) != -1) {
+		switch (op) {
+		case 's':
+			dst_addr = optarg;
+			break;
+		case 'b':
+			src_addr = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'L':
+			loopback = 1;
+			break;
+		case 't':
+			for (i = 0; i < TEST_MAX; i++)
+				if (!strcmp(optarg, test_str[i]))
+					break;
+			if (i == TEST_MAX)
+				usage(argv[0]);
+			test = i;
+			break;
+		case 'S':
+			size = atoi(optarg);
+			break;
+		case 'C':
+			iters = atoi(optarg);
+			break;
+		case 'c':
+			nsock = atoi(optarg);
+			break;
+		case 'V':
+			iovcnt = atoi(optarg);
+			break;
+		case 'Z':
+			zcopy = 1;
+			break;
+		case 'D':
+			idle_secs = atoi(optarg);
+			break;
+		case 'K':
+			keepidle = atoi(optarg);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "poll"))
+				use_poll = 1;
+			else if (!strcmp(optarg, "block"))
+				use_poll = 0;
+			else
+				usage(argv[0]);
+			break;
+		case 'T':
+			if (*optarg != 's')
+				usage(argv[0]);
+			use_rs = 0;
+			break;
+		case 'J':
+			json = 1;
+			break;
+		case 'P':
+			max_p99 = atof(optarg);
+			break;
+		case 'R':
+			min_gbps = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (size <= 0 || iters <= 0 || nsock <= 0) {
+		fprintf(stderr, "size, count and sockets must be positive\n");
+		exit(1);
+	}
+	if (test == TEST_IOMAP && !use_rs) {
+		fprintf(stderr, "iomap needs rsockets\n");
+		exit(1);
+	}
+	if (iovcnt < 1 || iovcnt > MAX_IOV || iovcnt > size ||
+	    (iovcnt > 1 && test != TEST_BW)) {
+		fprintf(stderr, "-V takes 1 to %d iovecs, at most the transfer "
+			"size, with the bw test\n", MAX_IOV);
+		exit(1);
+	}
+	if (zcopy && (test != TEST_BW || !use_rs || use_poll)) {
+		fprintf(stderr, "-Z needs the bw test over blocking rsockets\n");
+		exit(1);
+	}
+	if (idle_secs <= 0 || keepidle <= 0) {
+		fprintf(stderr, "idle and keep-alive times must be positive\n");
+		exit(1);
+	}
+	if (test == TEST_DGRAM && nsock > 1) {
+		fprintf(stderr, "dgram uses a single socket\n");
+		exit(1);
+	}
+
+	if (!dst_addr) {
+		if (loopback)
+			usage(argv[0]);
+		run_server(NULL);
+		return 1;
+	}
+
+	if (loopback) {
+		if (!src_addr)
+			src_addr = dst_addr;
+		pthread_barrier_init(&server_ready, NULL, 2);
+		if (pthread_create(&server, NULL, run_server, NULL)) {
+			perror("pthread_create");
+			exit(1);
+		}
+		pthread_barrier_wait(&server_ready);
+	}
+
+	ret = run_client();
+	if (ret < 0)
+		return 1;
+	return ret ? 2 : 0;
+}
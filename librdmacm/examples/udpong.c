@@ -92,6 +92,8 @@ static int echo;
 static int transfer_size = 1000;
 static int transfer_count = 1000;
 static int buffer_size;
+static int qp_count;
+static int num_clients = 1;
 static char test_name[10] = "custom";
 static const char *port = "7174";
 static char *dst_addr;
@@ -162,6 +164,10 @@ static void set_options(int fd)
 		rs_setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (void *) &val, sizeof val);
 	}
 
+	if (qp_count && use_rs)
+		rsetsockopt(fd, SOL_RDMA, RDMA_DGRAM_QPS, (void *) &qp_count,
+			    sizeof qp_count);
+
 	if (flags & MSG_DONTWAIT)
 		rs_fcntl(fd, F_SETFL, O_NONBLOCK);
 }
@@ -445,9 +451,6 @@ static int client_run(void)
 {
 	int i, ret;
 
-	printf("%-10s%-8s%-8s%-8s%8s %10s%13s\n",
-	       "name", "bytes", "xfers", "total", "time", "Gb/sec", "usec/xfer");
-
 	ret = client_connect();
 	if (ret)
 		return ret;
@@ -469,6 +472,39 @@ static int client_run(void)
 	return ret;
 }
 
+/*
+ * Run num_clients clients in parallel, each in its own process with its own
+ * socket, to load a server with traffic from many peers.
+ */
+static int clients_run(void)
+{
+	int i, status, ret = 0;
+	pid_t pid;
+
+	printf("%-10s%-8s%-8s%-8s%8s %10s%13s\n",
+	       "name", "bytes", "xfers", "total", "time", "Gb/sec", "usec/xfer");
+	if (num_clients == 1)
+		return client_run();
+
+	fflush(stdout);
+	for (i = 0; i < num_clients; i++) {
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			ret = -1;
+			break;
+		}
+		if (!pid)
+			exit(client_run() ? 1 : 0);
+	}
+
+	while (wait(&status) > 0) {
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			ret = -1;
+	}
+	return ret;
+}
+
 static int set_test_opt(const char *arg)
 {
 	if (strlen(arg) == 1) {
@@ -513,7 +549,7 @@ int main(int argc, char **argv)
 {
 	int op, ret;
 
-	while ((op = getopt(argc, argv, "s:b:B:C:S:p:T:")) != -1) {
+	while ((op = getopt(argc, argv, "s:b:B:C:S:p:Q:c:T:")) != -1) {
 		switch (op) {
 		case 's':
 			dst_addr = optarg;
@@ -540,6 +576,16 @@ int main(int argc, char **argv)
 		case 'p':
 			port = optarg;
 			break;
+		case 'Q':
+			qp_count = atoi(optarg);
+			break;
+		case 'c':
+			num_clients = atoi(optarg);
+			if (num_clients < 1 || num_clients > 256) {
+				printf("clients must be 1 to 256\n");
+				exit(1);
+			}
+			break;
 		case 'T':
 			if (!set_test_opt(optarg))
 				break;
@@ -553,6 +599,8 @@ int main(int argc, char **argv)
 			printf("\t[-C transfer_count]\n");
 			printf("\t[-S transfer_size]\n");
 			printf("\t[-p port_number]\n");
+			printf("\t[-Q qps_per_address]\n");
+			printf("\t[-c clients]\n");
 			printf("\t[-T test_option]\n");
 			printf("\t    s|sockets - use standard tcp/ip sockets\n");
 			printf("\t    a|async - asynchronous operation (use poll)\n");
@@ -566,6 +614,6 @@ int main(int argc, char **argv)
 	if (flags)
 		poll_timeout = -1;
 
-	ret = dst_addr ? client_run() : svr_run();
+	ret = dst_addr ? clients_run() : svr_run();
 	return ret;
 }
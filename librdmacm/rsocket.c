@@ -66,6 +66,9 @@
 #define RS_QP_MIN_SIZE 16
 #define RS_QP_MAX_SIZE 0xFFFE
 #define RS_QP_CTRL_SIZE 4	/* must be power of 2 */
+#define RS_MAX_SGE 8
+#define DS_MAX_QPS 16
+#define DS_POLL_BATCH 16
 #define RS_CONN_RETRIES 6
 #define RS_SGL_SIZE 2
 static struct index_map idm;
@@ -91,36 +94,53 @@ struct rs_svc_msg {
 	struct rsocket *rs;
 };
 
+/*
+ * The udp and cm services wait on their sockets with epoll, so adding or
+ * removing an rsocket is a single epoll_ctl call no matter how many are
+ * being serviced.  The keep-alive service keeps its rsockets on a timer
+ * wheel instead of scanning every deadline on each wakeup.
+ */
 struct rs_svc {
 	pthread_t id;
 	int sock[2];
 	int cnt;
-	int size;
-	int context_size;
+	int epfd;
 	void *(*run)(void *svc);
-	struct rsocket **rss;
-	void *contexts;
 };
 
-static struct pollfd *udp_svc_fds;
+#define RS_SVC_EVENTS	64
+
+/*
+ * Hierarchical timer wheel with 1 second ticks.  Level 0 holds the next
+ * 64 seconds, each higher level covers 64 times the span of the previous
+ * one and is cascaded down when the lower level wraps.  Four levels reach
+ * about 194 days, longer keep-alive times are clamped to that.
+ */
+#define RS_TW_BITS	6
+#define RS_TW_SLOTS	(1 << RS_TW_BITS)
+#define RS_TW_MASK	(RS_TW_SLOTS - 1)
+#define RS_TW_LEVELS	4
+#define RS_TW_MAX	((1ULL << (RS_TW_BITS * RS_TW_LEVELS)) - 1)
+
+struct rs_timer_wheel {
+	uint64_t	now;
+	dlist_entry	slot[RS_TW_LEVELS][RS_TW_SLOTS];
+};
+
 static void *udp_svc_run(void *arg);
 static struct rs_svc udp_svc = {
-	.context_size = sizeof(*udp_svc_fds),
 	.run = udp_svc_run
 };
-static uint64_t *tcp_svc_timeouts;
+static struct rs_timer_wheel tcp_svc_wheel;
 static void *tcp_svc_run(void *arg);
 static struct rs_svc tcp_svc = {
-	.context_size = sizeof(*tcp_svc_timeouts),
 	.run = tcp_svc_run
 };
 static void *cm_svc_run(void *arg);
 static struct rs_svc listen_svc = {
-	.context_size = sizeof(struct pollfd),
 	.run = cm_svc_run
 };
 static struct rs_svc connect_svc = {
-	.context_size = sizeof(struct pollfd),
 	.run = cm_svc_run
 };
 
@@ -314,6 +334,7 @@ struct ds_qp {
 	uint8_t		  *rbuf;
 
 	int		  cq_armed;
+	int		  index;	/* among the QPs of one source address */
 };
 
 struct rsocket {
@@ -321,7 +342,8 @@ struct rsocket {
 	int		  index;
 	fastlock_t	  slock;
 	fastlock_t	  rlock;
-	fastlock_t	  cq_lock;
+	fastlock_t	  cq_lock;	/* recv CQ, credits, state, ctrl_max_seqno */
+	fastlock_t	  scq_lock;	/* send CQ of stream sockets */
 	fastlock_t	  cq_wait_lock;
 	fastlock_t	  map_lock; /* acquire slock first if needed */
 
@@ -331,6 +353,8 @@ struct rsocket {
 			struct rdma_cm_id *cm_id;
 			uint64_t	  tcp_opts;
 			unsigned int	  keepalive_time;
+			uint64_t	  keepalive_expire;
+			dlist_entry	  keepalive_entry;
 			int		  accept_queue[2];
 
 			unsigned int	  ctrl_seqno;
@@ -370,6 +394,7 @@ struct rsocket {
 
 			int		  udp_sock;
 			int		  epfd;
+			int		  qp_count;	/* per source address */
 			int		  rqe_avail;
 			struct ds_smsg	  *smsg_free;
 		};
@@ -390,6 +415,7 @@ struct rsocket {
 	uint32_t	  sbuf_size;
 	uint16_t	  sq_size;
 	uint16_t	  sq_inline;
+	uint16_t	  sq_sge;
 
 	uint32_t	  rbuf_size;
 	uint16_t	  rq_size;
@@ -406,6 +432,7 @@ struct rsocket {
 	dlist_entry	  iomap_queue;
 	int		  iomap_pending;
 	int		  unack_cqe;
+	int		  unack_scqe;
 };
 
 #define DS_UDP_TAG 0x55555555
@@ -682,6 +709,7 @@ static struct rsocket *rs_alloc(struct rsocket *inherited_rs, int type)
 	fastlock_init(&rs->slock);
 	fastlock_init(&rs->rlock);
 	fastlock_init(&rs->cq_lock);
+	fastlock_init(&rs->scq_lock);
 	fastlock_init(&rs->cq_wait_lock);
 	fastlock_init(&rs->map_lock);
 	dlist_init(&rs->iomap_list);
@@ -834,28 +862,50 @@ static int ds_init_bufs(struct ds_qp *qp)
  * If a user is waiting on a datagram rsocket through poll or select, then
  * we need the first completion to generate an event on the related epoll fd
  * in order to signal the user.  We arm the CQ on creation for this purpose
+ *
+ * Stream sockets use separate send and receive CQs, so that rsend and rrecv
+ * can process their completions without serializing on a single CQ.  Both
+ * CQs share one completion channel, which keeps a single fd to wait on.
  */
 static int rs_create_cq(struct rsocket *rs, struct rdma_cm_id *cm_id)
 {
+	int recv_size;
+
 	cm_id->recv_cq_channel = ibv_create_comp_channel(cm_id->verbs);
 	if (!cm_id->recv_cq_channel)
 		return -1;
 
-	cm_id->recv_cq = ibv_create_cq(cm_id->verbs, rs->sq_size + rs->rq_size,
+	recv_size = (rs->type == SOCK_STREAM) ? rs->rq_size :
+						rs->sq_size + rs->rq_size;
+	cm_id->recv_cq = ibv_create_cq(cm_id->verbs, recv_size,
 				       cm_id, cm_id->recv_cq_channel, 0);
 	if (!cm_id->recv_cq)
 		goto err1;
 
+	if (rs->type == SOCK_STREAM) {
+		cm_id->send_cq = ibv_create_cq(cm_id->verbs, rs->sq_size,
+					       cm_id, cm_id->recv_cq_channel, 0);
+		if (!cm_id->send_cq)
+			goto err2;
+	} else {
+		cm_id->send_cq = cm_id->recv_cq;
+	}
+
 	if (rs->fd_flags & O_NONBLOCK) {
 		if (set_fd_nonblock(cm_id->recv_cq_channel->fd, true))
-			goto err2;
+			goto err3;
 	}
 
 	ibv_req_notify_cq(cm_id->recv_cq, 0);
+	if (cm_id->send_cq != cm_id->recv_cq)
+		ibv_req_notify_cq(cm_id->send_cq, 0);
 	cm_id->send_cq_channel = cm_id->recv_cq_channel;
-	cm_id->send_cq = cm_id->recv_cq;
 	return 0;
 
+err3:
+	if (cm_id->send_cq != cm_id->recv_cq)
+		ibv_destroy_cq(cm_id->send_cq);
+	cm_id->send_cq = NULL;
 err2:
 	ibv_destroy_cq(cm_id->recv_cq);
 	cm_id->recv_cq = NULL;
@@ -914,6 +964,7 @@ static inline int ds_post_recv(struct rsocket *rs, struct ds_qp *qp, uint32_t of
 static int rs_create_ep(struct rsocket *rs)
 {
 	struct ibv_qp_init_attr qp_attr;
+	struct ibv_device_attr dev_attr;
 	int i, ret;
 
 	rs_set_qp_size(rs);
@@ -927,6 +978,12 @@ static int rs_create_ep(struct rsocket *rs)
 	if (ret)
 		return ret;
 
+	/* rsendv gathers straight from the user's iovecs when it can */
+	rs->sq_sge = 2;
+	if (!ibv_query_device(rs->cm_id->verbs, &dev_attr) &&
+	    dev_attr.max_sge > rs->sq_sge)
+		rs->sq_sge = min_t(int, dev_attr.max_sge, RS_MAX_SGE);
+
 	memset(&qp_attr, 0, sizeof qp_attr);
 	qp_attr.qp_context = rs;
 	qp_attr.send_cq = rs->cm_id->send_cq;
@@ -935,7 +992,7 @@ static int rs_create_ep(struct rsocket *rs)
 	qp_attr.sq_sig_all = 1;
 	qp_attr.cap.max_send_wr = rs->sq_size;
 	qp_attr.cap.max_recv_wr = rs->rq_size;
-	qp_attr.cap.max_send_sge = 2;
+	qp_attr.cap.max_send_sge = rs->sq_sge;
 	qp_attr.cap.max_recv_sge = 1;
 	qp_attr.cap.max_inline_data = rs->sq_inline;
 
@@ -959,12 +1016,12 @@ static int rs_create_ep(struct rsocket *rs)
 	return 0;
 }
 
+/* Caller holds map_lock, the mapping is no longer on a list when unused */
 static void rs_release_iomap_mr(struct rs_iomap_mr *iomr)
 {
 	if (atomic_fetch_sub(&iomr->refcnt, 1) != 1)
 		return;
 
-	dlist_remove(&iomr->entry);
 	ibv_dereg_mr(iomr->mr);
 	if (iomr->index >= 0)
 		iomr->mr = NULL;
@@ -1001,7 +1058,9 @@ static void ds_free_qp(struct ds_qp *qp)
 
 	if (qp->cm_id) {
 		if (qp->cm_id->qp) {
-			tdelete(&qp->dest.addr, &qp->rs->dest_map, ds_compare_addr);
+			if (!qp->index)
+				tdelete(&qp->dest.addr, &qp->rs->dest_map,
+					ds_compare_addr);
 			epoll_ctl(qp->rs->epfd, EPOLL_CTL_DEL,
 				  qp->cm_id->recv_cq_channel->fd, NULL);
 			rdma_destroy_qp(qp->cm_id);
@@ -1039,6 +1098,7 @@ static void ds_free(struct rsocket *rs)
 	tdestroy(rs->dest_map, free);
 	fastlock_destroy(&rs->map_lock);
 	fastlock_destroy(&rs->cq_wait_lock);
+	fastlock_destroy(&rs->scq_lock);
 	fastlock_destroy(&rs->cq_lock);
 	fastlock_destroy(&rs->rlock);
 	fastlock_destroy(&rs->slock);
@@ -1080,6 +1140,9 @@ static void rs_free(struct rsocket *rs)
 		rs_free_iomappings(rs);
 		if (rs->cm_id->qp) {
 			ibv_ack_cq_events(rs->cm_id->recv_cq, rs->unack_cqe);
+			if (rs->cm_id->send_cq != rs->cm_id->recv_cq)
+				ibv_ack_cq_events(rs->cm_id->send_cq,
+						  rs->unack_scqe);
 			rdma_destroy_qp(rs->cm_id);
 		}
 		rdma_destroy_id(rs->cm_id);
@@ -1092,6 +1155,7 @@ static void rs_free(struct rsocket *rs)
 
 	fastlock_destroy(&rs->map_lock);
 	fastlock_destroy(&rs->cq_wait_lock);
+	fastlock_destroy(&rs->scq_lock);
 	fastlock_destroy(&rs->cq_lock);
 	fastlock_destroy(&rs->rlock);
 	fastlock_destroy(&rs->slock);
@@ -1580,16 +1644,23 @@ static int ds_add_qp_dest(struct ds_qp *qp, union socket_addr *addr,
 	if (!qp->dest.ah)
 		return ERR(ENOMEM);
 
-	tsearch(&qp->dest.addr, &qp->rs->dest_map, ds_compare_addr);
+	if (!qp->index)
+		tsearch(&qp->dest.addr, &qp->rs->dest_map, ds_compare_addr);
 	return 0;
 }
 
+/*
+ * The first QP of a source address is bound to the rsocket's port.  Any
+ * further QPs bind to an ephemeral port, since the port they carry in the
+ * datagram header is taken from src_addr anyway.
+ */
 static int ds_create_qp(struct rsocket *rs, union socket_addr *src_addr,
-			socklen_t addrlen, struct ds_qp **new_qp)
+			socklen_t addrlen, int index, struct ds_qp **new_qp)
 {
 	struct ds_qp *qp;
 	struct ibv_qp_init_attr qp_attr;
 	struct epoll_event event;
+	union socket_addr bind_addr;
 	int i, ret;
 
 	qp = calloc(1, sizeof(*qp));
@@ -1597,12 +1668,20 @@ static int ds_create_qp(struct rsocket *rs, union socket_addr *src_addr,
 		return ERR(ENOMEM);
 
 	qp->rs = rs;
+	qp->index = index;
 	ret = rdma_create_id(NULL, &qp->cm_id, qp, RDMA_PS_UDP);
 	if (ret)
 		goto err;
 
 	ds_format_hdr(&qp->hdr, src_addr);
-	ret = rdma_bind_addr(qp->cm_id, &src_addr->sa);
+	memcpy(&bind_addr, src_addr, addrlen);
+	if (index) {
+		if (bind_addr.sa.sa_family == AF_INET)
+			bind_addr.sin.sin_port = 0;
+		else
+			bind_addr.sin6.sin6_port = 0;
+	}
+	ret = rdma_bind_addr(qp->cm_id, &bind_addr.sa);
 	if (ret)
 		goto err;
 
@@ -1655,21 +1734,57 @@ err:
 	return ret;
 }
 
+/*
+ * With RDMA_DGRAM_QPS set, destinations are spread over several QPs per
+ * source address by a hash of their address, so that traffic to many peers
+ * is not limited by a single QP.  A destination always maps to the same QP,
+ * which is the QP the peer learns to reply to.
+ */
+static int ds_qp_index(struct rsocket *rs, const struct sockaddr *addr)
+{
+	const struct sockaddr_in *sin = (const struct sockaddr_in *) addr;
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) addr;
+	const uint8_t *key;
+	uint32_t hash = 2166136261U;
+	int i, len;
+
+	if (rs->qp_count <= 1)
+		return 0;
+
+	if (addr->sa_family == AF_INET) {
+		key = (const uint8_t *) &sin->sin_addr;
+		len = sizeof(sin->sin_addr);
+		hash ^= sin->sin_port;
+	} else {
+		key = (const uint8_t *) &sin6->sin6_addr;
+		len = sizeof(sin6->sin6_addr);
+		hash ^= sin6->sin6_port;
+	}
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++)
+		hash = (hash ^ key[i]) * 16777619;
+	return hash % rs->qp_count;
+}
+
 static int ds_get_qp(struct rsocket *rs, union socket_addr *src_addr,
-		     socklen_t addrlen, struct ds_qp **qp)
+		     socklen_t addrlen, const struct sockaddr *dest_addr,
+		     struct ds_qp **qp)
 {
+	int index = ds_qp_index(rs, dest_addr);
+
 	if (rs->qp_list) {
 		*qp = rs->qp_list;
 		do {
-			if (!ds_compare_addr(rdma_get_local_addr((*qp)->cm_id),
-					     src_addr))
+			if ((*qp)->index == index &&
+			    !ds_compare_addr(&(*qp)->dest.addr, src_addr))
 				return 0;
 
 			*qp = ds_next_qp(*qp);
 		} while (*qp != rs->qp_list);
 	}
 
-	return ds_create_qp(rs, src_addr, addrlen, qp);
+	return ds_create_qp(rs, src_addr, addrlen, index, qp);
 }
 
 static int ds_get_dest(struct rsocket *rs, const struct sockaddr *addr,
@@ -1690,7 +1805,7 @@ static int ds_get_dest(struct rsocket *rs, const struct sockaddr *addr,
 	if (ret)
 		goto out;
 
-	ret = ds_get_qp(rs, &src_addr, src_len, &qp);
+	ret = ds_get_qp(rs, &src_addr, src_len, addr, &qp);
 	if (ret)
 		goto out;
 
@@ -2004,79 +2119,53 @@ static void rs_update_credits(struct rsocket *rs)
 		rs_send_credits(rs);
 }
 
-static int rs_poll_cq(struct rsocket *rs)
+static int rs_poll_recv_cq(struct rsocket *rs)
 {
 	struct ibv_wc wc;
 	uint32_t msg;
 	int ret, rcnt = 0;
 
 	while ((ret = ibv_poll_cq(rs->cm_id->recv_cq, 1, &wc)) > 0) {
-		if (rs_wr_is_recv(wc.wr_id)) {
-			if (wc.status != IBV_WC_SUCCESS)
-				continue;
-			rcnt++;
+		if (wc.status != IBV_WC_SUCCESS)
+			continue;
+		rcnt++;
 
-			if (wc.wc_flags & IBV_WC_WITH_IMM) {
-				msg = be32toh(wc.imm_data);
-			} else {
-				msg = ((uint32_t *) (rs->rbuf + rs->rbuf_size))
-					[rs_wr_data(wc.wr_id)];
+		if (wc.wc_flags & IBV_WC_WITH_IMM) {
+			msg = be32toh(wc.imm_data);
+		} else {
+			msg = ((uint32_t *) (rs->rbuf + rs->rbuf_size))
+				[rs_wr_data(wc.wr_id)];
 
-			}
-			switch (rs_msg_op(msg)) {
-			case RS_OP_SGL:
-				rs->sseq_comp = (uint16_t) rs_msg_data(msg);
-				break;
-			case RS_OP_IOMAP_SGL:
-				/* The iomap was updated, that's nice to know. */
-				break;
-			case RS_OP_CTRL:
-				if (rs_msg_data(msg) == RS_CTRL_DISCONNECT) {
+		}
+		switch (rs_msg_op(msg)) {
+		case RS_OP_SGL:
+			rs->sseq_comp = (uint16_t) rs_msg_data(msg);
+			break;
+		case RS_OP_IOMAP_SGL:
+			/* The iomap was updated, that's nice to know. */
+			break;
+		case RS_OP_CTRL:
+			if (rs_msg_data(msg) == RS_CTRL_DISCONNECT) {
+				rs->state = rs_disconnected;
+				return 0;
+			} else if (rs_msg_data(msg) == RS_CTRL_SHUTDOWN) {
+				if (rs->state & rs_writable) {
+					rs->state &= ~rs_readable;
+				} else {
 					rs->state = rs_disconnected;
 					return 0;
-				} else if (rs_msg_data(msg) == RS_CTRL_SHUTDOWN) {
-					if (rs->state & rs_writable) {
-						rs->state &= ~rs_readable;
-					} else {
-						rs->state = rs_disconnected;
-						return 0;
-					}
 				}
-				break;
-			case RS_OP_WRITE:
-				/* We really shouldn't be here. */
-				break;
-			default:
-				rs->rmsg[rs->rmsg_tail].op = rs_msg_op(msg);
-				rs->rmsg[rs->rmsg_tail].data = rs_msg_data(msg);
-				if (++rs->rmsg_tail == rs->rq_size + 1)
-					rs->rmsg_tail = 0;
-				break;
-			}
-		} else {
-			switch  (rs_msg_op(rs_wr_data(wc.wr_id))) {
-			case RS_OP_SGL:
-				rs->ctrl_max_seqno++;
-				break;
-			case RS_OP_CTRL:
-				rs->ctrl_max_seqno++;
-				if (rs_msg_data(rs_wr_data(wc.wr_id)) == RS_CTRL_DISCONNECT)
-					rs->state = rs_disconnected;
-				break;
-			case RS_OP_IOMAP_SGL:
-				rs->sqe_avail++;
-				if (!rs_wr_is_msg_send(wc.wr_id))
-					rs->sbuf_bytes_avail += sizeof(struct rs_iomap);
-				break;
-			default:
-				rs->sqe_avail++;
-				rs->sbuf_bytes_avail += rs_msg_data(rs_wr_data(wc.wr_id));
-				break;
-			}
-			if (wc.status != IBV_WC_SUCCESS && (rs->state & rs_connected)) {
-				rs->state = rs_error;
-				rs->err = EIO;
 			}
+			break;
+		case RS_OP_WRITE:
+			/* We really shouldn't be here. */
+			break;
+		default:
+			rs->rmsg[rs->rmsg_tail].op = rs_msg_op(msg);
+			rs->rmsg[rs->rmsg_tail].data = rs_msg_data(msg);
+			if (++rs->rmsg_tail == rs->rq_size + 1)
+				rs->rmsg_tail = 0;
+			break;
 		}
 	}
 
@@ -2092,6 +2181,93 @@ static int rs_poll_cq(struct rsocket *rs)
 	return ret;
 }
 
+/*
+ * Send completions that change the connection state or return control
+ * messages, which the receive side reads, are only applied under cq_lock.
+ */
+struct rs_scq_update {
+	unsigned int	ctrl_comp;
+	int		disconnected;
+	int		err;
+};
+
+static int rs_poll_send_cq(struct rsocket *rs, struct rs_scq_update *update)
+{
+	struct ibv_wc wc;
+	int ret;
+
+	while ((ret = ibv_poll_cq(rs->cm_id->send_cq, 1, &wc)) > 0) {
+		switch  (rs_msg_op(rs_wr_data(wc.wr_id))) {
+		case RS_OP_SGL:
+			update->ctrl_comp++;
+			break;
+		case RS_OP_CTRL:
+			update->ctrl_comp++;
+			if (rs_msg_data(rs_wr_data(wc.wr_id)) == RS_CTRL_DISCONNECT)
+				update->disconnected = 1;
+			break;
+		case RS_OP_IOMAP_SGL:
+			rs->sqe_avail++;
+			if (!rs_wr_is_msg_send(wc.wr_id))
+				rs->sbuf_bytes_avail += sizeof(struct rs_iomap);
+			break;
+		default:
+			rs->sqe_avail++;
+			rs->sbuf_bytes_avail += rs_msg_data(rs_wr_data(wc.wr_id));
+			break;
+		}
+		if (wc.status != IBV_WC_SUCCESS && !update->disconnected)
+			update->err = EIO;
+	}
+
+	if (ret && !update->disconnected)
+		update->err = EIO;
+	return ret;
+}
+
+/* Caller holds cq_lock */
+static void rs_apply_scq_update(struct rsocket *rs,
+				struct rs_scq_update *update)
+{
+	rs->ctrl_max_seqno += update->ctrl_comp;
+	if (update->disconnected) {
+		rs->state = rs_disconnected;
+	} else if (update->err && (rs->state & rs_connected)) {
+		rs->state = rs_error;
+		rs->err = update->err;
+	}
+}
+
+/*
+ * Send completions only return send resources.  The receive path needs
+ * them just to free control messages for credit updates, so it skips the
+ * send CQ if another thread is already processing it.  That thread always
+ * goes on to poll the receive CQ and update credits afterwards.
+ */
+static int rs_poll_cqs(struct rsocket *rs, int need_send)
+{
+	struct rs_scq_update update = {};
+	int ret = 0;
+
+	if (need_send) {
+		fastlock_acquire(&rs->scq_lock);
+		ret = rs_poll_send_cq(rs, &update);
+		fastlock_release(&rs->scq_lock);
+	} else if (fastlock_tryacquire(&rs->scq_lock)) {
+		ret = rs_poll_send_cq(rs, &update);
+		fastlock_release(&rs->scq_lock);
+	}
+
+	fastlock_acquire(&rs->cq_lock);
+	rs_apply_scq_update(rs, &update);
+	rs_update_credits(rs);
+	if (!ret)
+		ret = rs_poll_recv_cq(rs);
+	rs_update_credits(rs);
+	fastlock_release(&rs->cq_lock);
+	return ret;
+}
+
 static int rs_get_cq_event(struct rsocket *rs)
 {
 	struct ibv_cq *cq;
@@ -2103,9 +2279,14 @@ static int rs_get_cq_event(struct rsocket *rs)
 
 	ret = ibv_get_cq_event(rs->cm_id->recv_cq_channel, &cq, &context);
 	if (!ret) {
-		if (++rs->unack_cqe >= rs->sq_size + rs->rq_size) {
-			ibv_ack_cq_events(rs->cm_id->recv_cq, rs->unack_cqe);
-			rs->unack_cqe = 0;
+		if (cq == rs->cm_id->recv_cq) {
+			if (++rs->unack_cqe >= rs->sq_size + rs->rq_size) {
+				ibv_ack_cq_events(cq, rs->unack_cqe);
+				rs->unack_cqe = 0;
+			}
+		} else if (++rs->unack_scqe >= rs->sq_size + rs->rq_size) {
+			ibv_ack_cq_events(cq, rs->unack_scqe);
+			rs->unack_scqe = 0;
 		}
 		rs->cq_armed = 0;
 	} else if (!(errno == EAGAIN || errno == EINTR)) {
@@ -2115,28 +2296,37 @@ static int rs_get_cq_event(struct rsocket *rs)
 	return ret;
 }
 
+static int rs_conn_have_rdata(struct rsocket *rs);
+
 /*
  * Although we serialize rsend and rrecv calls with respect to themselves,
- * both calls may run simultaneously and need to poll the CQ for completions.
- * We need to serialize access to the CQ, but rsend and rrecv need to
+ * both calls may run simultaneously and need to poll the CQs for completions.
+ * We need to serialize access to each CQ, but rsend and rrecv need to
  * allow each other to make forward progress.
  *
  * For example, rsend may need to wait for credits from the remote side,
  * which could be stalled until the remote process calls rrecv.  This should
  * not block rrecv from receiving data from the remote side however.
  *
- * We handle this by using two locks.  The cq_lock protects against polling
- * the CQ and processing completions.  The cq_wait_lock serializes access to
- * waiting on the CQ.
+ * We handle this by using three locks.  The cq_lock protects against polling
+ * the receive CQ, processing its completions and updating credits.  The
+ * scq_lock does the same for the send CQ.  The cq_wait_lock serializes
+ * arming and waiting on the completion channel shared by both CQs.  None
+ * of the locks is held while acquiring another, so rsend reaping its send
+ * completions never waits on rrecv reaping receives and vice versa.
+ *
+ * The completion handlers only change the connection state and
+ * ctrl_max_seqno under cq_lock, as the credit updates read both.  Send
+ * completions are reaped under scq_lock into a struct rs_scq_update and
+ * applied once cq_lock is taken.  Only the send side uses the send queue
+ * and buffer accounting, which send completions return under scq_lock.
  */
 static int rs_process_cq(struct rsocket *rs, int nonblock, int (*test)(struct rsocket *rs))
 {
 	int ret;
 
-	fastlock_acquire(&rs->cq_lock);
 	do {
-		rs_update_credits(rs);
-		ret = rs_poll_cq(rs);
+		ret = rs_poll_cqs(rs, test != rs_conn_have_rdata);
 		if (test(rs)) {
 			ret = 0;
 			break;
@@ -2144,22 +2334,19 @@ static int rs_process_cq(struct rsocket *rs, int nonblock, int (*test)(struct rs
 			break;
 		} else if (nonblock) {
 			ret = ERR(EWOULDBLOCK);
-		} else if (!rs->cq_armed) {
-			ibv_req_notify_cq(rs->cm_id->recv_cq, 0);
-			rs->cq_armed = 1;
 		} else {
-			rs_update_credits(rs);
 			fastlock_acquire(&rs->cq_wait_lock);
-			fastlock_release(&rs->cq_lock);
-
-			ret = rs_get_cq_event(rs);
+			if (!rs->cq_armed) {
+				ibv_req_notify_cq(rs->cm_id->recv_cq, 0);
+				ibv_req_notify_cq(rs->cm_id->send_cq, 0);
+				rs->cq_armed = 1;
+			} else {
+				ret = rs_get_cq_event(rs);
+			}
 			fastlock_release(&rs->cq_wait_lock);
-			fastlock_acquire(&rs->cq_lock);
 		}
 	} while (!ret);
 
-	rs_update_credits(rs);
-	fastlock_release(&rs->cq_lock);
 	return ret;
 }
 
@@ -2198,16 +2385,17 @@ static int ds_valid_recv(struct ds_qp *qp, struct ibv_wc *wc)
  * Poll all CQs associated with a datagram rsocket.  We need to drop any
  * received messages that we do not have room to store.  To limit drops,
  * we only poll if we have room to store the receive or we need a send
- * buffer.  To ensure fairness, we poll the CQs round robin, remembering
- * where we left off.
+ * buffer, and never reap more completions at once than we have room for.
+ * To ensure fairness, we poll the CQs round robin, remembering where we
+ * left off.
  */
 static void ds_poll_cqs(struct rsocket *rs)
 {
 	struct ds_qp *qp;
 	struct ds_smsg *smsg;
 	struct ds_rmsg *rmsg;
-	struct ibv_wc wc;
-	int ret, cnt;
+	struct ibv_wc wc[DS_POLL_BATCH];
+	int i, ret, cnt;
 
 	if (!(qp = rs->qp_list))
 		return;
@@ -2215,30 +2403,39 @@ static void ds_poll_cqs(struct rsocket *rs)
 	do {
 		cnt = 0;
 		do {
-			ret = ibv_poll_cq(qp->cm_id->recv_cq, 1, &wc);
+			ret = ibv_poll_cq(qp->cm_id->recv_cq,
+					  rs->rqe_avail ?
+					  min(rs->rqe_avail, DS_POLL_BATCH) : 1,
+					  wc);
 			if (ret <= 0) {
 				qp = ds_next_qp(qp);
 				continue;
 			}
 
-			if (rs_wr_is_recv(wc.wr_id)) {
-				if (rs->rqe_avail && wc.status == IBV_WC_SUCCESS &&
-				    ds_valid_recv(qp, &wc)) {
-					rs->rqe_avail--;
-					rmsg = &rs->dmsg[rs->rmsg_tail];
-					rmsg->qp = qp;
-					rmsg->offset = rs_wr_data(wc.wr_id);
-					rmsg->length = wc.byte_len - sizeof(struct ibv_grh);
-					if (++rs->rmsg_tail == rs->rq_size + 1)
-						rs->rmsg_tail = 0;
+			for (i = 0; i < ret; i++) {
+				if (rs_wr_is_recv(wc[i].wr_id)) {
+					if (rs->rqe_avail &&
+					    wc[i].status == IBV_WC_SUCCESS &&
+					    ds_valid_recv(qp, &wc[i])) {
+						rs->rqe_avail--;
+						rmsg = &rs->dmsg[rs->rmsg_tail];
+						rmsg->qp = qp;
+						rmsg->offset = rs_wr_data(wc[i].wr_id);
+						rmsg->length = wc[i].byte_len -
+							       sizeof(struct ibv_grh);
+						if (++rs->rmsg_tail == rs->rq_size + 1)
+							rs->rmsg_tail = 0;
+					} else {
+						ds_post_recv(rs, qp,
+							     rs_wr_data(wc[i].wr_id));
+					}
 				} else {
-					ds_post_recv(rs, qp, rs_wr_data(wc.wr_id));
+					smsg = (struct ds_smsg *) (rs->sbuf +
+						rs_wr_data(wc[i].wr_id));
+					smsg->next = rs->smsg_free;
+					rs->smsg_free = smsg;
+					rs->sqe_avail++;
 				}
-			} else {
-				smsg = (struct ds_smsg *) (rs->sbuf + rs_wr_data(wc.wr_id));
-				smsg->next = rs->smsg_free;
-				rs->smsg_free = smsg;
-				rs->sqe_avail++;
 			}
 
 			qp = ds_next_qp(qp);
@@ -2410,6 +2607,12 @@ static int rs_conn_have_rdata(struct rsocket *rs)
 	return rs_have_rdata(rs) || !(rs->state & rs_readable);
 }
 
+static int rs_conn_all_data_done(struct rsocket *rs)
+{
+	return (rs->sbuf_bytes_avail == rs->sbuf_size) ||
+	       !(rs->state & rs_connected);
+}
+
 static int rs_conn_all_sends_done(struct rsocket *rs)
 {
 	return ((((int) rs->ctrl_max_seqno) - ((int) rs->ctrl_seqno)) +
@@ -2478,9 +2681,30 @@ static ssize_t ds_recvfrom(struct rsocket *rs, void *buf, size_t len, int flags,
 	return len;
 }
 
-static ssize_t rs_peek(struct rsocket *rs, void *buf, size_t len)
+static void rs_copy_to_iov(const struct iovec **iov, size_t *offset,
+			   const void *src, size_t len)
 {
-	size_t left = len;
+	size_t size;
+
+	while (len) {
+		size = (*iov)->iov_len - *offset;
+		if (size > len) {
+			memcpy((*iov)->iov_base + *offset, src, len);
+			*offset += len;
+			break;
+		}
+
+		memcpy((*iov)->iov_base + *offset, src, size);
+		len -= size;
+		src += size;
+		(*iov)++;
+		*offset = 0;
+	}
+}
+
+static ssize_t rs_peek(struct rsocket *rs, const struct iovec *iov, size_t len)
+{
+	size_t left = len, offset = 0;
 	uint32_t end_size, rsize;
 	int rmsg_head, rbuf_offset;
 
@@ -2498,15 +2722,14 @@ static ssize_t rs_peek(struct rsocket *rs, void *buf, size_t len)
 
 		end_size = rs->rbuf_size - rbuf_offset;
 		if (rsize > end_size) {
-			memcpy(buf, &rs->rbuf[rbuf_offset], end_size);
+			rs_copy_to_iov(&iov, &offset, &rs->rbuf[rbuf_offset],
+				       end_size);
 			rbuf_offset = 0;
-			buf += end_size;
 			rsize -= end_size;
 			left -= end_size;
 		}
-		memcpy(buf, &rs->rbuf[rbuf_offset], rsize);
+		rs_copy_to_iov(&iov, &offset, &rs->rbuf[rbuf_offset], rsize);
 		rbuf_offset += rsize;
-		buf += rsize;
 	}
 
 	return len - left;
@@ -2514,20 +2737,22 @@ static ssize_t rs_peek(struct rsocket *rs, void *buf, size_t len)
 
 /*
  * Continue to receive any queued data even if the remote side has disconnected.
+ * Data is scattered from the receive buffer directly into the iovecs.
  */
-ssize_t rrecv(int socket, void *buf, size_t len, int flags)
+static ssize_t rrecvv(int socket, const struct iovec *iov, int iovcnt, int flags)
 {
 	struct rsocket *rs;
-	size_t left = len;
+	size_t left, len, offset = 0;
 	uint32_t end_size, rsize;
-	int ret = 0;
+	int i, ret = 0;
 
 	rs = idm_at(&idm, socket);
 	if (!rs)
 		return ERR(EBADF);
 	if (rs->type == SOCK_DGRAM) {
 		fastlock_acquire(&rs->rlock);
-		ret = ds_recvfrom(rs, buf, len, flags, NULL, NULL);
+		ret = ds_recvfrom(rs, iov[0].iov_base, iov[0].iov_len, flags,
+				  NULL, NULL);
 		fastlock_release(&rs->rlock);
 		return ret;
 	}
@@ -2540,6 +2765,12 @@ ssize_t rrecv(int socket, void *buf, size_t len, int flags)
 			return ret;
 		}
 	}
+
+	len = iov[0].iov_len;
+	for (i = 1; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	left = len;
+
 	fastlock_acquire(&rs->rlock);
 	do {
 		if (!rs_have_rdata(rs)) {
@@ -2550,7 +2781,7 @@ ssize_t rrecv(int socket, void *buf, size_t len, int flags)
 		}
 
 		if (flags & MSG_PEEK) {
-			left = len - rs_peek(rs, buf, left);
+			left = len - rs_peek(rs, iov, left);
 			break;
 		}
 
@@ -2567,16 +2798,16 @@ ssize_t rrecv(int socket, void *buf, size_t len, int flags)
 
 			end_size = rs->rbuf_size - rs->rbuf_offset;
 			if (rsize > end_size) {
-				memcpy(buf, &rs->rbuf[rs->rbuf_offset], end_size);
+				rs_copy_to_iov(&iov, &offset,
+					       &rs->rbuf[rs->rbuf_offset], end_size);
 				rs->rbuf_offset = 0;
-				buf += end_size;
 				rsize -= end_size;
 				left -= end_size;
 				rs->rbuf_bytes_avail += end_size;
 			}
-			memcpy(buf, &rs->rbuf[rs->rbuf_offset], rsize);
+			rs_copy_to_iov(&iov, &offset, &rs->rbuf[rs->rbuf_offset],
+				       rsize);
 			rs->rbuf_offset += rsize;
-			buf += rsize;
 			rs->rbuf_bytes_avail += rsize;
 		}
 
@@ -2586,6 +2817,13 @@ ssize_t rrecv(int socket, void *buf, size_t len, int flags)
 	return (ret && left == len) ? ret : len - left;
 }
 
+ssize_t rrecv(int socket, void *buf, size_t len, int flags)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+
+	return rrecvv(socket, &iov, 1, flags);
+}
+
 ssize_t rrecvfrom(int socket, void *buf, size_t len, int flags,
 		  struct sockaddr *src_addr, socklen_t *addrlen)
 {
@@ -2609,21 +2847,12 @@ ssize_t rrecvfrom(int socket, void *buf, size_t len, int flags,
 	return ret;
 }
 
-/*
- * Simple, straightforward implementation for now that only tries to fill
- * in the first vector.
- */
-static ssize_t rrecvv(int socket, const struct iovec *iov, int iovcnt, int flags)
-{
-	return rrecv(socket, iov[0].iov_base, iov[0].iov_len, flags);
-}
-
 ssize_t rrecvmsg(int socket, struct msghdr *msg, int flags)
 {
 	if (msg->msg_control && msg->msg_controllen)
 		return ERR(ENOTSUP);
 
-	return rrecvv(socket, msg->msg_iov, (int) msg->msg_iovlen, msg->msg_flags);
+	return rrecvv(socket, msg->msg_iov, (int) msg->msg_iovlen, flags);
 }
 
 ssize_t rread(int socket, void *buf, size_t count)
@@ -2933,13 +3162,145 @@ static void rs_copy_iov(void *dst, const struct iovec **iov, size_t *offset, siz
 	}
 }
 
+static void rs_skip_iov(const struct iovec **iov, size_t *offset, size_t len)
+{
+	size_t size;
+
+	while (len) {
+		size = (*iov)->iov_len - *offset;
+		if (size > len) {
+			*offset += len;
+			break;
+		}
+
+		len -= size;
+		(*iov)++;
+		*offset = 0;
+	}
+}
+
+/* Caller holds map_lock */
+static struct rs_iomap_mr *rs_find_local_mr(struct rsocket *rs, uintptr_t addr,
+					    size_t len)
+{
+	struct rs_iomap_mr *iomr;
+	dlist_entry *entry;
+
+	for (entry = rs->iomap_list.next; entry != &rs->iomap_list;
+	     entry = entry->next) {
+		iomr = container_of(entry, struct rs_iomap_mr, entry);
+		if (addr >= (uintptr_t) iomr->mr->addr &&
+		    addr + len <= (uintptr_t) iomr->mr->addr + iomr->mr->length)
+			return iomr;
+	}
+	return NULL;
+}
+
+/*
+ * Mappings used by a zero copy send, each holding a reference so that
+ * riounmap cannot deregister it before the send completes.
+ */
+struct rs_zcopy_pins {
+	struct rs_iomap_mr *iomr[RS_MAX_SGE];
+	int cnt;
+};
+
+/* Caller holds map_lock */
+static int rs_pin_iomap_mr(struct rs_zcopy_pins *pins, struct rs_iomap_mr *iomr)
+{
+	int i;
+
+	for (i = 0; i < pins->cnt; i++) {
+		if (pins->iomr[i] == iomr)
+			return 0;
+	}
+	if (pins->cnt == RS_MAX_SGE)
+		return -1;
+
+	atomic_fetch_add(&iomr->refcnt, 1);
+	pins->iomr[pins->cnt++] = iomr;
+	return 0;
+}
+
+static void rs_unpin_iomap_mrs(struct rsocket *rs, struct rs_zcopy_pins *pins)
+{
+	int i;
+
+	if (!pins->cnt)
+		return;
+
+	fastlock_acquire(&rs->map_lock);
+	for (i = 0; i < pins->cnt; i++)
+		rs_release_iomap_mr(pins->iomr[i]);
+	fastlock_release(&rs->map_lock);
+	pins->cnt = 0;
+}
+
+/*
+ * Build an SGL straight over the user's iovecs, avoiding the copy into the
+ * send buffer.  This works for inline data, and when pins are given for
+ * data in buffers registered through riomap, whose mappings are pinned.
+ * The transfer is shortened to what the SGL covers.  Returns the number of
+ * SGEs, or 0 if the data must be copied.
+ */
+static int rs_iov_sgl(struct rsocket *rs, struct ibv_sge *sgl,
+		      const struct iovec *iov, size_t offset,
+		      uint32_t *len, struct rs_zcopy_pins *pins)
+{
+	struct rs_iomap_mr *iomr;
+	uint32_t left = *len, size;
+	int inl = (*len <= rs->sq_inline);
+	int n = 0;
+
+	if (!inl && !pins)
+		return 0;
+
+	if (!inl)
+		fastlock_acquire(&rs->map_lock);
+
+	for (; left && n < rs->sq_sge; iov++, offset = 0) {
+		size = min_t(size_t, iov->iov_len - offset, left);
+		if (!size)
+			continue;
+
+		sgl[n].addr = (uintptr_t) iov->iov_base + offset;
+		sgl[n].length = size;
+		if (inl) {
+			sgl[n].lkey = 0;
+		} else {
+			iomr = rs_find_local_mr(rs, sgl[n].addr, size);
+			if (!iomr || rs_pin_iomap_mr(pins, iomr))
+				break;
+			sgl[n].lkey = iomr->mr->lkey;
+		}
+		left -= size;
+		n++;
+	}
+
+	if (!inl)
+		fastlock_release(&rs->map_lock);
+
+	if (n)
+		*len -= left;
+	return n;
+}
+
+/*
+ * On blocking sockets, data in buffers registered through riomap is written
+ * directly from the user's iovecs.  Because the user may reuse the buffers
+ * as soon as we return, a send that wrote any such data waits for the
+ * writes to complete.  The mappings used are pinned rather than holding
+ * map_lock, so riomap and riounmap are not blocked while the send waits.
+ */
 static ssize_t rsendv(int socket, const struct iovec *iov, int iovcnt, int flags)
 {
 	struct rsocket *rs;
 	const struct iovec *cur_iov;
+	struct ibv_sge sgl[RS_MAX_SGE];
 	size_t left, len, offset = 0;
 	uint32_t xfer_size, olen = RS_OLAP_START_SIZE;
-	int i, ret = 0;
+	struct rs_zcopy_pins pins = {};
+	int i, nsge, zcopy, zcopy_sent = 0, ret = 0;
 
 	rs = idm_at(&idm, socket);
 	if (!rs)
@@ -2965,6 +3326,9 @@ static ssize_t rsendv(int socket, const struct iovec *iov, int iovcnt, int flags
 		if (ret)
 			goto out;
 	}
+
+	zcopy = !rs_nonblocking(rs, flags);
+
 	for (; left; left -= xfer_size) {
 		if (!rs_can_send(rs)) {
 			ret = rs_get_comp(rs, rs_nonblocking(rs, flags),
@@ -2990,7 +3354,18 @@ static ssize_t rsendv(int socket, const struct iovec *iov, int iovcnt, int flags
 		if (xfer_size > rs->target_sgl[rs->target_sge].length)
 			xfer_size = rs->target_sgl[rs->target_sge].length;
 
-		if (xfer_size <= rs_sbuf_left(rs)) {
+		nsge = rs_iov_sgl(rs, sgl, cur_iov, offset, &xfer_size,
+				  zcopy ? &pins : NULL);
+		if (nsge) {
+			if (xfer_size <= rs->sq_inline) {
+				ret = rs_write_data(rs, sgl, nsge, xfer_size,
+						    IBV_SEND_INLINE);
+			} else {
+				ret = rs_write_data(rs, sgl, nsge, xfer_size, 0);
+				zcopy_sent = 1;
+			}
+			rs_skip_iov(&cur_iov, &offset, xfer_size);
+		} else if (xfer_size <= rs_sbuf_left(rs)) {
 			rs_copy_iov((void *) (uintptr_t) rs->ssgl[0].addr,
 				    &cur_iov, &offset, xfer_size);
 			rs->ssgl[0].length = xfer_size;
@@ -3013,6 +3388,10 @@ static ssize_t rsendv(int socket, const struct iovec *iov, int iovcnt, int flags
 		if (ret)
 			break;
 	}
+
+	if (zcopy_sent && rs_get_comp(rs, 0, rs_conn_all_data_done) && !ret)
+		ret = -1;
+	rs_unpin_iomap_mrs(rs, &pins);
 out:
 	fastlock_release(&rs->slock);
 
@@ -3779,6 +4158,16 @@ int rsetsockopt(int socket, int level, int optname,
 				(uint8_t) rs_value_to_scale(*(int *) optval, 8), 8);
 			ret = 0;
 			break;
+		case RDMA_DGRAM_QPS:
+			if (rs->type != SOCK_DGRAM) {
+				ret = ERR(EINVAL);
+				break;
+			}
+			rs->qp_count = min_t(int, *(int *) optval, DS_MAX_QPS);
+			if (rs->qp_count < 1)
+				rs->qp_count = 1;
+			ret = 0;
+			break;
 		case RDMA_ROUTE:
 			if ((rs->optval = malloc(optlen))) {
 				memcpy(rs->optval, optval, optlen);
@@ -3930,6 +4319,14 @@ int rgetsockopt(int socket, int level, int optname,
 			*((int *) optval) = rs->target_iomap_size;
 			*optlen = sizeof(int);
 			break;
+		case RDMA_DGRAM_QPS:
+			if (rs->type != SOCK_DGRAM) {
+				ret = EINVAL;
+				break;
+			}
+			*((int *) optval) = max(rs->qp_count, 1);
+			*optlen = sizeof(int);
+			break;
 		case RDMA_ROUTE:
 			if (rs->optval) {
 				if (*optlen < rs->optlen) {
@@ -4095,6 +4492,7 @@ int riounmap(int socket, void *buf, size_t len)
 	     entry = entry->next) {
 		iomr = container_of(entry, struct rs_iomap_mr, entry);
 		if (iomr->mr->addr == buf && iomr->mr->length == len) {
+			dlist_remove(&iomr->entry);
 			rs_release_iomap_mr(iomr);
 			goto out;
 		}
@@ -4104,6 +4502,7 @@ int riounmap(int socket, void *buf, size_t len)
 	     entry = entry->next) {
 		iomr = container_of(entry, struct rs_iomap_mr, entry);
 		if (iomr->mr->addr == buf && iomr->mr->length == len) {
+			dlist_remove(&iomr->entry);
 			rs_release_iomap_mr(iomr);
 			goto out;
 		}
@@ -4211,70 +4610,82 @@ out:
  * Service Processing Threads
  ****************************************************************************/
 
-static int rs_svc_grow_sets(struct rs_svc *svc, int grow_size)
+static int rs_svc_create(struct rs_svc *svc)
 {
-	struct rsocket **rss;
-	void *set, *contexts;
+	struct epoll_event event;
+	int ret;
 
-	set = calloc(svc->size + grow_size, sizeof(*rss) + svc->context_size);
-	if (!set)
-		return ENOMEM;
+	svc->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (svc->epfd < 0)
+		return errno;
 
-	svc->size += grow_size;
-	rss = set;
-	contexts = set + sizeof(*rss) * svc->size;
-	if (svc->cnt) {
-		memcpy(rss, svc->rss, sizeof(*rss) * (svc->cnt + 1));
-		memcpy(contexts, svc->contexts, svc->context_size * (svc->cnt + 1));
+	/* A NULL pointer marks the service's communication socket. */
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_ctl(svc->epfd, EPOLL_CTL_ADD, svc->sock[1], &event)) {
+		ret = errno;
+		close(svc->epfd);
+		return ret;
 	}
-
-	free(svc->rss);
-	svc->rss = rss;
-	svc->contexts = contexts;
 	return 0;
 }
 
-/*
- * Index 0 is reserved for the service's communication socket.
- */
-static int rs_svc_add_rs(struct rs_svc *svc, struct rsocket *rs)
+static int rs_svc_add_fd(struct rs_svc *svc, struct rsocket *rs, int fd)
 {
-	int ret;
+	struct epoll_event event;
 
-	if (svc->cnt >= svc->size - 1) {
-		ret = rs_svc_grow_sets(svc, 4);
-		if (ret)
-			return ret;
-	}
+	event.events = EPOLLIN;
+	event.data.ptr = rs;
+	if (epoll_ctl(svc->epfd, EPOLL_CTL_ADD, fd, &event))
+		return errno;
 
-	svc->rss[++svc->cnt] = rs;
+	svc->cnt++;
 	return 0;
 }
 
-static int rs_svc_index(struct rs_svc *svc, struct rsocket *rs)
+static int rs_svc_rm_fd(struct rs_svc *svc, int fd)
 {
-	int i;
+	if (epoll_ctl(svc->epfd, EPOLL_CTL_DEL, fd, NULL))
+		return EBADF;
 
-	for (i = 1; i <= svc->cnt; i++) {
-		if (svc->rss[i] == rs)
-			return i;
-	}
-	return -1;
+	svc->cnt--;
+	return 0;
 }
 
-static int rs_svc_rm_rs(struct rs_svc *svc, struct rsocket *rs)
+/*
+ * Events for rsockets are handled before any message on the communication
+ * socket, so that an rsocket removed by that message is not touched again.
+ */
+static void *rs_svc_run(struct rs_svc *svc,
+			void (*process_sock)(struct rs_svc *svc),
+			void (*process_rs)(struct rs_svc *svc, struct rsocket *rs))
 {
-	int i;
+	struct epoll_event events[RS_SVC_EVENTS];
+	struct rs_svc_msg msg;
+	int i, n, ret, sock_ready;
 
-	if ((i = rs_svc_index(svc, rs)) >= 0) {
-		svc->rss[i] = svc->rss[svc->cnt];
-		memcpy(svc->contexts + i * svc->context_size,
-		       svc->contexts + svc->cnt * svc->context_size,
-		       svc->context_size);
-		svc->cnt--;
-		return 0;
+	ret = rs_svc_create(svc);
+	if (ret) {
+		msg.status = ret;
+		write_all(svc->sock[1], &msg, sizeof(msg));
+		return (void *) (uintptr_t) ret;
 	}
-	return EBADF;
+
+	do {
+		n = epoll_wait(svc->epfd, events, RS_SVC_EVENTS, -1);
+		sock_ready = 0;
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr)
+				process_rs(svc, events[i].data.ptr);
+			else
+				sock_ready = 1;
+		}
+		if (sock_ready)
+			process_sock(svc);
+	} while (svc->cnt >= 1);
+
+	close(svc->epfd);
+	return NULL;
 }
 
 static void udp_svc_process_sock(struct rs_svc *svc)
@@ -4284,17 +4695,12 @@ static void udp_svc_process_sock(struct rs_svc *svc)
 	read_all(svc->sock[1], &msg, sizeof msg);
 	switch (msg.cmd) {
 	case RS_SVC_ADD_DGRAM:
-		msg.status = rs_svc_add_rs(svc, msg.rs);
-		if (!msg.status) {
+		msg.status = rs_svc_add_fd(svc, msg.rs, msg.rs->udp_sock);
+		if (!msg.status)
 			msg.rs->opts |= RS_OPT_UDP_SVC;
-			udp_svc_fds = svc->contexts;
-			udp_svc_fds[svc->cnt].fd = msg.rs->udp_sock;
-			udp_svc_fds[svc->cnt].events = POLLIN;
-			udp_svc_fds[svc->cnt].revents = 0;
-		}
 		break;
 	case RS_SVC_REM_DGRAM:
-		msg.status = rs_svc_rm_rs(svc, msg.rs);
+		msg.status = rs_svc_rm_fd(svc, msg.rs->udp_sock);
 		if (!msg.status)
 			msg.rs->opts &= ~RS_OPT_UDP_SVC;
 		break;
@@ -4475,69 +4881,122 @@ static void udp_svc_process_rs(struct rsocket *rs)
 	}
 }
 
+static void udp_svc_process_event(struct rs_svc *svc, struct rsocket *rs)
+{
+	udp_svc_process_rs(rs);
+}
+
 static void *udp_svc_run(void *arg)
 {
-	struct rs_svc *svc = arg;
-	struct rs_svc_msg msg;
-	int i, ret;
+	return rs_svc_run(arg, udp_svc_process_sock, udp_svc_process_event);
+}
 
-	ret = rs_svc_grow_sets(svc, 4);
-	if (ret) {
-		msg.status = ret;
-		write_all(svc->sock[1], &msg, sizeof msg);
-		return (void *) (uintptr_t) ret;
+static uint64_t rs_get_time(void)
+{
+	return rs_time_us() / 1000000;
+}
+
+static void rs_tw_init(struct rs_timer_wheel *tw, uint64_t now)
+{
+	int level, i;
+
+	for (level = 0; level < RS_TW_LEVELS; level++) {
+		for (i = 0; i < RS_TW_SLOTS; i++)
+			dlist_init(&tw->slot[level][i]);
 	}
+	tw->now = now;
+}
 
-	udp_svc_fds = svc->contexts;
-	udp_svc_fds[0].fd = svc->sock[1];
-	udp_svc_fds[0].events = POLLIN;
-	do {
-		for (i = 0; i <= svc->cnt; i++)
-			udp_svc_fds[i].revents = 0;
+static void rs_tw_add(struct rs_timer_wheel *tw, struct rsocket *rs)
+{
+	uint64_t delta;
+	int level;
 
-		poll(udp_svc_fds, svc->cnt + 1, -1);
-		if (udp_svc_fds[0].revents)
-			udp_svc_process_sock(svc);
+	if (rs->keepalive_expire < tw->now)
+		rs->keepalive_expire = tw->now;
+	delta = rs->keepalive_expire - tw->now;
+	if (delta > RS_TW_MAX) {
+		delta = RS_TW_MAX;
+		rs->keepalive_expire = tw->now + delta;
+	}
 
-		for (i = 1; i <= svc->cnt; i++) {
-			if (udp_svc_fds[i].revents)
-				udp_svc_process_rs(svc->rss[i]);
-		}
-	} while (svc->cnt >= 1);
+	for (level = 0; level < RS_TW_LEVELS - 1; level++) {
+		if (delta < 1ULL << (RS_TW_BITS * (level + 1)))
+			break;
+	}
+	dlist_insert_tail(&rs->keepalive_entry,
+			  &tw->slot[level][(rs->keepalive_expire >>
+					    (RS_TW_BITS * level)) & RS_TW_MASK]);
+}
 
-	return NULL;
+/*
+ * Move the timers of the current slot of a level down to the lower levels.
+ * Returns the slot index so the caller knows whether this level wrapped.
+ */
+static int rs_tw_cascade(struct rs_timer_wheel *tw, int level)
+{
+	dlist_entry *head;
+	int index;
+
+	index = (tw->now >> (RS_TW_BITS * level)) & RS_TW_MASK;
+	head = &tw->slot[level][index];
+	while (!dlist_empty(head)) {
+		struct rsocket *rs = container_of(head->next, struct rsocket,
+						  keepalive_entry);
+
+		dlist_remove(&rs->keepalive_entry);
+		rs_tw_add(tw, rs);
+	}
+	return index;
 }
 
-static uint64_t rs_get_time(void)
+/* Seconds from tw->now until a level 0 slot has timers or a cascade is due */
+static int rs_tw_next(struct rs_timer_wheel *tw)
 {
-	return rs_time_us() / 1000000;
+	uint64_t tick;
+	int i;
+
+	for (i = 0; i < RS_TW_SLOTS; i++) {
+		tick = tw->now + i;
+		if (!(tick & RS_TW_MASK) ||
+		    !dlist_empty(&tw->slot[0][tick & RS_TW_MASK]))
+			break;
+	}
+	return i;
 }
 
 static void tcp_svc_process_sock(struct rs_svc *svc)
 {
 	struct rs_svc_msg msg;
-	int i;
 
 	read_all(svc->sock[1], &msg, sizeof msg);
 	switch (msg.cmd) {
 	case RS_SVC_ADD_KEEPALIVE:
-		msg.status = rs_svc_add_rs(svc, msg.rs);
-		if (!msg.status) {
+		if (!(msg.rs->opts & RS_OPT_KEEPALIVE)) {
 			msg.rs->opts |= RS_OPT_KEEPALIVE;
-			tcp_svc_timeouts = svc->contexts;
-			tcp_svc_timeouts[svc->cnt] = rs_get_time() +
-						     msg.rs->keepalive_time;
+			msg.rs->keepalive_expire = rs_get_time() +
+						   msg.rs->keepalive_time;
+			rs_tw_add(&tcp_svc_wheel, msg.rs);
+			svc->cnt++;
 		}
+		msg.status = 0;
 		break;
 	case RS_SVC_REM_KEEPALIVE:
-		msg.status = rs_svc_rm_rs(svc, msg.rs);
-		if (!msg.status)
+		if (msg.rs->opts & RS_OPT_KEEPALIVE) {
+			dlist_remove(&msg.rs->keepalive_entry);
 			msg.rs->opts &= ~RS_OPT_KEEPALIVE;
+			svc->cnt--;
+			msg.status = 0;
+		} else {
+			msg.status = EBADF;
+		}
 		break;
 	case RS_SVC_MOD_KEEPALIVE:
-		i = rs_svc_index(svc, msg.rs);
-		if (i >= 0) {
-			tcp_svc_timeouts[i] = rs_get_time() + msg.rs->keepalive_time;
+		if (msg.rs->opts & RS_OPT_KEEPALIVE) {
+			dlist_remove(&msg.rs->keepalive_entry);
+			msg.rs->keepalive_expire = rs_get_time() +
+						   msg.rs->keepalive_time;
+			rs_tw_add(&tcp_svc_wheel, msg.rs);
 			msg.status = 0;
 		} else {
 			msg.status = EBADF;
@@ -4567,42 +5026,55 @@ static void tcp_svc_send_keepalive(struct rsocket *rs)
 	fastlock_release(&rs->cq_lock);
 }	
 
+/*
+ * Run every tick up to and including now.  A keep-alive is rearmed at least
+ * one tick ahead, so a zero keep-alive time cannot spin on the same slot.
+ */
+static void tcp_svc_expire(struct rs_timer_wheel *tw, uint64_t now)
+{
+	struct rsocket *rs;
+	dlist_entry *head;
+	int level, index;
+
+	for (; tw->now <= now; tw->now++) {
+		index = tw->now & RS_TW_MASK;
+		for (level = 1; !index && level < RS_TW_LEVELS; level++)
+			index = rs_tw_cascade(tw, level);
+
+		head = &tw->slot[0][tw->now & RS_TW_MASK];
+		while (!dlist_empty(head)) {
+			rs = container_of(head->next, struct rsocket,
+					  keepalive_entry);
+			dlist_remove(&rs->keepalive_entry);
+			tcp_svc_send_keepalive(rs);
+			rs->keepalive_expire = max_t(uint64_t,
+						     now + rs->keepalive_time,
+						     tw->now + 1);
+			rs_tw_add(tw, rs);
+		}
+	}
+}
+
 static void *tcp_svc_run(void *arg)
 {
 	struct rs_svc *svc = arg;
-	struct rs_svc_msg msg;
 	struct pollfd fds;
-	uint64_t now, next_timeout;
-	int i, ret, timeout;
+	uint64_t now;
+	int timeout;
 
-	ret = rs_svc_grow_sets(svc, 16);
-	if (ret) {
-		msg.status = ret;
-		write_all(svc->sock[1], &msg, sizeof msg);
-		return (void *) (uintptr_t) ret;
-	}
-
-	tcp_svc_timeouts = svc->contexts;
+	rs_tw_init(&tcp_svc_wheel, rs_get_time());
 	fds.fd = svc->sock[1];
 	fds.events = POLLIN;
 	timeout = -1;
 	do {
-		poll(&fds, 1, timeout * 1000);
+		poll(&fds, 1, timeout);
 		if (fds.revents)
 			tcp_svc_process_sock(svc);
 
 		now = rs_get_time();
-		next_timeout = ~0;
-		for (i = 1; i <= svc->cnt; i++) {
-			if (tcp_svc_timeouts[i] <= now) {
-				tcp_svc_send_keepalive(svc->rss[i]);
-				tcp_svc_timeouts[i] =
-					now + svc->rss[i]->keepalive_time;
-			}
-			if (tcp_svc_timeouts[i] < next_timeout)
-				next_timeout = tcp_svc_timeouts[i];
-		}
-		timeout = (int) (next_timeout - now);
+		tcp_svc_expire(&tcp_svc_wheel, now);
+		timeout = (int) (tcp_svc_wheel.now +
+				 rs_tw_next(&tcp_svc_wheel) - now) * 1000;
 	} while (svc->cnt >= 1);
 
 	return NULL;
@@ -4628,22 +5100,17 @@ static void rs_handle_cm_event(struct rsocket *rs)
 static void cm_svc_process_sock(struct rs_svc *svc)
 {
 	struct rs_svc_msg msg;
-	struct pollfd *fds;
 
 	read_all(svc->sock[1], &msg, sizeof(msg));
 	switch (msg.cmd) {
 	case RS_SVC_ADD_CM:
-		msg.status = rs_svc_add_rs(svc, msg.rs);
-		if (!msg.status) {
+		msg.status = rs_svc_add_fd(svc, msg.rs,
+					   msg.rs->cm_id->channel->fd);
+		if (!msg.status)
 			msg.rs->opts |= RS_OPT_CM_SVC;
-			fds = svc->contexts;
-			fds[svc->cnt].fd = msg.rs->cm_id->channel->fd;
-			fds[svc->cnt].events = POLLIN;
-			fds[svc->cnt].revents = 0;
-		}
 		break;
 	case RS_SVC_REM_CM:
-		msg.status = rs_svc_rm_rs(svc, msg.rs);
+		msg.status = rs_svc_rm_fd(svc, msg.rs->cm_id->channel->fd);
 		if (!msg.status)
 			msg.rs->opts &= ~RS_OPT_CM_SVC;
 		break;
@@ -4656,44 +5123,15 @@ static void cm_svc_process_sock(struct rs_svc *svc)
 	write_all(svc->sock[1], &msg, sizeof(msg));
 }
 
-static void *cm_svc_run(void *arg)
+static void cm_svc_process_event(struct rs_svc *svc, struct rsocket *rs)
 {
-	struct rs_svc *svc = arg;
-	struct pollfd *fds;
-	struct rs_svc_msg msg;
-	int i, ret;
-
-	ret = rs_svc_grow_sets(svc, 4);
-	if (ret) {
-		msg.status = ret;
-		write_all(svc->sock[1], &msg, sizeof(msg));
-		return (void *) (uintptr_t) ret;
-	}
-
-	fds = svc->contexts;
-	fds[0].fd = svc->sock[1];
-	fds[0].events = POLLIN;
-	do {
-		for (i = 0; i <= svc->cnt; i++)
-			fds[i].revents = 0;
-
-		poll(fds, svc->cnt + 1, -1);
-		if (fds[0].revents) {
-			cm_svc_process_sock(svc);
-			/* svc->contexts may have been reallocated, so need to assign again */
-			fds = svc->contexts;
-		}
-
-		for (i = 1; i <= svc->cnt; i++) {
-			if (!fds[i].revents)
-				continue;
-
-			if (svc == &listen_svc)
-				rs_accept(svc->rss[i]);
-			else
-				rs_handle_cm_event(svc->rss[i]);
-		}
-	} while (svc->cnt >= 1);
+	if (svc == &listen_svc)
+		rs_accept(rs);
+	else
+		rs_handle_cm_event(rs);
+}
 
-	return NULL;
+static void *cm_svc_run(void *arg)
+{
+	return rs_svc_run(arg, cm_svc_process_sock, cm_svc_process_event);
 }
@@ -79,7 +79,8 @@ enum {
 	RDMA_RQSIZE,
 	RDMA_INLINE,
 	RDMA_IOMAPSIZE,
-	RDMA_ROUTE
+	RDMA_ROUTE,
+	RDMA_DGRAM_QPS
 };
 
 int rsetsockopt(int socket, int level, int optname,
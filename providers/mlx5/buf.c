@@ -33,86 +33,109 @@
 #include <config.h>
 
 #include <signal.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <util/bitmap.h>
 
 #include "mlx5.h"
 
-/* Only ia64 requires this */
-#ifdef __ia64__
-#define MLX5_SHM_ADDR ((void *)0x8000000000000000UL)
-#define MLX5_SHMAT_FLAGS (SHM_RND)
-#else
-#define MLX5_SHM_ADDR NULL
-#define MLX5_SHMAT_FLAGS 0
-#endif
-
 #ifndef HPAGE_SIZE
 #define HPAGE_SIZE              (2UL * 1024 * 1024)
 #endif
 
 #define MLX5_SHM_LENGTH         HPAGE_SIZE
 #define MLX5_Q_CHUNK_SIZE       32768
+#define MLX5_MAX_NUMA_NODES     1024
+
+/*
+ * The node buffers of this context should be placed on, resolving
+ * MLX5DV_BUF_NUMA_NODE_LOCAL to the node of the calling thread.
+ */
+static int mlx5_buf_numa_node(struct mlx5_context *mctx)
+{
+	unsigned int cpu, node;
+
+	if (mctx->buf_numa_node != MLX5DV_BUF_NUMA_NODE_LOCAL)
+		return mctx->buf_numa_node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL))
+		return MLX5DV_BUF_NUMA_NODE_ANY;
+
+	return node;
+}
+
+/*
+ * Must be called before the range is first touched, the policy only
+ * applies to pages faulted in later on.  MPOL_PREFERRED falls back to
+ * other nodes rather than failing when the node is out of memory.
+ */
+static void mlx5_buf_bind_node(struct mlx5_context *mctx, void *addr,
+			       size_t length, int node)
+{
+	unsigned long mask[BITS_TO_LONGS(MLX5_MAX_NUMA_NODES)] = {};
+
+	if (node < 0 || node >= MLX5_MAX_NUMA_NODES)
+		return;
+
+	mask[node / BITS_PER_LONG] = 1UL << (node % BITS_PER_LONG);
+	if (syscall(SYS_mbind, addr, length, MPOL_PREFERRED, mask,
+		    MLX5_MAX_NUMA_NODES + 1, 0))
+		mlx5_dbg(mctx->dbg_fp, MLX5_DBG_CONTIG,
+			 "mbind to node %d failed: %s\n", node,
+			 strerror(errno));
+}
 
 static void free_huge_mem(struct mlx5_hugetlb_mem *hmem)
 {
 	if (hmem->bitmap)
 		free(hmem->bitmap);
 
-	if (shmdt(hmem->shmaddr) == -1)
+	if (munmap(hmem->addr, hmem->length) == -1)
 		mlx5_dbg(stderr, MLX5_DBG_CONTIG, "%s\n", strerror(errno));
-	shmctl(hmem->shmid, IPC_RMID, NULL);
 	free(hmem);
 }
 
-static struct mlx5_hugetlb_mem *alloc_huge_mem(size_t size)
+static struct mlx5_hugetlb_mem *alloc_huge_mem(struct mlx5_context *mctx,
+					       size_t size, int node)
 {
 	struct mlx5_hugetlb_mem *hmem;
-	size_t shm_len;
 
 	hmem = malloc(sizeof(*hmem));
 	if (!hmem)
 		return NULL;
 
-	shm_len = align(size, MLX5_SHM_LENGTH);
-	hmem->shmid = shmget(IPC_PRIVATE, shm_len, SHM_HUGETLB | SHM_R | SHM_W);
-	if (hmem->shmid == -1) {
+	/*
+	 * A private MAP_HUGETLB mapping draws from the same hugetlbfs pool
+	 * as SHM_HUGETLB did, without being bound by shmmax/shmall or
+	 * leaving a segment behind if the process dies.
+	 */
+	hmem->length = align(size, MLX5_SHM_LENGTH);
+	hmem->addr = mmap(NULL, hmem->length, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (hmem->addr == MAP_FAILED) {
 		mlx5_dbg(stderr, MLX5_DBG_CONTIG, "%s\n", strerror(errno));
 		goto out_free;
 	}
 
-	hmem->shmaddr = shmat(hmem->shmid, MLX5_SHM_ADDR, MLX5_SHMAT_FLAGS);
-	if (hmem->shmaddr == (void *)-1) {
-		mlx5_dbg(stderr, MLX5_DBG_CONTIG, "%s\n", strerror(errno));
-		goto out_rmid;
-	}
-
-	hmem->bitmap = bitmap_alloc0(shm_len / MLX5_Q_CHUNK_SIZE);
+	hmem->bitmap = bitmap_alloc0(hmem->length / MLX5_Q_CHUNK_SIZE);
 	if (!hmem->bitmap) {
 		mlx5_dbg(stderr, MLX5_DBG_CONTIG, "%s\n", strerror(errno));
-		goto out_shmdt;
+		goto out_unmap;
 	}
 
-	hmem->bmp_size = shm_len / MLX5_Q_CHUNK_SIZE;
-
-	/*
-	 * Marked to be destroyed when process detaches from shmget segment
-	 */
-	shmctl(hmem->shmid, IPC_RMID, NULL);
+	hmem->bmp_size = hmem->length / MLX5_Q_CHUNK_SIZE;
+	hmem->numa_node = node;
+	mlx5_buf_bind_node(mctx, hmem->addr, hmem->length, node);
 
 	return hmem;
 
-out_shmdt:
-	if (shmdt(hmem->shmaddr) == -1)
-		mlx5_dbg(stderr, MLX5_DBG_CONTIG, "%s\n", strerror(errno));
-
-out_rmid:
-	shmctl(hmem->shmid, IPC_RMID, NULL);
+out_unmap:
+	munmap(hmem->addr, hmem->length);
 
 out_free:
 	free(hmem);
@@ -125,6 +148,7 @@ static int alloc_huge_buf(struct mlx5_context *mctx, struct mlx5_buf *buf,
 	int found = 0;
 	int nchunk;
 	struct mlx5_hugetlb_mem *hmem;
+	int node;
 	int ret;
 
 	buf->length = align(size, MLX5_Q_CHUNK_SIZE);
@@ -133,9 +157,12 @@ static int alloc_huge_buf(struct mlx5_context *mctx, struct mlx5_buf *buf,
 	if (!nchunk)
 		return 0;
 
+	node = mlx5_buf_numa_node(mctx);
+
 	mlx5_spin_lock(&mctx->hugetlb_lock);
 	list_for_each(&mctx->hugetlb_list, hmem, entry) {
-		if (!bitmap_full(hmem->bitmap, hmem->bmp_size)) {
+		if (hmem->numa_node == node &&
+		    !bitmap_full(hmem->bitmap, hmem->bmp_size)) {
 			buf->base = bitmap_find_free_region(hmem->bitmap,
 							    hmem->bmp_size,
 							    nchunk);
@@ -151,7 +178,7 @@ static int alloc_huge_buf(struct mlx5_context *mctx, struct mlx5_buf *buf,
 	mlx5_spin_unlock(&mctx->hugetlb_lock);
 
 	if (!found) {
-		hmem = alloc_huge_mem(buf->length);
+		hmem = alloc_huge_mem(mctx, buf->length, node);
 		if (!hmem)
 			return -1;
 
@@ -169,7 +196,7 @@ static int alloc_huge_buf(struct mlx5_context *mctx, struct mlx5_buf *buf,
 		mlx5_spin_unlock(&mctx->hugetlb_lock);
 	}
 
-	buf->buf = hmem->shmaddr + buf->base * MLX5_Q_CHUNK_SIZE;
+	buf->buf = hmem->addr + buf->base * MLX5_Q_CHUNK_SIZE;
 
 	ret = ibv_dontfork_range(buf->buf, buf->length);
 	if (ret) {
@@ -328,8 +355,7 @@ int mlx5_alloc_prefered_buf(struct mlx5_context *mctx,
 	if (type == MLX5_ALLOC_TYPE_EXTERNAL)
 		return mlx5_alloc_buf_extern(mctx, buf, size);
 
-	return mlx5_alloc_buf(buf, size, page_size);
-
+	return mlx5_alloc_buf_numa(mctx, buf, size, page_size);
 }
 
 int mlx5_free_actual_buf(struct mlx5_context *ctx, struct mlx5_buf *buf)
@@ -357,6 +383,10 @@ int mlx5_free_actual_buf(struct mlx5_context *ctx, struct mlx5_buf *buf)
 		mlx5_free_buf_custom(ctx, buf);
 		break;
 
+	case MLX5_ALLOC_TYPE_NUMA:
+		mlx5_free_buf_numa(buf);
+		break;
+
 	default:
 		mlx5_err(ctx->dbg_fp, "Bad allocation type\n");
 	}
@@ -569,3 +599,59 @@ void mlx5_free_buf(struct mlx5_buf *buf)
 	ibv_dofork_range(buf->buf, buf->length);
 	free(buf->buf);
 }
+
+/*
+ * Anonymous buffer with its pages placed on the context's NUMA node.  Each
+ * buffer gets a mapping of its own so the memory policy can't leak onto
+ * unrelated heap allocations.  Buffers of a huge page and above are
+ * aligned to it and advised for transparent huge pages.
+ */
+int mlx5_alloc_buf_numa(struct mlx5_context *mctx, struct mlx5_buf *buf,
+			size_t size, int page_size)
+{
+	size_t al_size, map_size, head;
+	void *addr;
+	int node;
+
+	node = mlx5_buf_numa_node(mctx);
+	if (node < 0)
+		return mlx5_alloc_buf(buf, size, page_size);
+
+	al_size = align(size, page_size);
+	map_size = al_size;
+	if (al_size >= HPAGE_SIZE)
+		map_size += HPAGE_SIZE;
+
+	addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return -1;
+
+	if (map_size != al_size) {
+		head = align((uintptr_t)addr, HPAGE_SIZE) - (uintptr_t)addr;
+		if (head)
+			munmap(addr, head);
+		munmap(addr + head + al_size, map_size - al_size - head);
+		addr += head;
+		madvise(addr, al_size, MADV_HUGEPAGE);
+	}
+
+	mlx5_buf_bind_node(mctx, addr, al_size, node);
+
+	if (ibv_dontfork_range(addr, al_size)) {
+		munmap(addr, al_size);
+		return -1;
+	}
+
+	buf->buf = addr;
+	buf->length = al_size;
+	buf->type = MLX5_ALLOC_TYPE_NUMA;
+
+	return 0;
+}
+
+void mlx5_free_buf_numa(struct mlx5_buf *buf)
+{
+	ibv_dofork_range(buf->buf, buf->length);
+	munmap(buf->buf, buf->length);
+}
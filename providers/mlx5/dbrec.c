@@ -38,13 +38,19 @@
 
 #include "mlx5.h"
 
+/*
+ * Doorbell records are handed out from pages on dbr_available_pages, which
+ * holds every page with a free slot.  Free slots of a page are kept on a
+ * stack of slot indexes so that allocating and freeing a record never scans
+ * the page.
+ */
 struct mlx5_db_page {
 	cl_map_item_t			cl_map;
 	struct list_node		available;
 	struct mlx5_buf			buf;
 	int				num_db;
 	int				use_cnt;
-	unsigned long			free[0];
+	uint16_t			free[];
 };
 
 static struct mlx5_db_page *__add_page(struct mlx5_context *context)
@@ -53,20 +59,18 @@ static struct mlx5_db_page *__add_page(struct mlx5_context *context)
 	int ps = to_mdev(context->ibv_ctx.context.device)->page_size;
 	int pp;
 	int i;
-	int nlong;
 	int ret;
 
-	pp = ps / context->cache_line_size;
-	nlong = (pp + 8 * sizeof(long) - 1) / (8 * sizeof(long));
+	pp = ps / context->dbr_size;
 
-	page = malloc(sizeof *page + nlong * sizeof(long));
+	page = malloc(sizeof *page + pp * sizeof(page->free[0]));
 	if (!page)
 		return NULL;
 
 	if (mlx5_is_extern_alloc(context))
 		ret = mlx5_alloc_buf_extern(context, &page->buf, ps);
 	else
-		ret = mlx5_alloc_buf(&page->buf, ps, ps);
+		ret = mlx5_alloc_buf_numa(context, &page->buf, ps, ps);
 	if (ret) {
 		free(page);
 		return NULL;
@@ -74,8 +78,9 @@ static struct mlx5_db_page *__add_page(struct mlx5_context *context)
 
 	page->num_db  = pp;
 	page->use_cnt = 0;
-	for (i = 0; i < nlong; ++i)
-		page->free[i] = ~0;
+	/* lowest address on top, records are handed out in address order */
+	for (i = 0; i < pp; ++i)
+		page->free[i] = pp - 1 - i;
 
 	cl_qmap_insert(&context->dbr_map, (uintptr_t) page->buf.buf,
 		       &page->cl_map);
@@ -89,7 +94,7 @@ __be32 *mlx5_alloc_dbrec(struct mlx5_context *context, struct ibv_pd *pd,
 {
 	struct mlx5_db_page *page;
 	__be32 *db = NULL;
-	int i, j;
+	int i;
 
 	if (mlx5_is_custom_alloc(pd)) {
 		struct mlx5_parent_domain *mparent_domain = to_mparent_domain(pd);
@@ -121,17 +126,11 @@ default_alloc:
 		goto out;
 
 found:
-	++page->use_cnt;
+	i = page->free[page->num_db - ++page->use_cnt];
 	if (page->use_cnt == page->num_db)
 		list_del(&page->available);
 
-	for (i = 0; !page->free[i]; ++i)
-		/* nothing */;
-
-	j = ffsl(page->free[i]);
-	--j;
-	page->free[i] &= ~(1UL << j);
-	db = page->buf.buf + (i * 8 * sizeof(long) + j) * context->cache_line_size;
+	db = page->buf.buf + i * context->dbr_size;
 
 out:
 	pthread_mutex_unlock(&context->dbr_map_mutex);
@@ -164,19 +163,16 @@ void mlx5_free_db(struct mlx5_context *context, __be32 *db, struct ibv_pd *pd,
 	assert(item != cl_qmap_end(&context->dbr_map));
 
 	page = (container_of(item, struct mlx5_db_page, cl_map));
-	i = ((void *) db - page->buf.buf) / context->cache_line_size;
-	page->free[i / (8 * sizeof(long))] |= 1UL << (i % (8 * sizeof(long)));
+	i = ((void *) db - page->buf.buf) / context->dbr_size;
 	if (page->use_cnt == page->num_db)
 		list_add(&context->dbr_available_pages, &page->available);
 
-	if (!--page->use_cnt) {
+	page->free[page->num_db - page->use_cnt--] = i;
+	if (!page->use_cnt) {
 		cl_qmap_remove_item(&context->dbr_map, item);
 		list_del(&page->available);
 
-		if (page->buf.type == MLX5_ALLOC_TYPE_EXTERNAL)
-			mlx5_free_buf_extern(context, &page->buf);
-		else
-			mlx5_free_buf(&page->buf);
+		mlx5_free_actual_buf(context, &page->buf);
 
 		free(page);
 	}
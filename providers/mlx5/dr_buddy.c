@@ -34,28 +34,83 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <util/bitmap.h>
 #include "mlx5dv_dr.h"
 
-struct dr_icm_pool;
-struct dr_icm_buddy_mem;
+static void dr_buddy_set_free(struct dr_buddy_order *ord, uint32_t seg)
+{
+	unsigned long *word;
+	bool was_empty;
+	int l;
+
+	/* Mark the summaries up to the first one that already was */
+	for (l = 0; l < ord->num_levels; l++) {
+		word = &ord->level[l][seg / BITS_PER_LONG];
+		was_empty = !*word;
+		*word |= 1UL << (seg % BITS_PER_LONG);
+		if (!was_empty)
+			break;
+		seg /= BITS_PER_LONG;
+	}
+
+	ord->num_free++;
+}
 
-static int dr_find_first_bit(const unsigned long *set_addr,
-			     const unsigned long *addr,
-			     unsigned int size)
+static void dr_buddy_clear_free(struct dr_buddy_order *ord, uint32_t seg)
 {
-	unsigned int set_size = (size - 1) / BITS_PER_LONG + 1;
-	unsigned long set_idx;
+	unsigned long *word;
+	int l;
+
+	for (l = 0; l < ord->num_levels; l++) {
+		word = &ord->level[l][seg / BITS_PER_LONG];
+		*word &= ~(1UL << (seg % BITS_PER_LONG));
+		if (*word)
+			break;
+		seg /= BITS_PER_LONG;
+	}
+
+	ord->num_free--;
+}
 
-	/* find the first free in the first level */
-	set_idx =  bitmap_find_first_bit(set_addr, 0, set_size);
-	/* find the next level */
-	return bitmap_find_first_bit(addr, set_idx * BITS_PER_LONG, size);
+static bool dr_buddy_is_free(struct dr_buddy_order *ord, uint32_t seg)
+{
+	return bitmap_test_bit(ord->level[0], seg);
+}
+
+/* The lowest free segment, the order must have one */
+static uint32_t dr_buddy_find_free(struct dr_buddy_order *ord)
+{
+	uint32_t seg = 0;
+	int l;
+
+	for (l = ord->num_levels - 1; l >= 0; l--)
+		seg = seg * BITS_PER_LONG + ffsl(ord->level[l][seg]) - 1;
+
+	return seg;
+}
+
+static size_t dr_buddy_init_order(struct dr_buddy_order *ord, uint64_t nbits,
+				  unsigned long *bitmap)
+{
+	size_t nlongs = 0;
+
+	for (ord->num_levels = 0; ; nbits = BITS_TO_LONGS(nbits)) {
+		if (bitmap)
+			ord->level[ord->num_levels] = bitmap + nlongs;
+		ord->num_levels++;
+		nlongs += BITS_TO_LONGS(nbits);
+		if (nbits <= BITS_PER_LONG)
+			break;
+	}
+
+	return nlongs;
 }
 
 int dr_buddy_init(struct dr_icm_buddy_mem *buddy, uint32_t max_order)
 {
-	int i, s;
+	size_t nlongs = 0;
+	int i;
 
 	buddy->max_order = max_order;
 
@@ -63,107 +118,56 @@ int dr_buddy_init(struct dr_icm_buddy_mem *buddy, uint32_t max_order)
 	list_head_init(&buddy->used_list);
 	list_head_init(&buddy->hot_list);
 
-	buddy->bits = calloc(buddy->max_order + 1, sizeof(long *));
-	if (!buddy->bits) {
+	buddy->orders = calloc(buddy->max_order + 1, sizeof(*buddy->orders));
+	if (!buddy->orders) {
 		errno = ENOMEM;
 		return ENOMEM;
 	}
 
-	buddy->num_free = calloc(buddy->max_order + 1, sizeof(*buddy->num_free));
-	if (!buddy->num_free)
-		goto err_out_free_bits;
-
-	buddy->set_bit = calloc(buddy->max_order + 1, sizeof(long *));
-	if (!buddy->set_bit)
-		goto err_out_free_num_free;
-
-	/* Allocating max_order bitmaps, one for each order.
-	 * only the bitmap for the maximum size will be available for use and
-	 * the first bit there will be set.
+	/* Size the levels of all the orders, then carve them out of a
+	 * single bitmap.
 	 */
-	for (i = 0; i <= buddy->max_order; ++i) {
-		s = 1 << (buddy->max_order - i);
-		buddy->bits[i] = bitmap_alloc0(s);
-		if (!buddy->bits[i])
-			goto err_out_free_each_bit_per_order;
-	}
+	for (i = 0; i <= buddy->max_order; ++i)
+		nlongs += dr_buddy_init_order(&buddy->orders[i],
+					      1ULL << (buddy->max_order - i),
+					      NULL);
 
-	for (i = 0; i <= buddy->max_order; ++i) {
-		s = BITS_TO_LONGS(1 << (buddy->max_order - i));
-		buddy->set_bit[i] = bitmap_alloc0(s);
-		if (!buddy->set_bit[i])
-			goto err_out_free_set;
+	buddy->bitmap = calloc(nlongs, sizeof(long));
+	if (!buddy->bitmap) {
+		free(buddy->orders);
+		errno = ENOMEM;
+		return ENOMEM;
 	}
 
-	bitmap_set_bit(buddy->bits[buddy->max_order], 0);
-	bitmap_set_bit(buddy->set_bit[buddy->max_order], 0);
+	for (i = 0, nlongs = 0; i <= buddy->max_order; ++i)
+		nlongs += dr_buddy_init_order(&buddy->orders[i],
+					      1ULL << (buddy->max_order - i),
+					      buddy->bitmap + nlongs);
 
-	buddy->num_free[buddy->max_order] = 1;
+	/* Only the single segment of the maximum order is free */
+	dr_buddy_set_free(&buddy->orders[buddy->max_order], 0);
 
 	return 0;
-
-err_out_free_set:
-	for (i = 0; i <= buddy->max_order; ++i)
-		free(buddy->set_bit[i]);
-
-err_out_free_each_bit_per_order:
-	free(buddy->set_bit);
-
-	for (i = 0; i <= buddy->max_order; ++i)
-		free(buddy->bits[i]);
-
-err_out_free_num_free:
-	free(buddy->num_free);
-
-err_out_free_bits:
-	free(buddy->bits);
-	errno = ENOMEM;
-	return ENOMEM;
 }
 
 void dr_buddy_cleanup(struct dr_icm_buddy_mem *buddy)
 {
-	int i;
-
 	list_del(&buddy->list_node);
 
-	for (i = 0; i <= buddy->max_order; ++i) {
-		free(buddy->bits[i]);
-		free(buddy->set_bit[i]);
-	}
-
-	free(buddy->set_bit);
-	free(buddy->num_free);
-	free(buddy->bits);
+	free(buddy->bitmap);
+	free(buddy->orders);
 }
 
-/*
- * Find the borders (high and low) of specific seg (segment location)
- * of the lower level of the bitmap in order to mark the upper layer
- * of bitmap.
- */
-static void dr_buddy_get_seg_borders(uint32_t seg,
-				     uint32_t *low,
-				     uint32_t *high)
+/* Whether a segment of this order could be allocated, without allocating it */
+bool dr_buddy_has_free(struct dr_icm_buddy_mem *buddy, int order)
 {
-	*low = (seg / BITS_PER_LONG) * BITS_PER_LONG;
-	*high = ((seg / BITS_PER_LONG) + 1) * BITS_PER_LONG;
-}
+	int o;
 
-/*
- * We have two layers of searching in the bitmaps, so when needed update the
- * second layer of search.
- */
-static void dr_buddy_update_upper_bitmap(struct dr_icm_buddy_mem *buddy,
-					 uint32_t seg, int order)
-{
-	uint32_t h, l, m;
+	for (o = order; o <= buddy->max_order; ++o)
+		if (buddy->orders[o].num_free)
+			return true;
 
-	/* clear upper layer of search if needed */
-	dr_buddy_get_seg_borders(seg, &l, &h);
-	m = bitmap_find_first_bit(buddy->bits[order], l, h);
-	if (m == h) /* nothing in the long that includes seg */
-		bitmap_clear_bit(buddy->set_bit[order], seg / BITS_PER_LONG);
+	return false;
 }
 
 /*
@@ -176,28 +180,18 @@ static void dr_buddy_update_upper_bitmap(struct dr_icm_buddy_mem *buddy,
  */
 int dr_buddy_alloc_mem(struct dr_icm_buddy_mem *buddy, int order)
 {
-	int seg;
-	int o, m;
+	uint32_t seg;
+	int o;
 
 	for (o = order; o <= buddy->max_order; ++o)
-		if (buddy->num_free[o]) {
-			m = 1 << (buddy->max_order - o);
-			seg = dr_find_first_bit(buddy->set_bit[o], buddy->bits[o], m);
-			if (m <= seg) {
-				/* not found free mem, but there are free mem */
-				assert(false);
-				return -1;
-			}
+		if (buddy->orders[o].num_free)
 			goto found;
-		}
 
 	return -1;
 
 found:
-	bitmap_clear_bit(buddy->bits[o], seg);
-	/* clear upper layer of search if needed */
-	dr_buddy_update_upper_bitmap(buddy, seg, o);
-	--buddy->num_free[o];
+	seg = dr_buddy_find_free(&buddy->orders[o]);
+	dr_buddy_clear_free(&buddy->orders[o], seg);
 	/* if we find free memory in some order that it is bigger than the
 	 * required order, we need to devied each order between the required to
 	 * the found one to 2, and mark accordingly.
@@ -205,10 +199,7 @@ found:
 	while (o > order) {
 		--o;
 		seg <<= 1;
-		bitmap_set_bit(buddy->bits[o], seg ^ 1);
-		bitmap_set_bit(buddy->set_bit[o], (seg ^ 1) / BITS_PER_LONG);
-
-		++buddy->num_free[o];
+		dr_buddy_set_free(&buddy->orders[o], seg ^ 1);
 	}
 
 	seg <<= order;
@@ -222,16 +213,12 @@ dr_buddy_free_mem(struct dr_icm_buddy_mem *buddy, uint32_t seg, int order)
 	seg >>= order;
 
 	/* whenever a segment is free, the mem is added to the buddy that gave it */
-	while (bitmap_test_bit(buddy->bits[order], seg ^ 1)) {
-		bitmap_clear_bit(buddy->bits[order], seg ^ 1);
-		dr_buddy_update_upper_bitmap(buddy, seg ^ 1, order);
-		--buddy->num_free[order];
+	while (order < buddy->max_order &&
+	       dr_buddy_is_free(&buddy->orders[order], seg ^ 1)) {
+		dr_buddy_clear_free(&buddy->orders[order], seg ^ 1);
 		seg >>= 1;
 		++order;
 	}
-	bitmap_set_bit(buddy->bits[order], seg);
-	bitmap_set_bit(buddy->set_bit[order], seg / BITS_PER_LONG);
 
-	++buddy->num_free[order];
+	dr_buddy_set_free(&buddy->orders[order], seg);
 }
-
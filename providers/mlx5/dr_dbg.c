@@ -30,8 +30,10 @@
  * SOFTWARE.
  */
 
+#include <stdarg.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <ccan/array_size.h>
 #include "mlx5dv_dr.h"
 
 #define BUFF_SIZE	1024
@@ -83,6 +85,10 @@ enum dr_dump_rec_type {
 	DR_DUMP_REC_TYPE_ACTION_ASO_CT = 3419,
 	DR_DUMP_REC_TYPE_ACTION_MISS = 3423,
 	DR_DUMP_REC_TYPE_ACTION_ROOT_FT = 3424,
+
+	DR_DUMP_REC_TYPE_LOOKUP_RX = 3500,
+	DR_DUMP_REC_TYPE_LOOKUP_TX = 3501,
+	DR_DUMP_REC_TYPE_LOOKUP_STE = 3502,
 };
 
 static uint64_t dr_dump_icm_to_idx(uint64_t icm_addr)
@@ -92,189 +98,505 @@ static uint64_t dr_dump_icm_to_idx(uint64_t icm_addr)
 
 static void dump_hex_print(char *dest, char *src, uint32_t size)
 {
-	int i;
+	static const char hex[] = "0123456789abcdef";
+	uint32_t i;
+
+	/* Hot for big dumps, avoid going through sprintf per byte */
+	for (i = 0; i < size; i++) {
+		dest[2 * i] = hex[(uint8_t)src[i] >> 4];
+		dest[2 * i + 1] = hex[(uint8_t)src[i] & 0xf];
+	}
+	dest[2 * i] = '\0';
+}
+
+/* While the domain is locked the objects are only copied to a binary
+ * snapshot, the records are formatted and written to the user file once
+ * the locks are released.  Rule insertion is only held up by the copy,
+ * not by the formatting nor by a slow output file.
+ */
+#define DR_DUMP_CHUNK_SIZE	(64 * 1024)
+
+struct dr_dump_chunk {
+	struct dr_dump_chunk	*next;
+	size_t			size;
+	size_t			used;
+	uint8_t			data[];
+};
+
+struct dr_dump_snap {
+	struct dr_dump_chunk	*head;
+	struct dr_dump_chunk	*tail;
+};
+
+enum dr_dump_snap_kind {
+	/* rec_type followed by the values, and the blob in hex */
+	DR_DUMP_SNAP_VALS,
+	/* Same with the blob as a list of 8 byte big endian values */
+	DR_DUMP_SNAP_VALS_HEX64,
+	/* vals[0] is the matcher, vals[1] the criteria, the blob the mask */
+	DR_DUMP_SNAP_MASK,
+	/* A line formatted under the lock, only for the few domain records */
+	DR_DUMP_SNAP_TEXT,
+};
+
+struct dr_dump_snap_rec {
+	uint32_t	len;
+	uint16_t	rec_type;
+	uint8_t		kind;
+	uint8_t		num_vals;
+	/* Bit per value printed in decimal rather than in hex */
+	uint16_t	dec_mask;
+	uint32_t	blob_len;
+	uint64_t	vals[];
+};
+
+#define DR_DUMP_DEC(i)	(1 << (i))
+
+static struct dr_dump_snap_rec *
+dr_dump_rec_alloc(struct dr_dump_snap *s, enum dr_dump_snap_kind kind,
+		  uint16_t rec_type, int num_vals, size_t blob_len)
+{
+	struct dr_dump_snap_rec *rec;
+	struct dr_dump_chunk *chunk = s->tail;
+	size_t len;
+
+	len = align(sizeof(*rec) + num_vals * sizeof(uint64_t) + blob_len,
+		    sizeof(uint64_t));
+
+	if (!chunk || chunk->size - chunk->used < len) {
+		chunk = malloc(sizeof(*chunk) + max_t(size_t, len,
+						      DR_DUMP_CHUNK_SIZE));
+		if (!chunk)
+			return NULL;
+
+		chunk->next = NULL;
+		chunk->size = max_t(size_t, len, DR_DUMP_CHUNK_SIZE);
+		chunk->used = 0;
+		if (s->tail)
+			s->tail->next = chunk;
+		else
+			s->head = chunk;
+		s->tail = chunk;
+	}
+
+	rec = (struct dr_dump_snap_rec *)(chunk->data + chunk->used);
+	chunk->used += len;
+
+	rec->len = len;
+	rec->rec_type = rec_type;
+	rec->kind = kind;
+	rec->num_vals = num_vals;
+	rec->dec_mask = 0;
+	rec->blob_len = blob_len;
+	return rec;
+}
+
+static int dr_dump_vals_blob(struct dr_dump_snap *s, uint16_t rec_type,
+			     uint16_t dec_mask, const uint64_t *vals,
+			     int num_vals, enum dr_dump_snap_kind kind,
+			     const void *blob, size_t blob_len)
+{
+	struct dr_dump_snap_rec *rec;
 
-	for (i = 0; i < size; i++)
-		sprintf(&dest[2 * i], "%02x", (uint8_t)src[i]);
+	rec = dr_dump_rec_alloc(s, kind, rec_type, num_vals, blob_len);
+	if (!rec)
+		return -ENOMEM;
+
+	rec->dec_mask = dec_mask;
+	memcpy(rec->vals, vals, num_vals * sizeof(*vals));
+	if (blob_len)
+		memcpy(&rec->vals[num_vals], blob, blob_len);
+	return 0;
 }
 
-static int dr_dump_rule_action(FILE *f, const uint64_t rule_id,
+static int dr_dump_vals(struct dr_dump_snap *s, uint16_t rec_type,
+			uint16_t dec_mask, const uint64_t *vals, int num_vals)
+{
+	return dr_dump_vals_blob(s, rec_type, dec_mask, vals, num_vals,
+				 DR_DUMP_SNAP_VALS, NULL, 0);
+}
+
+static int dr_dump_text(struct dr_dump_snap *s, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static int dr_dump_text(struct dr_dump_snap *s, const char *fmt, ...)
+{
+	struct dr_dump_snap_rec *rec;
+	char line[BUFF_SIZE];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return len;
+	if (len >= (int)sizeof(line))
+		len = sizeof(line) - 1;
+
+	rec = dr_dump_rec_alloc(s, DR_DUMP_SNAP_TEXT, 0, 0, len + 1);
+	if (!rec)
+		return -ENOMEM;
+
+	memcpy(rec->vals, line, len + 1);
+	return 0;
+}
+
+static int dr_dump_write_mask(FILE *f, struct dr_dump_snap_rec *rec)
+{
+	struct dr_match_param *mask = (struct dr_match_param *)&rec->vals[2];
+	uint8_t criteria = rec->vals[1];
+	char dump[BUFF_SIZE];
+	int ret;
+
+	ret = fprintf(f, "%d,0x%" PRIx64 ",", DR_DUMP_REC_TYPE_MATCHER_MASK,
+		      rec->vals[0]);
+	if (ret < 0)
+		return ret;
+
+	if (criteria & DR_MATCHER_CRITERIA_OUTER) {
+		dump_hex_print(dump, (char *)&mask->outer, sizeof(mask->outer));
+		ret = fprintf(f, "%s,", dump);
+	} else {
+		ret = fprintf(f, ",");
+	}
+
+	if (ret < 0)
+		return ret;
+
+	if (criteria & DR_MATCHER_CRITERIA_INNER) {
+		dump_hex_print(dump, (char *)&mask->inner, sizeof(mask->inner));
+		ret = fprintf(f, "%s,", dump);
+	} else {
+		ret = fprintf(f, ",");
+	}
+
+	if (ret < 0)
+		return ret;
+
+	if (criteria & DR_MATCHER_CRITERIA_MISC) {
+		dump_hex_print(dump, (char *)&mask->misc, sizeof(mask->misc));
+		ret = fprintf(f, "%s,", dump);
+	} else {
+		ret = fprintf(f, ",");
+	}
+
+	if (ret < 0)
+		return ret;
+
+	if (criteria & DR_MATCHER_CRITERIA_MISC2) {
+		dump_hex_print(dump, (char *)&mask->misc2, sizeof(mask->misc2));
+		ret = fprintf(f, "%s,", dump);
+	} else {
+		ret = fprintf(f, ",");
+	}
+
+	if (ret < 0)
+		return ret;
+
+	if (criteria & DR_MATCHER_CRITERIA_MISC3) {
+		dump_hex_print(dump, (char *)&mask->misc3, sizeof(mask->misc3));
+		ret = fprintf(f, "%s,", dump);
+	} else {
+		ret = fprintf(f, ",");
+	}
+
+	if (criteria & DR_MATCHER_CRITERIA_MISC4) {
+		dump_hex_print(dump, (char *)&mask->misc4, sizeof(mask->misc4));
+		ret = fprintf(f, "%s,", dump);
+	} else {
+		ret = fprintf(f, ",");
+	}
+
+	if (criteria & DR_MATCHER_CRITERIA_MISC5) {
+		dump_hex_print(dump, (char *)&mask->misc5, sizeof(mask->misc5));
+		ret = fprintf(f, "%s\n", dump);
+	} else {
+		ret = fprintf(f, ",\n");
+	}
+
+	return ret;
+}
+
+static int dr_dump_write_rec(FILE *f, struct dr_dump_snap_rec *rec)
+{
+	char *blob = (char *)&rec->vals[rec->num_vals];
+	char dump[BUFF_SIZE];
+	uint32_t off;
+	int ret, i;
+
+	switch (rec->kind) {
+	case DR_DUMP_SNAP_TEXT:
+		return fputs(blob, f) == EOF ? -EIO : 0;
+	case DR_DUMP_SNAP_MASK:
+		return dr_dump_write_mask(f, rec);
+	default:
+		break;
+	}
+
+	ret = fprintf(f, "%d", rec->rec_type);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < rec->num_vals; i++) {
+		if (rec->dec_mask & DR_DUMP_DEC(i))
+			ret = fprintf(f, ",%" PRId64, (int64_t)rec->vals[i]);
+		else
+			ret = fprintf(f, ",0x%" PRIx64, rec->vals[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (rec->kind == DR_DUMP_SNAP_VALS_HEX64) {
+		for (off = 0; off + sizeof(uint64_t) <= rec->blob_len;
+		     off += sizeof(uint64_t)) {
+			dump_hex_print(dump, blob + off, sizeof(uint64_t));
+			ret = fprintf(f, ",0x%s", dump);
+			if (ret < 0)
+				return ret;
+		}
+	} else if (rec->blob_len) {
+		dump_hex_print(dump, blob, rec->blob_len);
+		ret = fprintf(f, ",%s", dump);
+		if (ret < 0)
+			return ret;
+	}
+
+	return fputc('\n', f) == EOF ? -EIO : 0;
+}
+
+/* Write the snapshot taken when ret is not an error, and free it */
+static int dr_dump_snap_flush(struct dr_dump_snap *s, FILE *fout, int ret)
+{
+	struct dr_dump_chunk *chunk, *next;
+	size_t off;
+
+	for (chunk = s->head; chunk; chunk = next) {
+		for (off = 0; ret >= 0 && off < chunk->used;) {
+			struct dr_dump_snap_rec *rec =
+				(struct dr_dump_snap_rec *)(chunk->data + off);
+
+			ret = dr_dump_write_rec(fout, rec);
+			off += rec->len;
+		}
+		next = chunk->next;
+		free(chunk);
+	}
+
+	return ret < 0 ? ret : 0;
+}
+
+static int dr_dump_rule_action(struct dr_dump_snap *s, const uint64_t rule_id,
 			       struct mlx5dv_dr_action *action)
 {
 	const uint64_t action_id = (uint64_t) (uintptr_t) action;
-	int ret;
 
 	switch (action->action_type) {
 	case DR_ACTION_TYP_DROP:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 "\n",
-			      DR_DUMP_REC_TYPE_ACTION_DROP, action_id, rule_id);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_DROP, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_FT:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x,0x%" PRIx64 "\n",
-			      DR_DUMP_REC_TYPE_ACTION_FT, action_id, rule_id,
-			      action->dest_tbl->devx_obj->object_id,
-			      (uint64_t)(uintptr_t)action->dest_tbl);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    action->dest_tbl->devx_obj->object_id,
+				    (uint64_t)(uintptr_t)action->dest_tbl };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_FT, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_QP:
-		if (action->dest_qp.is_qp)
-			ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x\n",
-				      DR_DUMP_REC_TYPE_ACTION_QP, action_id,
-				      rule_id, action->dest_qp.qp->qp_num);
-		else
-			ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%" PRIx64 "\n",
-				      DR_DUMP_REC_TYPE_ACTION_DEVX_TIR, action_id,
-				      rule_id, action->dest_qp.devx_tir->rx_icm_addr);
-		break;
+		if (action->dest_qp.is_qp) {
+			uint64_t vals[] = { action_id, rule_id,
+					    action->dest_qp.qp->qp_num };
+
+			return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_QP, 0,
+					    vals, ARRAY_SIZE(vals));
+		} else {
+			uint64_t vals[] = { action_id, rule_id,
+					    action->dest_qp.devx_tir->rx_icm_addr };
+
+			return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_DEVX_TIR,
+					    0, vals, ARRAY_SIZE(vals));
+		}
 	case DR_ACTION_TYP_CTR:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x\n",
-			      DR_DUMP_REC_TYPE_ACTION_CTR, action_id, rule_id,
-			      action->ctr.devx_obj->object_id +
-			      action->ctr.offset);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    action->ctr.devx_obj->object_id +
+				    action->ctr.offset };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_CTR, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_TAG:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x\n",
-			      DR_DUMP_REC_TYPE_ACTION_TAG, action_id, rule_id,
-			      action->flow_tag);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id, action->flow_tag };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_TAG, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_MODIFY_HDR:
 	{
 		struct dr_ptrn_obj *ptrn = action->rewrite.ptrn_arg.ptrn;
 		struct dr_rewrite_param *param = &action->rewrite.param;
 		struct dr_arg_obj *arg = action->rewrite.ptrn_arg.arg;
-		bool ptrn_in_use = false;
-		int i;
-
-		if (!action->rewrite.single_action_opt && ptrn && arg)
-			ptrn_in_use = true;
-
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x,%d,0x%x,0x%" PRIx32 ",0x%" PRIx32,
-			      DR_DUMP_REC_TYPE_ACTION_MODIFY_HDR, action_id,
-			      rule_id, param->index,
-			      action->rewrite.single_action_opt,
-			      ptrn_in_use ? param->num_of_actions : 0,
-			      ptrn_in_use ? ptrn->rewrite_param.index : 0,
-			      ptrn_in_use ? dr_arg_get_object_id(arg) : 0);
-		if (ret < 0)
-			return ret;
-
-		if (ptrn_in_use) {
-			for (i = 0; i < param->num_of_actions; i++) {
-				ret = fprintf(f, ",0x%016" PRIx64,
-					      be64toh(((__be64 *)param->data)[i]));
-				if (ret < 0)
-					return ret;
-			}
-		}
-		ret = fprintf(f, "\n");
-		break;
+		bool ptrn_in_use = !action->rewrite.single_action_opt &&
+				   ptrn && arg;
+		uint64_t vals[] = { action_id, rule_id, param->index,
+				    action->rewrite.single_action_opt,
+				    ptrn_in_use ? param->num_of_actions : 0,
+				    ptrn_in_use ? ptrn->rewrite_param.index : 0,
+				    ptrn_in_use ? dr_arg_get_object_id(arg) : 0 };
+
+		/* The actions are big endian, their bytes are the hex digits */
+		return dr_dump_vals_blob(s, DR_DUMP_REC_TYPE_ACTION_MODIFY_HDR,
+					 DR_DUMP_DEC(3), vals, ARRAY_SIZE(vals),
+					 DR_DUMP_SNAP_VALS_HEX64, param->data,
+					 ptrn_in_use ? param->num_of_actions *
+						       sizeof(__be64) : 0);
 	}
 	case DR_ACTION_TYP_VPORT:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x\n",
-			      DR_DUMP_REC_TYPE_ACTION_VPORT, action_id, rule_id,
-			      action->vport.caps->num);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id, action->vport.caps->num };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_VPORT, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_TNL_L2_TO_L2:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 "\n",
-			      DR_DUMP_REC_TYPE_ACTION_DECAP_L2, action_id,
-			      rule_id);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_DECAP_L2, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_TNL_L3_TO_L2:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x\n",
-			      DR_DUMP_REC_TYPE_ACTION_DECAP_L3, action_id,
-			      rule_id, action->rewrite.param.index);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    action->rewrite.param.index };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_DECAP_L3, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_L2_TO_TNL_L2:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x\n",
-			      DR_DUMP_REC_TYPE_ACTION_ENCAP_L2, action_id,
-			      rule_id, dr_actions_reformat_get_id(action));
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    dr_actions_reformat_get_id(action) };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_ENCAP_L2, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_L2_TO_TNL_L3:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x\n",
-			      DR_DUMP_REC_TYPE_ACTION_ENCAP_L3, action_id,
-			      rule_id, dr_actions_reformat_get_id(action));
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    dr_actions_reformat_get_id(action) };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_ENCAP_L3, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_METER:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%" PRIx64 ",0x%x,0x%" PRIx64 ",0x%" PRIx64 "\n",
-			      DR_DUMP_REC_TYPE_ACTION_METER,
-			      action_id,
-			      rule_id,
-			      (uint64_t)(uintptr_t)action->meter.next_ft,
-			      action->meter.devx_obj->object_id,
-			      action->meter.rx_icm_addr,
-			      action->meter.tx_icm_addr);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    (uint64_t)(uintptr_t)action->meter.next_ft,
+				    action->meter.devx_obj->object_id,
+				    action->meter.rx_icm_addr,
+				    action->meter.tx_icm_addr };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_METER, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_SAMPLER:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%" PRIx64 ",0x%x,0x%x,0x%" PRIx64 ",0x%" PRIx64 "\n",
-			      DR_DUMP_REC_TYPE_ACTION_SAMPLER,
-			      action_id,
-			      rule_id,
-			      (uint64_t)(uintptr_t)action->sampler.sampler_default->next_ft,
-			      action->sampler.term_tbl->devx_tbl->ft_dvo->object_id,
-			      action->sampler.sampler_default->devx_obj->object_id,
-			      action->sampler.sampler_default->rx_icm_addr,
-			      (action->sampler.sampler_restore) ?
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    (uint64_t)(uintptr_t)action->sampler.sampler_default->next_ft,
+				    action->sampler.term_tbl->devx_tbl->ft_dvo->object_id,
+				    action->sampler.sampler_default->devx_obj->object_id,
+				    action->sampler.sampler_default->rx_icm_addr,
+				    (action->sampler.sampler_restore) ?
 					action->sampler.sampler_restore->tx_icm_addr :
-					action->sampler.sampler_default->tx_icm_addr);
-		break;
+					action->sampler.sampler_default->tx_icm_addr };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_SAMPLER, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_DEST_ARRAY:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x,0x%" PRIx64 ",0x%" PRIx64 "\n",
-			      DR_DUMP_REC_TYPE_ACTION_DEST_ARRAY, action_id, rule_id,
-			      action->dest_array.devx_tbl->ft_dvo->object_id,
-			      action->dest_array.rx_icm_addr,
-			      action->dest_array.tx_icm_addr);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    action->dest_array.devx_tbl->ft_dvo->object_id,
+				    action->dest_array.rx_icm_addr,
+				    action->dest_array.tx_icm_addr };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_DEST_ARRAY, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_POP_VLAN:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 "\n",
-			      DR_DUMP_REC_TYPE_ACTION_POP_VLAN, action_id,
-			      rule_id);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_POP_VLAN, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_PUSH_VLAN:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x\n",
-			      DR_DUMP_REC_TYPE_ACTION_PUSH_VLAN, action_id,
-			      rule_id, action->push_vlan.vlan_hdr);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    action->push_vlan.vlan_hdr };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_PUSH_VLAN, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_ASO_FIRST_HIT:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x\n",
-			      DR_DUMP_REC_TYPE_ACTION_ASO_FIRST_HIT, action_id,
-			      rule_id, action->aso.devx_obj->object_id);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    action->aso.devx_obj->object_id };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_ASO_FIRST_HIT, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_ASO_FLOW_METER:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x\n",
-			      DR_DUMP_REC_TYPE_ACTION_ASO_FLOW_METER, action_id,
-			      rule_id, action->aso.devx_obj->object_id);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    action->aso.devx_obj->object_id };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_ASO_FLOW_METER,
+				    0, vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_ASO_CT:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x\n",
-			      DR_DUMP_REC_TYPE_ACTION_ASO_CT, action_id,
-			      rule_id, action->aso.devx_obj->object_id);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    action->aso.devx_obj->object_id };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_ASO_CT, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_MISS:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 "\n",
-			      DR_DUMP_REC_TYPE_ACTION_MISS, action_id, rule_id);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_MISS, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	case DR_ACTION_TYP_ROOT_FT:
-		ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x\n",
-			      DR_DUMP_REC_TYPE_ACTION_ROOT_FT, action_id,
-			      rule_id,
-			      action->root_tbl.devx_tbl->ft_dvo->object_id);
-		break;
+	{
+		uint64_t vals[] = { action_id, rule_id,
+				    action->root_tbl.devx_tbl->ft_dvo->object_id };
+
+		return dr_dump_vals(s, DR_DUMP_REC_TYPE_ACTION_ROOT_FT, 0,
+				    vals, ARRAY_SIZE(vals));
+	}
 	default:
 		return 0;
 	}
-
-	if (ret < 0)
-		return ret;
-
-	return 0;
 }
 
-static int dr_dump_rule_mem(FILE *f, struct dr_ste *ste,
+static int dr_dump_rule_mem(struct dr_dump_snap *s, struct dr_ste *ste,
 			    bool is_rx, const uint64_t rule_id,
 			    enum mlx5_ifc_steering_format_version format_ver)
 {
-	char hw_ste_dump[BUFF_SIZE] = {};
+	uint64_t vals[] = { dr_dump_icm_to_idx(dr_ste_get_icm_addr(ste)),
+			    rule_id };
 	enum dr_dump_rec_type mem_rec_type;
-	int ret;
 
 	if (format_ver == MLX5_HW_CONNECTX_5) {
 		mem_rec_type = is_rx ? DR_DUMP_REC_TYPE_RULE_RX_ENTRY_V0 :
@@ -284,19 +606,12 @@ static int dr_dump_rule_mem(FILE *f, struct dr_ste *ste,
 				       DR_DUMP_REC_TYPE_RULE_TX_ENTRY_V1;
 	}
 
-	dump_hex_print(hw_ste_dump, (char *)ste->hw_ste, ste->size);
-	ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",%s\n",
-		      mem_rec_type,
-		      dr_dump_icm_to_idx(dr_ste_get_icm_addr(ste)),
-		      rule_id,
-		      hw_ste_dump);
-	if (ret < 0)
-		return ret;
-
-	return 0;
+	return dr_dump_vals_blob(s, mem_rec_type, 0, vals, ARRAY_SIZE(vals),
+				 DR_DUMP_SNAP_VALS, ste->hw_ste, ste->size);
 }
 
-static int dr_dump_rule_rx_tx(FILE *f, struct dr_rule_rx_tx *nic_rule,
+static int dr_dump_rule_rx_tx(struct dr_dump_snap *s,
+			      struct dr_rule_rx_tx *nic_rule,
 			      bool is_rx, const uint64_t rule_id,
 			      enum mlx5_ifc_steering_format_version format_ver)
 {
@@ -307,7 +622,7 @@ static int dr_dump_rule_rx_tx(FILE *f, struct dr_rule_rx_tx *nic_rule,
 	dr_rule_get_reverse_rule_members(ste_arr, curr_ste, &i);
 
 	while (i--) {
-		ret = dr_dump_rule_mem(f, ste_arr[i], is_rx, rule_id, format_ver);
+		ret = dr_dump_rule_mem(s, ste_arr[i], is_rx, rule_id, format_ver);
 		if (ret < 0)
 			return ret;
 	}
@@ -315,34 +630,32 @@ static int dr_dump_rule_rx_tx(FILE *f, struct dr_rule_rx_tx *nic_rule,
 	return 0;
 }
 
-static int dr_dump_rule(FILE *f, struct mlx5dv_dr_rule *rule)
+static int dr_dump_rule(struct dr_dump_snap *s, struct mlx5dv_dr_rule *rule)
 {
 	const uint64_t rule_id = (uint64_t) (uintptr_t) rule;
 	enum mlx5_ifc_steering_format_version format_ver;
 	struct dr_rule_rx_tx *rx = &rule->rx;
 	struct dr_rule_rx_tx *tx = &rule->tx;
+	uint64_t vals[] = { rule_id, (uint64_t) (uintptr_t) rule->matcher };
 	int ret;
 	int i;
 
 	format_ver = rule->matcher->tbl->dmn->info.caps.sw_format_ver;
 
-	ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 "\n",
-		      DR_DUMP_REC_TYPE_RULE,
-		      rule_id,
-		      (uint64_t) (uintptr_t) rule->matcher);
+	ret = dr_dump_vals(s, DR_DUMP_REC_TYPE_RULE, 0, vals, ARRAY_SIZE(vals));
 	if (ret < 0)
 		return ret;
 
 	if (!dr_is_root_table(rule->matcher->tbl)) {
 		if (rx->nic_matcher) {
-			ret = dr_dump_rule_rx_tx(f, rx, true, rule_id,
+			ret = dr_dump_rule_rx_tx(s, rx, true, rule_id,
 						 format_ver);
 			if (ret < 0)
 				return ret;
 		}
 
 		if (tx->nic_matcher) {
-			ret = dr_dump_rule_rx_tx(f, tx, false, rule_id,
+			ret = dr_dump_rule_rx_tx(s, tx, false, rule_id,
 						 format_ver);
 			if (ret < 0)
 				return ret;
@@ -350,7 +663,7 @@ static int dr_dump_rule(FILE *f, struct mlx5dv_dr_rule *rule)
 	}
 
 	for (i = 0; i < rule->num_actions; i++) {
-		ret = dr_dump_rule_action(f, rule_id, rule->actions[i]);
+		ret = dr_dump_rule_action(s, rule_id, rule->actions[i]);
 		if (ret < 0)
 			return ret;
 	}
@@ -358,127 +671,54 @@ static int dr_dump_rule(FILE *f, struct mlx5dv_dr_rule *rule)
 	return 0;
 }
 
-static int dr_dump_matcher_mask(FILE *f, struct dr_match_param *mask,
-				 uint8_t criteria, const uint64_t matcher_id)
+static int dr_dump_matcher_mask(struct dr_dump_snap *s,
+				struct dr_match_param *mask,
+				uint8_t criteria, const uint64_t matcher_id)
 {
-	char dump[BUFF_SIZE] = {};
-	int ret;
+	uint64_t vals[] = { matcher_id, criteria };
 
-	ret = fprintf(f, "%d,0x%" PRIx64 ",", DR_DUMP_REC_TYPE_MATCHER_MASK, matcher_id);
-	if (ret < 0)
-		return ret;
-
-	if (criteria & DR_MATCHER_CRITERIA_OUTER) {
-		dump_hex_print(dump, (char *)&mask->outer, sizeof(mask->outer));
-		ret = fprintf(f, "%s,", dump);
-	} else {
-		ret = fprintf(f, ",");
-	}
-
-	if (ret < 0)
-		return ret;
-
-	if (criteria & DR_MATCHER_CRITERIA_INNER) {
-		dump_hex_print(dump, (char *)&mask->inner, sizeof(mask->inner));
-		ret = fprintf(f, "%s,", dump);
-	} else {
-		ret = fprintf(f, ",");
-	}
-
-
-	if (ret < 0)
-		return ret;
-
-	if (criteria & DR_MATCHER_CRITERIA_MISC) {
-		dump_hex_print(dump, (char *)&mask->misc, sizeof(mask->misc));
-		ret = fprintf(f, "%s,", dump);
-	} else {
-		ret = fprintf(f, ",");
-	}
-
-	if (ret < 0)
-		return ret;
-
-	if (criteria & DR_MATCHER_CRITERIA_MISC2) {
-		dump_hex_print(dump, (char *)&mask->misc2, sizeof(mask->misc2));
-		ret = fprintf(f, "%s,", dump);
-	} else {
-		ret = fprintf(f, ",");
-	}
-
-	if (ret < 0)
-		return ret;
-
-	if (criteria & DR_MATCHER_CRITERIA_MISC3) {
-		dump_hex_print(dump, (char *)&mask->misc3, sizeof(mask->misc3));
-		ret = fprintf(f, "%s,", dump);
-	} else {
-		ret = fprintf(f, ",");
-	}
-
-	if (criteria & DR_MATCHER_CRITERIA_MISC4) {
-		dump_hex_print(dump, (char *)&mask->misc4, sizeof(mask->misc4));
-		ret = fprintf(f, "%s,", dump);
-	} else {
-		ret = fprintf(f, ",");
-	}
-
-	if (criteria & DR_MATCHER_CRITERIA_MISC5) {
-		dump_hex_print(dump, (char *)&mask->misc5, sizeof(mask->misc5));
-		ret = fprintf(f, "%s\n", dump);
-	} else {
-		ret = fprintf(f, ",\n");
-	}
-
-	if (ret < 0)
-		return ret;
-
-	return 0;
+	return dr_dump_vals_blob(s, DR_DUMP_REC_TYPE_MATCHER_MASK, 0,
+				 vals, ARRAY_SIZE(vals), DR_DUMP_SNAP_MASK,
+				 mask, sizeof(*mask));
 }
 
-static int dr_dump_matcher_builder(FILE *f, struct dr_ste_build *builder,
+static int dr_dump_matcher_builder(struct dr_dump_snap *s,
+				   struct dr_ste_build *builder,
 				   uint32_t index, bool is_rx,
 				   const uint64_t matcher_id)
 {
 	bool is_match = builder->htbl_type == DR_STE_HTBL_TYPE_MATCH;
-	int ret;
+	uint64_t vals[] = { matcher_id, index, is_rx, builder->lu_type,
+			    is_match ? builder->format_id : -1 };
 
-	ret = fprintf(f, "%d,0x%" PRIx64 ",%d,%d,0x%x,%d\n",
-		      DR_DUMP_REC_TYPE_MATCHER_BUILDER,
-		      matcher_id,
-		      index,
-		      is_rx,
-		      builder->lu_type,
-		      is_match ? builder->format_id : -1);
-	if (ret < 0)
-		return ret;
-
-	return 0;
+	return dr_dump_vals(s, DR_DUMP_REC_TYPE_MATCHER_BUILDER,
+			    DR_DUMP_DEC(1) | DR_DUMP_DEC(2) | DR_DUMP_DEC(4),
+			    vals, ARRAY_SIZE(vals));
 }
 
-static int dr_dump_matcher_rx_tx(FILE *f, bool is_rx,
+static int dr_dump_matcher_rx_tx(struct dr_dump_snap *s, bool is_rx,
 				 struct dr_matcher_rx_tx *matcher_rx_tx,
 				 const uint64_t matcher_id)
 {
 	enum dr_dump_rec_type rec_type;
 	int i, ret;
+	uint64_t vals[] = { (uint64_t) (uintptr_t) matcher_rx_tx,
+			    matcher_id,
+			    matcher_rx_tx->num_of_builders,
+			    dr_dump_icm_to_idx(dr_icm_pool_get_chunk_icm_addr(matcher_rx_tx->s_htbl->chunk)),
+			    dr_dump_icm_to_idx(dr_icm_pool_get_chunk_icm_addr(matcher_rx_tx->e_anchor->chunk)),
+			    matcher_rx_tx->fixed_size ? matcher_rx_tx->s_htbl->chunk_size : -1 };
 
 	rec_type = is_rx ? DR_DUMP_REC_TYPE_MATCHER_RX :
 			   DR_DUMP_REC_TYPE_MATCHER_TX;
 
-	ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",%d,0x%" PRIx64 ",0x%" PRIx64 ",%d\n",
-		      rec_type,
-		      (uint64_t) (uintptr_t) matcher_rx_tx,
-		      matcher_id,
-		      matcher_rx_tx->num_of_builders,
-		      dr_dump_icm_to_idx(dr_icm_pool_get_chunk_icm_addr(matcher_rx_tx->s_htbl->chunk)),
-		      dr_dump_icm_to_idx(dr_icm_pool_get_chunk_icm_addr(matcher_rx_tx->e_anchor->chunk)),
-		      matcher_rx_tx->fixed_size ? matcher_rx_tx->s_htbl->chunk_size : -1);
+	ret = dr_dump_vals(s, rec_type, DR_DUMP_DEC(2) | DR_DUMP_DEC(5),
+			   vals, ARRAY_SIZE(vals));
 	if (ret < 0)
 		return ret;
 
 	for (i = 0; i < matcher_rx_tx->num_of_builders; i++) {
-		ret = dr_dump_matcher_builder(f, &matcher_rx_tx->ste_builder[i],
+		ret = dr_dump_matcher_builder(s, &matcher_rx_tx->ste_builder[i],
 					      i, is_rx, matcher_id);
 		if (ret < 0)
 			return ret;
@@ -487,37 +727,34 @@ static int dr_dump_matcher_rx_tx(FILE *f, bool is_rx,
 	return 0;
 }
 
-static int dr_dump_matcher(FILE *f, struct mlx5dv_dr_matcher *matcher)
+static int dr_dump_matcher(struct dr_dump_snap *s,
+			   struct mlx5dv_dr_matcher *matcher)
 {
 	struct dr_matcher_rx_tx *rx = &matcher->rx;
 	struct dr_matcher_rx_tx *tx = &matcher->tx;
-	uint64_t matcher_id;
+	uint64_t matcher_id = (uint64_t) (uintptr_t) matcher;
+	uint64_t vals[] = { matcher_id, (uint64_t) (uintptr_t) matcher->tbl,
+			    matcher->prio };
 	int ret;
 
-	matcher_id = (uint64_t) (uintptr_t) matcher;
-
-	ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",%d\n",
-		      DR_DUMP_REC_TYPE_MATCHER,
-		      matcher_id,
-		      (uint64_t) (uintptr_t) matcher->tbl,
-		      matcher->prio);
+	ret = dr_dump_vals(s, DR_DUMP_REC_TYPE_MATCHER, DR_DUMP_DEC(2),
+			   vals, ARRAY_SIZE(vals));
 	if (ret < 0)
 		return ret;
 
-
 	if (!dr_is_root_table(matcher->tbl)) {
-		ret = dr_dump_matcher_mask(f, &matcher->mask, matcher->match_criteria, matcher_id);
+		ret = dr_dump_matcher_mask(s, &matcher->mask, matcher->match_criteria, matcher_id);
 		if (ret < 0)
 			return ret;
 
 		if (rx->nic_tbl) {
-			ret = dr_dump_matcher_rx_tx(f, true, rx, matcher_id);
+			ret = dr_dump_matcher_rx_tx(s, true, rx, matcher_id);
 			if (ret < 0)
 				return ret;
 		}
 
 		if (tx->nic_tbl) {
-			ret = dr_dump_matcher_rx_tx(f, false, tx, matcher_id);
+			ret = dr_dump_matcher_rx_tx(s, false, tx, matcher_id);
 			if (ret < 0)
 				return ret;
 		}
@@ -526,17 +763,141 @@ static int dr_dump_matcher(FILE *f, struct mlx5dv_dr_matcher *matcher)
 	return 0;
 }
 
-static int dr_dump_matcher_all(FILE *fout, struct mlx5dv_dr_matcher *matcher)
+static int dr_dump_matcher_all(struct dr_dump_snap *s,
+			       struct mlx5dv_dr_matcher *matcher)
 {
 	struct mlx5dv_dr_rule *rule;
 	int ret;
 
-	ret = dr_dump_matcher(fout, matcher);
+	ret = dr_dump_matcher(s, matcher);
 	if (ret < 0)
 		return ret;
 
 	list_for_each(&matcher->rule_list, rule, rule_list) {
-		ret = dr_dump_rule(fout, rule);
+		ret = dr_dump_rule(s, rule);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int dr_dump_lookup_ste(struct dr_dump_snap *s, const uint64_t matcher_id,
+			      struct dr_ste_htbl *htbl, int location,
+			      uint32_t index, int pos, int len,
+			      struct dr_ste *ste)
+{
+	uint64_t vals[] = { matcher_id, location, htbl->chunk_size, index,
+			    pos, len, htbl->ctrl.num_of_valid_entries,
+			    htbl->ctrl.num_of_collisions,
+			    ste ? dr_dump_icm_to_idx(dr_ste_get_icm_addr(ste)) : 0 };
+
+	return dr_dump_vals(s, DR_DUMP_REC_TYPE_LOOKUP_STE,
+			    DR_DUMP_DEC(1) | DR_DUMP_DEC(2) | DR_DUMP_DEC(3) |
+			    DR_DUMP_DEC(4) | DR_DUMP_DEC(5) | DR_DUMP_DEC(6) |
+			    DR_DUMP_DEC(7), vals, ARRAY_SIZE(vals));
+}
+
+/* Walk the matcher hash tables the way the device does for a packet with
+ * the given header values, dumping every table visited on the way.
+ */
+static int dr_dump_lookup_rx_tx(struct dr_dump_snap *s,
+				struct mlx5dv_dr_matcher *matcher,
+				struct dr_matcher_rx_tx *nic_matcher, bool is_rx,
+				struct dr_match_param *pkt)
+{
+	uint8_t hw_ste_arr[DR_RULE_MAX_STES * DR_STE_SIZE] = {};
+	const uint64_t matcher_id = (uint64_t) (uintptr_t) matcher;
+	struct dr_ste_htbl *htbl = nic_matcher->s_htbl;
+	struct dr_match_param param = *pkt;
+	struct mlx5dv_dr_rule *rule = NULL;
+	struct dr_rule_rx_tx *nic_rule;
+	struct dr_ste *ste = NULL;
+	uint64_t vals[4];
+	uint8_t *hw_ste;
+	uint32_t index;
+	int pos, len;
+	int ret, i;
+
+	/* The builders consume the values they used */
+	ret = dr_ste_build_ste_arr(matcher, nic_matcher, &param, hw_ste_arr);
+	if (ret)
+		return -ret;
+
+	for (i = 0; i < nic_matcher->num_of_builders && htbl; i++) {
+		struct dr_ste *cur_ste;
+
+		hw_ste = hw_ste_arr + i * DR_STE_SIZE;
+		index = dr_ste_calc_hash_index(hw_ste, htbl);
+		pos = -1;
+		len = 0;
+		ste = NULL;
+
+		if (!dr_ste_is_not_used(&htbl->ste_arr[index])) {
+			list_for_each(&htbl->miss_list[index], cur_ste, miss_list_node) {
+				if (!ste && dr_ste_equal_tag(cur_ste->hw_ste, hw_ste,
+							     dr_ste_tag_sz(cur_ste))) {
+					ste = cur_ste;
+					pos = len;
+				}
+				len++;
+			}
+		}
+
+		ret = dr_dump_lookup_ste(s, matcher_id, htbl, i + 1, index,
+					 pos, len, ste);
+		if (ret < 0)
+			return ret;
+
+		if (!ste)
+			break;
+
+		htbl = ste->next_htbl;
+	}
+
+	if (ste && i == nic_matcher->num_of_builders && ste->rule_rx_tx) {
+		nic_rule = ste->rule_rx_tx;
+		rule = is_rx ? container_of(nic_rule, struct mlx5dv_dr_rule, rx) :
+			       container_of(nic_rule, struct mlx5dv_dr_rule, tx);
+	}
+
+	vals[0] = (uint64_t) (uintptr_t) nic_matcher;
+	vals[1] = matcher_id;
+	vals[2] = rule ? 1 : 0;
+	vals[3] = (uint64_t) (uintptr_t) rule;
+
+	return dr_dump_vals(s, is_rx ? DR_DUMP_REC_TYPE_LOOKUP_RX :
+				       DR_DUMP_REC_TYPE_LOOKUP_TX,
+			    DR_DUMP_DEC(2), vals, ARRAY_SIZE(vals));
+}
+
+static int dr_dump_lookup(struct dr_dump_snap *s,
+			  struct mlx5dv_dr_matcher *matcher,
+			  struct mlx5dv_flow_match_parameters *value)
+{
+	uint8_t *mask_p = (uint8_t *)&matcher->mask;
+	struct dr_match_param pkt = {};
+	uint8_t *pkt_p = (uint8_t *)&pkt;
+	int ret, i;
+
+	if (value->match_sz > DEVX_ST_SZ_BYTES(dr_match_param) ||
+	    value->match_sz % sizeof(uint32_t))
+		return -EINVAL;
+
+	/* The device only looks at the header bits the matcher masks */
+	dr_ste_copy_param(matcher->match_criteria, &pkt, value->match_buf,
+			  value->match_sz, false);
+	for (i = 0; i < sizeof(pkt); i++)
+		pkt_p[i] &= mask_p[i];
+
+	if (matcher->rx.nic_tbl) {
+		ret = dr_dump_lookup_rx_tx(s, matcher, &matcher->rx, true, &pkt);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (matcher->tx.nic_tbl) {
+		ret = dr_dump_lookup_rx_tx(s, matcher, &matcher->tx, false, &pkt);
 		if (ret < 0)
 			return ret;
 	}
@@ -549,50 +910,44 @@ static uint64_t dr_domain_id_calc(enum mlx5dv_dr_domain_type type)
 	return (getpid() << 8) | (type & 0xff);
 }
 
-static int dr_dump_table_rx_tx(FILE *f, bool is_rx,
+static int dr_dump_table_rx_tx(struct dr_dump_snap *s, bool is_rx,
 			       struct dr_table_rx_tx *table_rx_tx,
 			       const uint64_t table_id)
 {
 	struct dr_icm_chunk *chunk = table_rx_tx->s_anchor->chunk;
 	enum dr_dump_rec_type rec_type;
-	int ret;
+	uint64_t vals[] = { table_id,
+			    dr_dump_icm_to_idx(dr_icm_pool_get_chunk_icm_addr(chunk)) };
 
 	rec_type = is_rx ? DR_DUMP_REC_TYPE_TABLE_RX : DR_DUMP_REC_TYPE_TABLE_TX;
 
-	ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 "\n",
-		      rec_type,
-		      table_id,
-		      dr_dump_icm_to_idx(dr_icm_pool_get_chunk_icm_addr(chunk)));
-	if (ret < 0)
-		return ret;
-
-	return 0;
+	return dr_dump_vals(s, rec_type, 0, vals, ARRAY_SIZE(vals));
 }
 
-static int dr_dump_table(FILE *f, struct mlx5dv_dr_table *table)
+static int dr_dump_table(struct dr_dump_snap *s, struct mlx5dv_dr_table *table)
 {
 	struct dr_table_rx_tx *rx = &table->rx;
 	struct dr_table_rx_tx *tx = &table->tx;
+	uint64_t vals[] = { (uint64_t) (uintptr_t) table,
+			    dr_domain_id_calc(table->dmn->type),
+			    table->table_type, table->level };
 	int ret;
 
-	ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",%d,%d\n",
-		      DR_DUMP_REC_TYPE_TABLE,
-		      (uint64_t) (uintptr_t) table,
-		      dr_domain_id_calc(table->dmn->type),
-		      table->table_type,
-		      table->level);
+	ret = dr_dump_vals(s, DR_DUMP_REC_TYPE_TABLE,
+			   DR_DUMP_DEC(2) | DR_DUMP_DEC(3),
+			   vals, ARRAY_SIZE(vals));
 	if (ret < 0)
 		return ret;
 
 	if (!dr_is_root_table(table)) {
 		if (rx->nic_dmn) {
-			ret = dr_dump_table_rx_tx(f, true, rx, (uint64_t) (uintptr_t) table);
+			ret = dr_dump_table_rx_tx(s, true, rx, (uint64_t) (uintptr_t) table);
 			if (ret < 0)
 				return ret;
 		}
 
 		if (tx->nic_dmn) {
-			ret = dr_dump_table_rx_tx(f, false, tx, (uint64_t) (uintptr_t) table);
+			ret = dr_dump_table_rx_tx(s, false, tx, (uint64_t) (uintptr_t) table);
 			if (ret < 0)
 				return ret;
 		}
@@ -600,18 +955,18 @@ static int dr_dump_table(FILE *f, struct mlx5dv_dr_table *table)
 	return 0;
 }
 
-static int dr_dump_table_all(FILE *fout, struct mlx5dv_dr_table *tbl)
+static int dr_dump_table_all(struct dr_dump_snap *s, struct mlx5dv_dr_table *tbl)
 {
 	struct mlx5dv_dr_matcher *matcher;
 	int ret;
 
-	ret = dr_dump_table(fout, tbl);
+	ret = dr_dump_table(s, tbl);
 	if (ret < 0)
 		return ret;
 
 	if (!dr_is_root_table(tbl)) {
 		list_for_each(&tbl->matcher_list, matcher, matcher_list) {
-			ret = dr_dump_matcher_all(fout, matcher);
+			ret = dr_dump_matcher_all(s, matcher);
 			if (ret < 0)
 				return ret;
 		}
@@ -619,41 +974,30 @@ static int dr_dump_table_all(FILE *fout, struct mlx5dv_dr_table *tbl)
 	return 0;
 }
 
-static int dr_dump_send_ring(FILE *f, struct dr_send_ring *ring,
+static int dr_dump_send_ring(struct dr_dump_snap *s, struct dr_send_ring *ring,
 			     const uint64_t domain_id)
 {
-	int ret;
-
-	ret = fprintf(f, "%d,0x%" PRIx64 ",0x%" PRIx64 ",0x%x,0x%x\n",
-		      DR_DUMP_REC_TYPE_DOMAIN_SEND_RING,
-		      (uint64_t) (uintptr_t) ring,
-		      domain_id,
-		      ring->cq.cqn,
-		      ring->qp->obj->object_id);
-	if (ret < 0)
-		return ret;
+	uint64_t vals[] = { (uint64_t) (uintptr_t) ring, domain_id,
+			    ring->cq.cqn, ring->qp->obj->object_id };
 
-	return 0;
+	return dr_dump_vals(s, DR_DUMP_REC_TYPE_DOMAIN_SEND_RING, 0,
+			    vals, ARRAY_SIZE(vals));
 }
 
-static int dr_dump_domain_info_flex_parser(FILE *f, const char *flex_parser_name,
+static int dr_dump_domain_info_flex_parser(struct dr_dump_snap *s,
+					   const char *flex_parser_name,
 					   const uint8_t flex_parser_value,
 					   const uint64_t domain_id)
 {
-	int ret;
-
-	ret = fprintf(f, "%d,0x%" PRIx64 ",%s,0x%x\n",
-		      DR_DUMP_REC_TYPE_DOMAIN_INFO_FLEX_PARSER,
-		      domain_id,
-		      flex_parser_name,
-		      flex_parser_value);
-	if (ret < 0)
-		return ret;
-
-	return 0;
+	return dr_dump_text(s, "%d,0x%" PRIx64 ",%s,0x%x\n",
+			    DR_DUMP_REC_TYPE_DOMAIN_INFO_FLEX_PARSER,
+			    domain_id,
+			    flex_parser_name,
+			    flex_parser_value);
 }
 
-static int dr_dump_vports_table(FILE *f, struct dr_vports_table *vports_tbl,
+static int dr_dump_vports_table(struct dr_dump_snap *s,
+				struct dr_vports_table *vports_tbl,
 				const uint64_t domain_id)
 {
 	struct dr_devx_vport_cap *vport_cap;
@@ -665,13 +1009,14 @@ static int dr_dump_vports_table(FILE *f, struct dr_vports_table *vports_tbl,
 	for (i = 0; i < DR_VPORTS_BUCKETS; i++) {
 		vport_cap = vports_tbl->buckets[i];
 		while (vport_cap) {
-			ret = fprintf(f, "%d,0x%" PRIx64 ",%d,0x%x,0x%" PRIx64 ",0x%" PRIx64 "\n",
-				      DR_DUMP_REC_TYPE_DOMAIN_INFO_VPORT,
-				      domain_id,
-				      vport_cap->num,
-				      vport_cap->vport_gvmi,
-				      vport_cap->icm_address_rx,
-				      vport_cap->icm_address_tx);
+			uint64_t vals[] = { domain_id, vport_cap->num,
+					    vport_cap->vport_gvmi,
+					    vport_cap->icm_address_rx,
+					    vport_cap->icm_address_tx };
+
+			ret = dr_dump_vals(s, DR_DUMP_REC_TYPE_DOMAIN_INFO_VPORT,
+					   DR_DUMP_DEC(1), vals,
+					   ARRAY_SIZE(vals));
 			if (ret < 0)
 				return ret;
 
@@ -682,79 +1027,74 @@ static int dr_dump_vports_table(FILE *f, struct dr_vports_table *vports_tbl,
 	return 0;
 }
 
-static int dr_dump_domain_info_caps(FILE *f, struct dr_devx_caps *caps,
-					 const uint64_t domain_id)
+static int dr_dump_domain_info_caps(struct dr_dump_snap *s,
+				    struct dr_devx_caps *caps,
+				    const uint64_t domain_id)
 {
+	uint64_t vals[] = { domain_id, caps->gvmi, caps->nic_rx_drop_address,
+			    caps->nic_tx_drop_address, caps->flex_protocols,
+			    caps->vports.num_ports, caps->eswitch_manager };
 	int ret;
 
-	ret = fprintf(f, "%d,0x%" PRIx64 ",0x%x,0x%" PRIx64 ",0x%" PRIx64 ",0x%x,%d,%d\n",
-		      DR_DUMP_REC_TYPE_DOMAIN_INFO_CAPS,
-		      domain_id,
-		      caps->gvmi,
-		      caps->nic_rx_drop_address,
-		      caps->nic_tx_drop_address,
-		      caps->flex_protocols,
-		      caps->vports.num_ports,
-		      caps->eswitch_manager);
+	ret = dr_dump_vals(s, DR_DUMP_REC_TYPE_DOMAIN_INFO_CAPS,
+			   DR_DUMP_DEC(5) | DR_DUMP_DEC(6),
+			   vals, ARRAY_SIZE(vals));
 	if (ret < 0)
 		return ret;
 
-	ret = dr_dump_vports_table(f, caps->vports.vports, domain_id);
+	ret = dr_dump_vports_table(s, caps->vports.vports, domain_id);
 	if (ret < 0)
 		return ret;
 
 	return 0;
 }
 
-static int dr_dump_domain_info_dev_attr(FILE *f, struct dr_domain_info *info,
+static int dr_dump_domain_info_dev_attr(struct dr_dump_snap *s,
+					struct dr_domain_info *info,
 					const uint64_t domain_id)
 {
-	int ret;
-
-	ret = fprintf(f, "%d,0x%" PRIx64 ",%u,%s,%d\n",
-		      DR_DUMP_REC_TYPE_DOMAIN_INFO_DEV_ATTR,
-		      domain_id,
-		      info->caps.vports.num_ports,
-		      info->attr.orig_attr.fw_ver,
-		      info->use_mqs);
-	if (ret < 0)
-		return ret;
-
-	return 0;
+	return dr_dump_text(s, "%d,0x%" PRIx64 ",%u,%s,%d\n",
+			    DR_DUMP_REC_TYPE_DOMAIN_INFO_DEV_ATTR,
+			    domain_id,
+			    info->caps.vports.num_ports,
+			    info->attr.orig_attr.fw_ver,
+			    info->use_mqs);
 }
-static int dr_dump_domain_info(FILE *f, struct dr_domain_info *info,
+
+static int dr_dump_domain_info(struct dr_dump_snap *s,
+			       struct dr_domain_info *info,
 			       const uint64_t domain_id)
 {
 	int ret;
 
-	ret = dr_dump_domain_info_dev_attr(f, info, domain_id);
+	ret = dr_dump_domain_info_dev_attr(s, info, domain_id);
 	if (ret < 0)
 		return ret;
 
-	ret = dr_dump_domain_info_caps(f, &info->caps, domain_id);
+	ret = dr_dump_domain_info_caps(s, &info->caps, domain_id);
 	if (ret < 0)
 		return ret;
 
-	ret = dr_dump_domain_info_flex_parser(f, "icmp_dw0", info->caps.flex_parser_id_icmp_dw0, domain_id);
+	ret = dr_dump_domain_info_flex_parser(s, "icmp_dw0", info->caps.flex_parser_id_icmp_dw0, domain_id);
 	if (ret < 0)
 		return ret;
 
-	ret = dr_dump_domain_info_flex_parser(f, "icmp_dw1", info->caps.flex_parser_id_icmp_dw1, domain_id);
+	ret = dr_dump_domain_info_flex_parser(s, "icmp_dw1", info->caps.flex_parser_id_icmp_dw1, domain_id);
 	if (ret < 0)
 		return ret;
 
-	ret = dr_dump_domain_info_flex_parser(f, "icmpv6_dw0", info->caps.flex_parser_id_icmpv6_dw0, domain_id);
+	ret = dr_dump_domain_info_flex_parser(s, "icmpv6_dw0", info->caps.flex_parser_id_icmpv6_dw0, domain_id);
 	if (ret < 0)
 		return ret;
 
-	ret = dr_dump_domain_info_flex_parser(f, "icmpv6_dw1", info->caps.flex_parser_id_icmpv6_dw1, domain_id);
+	ret = dr_dump_domain_info_flex_parser(s, "icmpv6_dw1", info->caps.flex_parser_id_icmpv6_dw1, domain_id);
 	if (ret < 0)
 		return ret;
 
 	return 0;
 }
 
-static int dr_dump_domain(FILE *f, struct mlx5dv_dr_domain *dmn)
+static int dr_dump_domain(struct dr_dump_snap *s, struct mlx5dv_dr_domain *dmn)
 {
 	enum mlx5dv_dr_domain_type dmn_type = dmn->type;
 	char *dev_name = dmn->ctx->device->dev_name;
@@ -762,29 +1102,29 @@ static int dr_dump_domain(FILE *f, struct mlx5dv_dr_domain *dmn)
 	int ret, i;
 
 	domain_id = dr_domain_id_calc(dmn_type);
-	ret = fprintf(f, "%d,0x%" PRIx64 ",%d,0%x,%d,%s,%s,%u,%u,%u,%u,%u\n",
-		      DR_DUMP_REC_TYPE_DOMAIN,
-		      domain_id,
-		      dmn_type,
-		      dmn->info.caps.gvmi,
-		      dmn->info.supp_sw_steering,
-		      PACKAGE_VERSION,
-		      dev_name,
-		      dmn->flags,
-		      dmn->num_buddies[DR_ICM_TYPE_STE],
-		      dmn->num_buddies[DR_ICM_TYPE_MODIFY_ACTION],
-		      dmn->num_buddies[DR_ICM_TYPE_MODIFY_HDR_PTRN],
-		      dmn->info.caps.sw_format_ver);
+	ret = dr_dump_text(s, "%d,0x%" PRIx64 ",%d,0%x,%d,%s,%s,%u,%u,%u,%u,%u\n",
+			   DR_DUMP_REC_TYPE_DOMAIN,
+			   domain_id,
+			   dmn_type,
+			   dmn->info.caps.gvmi,
+			   dmn->info.supp_sw_steering,
+			   PACKAGE_VERSION,
+			   dev_name,
+			   dmn->flags,
+			   dmn->num_buddies[DR_ICM_TYPE_STE],
+			   dmn->num_buddies[DR_ICM_TYPE_MODIFY_ACTION],
+			   dmn->num_buddies[DR_ICM_TYPE_MODIFY_HDR_PTRN],
+			   dmn->info.caps.sw_format_ver);
 	if (ret < 0)
 		return ret;
 
-	ret = dr_dump_domain_info(f, &dmn->info, domain_id);
+	ret = dr_dump_domain_info(s, &dmn->info, domain_id);
 	if (ret < 0)
 		return ret;
 
 	if (dmn->info.supp_sw_steering) {
 		for (i = 0; i < DR_MAX_SEND_RINGS; i++) {
-			ret = dr_dump_send_ring(f, dmn->send_ring[i], domain_id);
+			ret = dr_dump_send_ring(s, dmn->send_ring[i], domain_id);
 			if (ret < 0)
 				return ret;
 		}
@@ -793,17 +1133,17 @@ static int dr_dump_domain(FILE *f, struct mlx5dv_dr_domain *dmn)
 	return 0;
 }
 
-static int dr_dump_domain_all(FILE *fout, struct mlx5dv_dr_domain *dmn)
+static int dr_dump_domain_all(struct dr_dump_snap *s, struct mlx5dv_dr_domain *dmn)
 {
 	struct mlx5dv_dr_table *tbl;
 	int ret;
 
-	ret = dr_dump_domain(fout, dmn);
+	ret = dr_dump_domain(s, dmn);
 	if (ret < 0)
 		return ret;
 
 	list_for_each(&dmn->tbl_list, tbl, tbl_list) {
-		ret = dr_dump_table_all(fout, tbl);
+		ret = dr_dump_table_all(s, tbl);
 		if (ret < 0)
 			return ret;
 	}
@@ -813,6 +1153,7 @@ static int dr_dump_domain_all(FILE *fout, struct mlx5dv_dr_domain *dmn)
 
 int mlx5dv_dump_dr_domain(FILE *fout, struct mlx5dv_dr_domain *dmn)
 {
+	struct dr_dump_snap snap = {};
 	int ret;
 
 	if (!fout || !dmn)
@@ -821,16 +1162,17 @@ int mlx5dv_dump_dr_domain(FILE *fout, struct mlx5dv_dr_domain *dmn)
 	pthread_spin_lock(&dmn->debug_lock);
 	dr_domain_lock(dmn);
 
-	ret = dr_dump_domain_all(fout, dmn);
+	ret = dr_dump_domain_all(&snap, dmn);
 
 	dr_domain_unlock(dmn);
 	pthread_spin_unlock(&dmn->debug_lock);
 
-	return ret;
+	return dr_dump_snap_flush(&snap, fout, ret);
 }
 
 int mlx5dv_dump_dr_table(FILE *fout, struct mlx5dv_dr_table *tbl)
 {
+	struct dr_dump_snap snap = {};
 	int ret;
 
 	if (!fout || !tbl)
@@ -839,19 +1181,21 @@ int mlx5dv_dump_dr_table(FILE *fout, struct mlx5dv_dr_table *tbl)
 	pthread_spin_lock(&tbl->dmn->debug_lock);
 	dr_domain_lock(tbl->dmn);
 
-	ret = dr_dump_domain(fout, tbl->dmn);
+	ret = dr_dump_domain(&snap, tbl->dmn);
 	if (ret < 0)
 		goto out;
 
-	ret = dr_dump_table_all(fout, tbl);
+	ret = dr_dump_table_all(&snap, tbl);
 out:
 	dr_domain_unlock(tbl->dmn);
 	pthread_spin_unlock(&tbl->dmn->debug_lock);
-	return ret;
+
+	return dr_dump_snap_flush(&snap, fout, ret);
 }
 
 int mlx5dv_dump_dr_matcher(FILE *fout, struct mlx5dv_dr_matcher *matcher)
 {
+	struct dr_dump_snap snap = {};
 	int ret;
 
 	if (!fout || !matcher)
@@ -860,23 +1204,25 @@ int mlx5dv_dump_dr_matcher(FILE *fout, struct mlx5dv_dr_matcher *matcher)
 	pthread_spin_lock(&matcher->tbl->dmn->debug_lock);
 	dr_domain_lock(matcher->tbl->dmn);
 
-	ret = dr_dump_domain(fout, matcher->tbl->dmn);
+	ret = dr_dump_domain(&snap, matcher->tbl->dmn);
 	if (ret < 0)
 		goto out;
 
-	ret = dr_dump_table(fout, matcher->tbl);
+	ret = dr_dump_table(&snap, matcher->tbl);
 	if (ret < 0)
 		goto out;
 
-	ret = dr_dump_matcher_all(fout, matcher);
+	ret = dr_dump_matcher_all(&snap, matcher);
 out:
 	dr_domain_unlock(matcher->tbl->dmn);
 	pthread_spin_unlock(&matcher->tbl->dmn->debug_lock);
-	return ret;
+
+	return dr_dump_snap_flush(&snap, fout, ret);
 }
 
 int mlx5dv_dump_dr_rule(FILE *fout, struct mlx5dv_dr_rule *rule)
 {
+	struct dr_dump_snap snap = {};
 	int ret;
 
 	if (!fout || !rule)
@@ -885,22 +1231,50 @@ int mlx5dv_dump_dr_rule(FILE *fout, struct mlx5dv_dr_rule *rule)
 	pthread_spin_lock(&rule->matcher->tbl->dmn->debug_lock);
 	dr_domain_lock(rule->matcher->tbl->dmn);
 
-	ret = dr_dump_domain(fout, rule->matcher->tbl->dmn);
+	ret = dr_dump_domain(&snap, rule->matcher->tbl->dmn);
 	if (ret < 0)
 		goto out;
 
-	ret = dr_dump_table(fout, rule->matcher->tbl);
+	ret = dr_dump_table(&snap, rule->matcher->tbl);
 	if (ret < 0)
 		goto out;
 
-	ret = dr_dump_matcher(fout, rule->matcher);
+	ret = dr_dump_matcher(&snap, rule->matcher);
 	if (ret < 0)
 		goto out;
 
-	ret = dr_dump_rule(fout, rule);
+	ret = dr_dump_rule(&snap, rule);
 out:
 	dr_domain_unlock(rule->matcher->tbl->dmn);
 	pthread_spin_unlock(&rule->matcher->tbl->dmn->debug_lock);
-	return ret;
+
+	return dr_dump_snap_flush(&snap, fout, ret);
 }
 
+int mlx5dv_dump_dr_matcher_lookup(FILE *fout,
+				  struct mlx5dv_dr_matcher *matcher,
+				  struct mlx5dv_flow_match_parameters *value)
+{
+	struct dr_dump_snap snap = {};
+	int ret;
+
+	if (!fout || !matcher || !value)
+		return -EINVAL;
+
+	if (dr_is_root_table(matcher->tbl))
+		return -EOPNOTSUPP;
+
+	pthread_spin_lock(&matcher->tbl->dmn->debug_lock);
+	dr_domain_lock(matcher->tbl->dmn);
+
+	ret = dr_dump_matcher(&snap, matcher);
+	if (ret < 0)
+		goto out;
+
+	ret = dr_dump_lookup(&snap, matcher, value);
+out:
+	dr_domain_unlock(matcher->tbl->dmn);
+	pthread_spin_unlock(&matcher->tbl->dmn->debug_lock);
+
+	return dr_dump_snap_flush(&snap, fout, ret);
+}
@@ -525,9 +525,27 @@ mlx5dv_dr_domain_create(struct ibv_context *ctx,
 		goto free_domain;
 	}
 
+	ret = pthread_mutex_init(&dmn->bg_sync.ctrl_mutex, NULL);
+	if (ret) {
+		errno = ret;
+		goto free_debug_lock;
+	}
+
+	ret = pthread_mutex_init(&dmn->bg_sync.mutex, NULL);
+	if (ret) {
+		errno = ret;
+		goto free_bg_ctrl_mutex;
+	}
+
+	ret = pthread_cond_init(&dmn->bg_sync.cond, NULL);
+	if (ret) {
+		errno = ret;
+		goto free_bg_mutex;
+	}
+
 	ret = dr_domain_nic_lock_init(&dmn->info.rx);
 	if (ret)
-		goto free_debug_lock;
+		goto free_bg_cond;
 
 	ret = dr_domain_nic_lock_init(&dmn->info.tx);
 	if (ret)
@@ -562,6 +580,12 @@ uninit_tx_locks:
 	dr_domain_nic_lock_uninit(&dmn->info.tx);
 uninit_rx_locks:
 	dr_domain_nic_lock_uninit(&dmn->info.rx);
+free_bg_cond:
+	pthread_cond_destroy(&dmn->bg_sync.cond);
+free_bg_mutex:
+	pthread_mutex_destroy(&dmn->bg_sync.mutex);
+free_bg_ctrl_mutex:
+	pthread_mutex_destroy(&dmn->bg_sync.ctrl_mutex);
 free_debug_lock:
 	pthread_spin_destroy(&dmn->debug_lock);
 free_domain:
@@ -643,11 +667,116 @@ void mlx5dv_dr_domain_allow_duplicate_rules(struct mlx5dv_dr_domain *dmn,
 	dr_domain_unlock(dmn);
 }
 
+void dr_domain_bg_sync_wake(struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_bg_sync *bg_sync = &dmn->bg_sync;
+
+	pthread_mutex_lock(&bg_sync->mutex);
+	bg_sync->pending = true;
+	pthread_cond_signal(&bg_sync->cond);
+	pthread_mutex_unlock(&bg_sync->mutex);
+}
+
+static void dr_domain_bg_sync_pools(struct mlx5dv_dr_domain *dmn)
+{
+	if (dmn->ste_icm_pool) {
+		dr_icm_pool_bg_sync_pool(dmn->ste_icm_pool);
+		dr_icm_pool_bg_reserve(dmn->ste_icm_pool);
+	}
+
+	if (dmn->encap_icm_pool)
+		dr_icm_pool_bg_sync_pool(dmn->encap_icm_pool);
+
+	if (dmn->action_icm_pool)
+		dr_icm_pool_bg_sync_pool(dmn->action_icm_pool);
+
+	if (dmn->modify_header_ptrn_mngr)
+		dr_ptrn_bg_sync_pool(dmn->modify_header_ptrn_mngr);
+}
+
+static void *dr_domain_bg_sync_run(void *arg)
+{
+	struct mlx5dv_dr_domain *dmn = arg;
+	struct dr_bg_sync *bg_sync = &dmn->bg_sync;
+
+	pthread_mutex_lock(&bg_sync->mutex);
+	while (!bg_sync->stop) {
+		if (!bg_sync->pending) {
+			pthread_cond_wait(&bg_sync->cond, &bg_sync->mutex);
+			continue;
+		}
+
+		bg_sync->pending = false;
+		pthread_mutex_unlock(&bg_sync->mutex);
+		dr_domain_bg_sync_pools(dmn);
+		pthread_mutex_lock(&bg_sync->mutex);
+	}
+	pthread_mutex_unlock(&bg_sync->mutex);
+
+	return NULL;
+}
+
+static void dr_domain_bg_sync_stop(struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_bg_sync *bg_sync = &dmn->bg_sync;
+
+	atomic_store(&bg_sync->enabled, false);
+
+	pthread_mutex_lock(&bg_sync->mutex);
+	bg_sync->stop = true;
+	pthread_cond_signal(&bg_sync->cond);
+	pthread_mutex_unlock(&bg_sync->mutex);
+
+	pthread_join(bg_sync->thread, NULL);
+}
+
+int mlx5dv_dr_domain_set_background_sync(struct mlx5dv_dr_domain *dmn,
+					 bool enable)
+{
+	struct dr_bg_sync *bg_sync = &dmn->bg_sync;
+	int ret;
+
+	if (!dmn->info.supp_sw_steering) {
+		errno = EOPNOTSUPP;
+		return errno;
+	}
+
+	pthread_mutex_lock(&bg_sync->ctrl_mutex);
+	if (enable == atomic_load(&bg_sync->enabled)) {
+		ret = 0;
+		goto out;
+	}
+
+	if (!enable) {
+		dr_domain_bg_sync_stop(dmn);
+		ret = 0;
+		goto out;
+	}
+
+	bg_sync->stop = false;
+	bg_sync->pending = false;
+	ret = pthread_create(&bg_sync->thread, NULL, dr_domain_bg_sync_run, dmn);
+	if (ret) {
+		errno = ret;
+		goto out;
+	}
+
+	atomic_store(&bg_sync->enabled, true);
+out:
+	pthread_mutex_unlock(&bg_sync->ctrl_mutex);
+	return ret;
+}
+
 int mlx5dv_dr_domain_destroy(struct mlx5dv_dr_domain *dmn)
 {
 	if (atomic_load(&dmn->refcount) > 1)
 		return EBUSY;
 
+	pthread_mutex_lock(&dmn->bg_sync.ctrl_mutex);
+	if (atomic_load(&dmn->bg_sync.enabled))
+		dr_domain_bg_sync_stop(dmn);
+	pthread_mutex_unlock(&dmn->bg_sync.ctrl_mutex);
+
 	if (dmn->info.supp_sw_steering) {
 		/* make sure resources are not used by the hardware */
 		dr_devx_sync_steering(dmn->ctx);
@@ -658,6 +787,9 @@ int mlx5dv_dr_domain_destroy(struct mlx5dv_dr_domain *dmn)
 
 	dr_domain_nic_lock_uninit(&dmn->info.tx);
 	dr_domain_nic_lock_uninit(&dmn->info.rx);
+	pthread_cond_destroy(&dmn->bg_sync.cond);
+	pthread_mutex_destroy(&dmn->bg_sync.mutex);
+	pthread_mutex_destroy(&dmn->bg_sync.ctrl_mutex);
 	pthread_spin_destroy(&dmn->debug_lock);
 
 	free(dmn);
@@ -44,6 +44,12 @@ struct dr_icm_pool {
 	uint64_t		hot_memory_size;
 	bool			syncing;
 	size_t			th;
+	/* wake the background sync thread above this much hot memory */
+	size_t			bg_th;
+	bool			bg_requested;
+	/* chunk size a growing hash table will soon ask for */
+	enum dr_icm_chunk_size	reserve_sz;
+	bool			reserve_requested;
 };
 
 struct dr_icm_mr {
@@ -258,14 +264,15 @@ static void dr_icm_buddy_cleanup_ste_cache(struct dr_icm_buddy_mem *buddy)
 	free(buddy->miss_list);
 }
 
-static int dr_icm_buddy_create(struct dr_icm_pool *pool)
+/* Only reads the pool configuration, may be called without the pool lock */
+static struct dr_icm_buddy_mem *dr_icm_buddy_alloc(struct dr_icm_pool *pool)
 {
 	struct dr_icm_buddy_mem *buddy;
 	struct dr_icm_mr *icm_mr;
 
 	icm_mr = dr_icm_pool_mr_create(pool);
 	if (!icm_mr)
-		return ENOMEM;
+		return NULL;
 
 	buddy = calloc(1, sizeof(*buddy));
 	if (!buddy) {
@@ -284,12 +291,7 @@ static int dr_icm_buddy_create(struct dr_icm_pool *pool)
 	    dr_icm_buddy_init_ste_cache(buddy))
 		goto err_cleanup_buddy;
 
-	/* add it to the -start- of the list in order to search in it first */
-	list_add(&pool->buddy_mem_list, &buddy->list_node);
-
-	pool->dmn->num_buddies[pool->icm_type]++;
-
-	return 0;
+	return buddy;
 
 err_cleanup_buddy:
 	dr_buddy_cleanup(buddy);
@@ -297,7 +299,28 @@ err_free_buddy:
 	free(buddy);
 free_mr:
 	dr_icm_pool_mr_destroy(icm_mr);
-	return errno;
+	return NULL;
+}
+
+static void dr_icm_buddy_add(struct dr_icm_pool *pool,
+			     struct dr_icm_buddy_mem *buddy)
+{
+	/* add it to the -start- of the list in order to search in it first */
+	list_add(&pool->buddy_mem_list, &buddy->list_node);
+
+	pool->dmn->num_buddies[pool->icm_type]++;
+}
+
+static int dr_icm_buddy_create(struct dr_icm_pool *pool)
+{
+	struct dr_icm_buddy_mem *buddy;
+
+	buddy = dr_icm_buddy_alloc(pool);
+	if (!buddy)
+		return errno;
+
+	dr_icm_buddy_add(pool, buddy);
+	return 0;
 }
 
 static void dr_icm_buddy_destroy(struct dr_icm_buddy_mem *buddy)
@@ -348,6 +371,7 @@ dr_icm_chunk_create(struct dr_icm_pool *pool,
 		dr_icm_chunk_ste_init(chunk, offset);
 
 	buddy_mem_pool->used_memory += chunk->byte_size;
+	buddy_mem_pool->reserved = false;
 	list_node_init(&chunk->chunk_list);
 
 	/* chunk now is part of the used_list */
@@ -404,7 +428,7 @@ static int dr_icm_pool_sync_pool_buddies(struct dr_icm_pool *pool)
 
 	if (need_reclaim) {
 		list_for_each_safe(&pool->buddy_mem_list, buddy, tmp_buddy, list_node)
-			if (!buddy->used_memory)
+			if (!buddy->used_memory && !buddy->reserved)
 				dr_icm_buddy_destroy(buddy);
 	}
 
@@ -424,6 +448,92 @@ int dr_icm_pool_sync_pool(struct dr_icm_pool *pool)
 	return ret;
 }
 
+/* Called by the background sync thread, only syncs a pool that asked for it */
+int dr_icm_pool_bg_sync_pool(struct dr_icm_pool *pool)
+{
+	int ret = 0;
+
+	pthread_spin_lock(&pool->lock);
+	if (pool->bg_requested) {
+		pool->bg_requested = false;
+		if (!pool->syncing)
+			ret = dr_icm_pool_sync_pool_buddies(pool);
+	}
+	pthread_spin_unlock(&pool->lock);
+
+	return ret;
+}
+
+static bool dr_icm_pool_has_free_chunk(struct dr_icm_pool *pool,
+				       enum dr_icm_chunk_size chunk_size)
+{
+	struct dr_icm_buddy_mem *buddy;
+
+	list_for_each(&pool->buddy_mem_list, buddy, list_node)
+		if (dr_buddy_has_free(buddy, chunk_size))
+			return true;
+
+	return false;
+}
+
+/* Ask the background thread to make sure a chunk of this size can be
+ * allocated without creating a new buddy (DM allocation, MR registration
+ * and STE cache setup) on the caller's thread.
+ */
+void dr_icm_pool_request_reserve(struct dr_icm_pool *pool,
+				 enum dr_icm_chunk_size chunk_size)
+{
+	bool wake = false;
+
+	if (!atomic_load(&pool->dmn->bg_sync.enabled))
+		return;
+
+	pthread_spin_lock(&pool->lock);
+	if (chunk_size <= pool->max_log_chunk_sz) {
+		if (!pool->reserve_requested || chunk_size > pool->reserve_sz)
+			pool->reserve_sz = chunk_size;
+		wake = !pool->reserve_requested;
+		pool->reserve_requested = true;
+	}
+	pthread_spin_unlock(&pool->lock);
+
+	if (wake)
+		dr_domain_bg_sync_wake(pool->dmn);
+}
+
+/* Called by the background sync thread, the new buddy is built out of
+ * the lock so allocations from the pool are not held up meanwhile.
+ */
+int dr_icm_pool_bg_reserve(struct dr_icm_pool *pool)
+{
+	struct dr_icm_buddy_mem *buddy;
+	bool need_buddy = false;
+
+	pthread_spin_lock(&pool->lock);
+	if (pool->reserve_requested) {
+		pool->reserve_requested = false;
+		need_buddy = !dr_icm_pool_has_free_chunk(pool, pool->reserve_sz);
+	}
+	pthread_spin_unlock(&pool->lock);
+
+	if (!need_buddy)
+		return 0;
+
+	buddy = dr_icm_buddy_alloc(pool);
+	if (!buddy) {
+		dr_dbg(pool->dmn, "Failed reserving ICM memory\n");
+		return errno;
+	}
+
+	buddy->reserved = true;
+
+	pthread_spin_lock(&pool->lock);
+	dr_icm_buddy_add(pool, buddy);
+	pthread_spin_unlock(&pool->lock);
+
+	return 0;
+}
+
 static int dr_icm_handle_buddies_get_mem(struct dr_icm_pool *pool,
 					 enum dr_icm_chunk_size chunk_size,
 					 struct dr_icm_buddy_mem **buddy,
@@ -506,6 +616,7 @@ void dr_icm_free_chunk(struct dr_icm_chunk *chunk)
 {
 	struct dr_icm_buddy_mem *buddy = chunk->buddy_mem;
 	struct dr_icm_pool *pool = buddy->pool;
+	bool wake = false;
 
 	/* move the memory to the waiting list AKA "hot" */
 	pthread_spin_lock(&pool->lock);
@@ -513,11 +624,22 @@ void dr_icm_free_chunk(struct dr_icm_chunk *chunk)
 	list_add_tail(&buddy->hot_list, &chunk->chunk_list);
 	buddy->pool->hot_memory_size += chunk->byte_size;
 
-	/* Check if we have chunks that are waiting for sync-ste */
-	if (dr_icm_pool_is_sync_required(pool) && !pool->syncing)
+	/* Check if we have chunks that are waiting for sync-ste, with a
+	 * background sync thread this only happens if it falls behind.
+	 */
+	if (dr_icm_pool_is_sync_required(pool) && !pool->syncing) {
 		dr_icm_pool_sync_pool_buddies(buddy->pool);
+	} else if (atomic_load(&pool->dmn->bg_sync.enabled) &&
+		   pool->hot_memory_size >= pool->bg_th &&
+		   !pool->bg_requested) {
+		pool->bg_requested = true;
+		wake = true;
+	}
 
 	pthread_spin_unlock(&pool->lock);
+
+	if (wake)
+		dr_domain_bg_sync_wake(pool->dmn);
 }
 
 void dr_icm_pool_set_pool_max_log_chunk_sz(struct dr_icm_pool *pool,
@@ -589,6 +711,7 @@ struct dr_icm_pool *dr_icm_pool_create(struct mlx5dv_dr_domain *dmn,
 	default:
 		assert(false);
 	}
+	pool->bg_th = pool->th / 2;
 
 	list_head_init(&pool->buddy_mem_list);
 
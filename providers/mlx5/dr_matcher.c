@@ -750,6 +750,8 @@ clear_definers_builders:
 
 static void dr_matcher_clear_ste_builders(struct dr_matcher_rx_tx *nic_matcher)
 {
+	dr_ste_build_free_tags(nic_matcher);
+
 	if (nic_matcher->ste_builder->htbl_type == DR_STE_HTBL_TYPE_MATCH)
 		dr_matcher_destroy_definer_objs(nic_matcher->ste_builder,
 						nic_matcher->num_of_builders);
@@ -1199,6 +1201,8 @@ static int dr_matcher_init_nic(struct mlx5dv_dr_matcher *matcher,
 	if (ret)
 		return ret;
 
+	dr_ste_build_compile_tags(matcher, nic_matcher);
+
 	nic_matcher->e_anchor = dr_ste_htbl_alloc(dmn->ste_icm_pool,
 						  DR_CHUNK_SIZE_1,
 						  DR_STE_HTBL_TYPE_LEGACY,
@@ -12,11 +12,22 @@ enum dr_ptrn_modify_hdr_action_id {
 	DR_PTRN_MODIFY_HDR_ACTION_ID_INSERT_INLINE = 0x0a,
 };
 
+/* Patterns are looked up by a hash over their type and masked actions.
+ * Unreferenced patterns stay cached, up to DR_PTRN_IDLE_MAX of them, so a
+ * pattern that is used again soon needs no new ICM and no device write.
+ */
+#define DR_PTRN_HASH_LOG_SIZE	10
+#define DR_PTRN_HASH_SIZE	(1 << DR_PTRN_HASH_LOG_SIZE)
+#define DR_PTRN_IDLE_MAX	256
+
 struct dr_ptrn_mngr {
 	struct mlx5dv_dr_domain *dmn;
 	struct dr_icm_pool *ptrn_icm_pool;
 	/* cache for modify_header ptrn */
-	struct list_head ptrn_list;
+	struct list_head ptrn_hash[DR_PTRN_HASH_SIZE];
+	/* unreferenced patterns, least recently used first */
+	struct list_head idle_list;
+	uint32_t num_idle;
 	pthread_mutex_t modify_hdr_mutex;
 };
 
@@ -25,6 +36,11 @@ int dr_ptrn_sync_pool(struct dr_ptrn_mngr *ptrn_mngr)
 	return dr_icm_pool_sync_pool(ptrn_mngr->ptrn_icm_pool);
 }
 
+int dr_ptrn_bg_sync_pool(struct dr_ptrn_mngr *ptrn_mngr)
+{
+	return dr_icm_pool_bg_sync_pool(ptrn_mngr->ptrn_icm_pool);
+}
+
 /* Cache structure and functions */
 static bool dr_ptrn_compare_modify_hdr(size_t cur_num_of_actions,
 				       __be64 cur_hw_actions[],
@@ -77,24 +93,61 @@ static bool dr_ptrn_compare_pattern(enum dr_ptrn_type type,
 	}
 }
 
+/* Hashes exactly the bits dr_ptrn_compare_pattern() looks at */
+static uint32_t dr_ptrn_hash(enum dr_ptrn_type type,
+			     size_t num_of_actions,
+			     __be64 hw_actions[])
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint64_t val;
+	int i;
+
+	hash = (hash ^ type) * 0x100000001b3ULL;
+	hash = (hash ^ num_of_actions) * 0x100000001b3ULL;
+
+	if (type == DR_PTRN_TYP_MODIFY_HDR) {
+		for (i = 0; i < num_of_actions; i++) {
+			u8 action_id =
+				DEVX_GET(ste_double_action_add_v1, &hw_actions[i], action_id);
+
+			if (action_id == DR_PTRN_MODIFY_HDR_ACTION_ID_COPY)
+				val = (__force uint64_t)hw_actions[i];
+			else
+				val = (__force uint32_t)(__force __be32)hw_actions[i];
+
+			hash = (hash ^ val) * 0x100000001b3ULL;
+		}
+	}
+
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static struct list_head *dr_ptrn_bucket(struct dr_ptrn_mngr *mngr,
+					uint32_t hash)
+{
+	return &mngr->ptrn_hash[hash & (DR_PTRN_HASH_SIZE - 1)];
+}
+
 static struct dr_ptrn_obj *
 dr_ptrn_find_cached_pattern(struct dr_ptrn_mngr *mngr,
 			    enum dr_ptrn_type type,
 			    size_t num_of_actions,
-			    __be64 hw_actions[])
+			    __be64 hw_actions[],
+			    uint32_t hash)
 {
-	struct dr_ptrn_obj *tmp;
+	struct list_head *bucket = dr_ptrn_bucket(mngr, hash);
 	struct dr_ptrn_obj *cached_pattern;
 
-	list_for_each_safe(&mngr->ptrn_list, cached_pattern, tmp, list) {
-		if (dr_ptrn_compare_pattern(type,
+	list_for_each(bucket, cached_pattern, list) {
+		if (cached_pattern->hash == hash &&
+		    dr_ptrn_compare_pattern(type,
 					    cached_pattern->type,
 					    cached_pattern->rewrite_param.num_of_actions,
 					    (__be64 *)cached_pattern->rewrite_param.data,
 					    num_of_actions,
 					    hw_actions)) {
 			list_del(&cached_pattern->list);
-			list_add(&mngr->ptrn_list, &cached_pattern->list);
+			list_add(bucket, &cached_pattern->list);
 			return cached_pattern;
 		}
 	}
@@ -104,7 +157,7 @@ dr_ptrn_find_cached_pattern(struct dr_ptrn_mngr *mngr,
 
 static struct dr_ptrn_obj *
 dr_ptrn_alloc_pattern(struct dr_ptrn_mngr *mngr, uint16_t num_of_actions,
-		      uint8_t *data, enum dr_ptrn_type type)
+		      uint8_t *data, enum dr_ptrn_type type, uint32_t hash)
 {
 	struct dr_ptrn_obj *pattern;
 	struct dr_icm_chunk *chunk;
@@ -138,13 +191,15 @@ dr_ptrn_alloc_pattern(struct dr_ptrn_mngr *mngr, uint16_t num_of_actions,
 	}
 
 	pattern->type = type;
+	pattern->hash = hash;
 
 	memcpy(pattern->rewrite_param.data, data, num_of_actions * DR_MODIFY_ACTION_SIZE);
 	pattern->rewrite_param.chunk = chunk;
 	pattern->rewrite_param.index = index;
 	pattern->rewrite_param.num_of_actions = num_of_actions;
 
-	list_add(&mngr->ptrn_list, &pattern->list);
+	list_add(dr_ptrn_bucket(mngr, hash), &pattern->list);
+	list_node_init(&pattern->idle_node);
 	atomic_init(&pattern->refcount, 0);
 	return pattern;
 
@@ -173,16 +228,26 @@ dr_ptrn_cache_get_pattern(struct dr_ptrn_mngr *mngr,
 	struct dr_ptrn_obj *pattern;
 	uint64_t *hw_actions;
 	uint8_t action_id;
+	uint32_t hash;
 	int i;
 
+	hash = dr_ptrn_hash(type, num_of_actions, (__be64 *)data);
+
 	pthread_mutex_lock(&mngr->modify_hdr_mutex);
 	pattern = dr_ptrn_find_cached_pattern(mngr,
 					      type,
 					      num_of_actions,
-					      (__be64 *)data);
+					      (__be64 *)data,
+					      hash);
+	if (pattern && !atomic_load(&pattern->refcount)) {
+		/* Back in use, no longer a candidate for eviction */
+		list_del_init(&pattern->idle_node);
+		mngr->num_idle--;
+	}
 	if (!pattern) {
 		/* Alloc and add new pattern to cache */
-		pattern = dr_ptrn_alloc_pattern(mngr, num_of_actions, data, type);
+		pattern = dr_ptrn_alloc_pattern(mngr, num_of_actions, data,
+						type, hash);
 		if (!pattern)
 			goto out_unlock;
 
@@ -221,12 +286,20 @@ void
 dr_ptrn_cache_put_pattern(struct dr_ptrn_mngr *mngr,
 			  struct dr_ptrn_obj *pattern)
 {
+	struct dr_ptrn_obj *lru;
+
 	pthread_mutex_lock(&mngr->modify_hdr_mutex);
 
 	if (atomic_fetch_sub(&pattern->refcount, 1) != 1)
 		goto out;
 
-	dr_ptrn_free_pattern(pattern);
+	list_add_tail(&mngr->idle_list, &pattern->idle_node);
+	if (++mngr->num_idle > DR_PTRN_IDLE_MAX) {
+		lru = list_top(&mngr->idle_list, struct dr_ptrn_obj, idle_node);
+		list_del(&lru->idle_node);
+		mngr->num_idle--;
+		dr_ptrn_free_pattern(lru);
+	}
 out:
 	pthread_mutex_unlock(&mngr->modify_hdr_mutex);
 }
@@ -235,6 +308,7 @@ struct dr_ptrn_mngr *
 dr_ptrn_mngr_create(struct mlx5dv_dr_domain *dmn)
 {
 	struct dr_ptrn_mngr *mngr;
+	int i;
 
 	if (!dr_domain_is_support_modify_hdr_cache(dmn))
 		return NULL;
@@ -253,7 +327,9 @@ dr_ptrn_mngr_create(struct mlx5dv_dr_domain *dmn)
 		goto free_mngr;
 	}
 
-	list_head_init(&mngr->ptrn_list);
+	for (i = 0; i < DR_PTRN_HASH_SIZE; i++)
+		list_head_init(&mngr->ptrn_hash[i]);
+	list_head_init(&mngr->idle_list);
 	return mngr;
 
 free_mngr:
@@ -265,14 +341,17 @@ void dr_ptrn_mngr_destroy(struct dr_ptrn_mngr *mngr)
 {
 	struct dr_ptrn_obj *tmp;
 	struct dr_ptrn_obj *pattern;
+	int i;
 
 	if (!mngr)
 		return;
 
-	list_for_each_safe(&mngr->ptrn_list, pattern, tmp, list) {
-		list_del(&pattern->list);
-		free(pattern->rewrite_param.data);
-		free(pattern);
+	for (i = 0; i < DR_PTRN_HASH_SIZE; i++) {
+		list_for_each_safe(&mngr->ptrn_hash[i], pattern, tmp, list) {
+			list_del(&pattern->list);
+			free(pattern->rewrite_param.data);
+			free(pattern);
+		}
 	}
 
 	dr_icm_pool_destroy(mngr->ptrn_icm_pool);
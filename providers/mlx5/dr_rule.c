@@ -559,6 +559,15 @@ err_out:
 	return ENOTSUP;
 }
 
+static enum dr_icm_chunk_size
+dr_rule_rehash_size(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl)
+{
+	enum dr_icm_chunk_size new_size;
+
+	new_size = dr_icm_next_higher_chunk(htbl->chunk_size);
+	return min_t(uint32_t, new_size, dmn->info.max_log_sw_icm_rehash_sz);
+}
+
 static struct dr_ste_htbl *dr_rule_rehash(struct mlx5dv_dr_rule *rule,
 					  struct dr_rule_rx_tx *nic_rule,
 					  struct dr_ste_htbl *cur_htbl,
@@ -568,10 +577,7 @@ static struct dr_ste_htbl *dr_rule_rehash(struct mlx5dv_dr_rule *rule,
 	struct mlx5dv_dr_domain *dmn = rule->matcher->tbl->dmn;
 	enum dr_icm_chunk_size new_size;
 
-	new_size = dr_icm_next_higher_chunk(cur_htbl->chunk_size);
-	new_size = min_t(uint32_t, new_size,
-			 dmn->info.max_log_sw_icm_rehash_sz);
-
+	new_size = dr_rule_rehash_size(dmn, cur_htbl);
 	if (new_size == cur_htbl->chunk_size)
 		return NULL; /* Skip rehash, we already at the max size */
 
@@ -627,35 +633,52 @@ free_send_info:
 	return NULL;
 }
 
-static void dr_rule_remove_action_members(struct mlx5dv_dr_rule *rule)
+static void dr_rule_put_action_members(struct mlx5dv_dr_action **actions,
+				       uint16_t num_actions)
 {
 	int i;
 
-	for (i = 0; i < rule->num_actions; i++)
-		atomic_fetch_sub(&rule->actions[i]->refcount, 1);
+	for (i = 0; i < num_actions; i++)
+		atomic_fetch_sub(&actions[i]->refcount, 1);
 
-	free(rule->actions);
+	free(actions);
 }
 
-static int dr_rule_add_action_members(struct mlx5dv_dr_rule *rule,
-				      size_t num_actions,
-				      struct mlx5dv_dr_action *actions[])
+static void dr_rule_remove_action_members(struct mlx5dv_dr_rule *rule)
 {
-	struct mlx5dv_dr_action *action;
+	dr_rule_put_action_members(rule->actions, rule->num_actions);
+}
+
+static struct mlx5dv_dr_action **
+dr_rule_get_action_members(size_t num_actions,
+			   struct mlx5dv_dr_action *actions[])
+{
+	struct mlx5dv_dr_action **members;
 	int i;
 
-	rule->actions = calloc(num_actions, sizeof(action));
-	if (!rule->actions) {
+	members = calloc(num_actions, sizeof(*members));
+	if (!members) {
 		errno = ENOMEM;
-		return errno;
+		return NULL;
 	}
-	rule->num_actions = num_actions;
 
 	for (i = 0; i < num_actions; i++) {
-		rule->actions[i] = actions[i];
-		atomic_fetch_add(&rule->actions[i]->refcount, 1);
+		members[i] = actions[i];
+		atomic_fetch_add(&members[i]->refcount, 1);
 	}
 
+	return members;
+}
+
+static int dr_rule_add_action_members(struct mlx5dv_dr_rule *rule,
+				      size_t num_actions,
+				      struct mlx5dv_dr_action *actions[])
+{
+	rule->actions = dr_rule_get_action_members(num_actions, actions);
+	if (!rule->actions)
+		return errno;
+
+	rule->num_actions = num_actions;
 	return 0;
 }
 
@@ -875,6 +898,36 @@ static bool dr_rule_need_enlarge_hash(struct dr_ste_htbl *htbl,
 	return false;
 }
 
+/* Once a table is half way to its rehash threshold let the background
+ * thread get the ICM for the bigger table ready, so the rehash itself
+ * only copies entries.
+ */
+static void dr_rule_reserve_enlarge_hash(struct dr_ste_htbl *htbl,
+					 struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_ste_htbl_ctrl *ctrl = &htbl->ctrl;
+	enum dr_icm_chunk_size new_size;
+	int threshold;
+
+	if (htbl->grow_reserved || !atomic_load(&dmn->bg_sync.enabled))
+		return;
+
+	if (dmn->info.max_log_sw_icm_sz <= htbl->chunk_size ||
+	    !dr_ste_htbl_may_grow(htbl))
+		return;
+
+	threshold = dr_ste_htbl_increase_threshold(htbl) / 2;
+	if (ctrl->num_of_collisions < threshold ||
+	    (ctrl->num_of_valid_entries - ctrl->num_of_collisions) < threshold)
+		return;
+
+	htbl->grow_reserved = true;
+
+	new_size = dr_rule_rehash_size(dmn, htbl);
+	if (new_size != htbl->chunk_size)
+		dr_icm_pool_request_reserve(dmn->ste_icm_pool, new_size);
+}
+
 static int dr_rule_handle_regular_action_stes(struct mlx5dv_dr_rule *rule,
 					      struct dr_rule_rx_tx *nic_rule,
 					      struct list_head *send_ste_list,
@@ -1106,6 +1159,9 @@ again:
 			}
 			goto again;
 		} else {
+			if (!skip_rehash)
+				dr_rule_reserve_enlarge_hash(cur_htbl, dmn);
+
 			/* Hash table index in use, add another collision (miss) */
 			ste = dr_rule_handle_collision(matcher,
 						       nic_rule,
@@ -1608,6 +1664,210 @@ free_rule:
 	return NULL;
 }
 
+static bool dr_rule_has_cross_dmn_action(struct mlx5dv_dr_domain *dmn,
+					 size_t num_actions,
+					 struct mlx5dv_dr_action *actions[])
+{
+	int i;
+
+	for (i = 0; i < num_actions; i++)
+		if (actions[i]->action_type == DR_ACTION_TYP_ASO_CT &&
+		    actions[i]->aso.dmn != dmn)
+			return true;
+
+	return false;
+}
+
+/* Drop the action STEs created for a rule after its last match STE */
+static void dr_rule_put_action_stes(struct mlx5dv_dr_rule *rule,
+				    struct dr_rule_rx_tx *nic_rule)
+{
+	struct dr_ste *ste_arr[DR_RULE_MAX_STES + DR_ACTION_MAX_STES];
+	int num_of_builders = nic_rule->nic_matcher->num_of_builders;
+	int i;
+
+	dr_rule_get_reverse_rule_members(ste_arr, nic_rule->last_rule_ste, &i);
+
+	/* The members are returned last first, the action STEs lead */
+	i -= num_of_builders;
+	while (i--)
+		dr_ste_put(ste_arr[i], rule, nic_rule);
+}
+
+/*
+ * Replace the actions of a rule in place. The tag of the last match STE is
+ * kept and only its action part and the action STEs after it are rebuilt.
+ * The new action STEs are written before the match STE is switched to them
+ * and the old ones are released only after that, so packets hit either the
+ * old or the new actions.
+ */
+static int dr_rule_modify_actions_nic(struct mlx5dv_dr_rule *rule,
+				      struct dr_rule_rx_tx *nic_rule,
+				      size_t num_actions,
+				      struct mlx5dv_dr_action *actions[])
+{
+	uint8_t hw_ste_arr[DR_RULE_MAX_STE_CHAIN * DR_STE_SIZE] = {};
+	struct dr_ste *ste_arr[DR_RULE_MAX_STES + DR_ACTION_MAX_STES];
+	struct dr_matcher_rx_tx *nic_matcher = nic_rule->nic_matcher;
+	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
+	uint8_t num_of_builders = nic_matcher->num_of_builders;
+	struct dr_ste_send_info *ste_info, *tmp_ste_info;
+	struct mlx5dv_dr_matcher *matcher = rule->matcher;
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	struct cross_dmn_params cross_dmn_p = {};
+	struct dr_ste *old_last_ste, *match_ste;
+	struct dr_ste_htbl *old_next_htbl;
+	uint32_t new_hw_ste_arr_sz = 0;
+	LIST_HEAD(send_ste_list);
+	uint8_t *last_hw_ste;
+	int num_of_stes, i;
+	int ret;
+
+	/* The rule was skipped on this side */
+	if (!nic_rule->last_rule_ste)
+		return 0;
+
+	cross_dmn_p.cross_dmn_loc = -1;
+	last_hw_ste = hw_ste_arr + (num_of_builders - 1) * DR_STE_SIZE;
+
+	dr_rule_lock(nic_rule, NULL);
+
+	old_last_ste = nic_rule->last_rule_ste;
+	dr_rule_get_reverse_rule_members(ste_arr, old_last_ste, &num_of_stes);
+	match_ste = ste_arr[num_of_stes - num_of_builders];
+	old_next_htbl = match_ste->next_htbl;
+
+	dr_ste_init_rule_last_ste(dmn->ste_ctx, match_ste,
+				  &nic_matcher->ste_builder[num_of_builders - 1],
+				  nic_dmn->type == DR_DOMAIN_NIC_TYPE_RX,
+				  dmn->info.caps.gvmi, last_hw_ste);
+
+	ret = dr_actions_build_ste_arr(matcher, nic_matcher, actions,
+				       num_actions, hw_ste_arr,
+				       &new_hw_ste_arr_sz,
+				       &cross_dmn_p,
+				       nic_rule->lock_index);
+	if (ret)
+		goto out_unlock;
+
+	/* Stay in the same place of the miss list */
+	dr_ste_set_miss_addr(dmn->ste_ctx, last_hw_ste,
+			     dr_ste_get_miss_addr(dmn->ste_ctx, match_ste->hw_ste));
+
+	ste_info = calloc(1, sizeof(*ste_info));
+	if (!ste_info) {
+		errno = ENOMEM;
+		ret = ENOMEM;
+		goto out_unlock;
+	}
+
+	/* The list is sent in reverse, the match STE goes out last */
+	dr_send_fill_and_append_ste_send_info(match_ste, DR_STE_SIZE, 0,
+					      last_hw_ste, ste_info,
+					      &send_ste_list, false);
+
+	dr_rule_set_last_member(nic_rule, match_ste, true);
+
+	ret = dr_rule_handle_regular_action_stes(rule, nic_rule,
+						 &send_ste_list, match_ste,
+						 hw_ste_arr,
+						 new_hw_ste_arr_sz);
+	if (ret) {
+		dr_dbg(dmn, "Failed apply actions\n");
+		goto restore_actions;
+	}
+
+	ret = dr_rule_send_update_list(&send_ste_list, dmn, true,
+				       nic_rule->lock_index);
+	if (ret) {
+		dr_dbg(dmn, "Failed sending ste!\n");
+		goto restore_actions;
+	}
+
+	/* The old action STEs are not pointed to anymore */
+	for (i = num_of_stes - num_of_builders - 1; i >= 0; i--)
+		dr_ste_put(ste_arr[i], rule, nic_rule);
+
+	goto out_unlock;
+
+restore_actions:
+	list_for_each_safe(&send_ste_list, ste_info, tmp_ste_info, send_list) {
+		list_del(&ste_info->send_list);
+		free(ste_info);
+	}
+	dr_rule_put_action_stes(rule, nic_rule);
+	match_ste->next_htbl = old_next_htbl;
+	dr_rule_set_last_member(nic_rule, old_last_ste, true);
+out_unlock:
+	dr_rule_unlock(nic_rule);
+	return ret;
+}
+
+static int dr_rule_modify_actions(struct mlx5dv_dr_rule *rule,
+				  size_t num_actions,
+				  struct mlx5dv_dr_action *actions[])
+{
+	struct mlx5dv_dr_domain *dmn = rule->matcher->tbl->dmn;
+	struct mlx5dv_dr_action **old_actions = rule->actions;
+	uint16_t old_num_actions = rule->num_actions;
+	struct mlx5dv_dr_action **new_actions;
+	int ret;
+
+	if (dr_rule_has_cross_dmn_action(dmn, old_num_actions, old_actions) ||
+	    dr_rule_has_cross_dmn_action(dmn, num_actions, actions)) {
+		dr_dbg(dmn, "Modify of cross domain ASO actions is not supported\n");
+		errno = EOPNOTSUPP;
+		return errno;
+	}
+
+	new_actions = dr_rule_get_action_members(num_actions, actions);
+	if (!new_actions)
+		return errno;
+
+	if (rule->rx.nic_matcher) {
+		ret = dr_rule_modify_actions_nic(rule, &rule->rx,
+						 num_actions, actions);
+		if (ret)
+			goto put_new_actions;
+	}
+
+	if (rule->tx.nic_matcher) {
+		ret = dr_rule_modify_actions_nic(rule, &rule->tx,
+						 num_actions, actions);
+		if (ret)
+			goto restore_rx;
+	}
+
+	pthread_spin_lock(&dmn->debug_lock);
+	rule->actions = new_actions;
+	rule->num_actions = num_actions;
+	pthread_spin_unlock(&dmn->debug_lock);
+
+	dr_rule_put_action_members(old_actions, old_num_actions);
+	return 0;
+
+restore_rx:
+	if (rule->rx.nic_matcher)
+		dr_rule_modify_actions_nic(rule, &rule->rx,
+					   old_num_actions, old_actions);
+put_new_actions:
+	dr_rule_put_action_members(new_actions, num_actions);
+	errno = ret;
+	return ret;
+}
+
+int mlx5dv_dr_rule_modify_actions(struct mlx5dv_dr_rule *rule,
+				  size_t num_actions,
+				  struct mlx5dv_dr_action *actions[])
+{
+	if (dr_is_root_table(rule->matcher->tbl)) {
+		errno = EOPNOTSUPP;
+		return errno;
+	}
+
+	return dr_rule_modify_actions(rule, num_actions, actions);
+}
+
 struct mlx5dv_dr_rule *mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
 					     struct mlx5dv_flow_match_parameters *value,
 					     size_t num_actions,
@@ -124,6 +124,26 @@ void dr_ste_set_miss_addr(struct dr_ste_ctx *ste_ctx, uint8_t *hw_ste_p,
 	ste_ctx->set_miss_addr(hw_ste_p, miss_addr);
 }
 
+uint64_t dr_ste_get_miss_addr(struct dr_ste_ctx *ste_ctx, uint8_t *hw_ste_p)
+{
+	return ste_ctx->get_miss_addr(hw_ste_p);
+}
+
+/* Init a copy of the last match STE of a rule without any of its actions,
+ * only the tag is taken from the existing STE.
+ */
+void dr_ste_init_rule_last_ste(struct dr_ste_ctx *ste_ctx,
+			       struct dr_ste *ste,
+			       struct dr_ste_build *sb,
+			       bool is_rx, uint16_t gvmi,
+			       uint8_t *hw_ste_p)
+{
+	ste_ctx->ste_init(hw_ste_p, sb->lu_type, is_rx, gvmi);
+	dr_ste_set_bit_mask(hw_ste_p, sb);
+	memcpy(dr_ste_get_tag(hw_ste_p), dr_ste_get_tag(ste->hw_ste),
+	       dr_ste_tag_sz(ste));
+}
+
 static void dr_ste_always_miss_addr(struct dr_ste_ctx *ste_ctx,
 				    struct dr_ste *ste,
 				    uint64_t miss_addr,
@@ -822,15 +842,89 @@ int dr_ste_build_pre_check(struct mlx5dv_dr_domain *dmn,
 	return 0;
 }
 
+static int dr_ste_build_tag_sz(struct dr_ste_build *sb)
+{
+	if (sb->htbl_type == DR_STE_HTBL_TYPE_LEGACY)
+		return DR_STE_SIZE_TAG;
+
+	return DR_STE_SIZE_MATCH_TAG;
+}
+
+/* Same as sb->ste_build_tag_func() for the mask the program was compiled
+ * for, on a zeroed tag.  The value is left as is, the programs of the next
+ * builders already skip the bits used by this one.
+ */
+static void dr_ste_tag_prog_run(struct dr_ste_tag_prog *prog,
+				struct dr_match_param *value,
+				uint8_t *tag, int tag_sz)
+{
+	uint64_t acc[DR_STE_SIZE_MATCH_TAG / sizeof(uint64_t)];
+	const uint8_t *val = (const uint8_t *)value;
+	struct dr_ste_tag_op *op;
+	uint64_t bits;
+	int i;
+
+	memcpy(acc, prog->const_tag, sizeof(acc));
+
+	for (i = 0; i < prog->num_copy_ops; i++) {
+		op = &prog->ops[i];
+		memcpy(&bits, val + op->byte, sizeof(bits));
+		bits = (le64toh(bits) >> op->shift) & op->mask;
+		acc[op->dst / 64] |= bits << (op->dst % 64);
+	}
+
+	for (; i < prog->num_ops; i++) {
+		op = &prog->ops[i];
+		memcpy(&bits, val + op->byte, sizeof(bits));
+		bits = !!((le64toh(bits) >> op->shift) & op->mask);
+		acc[op->dst / 64] |= bits << (op->dst % 64);
+	}
+
+	/* acc[0] holds the last 8 bytes of the tag */
+	for (i = 0; i < tag_sz / sizeof(uint64_t); i++) {
+		uint8_t *p = tag + tag_sz - (i + 1) * sizeof(bits);
+
+		memcpy(&bits, p, sizeof(bits));
+		bits |= htobe64(acc[i]);
+		memcpy(p, &bits, sizeof(bits));
+	}
+}
+
+/* Everything in the STE of the builder at idx but the tag */
+static void dr_ste_build_ste_ctrl(struct mlx5dv_dr_domain *dmn,
+				  struct dr_matcher_rx_tx *nic_matcher,
+				  int idx, uint8_t *hw_ste_p)
+{
+	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
+	bool is_rx = nic_dmn->type == DR_DOMAIN_NIC_TYPE_RX;
+	struct dr_ste_build *sb = &nic_matcher->ste_builder[idx];
+	struct dr_ste_ctx *ste_ctx = dmn->ste_ctx;
+
+	ste_ctx->ste_init(hw_ste_p,
+			  sb->lu_type,
+			  is_rx,
+			  dmn->info.caps.gvmi);
+
+	dr_ste_set_bit_mask(hw_ste_p, sb);
+
+	/* Connect the STEs */
+	if (idx < (nic_matcher->num_of_builders - 1)) {
+		/* Need the next builder for these fields,
+		 * not relevant for the last ste in the chain.
+		 */
+		sb++;
+		ste_ctx->set_next_lu_type(hw_ste_p, sb->lu_type);
+		ste_ctx->set_byte_mask(hw_ste_p, sb->byte_mask);
+	}
+}
+
 int dr_ste_build_ste_arr(struct mlx5dv_dr_matcher *matcher,
 			 struct dr_matcher_rx_tx *nic_matcher,
 			 struct dr_match_param *value,
 			 uint8_t *ste_arr)
 {
-	struct dr_domain_rx_tx *nic_dmn = nic_matcher->nic_tbl->nic_dmn;
-	bool is_rx = nic_dmn->type == DR_DOMAIN_NIC_TYPE_RX;
 	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
-	struct dr_ste_ctx *ste_ctx = dmn->ste_ctx;
+	struct dr_ste_tag_prog *prog;
 	struct dr_ste_build *sb;
 	int ret, i;
 
@@ -841,31 +935,358 @@ int dr_ste_build_ste_arr(struct mlx5dv_dr_matcher *matcher,
 
 	sb = nic_matcher->ste_builder;
 	for (i = 0; i < nic_matcher->num_of_builders; i++) {
-		ste_ctx->ste_init(ste_arr,
-				  sb->lu_type,
-				  is_rx,
-				  dmn->info.caps.gvmi);
+		prog = sb->tag_prog;
+		if (prog) {
+			memcpy(ste_arr, prog->hw_ste, DR_STE_SIZE);
+			dr_ste_tag_prog_run(prog, value,
+					    dr_ste_get_tag(ste_arr),
+					    prog->tag_sz);
+		} else {
+			dr_ste_build_ste_ctrl(dmn, nic_matcher, i, ste_arr);
+			ret = sb->ste_build_tag_func(value, sb,
+						     dr_ste_get_tag(ste_arr));
+			if (ret)
+				return ret;
+		}
+
+		sb++;
+		ste_arr += DR_STE_SIZE;
+	}
+	return 0;
+}
+
+/* Compiling the tag builders of a matcher.
+ *
+ * For a given mask most builders only move value bits to fixed tag bits.
+ * These moves are found by running the builders on values that have a
+ * single mask bit set, and are kept as a short list of copy ops that
+ * replaces the builders when rules are created.  Builders whose tag
+ * depends on more than which bits are set, e.g. compare a field to a
+ * constant, are caught by checking the ops against the builders on random
+ * values, the matcher then keeps using the builders.
+ */
+#define DR_STE_TAG_BITS		(DR_STE_SIZE_MATCH_TAG * 8)
+#define DR_STE_TAG_OP_MAX_WIDTH	32
+#define DR_STE_TAG_CHECKS	64
+
+struct dr_ste_tag_pair {
+	uint16_t	src;
+	uint8_t		dst;
+};
+
+struct dr_ste_tag_probe {
+	uint8_t			tag0[DR_STE_SIZE_MATCH_TAG];
+	int			tag_sz;
+	struct dr_ste_tag_pair	*pairs;
+	int			num_pairs;
+};
+
+static bool dr_ste_tag_test_bit(uint8_t *tag, int tag_sz, int bit)
+{
+	return tag[tag_sz - 1 - bit / 8] & (1 << (bit % 8));
+}
+
+static int dr_ste_tag_op_src(struct dr_ste_tag_op *op)
+{
+	return op->byte * 8 + op->shift;
+}
+
+static int dr_ste_tag_op_width(struct dr_ste_tag_op *op)
+{
+	return ilog32(op->mask);
+}
+
+static void dr_ste_tag_op_init(struct dr_ste_tag_op *op, int src, int dst)
+{
+	/* Keep the 8 byte load inside the value */
+	int byte = min_t(int, src / 8,
+			 sizeof(struct dr_match_param) - sizeof(uint64_t));
+
+	op->byte = byte;
+	op->shift = src - byte * 8;
+	op->dst = dst;
+	op->mask = 1;
+}
+
+static bool dr_ste_tag_op_extend(struct dr_ste_tag_op *op, int src)
+{
+	int width = dr_ste_tag_op_width(op);
+
+	if (src != dr_ste_tag_op_src(op) + width ||
+	    width == DR_STE_TAG_OP_MAX_WIDTH)
+		return false;
+
+	op->mask = (op->mask << 1) | 1;
+	return true;
+}
+
+static struct dr_ste_tag_prog *
+dr_ste_tag_prog_create(struct dr_ste_tag_probe *probe)
+{
+	uint16_t dst_cnt[DR_STE_TAG_BITS] = {};
+	struct dr_ste_tag_op *op = NULL;
+	struct dr_ste_tag_prog *prog;
+	struct dr_ste_tag_pair *p;
+	int i, dst;
+
+	/* There is at most an op per pair */
+	prog = calloc(1, sizeof(*prog) + probe->num_pairs * sizeof(*op));
+	if (!prog)
+		return NULL;
+
+	prog->tag_sz = probe->tag_sz;
+
+	for (dst = 0; dst < probe->tag_sz * 8; dst++)
+		if (dr_ste_tag_test_bit(probe->tag0, probe->tag_sz, dst))
+			prog->const_tag[dst / 64] |= 1ULL << (dst % 64);
+
+	for (i = 0; i < probe->num_pairs; i++)
+		dst_cnt[probe->pairs[i].dst]++;
+
+	/* Value bits that own a tag bit, the pairs are sorted by src */
+	for (i = 0; i < probe->num_pairs; i++) {
+		p = &probe->pairs[i];
+		if (dst_cnt[p->dst] != 1)
+			continue;
+
+		if (op && p->dst == op->dst + dr_ste_tag_op_width(op) &&
+		    p->dst % 64 && dr_ste_tag_op_extend(op, p->src))
+			continue;
+
+		op = &prog->ops[prog->num_ops++];
+		dr_ste_tag_op_init(op, p->src, p->dst);
+	}
+	prog->num_copy_ops = prog->num_ops;
+
+	/* Tag bits set by any of several value bits, e.g. a field is set */
+	for (dst = 0; dst < DR_STE_TAG_BITS; dst++) {
+		if (dst_cnt[dst] < 2)
+			continue;
+
+		op = NULL;
+		for (i = 0; i < probe->num_pairs; i++) {
+			p = &probe->pairs[i];
+			if (p->dst != dst)
+				continue;
+
+			if (op && dr_ste_tag_op_extend(op, p->src))
+				continue;
+
+			op = &prog->ops[prog->num_ops++];
+			dr_ste_tag_op_init(op, p->src, dst);
+		}
+	}
+
+	return prog;
+}
+
+/* Run the builders on base with bit set, or on base as is when bit is
+ * negative, and record the tag bits the value bit sets in each of them.
+ */
+static int dr_ste_tag_probe_bit(struct dr_matcher_rx_tx *nic_matcher,
+				struct dr_ste_tag_probe *probe,
+				struct dr_match_param *base,
+				int bit, int max_pairs)
+{
+	struct dr_ste_build *sb = nic_matcher->ste_builder;
+	struct dr_match_param value = *base;
+	uint8_t tag[DR_STE_SIZE_MATCH_TAG];
+	uint8_t *val = (uint8_t *)&value;
+	int i, j, tag_sz, ret;
+	bool set, set0;
 
-		dr_ste_set_bit_mask(ste_arr, sb);
+	if (bit >= 0)
+		val[bit / 8] |= 1 << (bit % 8);
 
-		ret = sb->ste_build_tag_func(value, sb, dr_ste_get_tag(ste_arr));
+	for (i = 0; i < nic_matcher->num_of_builders; i++) {
+		memset(tag, 0, sizeof(tag));
+		ret = sb[i].ste_build_tag_func(&value, &sb[i], tag);
 		if (ret)
 			return ret;
 
-		/* Connect the STEs */
-		if (i < (nic_matcher->num_of_builders - 1)) {
-			/* Need the next builder for these fields,
-			 * not relevant for the last ste in the chain.
-			 */
-			sb++;
-			ste_ctx->set_next_lu_type(ste_arr, sb->lu_type);
-			ste_ctx->set_byte_mask(ste_arr, sb->byte_mask);
+		tag_sz = dr_ste_build_tag_sz(&sb[i]);
+		if (bit < 0) {
+			memcpy(probe[i].tag0, tag, sizeof(tag));
+			probe[i].tag_sz = tag_sz;
+			continue;
 		}
-		ste_arr += DR_STE_SIZE;
+
+		for (j = 0; j < tag_sz * 8; j++) {
+			set = dr_ste_tag_test_bit(tag, tag_sz, j);
+			set0 = dr_ste_tag_test_bit(probe[i].tag0, tag_sz, j);
+			if (set0 && !set)
+				return EINVAL;
+			if (set0 || !set)
+				continue;
+
+			if (probe[i].num_pairs == max_pairs)
+				return ENOSPC;
+
+			probe[i].pairs[probe[i].num_pairs].src = bit;
+			probe[i].pairs[probe[i].num_pairs].dst = j;
+			probe[i].num_pairs++;
+		}
+	}
+
+	return 0;
+}
+
+static uint64_t dr_ste_tag_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* Compare the programs to the builders on the full mask and on random
+ * values within it.
+ */
+static bool dr_ste_tag_progs_check(struct dr_matcher_rx_tx *nic_matcher,
+				   struct dr_ste_tag_prog **prog,
+				   struct dr_match_param *base,
+				   struct dr_match_param *mask)
+{
+	struct dr_ste_build *sb = nic_matcher->ste_builder;
+	uint8_t prog_tag[DR_STE_SIZE_MATCH_TAG];
+	uint8_t tag[DR_STE_SIZE_MATCH_TAG];
+	struct dr_match_param value, prog_value;
+	uint8_t *base_p = (uint8_t *)base;
+	uint8_t *mask_p = (uint8_t *)mask;
+	uint8_t *val = (uint8_t *)&value;
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	uint64_t rnd = 0;
+	int i, j, tag_sz;
+
+	for (i = 0; i <= DR_STE_TAG_CHECKS; i++) {
+		for (j = 0; j < sizeof(value); j++) {
+			if (!(j % sizeof(rnd)))
+				rnd = dr_ste_tag_rand(&state);
+			val[j] = base_p[j] | (mask_p[j] &
+				 (i == DR_STE_TAG_CHECKS ? 0xff : rnd >> (j % 8 * 8)));
+		}
+		prog_value = value;
+
+		for (j = 0; j < nic_matcher->num_of_builders; j++) {
+			tag_sz = dr_ste_build_tag_sz(&sb[j]);
+			memset(tag, 0, sizeof(tag));
+			memset(prog_tag, 0, sizeof(prog_tag));
+
+			if (sb[j].ste_build_tag_func(&value, &sb[j], tag))
+				return false;
+
+			dr_ste_tag_prog_run(prog[j], &prog_value, prog_tag, tag_sz);
+			if (memcmp(tag, prog_tag, tag_sz))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static int dr_ste_tag_probe_all(struct mlx5dv_dr_matcher *matcher,
+				struct dr_matcher_rx_tx *nic_matcher,
+				struct dr_ste_tag_probe *probe,
+				struct dr_ste_tag_prog **prog,
+				struct dr_match_param *base)
+{
+	uint8_t *mask_p = (uint8_t *)&matcher->mask;
+	uint8_t *base_p = (uint8_t *)base;
+	int max_pairs = DR_STE_TAG_BITS;
+	int i, bit, ret;
+
+	for (bit = 0; bit < sizeof(*base) * 8; bit++)
+		if (mask_p[bit / 8] & ~base_p[bit / 8] & (1 << (bit % 8)))
+			max_pairs += 2;
+
+	for (i = 0; i < nic_matcher->num_of_builders; i++) {
+		probe[i].pairs = calloc(max_pairs, sizeof(*probe[i].pairs));
+		if (!probe[i].pairs)
+			return ENOMEM;
+	}
+
+	ret = dr_ste_tag_probe_bit(nic_matcher, probe, base, -1, max_pairs);
+	if (ret)
+		return ret;
+
+	for (bit = 0; bit < sizeof(*base) * 8; bit++) {
+		if (!(mask_p[bit / 8] & ~base_p[bit / 8] & (1 << (bit % 8))))
+			continue;
+
+		ret = dr_ste_tag_probe_bit(nic_matcher, probe, base, bit,
+					   max_pairs);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < nic_matcher->num_of_builders; i++) {
+		prog[i] = dr_ste_tag_prog_create(&probe[i]);
+		if (!prog[i])
+			return ENOMEM;
 	}
+
+	if (!dr_ste_tag_progs_check(nic_matcher, prog, base, &matcher->mask))
+		return EINVAL;
+
 	return 0;
 }
 
+/* All the builders of the matcher are compiled or none, a builder program
+ * relies on the previous builders having used their bits.
+ */
+void dr_ste_build_compile_tags(struct mlx5dv_dr_matcher *matcher,
+			       struct dr_matcher_rx_tx *nic_matcher)
+{
+	struct dr_ste_tag_prog *prog[DR_RULE_MAX_STES] = {};
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+	struct dr_ste_tag_probe *probe;
+	struct dr_match_param base = {};
+	int i, ret;
+
+	/* The source port is translated through the vports table */
+	if (matcher->mask.misc.source_port)
+		return;
+
+	/* dr_ste_build_pre_check() rejects rules of another IP version than
+	 * the mask, so the IP version is the same for every value.
+	 */
+	if (matcher->match_criteria & DR_MATCHER_CRITERIA_OUTER)
+		base.outer.ip_version = matcher->mask.outer.ip_version;
+	if (matcher->match_criteria & DR_MATCHER_CRITERIA_INNER)
+		base.inner.ip_version = matcher->mask.inner.ip_version;
+
+	probe = calloc(nic_matcher->num_of_builders, sizeof(*probe));
+	if (!probe)
+		return;
+
+	ret = dr_ste_tag_probe_all(matcher, nic_matcher, probe, prog, &base);
+	if (ret)
+		dr_dbg(dmn, "Matcher tag builders were not compiled (%d)\n", ret);
+
+	for (i = 0; i < nic_matcher->num_of_builders; i++) {
+		if (ret) {
+			free(prog[i]);
+		} else {
+			dr_ste_build_ste_ctrl(dmn, nic_matcher, i,
+					      prog[i]->hw_ste);
+			nic_matcher->ste_builder[i].tag_prog = prog[i];
+		}
+		free(probe[i].pairs);
+	}
+	free(probe);
+}
+
+void dr_ste_build_free_tags(struct dr_matcher_rx_tx *nic_matcher)
+{
+	struct dr_ste_build *sb = nic_matcher->ste_builder;
+	int i;
+
+	for (i = 0; i < nic_matcher->num_of_builders; i++) {
+		free(sb[i].tag_prog);
+		sb[i].tag_prog = NULL;
+	}
+}
+
 static void dr_ste_copy_mask_misc(char *mask, struct dr_match_misc *spec, bool clear)
 {
 	spec->gre_c_present = DR_DEVX_GET_CLEAR(dr_match_set_misc, mask, gre_c_present, clear);
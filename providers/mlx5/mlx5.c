@@ -556,6 +556,58 @@ out:
 	return stall_enable;
 }
 
+static int mlx5_dev_numa_node(struct ibv_device *ibdev)
+{
+	char fname[MAXPATHLEN];
+	int node;
+	FILE *fp;
+
+	snprintf(fname, MAXPATHLEN, "/sys/class/infiniband/%s/device/numa_node",
+		 ibv_get_device_name(ibdev));
+
+	fp = fopen(fname, "r");
+	if (!fp)
+		return MLX5DV_BUF_NUMA_NODE_ANY;
+	if (fscanf(fp, "%d", &node) != 1 || node < 0)
+		node = MLX5DV_BUF_NUMA_NODE_ANY;
+	fclose(fp);
+
+	return node;
+}
+
+static int mlx5_resolve_numa_node(struct ibv_device *ibdev, int node)
+{
+	if (node == MLX5DV_BUF_NUMA_NODE_DEVICE)
+		return mlx5_dev_numa_node(ibdev);
+	if (node < MLX5DV_BUF_NUMA_NODE_DEVICE)
+		return MLX5DV_BUF_NUMA_NODE_ANY;
+
+	return node;
+}
+
+/*
+ * MLX5_BUF_NUMA_NODE: "local" for the node of the thread creating the
+ * resource, "device" for the node the device is attached to, or a node id.
+ */
+static void mlx5_read_buf_numa_node(struct ibv_device *ibdev,
+				    struct mlx5_context *ctx)
+{
+	char *env_value;
+	int node = MLX5DV_BUF_NUMA_NODE_ANY;
+
+	env_value = getenv("MLX5_BUF_NUMA_NODE");
+	if (env_value) {
+		if (!strcasecmp(env_value, "local"))
+			node = MLX5DV_BUF_NUMA_NODE_LOCAL;
+		else if (!strcasecmp(env_value, "device"))
+			node = MLX5DV_BUF_NUMA_NODE_DEVICE;
+		else
+			node = atoi(env_value);
+	}
+
+	ctx->buf_numa_node = mlx5_resolve_numa_node(ibdev, node);
+}
+
 static void mlx5_read_env(struct ibv_device *ibdev, struct mlx5_context *ctx)
 {
 	char *env_value;
@@ -596,6 +648,7 @@ static void mlx5_read_env(struct ibv_device *ibdev, struct mlx5_context *ctx)
 		ctx->stall_cycles = mlx5_stall_cq_poll_min;
 	}
 
+	mlx5_read_buf_numa_node(ibdev, ctx);
 }
 
 static int get_total_uuars(int page_size)
@@ -725,6 +778,28 @@ static int need_uuar_lock(struct mlx5_context *ctx, int uuarn)
 	return 1;
 }
 
+/*
+ * Doorbell records are a cache line apart by default, so records of
+ * queues driven by different threads never share a line.  MLX5_DBR_SIZE
+ * packs them tighter, down to the 8 bytes a record needs, for
+ * applications with very many mostly idle queues.
+ */
+static int get_dbr_size(int cache_line_size)
+{
+	char *env;
+	int size;
+
+	env = getenv("MLX5_DBR_SIZE");
+	if (!env)
+		return cache_line_size;
+
+	size = atoi(env);
+	if (size < 8 || size > cache_line_size || (size & (size - 1)))
+		return cache_line_size;
+
+	return size;
+}
+
 static int single_threaded_app(void)
 {
 
@@ -2220,6 +2295,10 @@ static int _mlx5dv_set_context_attr(struct ibv_context *ibv_ctx,
 	case MLX5DV_CTX_ATTR_BUF_ALLOCATORS:
 		ctx->extern_alloc = *((struct mlx5dv_ctx_allocators *)attr);
 		break;
+	case MLX5DV_CTX_ATTR_BUF_NUMA_NODE:
+		ctx->buf_numa_node = mlx5_resolve_numa_node(ibv_ctx->device,
+							    *(int *)attr);
+		break;
 	default:
 		return ENOTSUP;
 	}
@@ -2425,6 +2504,7 @@ static int mlx5_set_context(struct mlx5_context *context,
 	context->max_num_qps = resp->qp_tab_size;
 	context->bf_reg_size = resp->bf_reg_size;
 	context->cache_line_size = resp->cache_line_size;
+	context->dbr_size = get_dbr_size(context->cache_line_size);
 	context->max_sq_desc_sz = resp->max_sq_desc_sz;
 	context->max_rq_desc_sz = resp->max_rq_desc_sz;
 	context->max_send_wqebb	= resp->max_send_wqebb;
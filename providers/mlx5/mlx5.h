@@ -203,6 +203,7 @@ enum mlx5_alloc_type {
 	MLX5_ALLOC_TYPE_PREFER_CONTIG,
 	MLX5_ALLOC_TYPE_EXTERNAL,
 	MLX5_ALLOC_TYPE_CUSTOM,
+	MLX5_ALLOC_TYPE_NUMA,
 	MLX5_ALLOC_TYPE_ALL
 };
 
@@ -353,6 +354,7 @@ struct mlx5_context {
 	cl_qmap_t		        dbr_map;
 	pthread_mutex_t			dbr_map_mutex;
 	int				cache_line_size;
+	int				dbr_size;
 	int				max_sq_desc_sz;
 	int				max_rq_desc_sz;
 	int				max_send_wqebb;
@@ -367,6 +369,7 @@ struct mlx5_context {
 	char				hostname[HOST_NAME_MAX + 1];
 	struct mlx5_spinlock            hugetlb_lock;
 	struct list_head                hugetlb_list;
+	int				buf_numa_node;
 	int				cqe_version;
 	uint8_t				cached_link_layer[MLX5_MAX_PORTS_NUM];
 	uint8_t				cached_port_flags[MLX5_MAX_PORTS_NUM];
@@ -429,8 +432,9 @@ struct mlx5_context {
 };
 
 struct mlx5_hugetlb_mem {
-	int			shmid;
-	void		       *shmaddr;
+	void		       *addr;
+	size_t			length;
+	int			numa_node;
 	unsigned long		*bitmap;
 	unsigned long		bmp_size;
 	struct list_node	entry;
@@ -1093,6 +1097,9 @@ void mlx5_close_debug_file(FILE *dbg_fp);
 void mlx5_set_debug_mask(void);
 
 int mlx5_alloc_buf(struct mlx5_buf *buf, size_t size, int page_size);
+int mlx5_alloc_buf_numa(struct mlx5_context *mctx, struct mlx5_buf *buf,
+			size_t size, int page_size);
+void mlx5_free_buf_numa(struct mlx5_buf *buf);
 void mlx5_free_buf(struct mlx5_buf *buf);
 int mlx5_alloc_buf_contig(struct mlx5_context *mctx, struct mlx5_buf *buf,
 			  size_t size, int page_size, const char *component);
@@ -1627,6 +1627,14 @@ void mlx5dv_set_eth_seg(struct mlx5_wqe_eth_seg *seg, uint8_t cs_flags,
 
 enum mlx5dv_set_ctx_attr_type {
 	MLX5DV_CTX_ATTR_BUF_ALLOCATORS = 1,
+	MLX5DV_CTX_ATTR_BUF_NUMA_NODE = 2,
+};
+
+/* Special values for MLX5DV_CTX_ATTR_BUF_NUMA_NODE, any other is a node id */
+enum mlx5dv_buf_numa_node {
+	MLX5DV_BUF_NUMA_NODE_ANY	= -1,
+	MLX5DV_BUF_NUMA_NODE_LOCAL	= -2,
+	MLX5DV_BUF_NUMA_NODE_DEVICE	= -3,
 };
 
 enum {
@@ -2005,6 +2013,9 @@ void mlx5dv_dr_domain_set_reclaim_device_memory(struct mlx5dv_dr_domain *dmn,
 void mlx5dv_dr_domain_allow_duplicate_rules(struct mlx5dv_dr_domain *domain,
 					    bool allow);
 
+int mlx5dv_dr_domain_set_background_sync(struct mlx5dv_dr_domain *domain,
+					 bool enable);
+
 struct mlx5dv_dr_table *
 mlx5dv_dr_table_create(struct mlx5dv_dr_domain *domain, uint32_t level);
 
@@ -2039,6 +2050,10 @@ mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
 
 int mlx5dv_dr_rule_destroy(struct mlx5dv_dr_rule *rule);
 
+int mlx5dv_dr_rule_modify_actions(struct mlx5dv_dr_rule *rule,
+				  size_t num_actions,
+				  struct mlx5dv_dr_action *actions[]);
+
 enum mlx5dv_dr_action_flags {
 	MLX5DV_DR_ACTION_FLAGS_ROOT_LEVEL	= 1 << 0,
 };
@@ -2160,6 +2175,9 @@ int mlx5dv_dump_dr_domain(FILE *fout, struct mlx5dv_dr_domain *domain);
 int mlx5dv_dump_dr_table(FILE *fout, struct mlx5dv_dr_table *table);
 int mlx5dv_dump_dr_matcher(FILE *fout, struct mlx5dv_dr_matcher *matcher);
 int mlx5dv_dump_dr_rule(FILE *fout, struct mlx5dv_dr_rule *rule);
+int mlx5dv_dump_dr_matcher_lookup(FILE *fout,
+				  struct mlx5dv_dr_matcher *matcher,
+				  struct mlx5dv_flow_match_parameters *value);
 
 struct mlx5dv_pp {
 	uint16_t index;
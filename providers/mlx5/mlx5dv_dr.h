@@ -280,6 +280,8 @@ struct dr_ste_htbl {
 	struct dr_ste		*pointing_ste;
 
 	struct dr_ste_htbl_ctrl ctrl;
+	/* ICM for the next rehash was requested from the background thread */
+	bool			grow_reserved;
 };
 
 struct dr_ste_send_info {
@@ -297,6 +299,28 @@ void dr_send_fill_and_append_ste_send_info(struct dr_ste *ste, uint16_t size,
 					   struct list_head *send_list,
 					   bool copy_data);
 
+/* Tag builder compiled for the mask of a matcher, see
+ * dr_ste_build_compile_tags().
+ */
+struct dr_ste_tag_op {
+	uint16_t		byte;	/* the 8 value bytes to load */
+	uint8_t			shift;
+	uint8_t			dst;	/* tag bit, counted from the tag end */
+	uint32_t		mask;
+};
+
+struct dr_ste_tag_prog {
+	/* The STE without the tag */
+	uint8_t			hw_ste[DR_STE_SIZE];
+	int			tag_sz;
+	/* Tag bits set for every value, counted as dst */
+	uint64_t		const_tag[DR_STE_SIZE_MATCH_TAG / sizeof(uint64_t)];
+	/* ops from num_copy_ops on set dst if any of their bits is set */
+	uint16_t		num_copy_ops;
+	uint16_t		num_ops;
+	struct dr_ste_tag_op	ops[];
+};
+
 struct dr_ste_build {
 	bool			inner;
 	bool			rx;
@@ -317,6 +341,7 @@ struct dr_ste_build {
 	int (*ste_build_tag_func)(struct dr_match_param *spec,
 				  struct dr_ste_build *sb,
 				  uint8_t *tag);
+	struct dr_ste_tag_prog	*tag_prog;
 };
 
 struct dr_ste_htbl *dr_ste_htbl_alloc(struct dr_icm_pool *pool,
@@ -340,6 +365,7 @@ static inline void dr_htbl_get(struct dr_ste_htbl *htbl)
 uint32_t dr_ste_calc_hash_index(uint8_t *hw_ste_p, struct dr_ste_htbl *htbl);
 void dr_ste_set_miss_addr(struct dr_ste_ctx *ste_ctx, uint8_t *hw_ste_p,
 			  uint64_t miss_addr);
+uint64_t dr_ste_get_miss_addr(struct dr_ste_ctx *ste_ctx, uint8_t *hw_ste_p);
 void dr_ste_set_hit_addr_by_next_htbl(struct dr_ste_ctx *ste_ctx,
 				      uint8_t *hw_ste,
 				      struct dr_ste_htbl *next_htbl);
@@ -348,6 +374,11 @@ void dr_ste_set_hit_addr(struct dr_ste_ctx *ste_ctx, uint8_t *hw_ste_p,
 void dr_ste_set_hit_gvmi(struct dr_ste_ctx *ste_ctx, uint8_t *hw_ste_p,
 			 uint16_t gvmi);
 void dr_ste_set_bit_mask(uint8_t *hw_ste_p, struct dr_ste_build *sb);
+void dr_ste_init_rule_last_ste(struct dr_ste_ctx *ste_ctx,
+			       struct dr_ste *ste,
+			       struct dr_ste_build *sb,
+			       bool is_rx, uint16_t gvmi,
+			       uint8_t *hw_ste_p);
 bool dr_ste_is_last_in_rule(struct dr_matcher_rx_tx *nic_matcher,
 			    uint8_t ste_location);
 uint64_t dr_ste_get_icm_addr(struct dr_ste *ste);
@@ -505,6 +536,9 @@ int dr_ste_build_ste_arr(struct mlx5dv_dr_matcher *matcher,
 			 struct dr_matcher_rx_tx *nic_matcher,
 			 struct dr_match_param *value,
 			 uint8_t *ste_arr);
+void dr_ste_build_compile_tags(struct mlx5dv_dr_matcher *matcher,
+			       struct dr_matcher_rx_tx *nic_matcher);
+void dr_ste_build_free_tags(struct dr_matcher_rx_tx *nic_matcher);
 void dr_ste_build_eth_l2_src_dst(struct dr_ste_ctx *ste_ctx,
 				 struct dr_ste_build *sb,
 				 struct dr_match_param *mask,
@@ -1077,6 +1111,21 @@ enum dr_domain_flags {
 	 DR_DOMAIN_FLAG_DISABLE_DUPLICATE_RULES = 1 << 1,
 };
 
+/*
+ * Optional thread that syncs the hot memory of the ICM pools, so rule
+ * deletion does not have to wait for the device in the common case.
+ */
+struct dr_bg_sync {
+	pthread_t		thread;
+	/* serializes starting and stopping the thread */
+	pthread_mutex_t		ctrl_mutex;
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;
+	atomic_bool		enabled;
+	bool			pending;
+	bool			stop;
+};
+
 struct mlx5dv_dr_domain {
 	struct ibv_context		*ctx;
 	struct dr_ste_ctx		*ste_ctx;
@@ -1096,6 +1145,7 @@ struct mlx5dv_dr_domain {
 	uint32_t			flags;
 	/* protect debug lists of all tracked objects */
 	pthread_spinlock_t		debug_lock;
+	struct dr_bg_sync		bg_sync;
 	/* statistcs */
 	uint32_t num_buddies[DR_ICM_TYPE_MAX];
 };
@@ -1244,6 +1294,9 @@ struct dr_ptrn_obj {
 	struct dr_rewrite_param rewrite_param;
 	atomic_int refcount;
 	struct list_node list;
+	/* on the manager's idle list while refcount is 0 */
+	struct list_node idle_node;
+	uint32_t hash;
 	enum dr_ptrn_type type;
 };
 
@@ -1614,6 +1667,11 @@ struct dr_icm_pool *dr_icm_pool_create(struct mlx5dv_dr_domain *dmn,
 				       enum dr_icm_type icm_type);
 void dr_icm_pool_destroy(struct dr_icm_pool *pool);
 int dr_icm_pool_sync_pool(struct dr_icm_pool *pool);
+int dr_icm_pool_bg_sync_pool(struct dr_icm_pool *pool);
+void dr_icm_pool_request_reserve(struct dr_icm_pool *pool,
+				 enum dr_icm_chunk_size chunk_size);
+int dr_icm_pool_bg_reserve(struct dr_icm_pool *pool);
+void dr_domain_bg_sync_wake(struct mlx5dv_dr_domain *dmn);
 
 uint64_t dr_icm_pool_get_chunk_icm_addr(struct dr_icm_chunk *chunk);
 uint64_t dr_icm_pool_get_chunk_mr_addr(struct dr_icm_chunk *chunk);
@@ -1731,10 +1789,23 @@ int dr_send_postsend_args(struct mlx5dv_dr_domain *dmn, uint64_t arg_id,
 /* buddy functions & structure */
 struct dr_icm_mr;
 
+/* Enough levels of 64 bit summaries for 2^32 segments */
+#define DR_BUDDY_MAX_LEVELS 6
+
+/* The free segments of an order. level[0] has a bit per segment, a bit of
+ * each next level is set when the long it stands for in the level below
+ * is not zero, and the last level is a single long.
+ */
+struct dr_buddy_order {
+	unsigned long		*level[DR_BUDDY_MAX_LEVELS];
+	unsigned int		num_levels;
+	unsigned int		num_free;
+};
+
 struct dr_icm_buddy_mem {
-	unsigned long		**bits;
-	unsigned int		*num_free;
-	unsigned long		**set_bit;
+	struct dr_buddy_order	*orders;
+	/* Backs the levels of all the orders */
+	unsigned long		*bitmap;
 	uint32_t		max_order;
 	struct list_node	list_node;
 	struct dr_icm_mr	*icm_mr;
@@ -1743,6 +1814,10 @@ struct dr_icm_buddy_mem {
 	/* This is the list of used chunks. HW may be accessing this memory */
 	struct list_head	used_list;
 	size_t			used_memory;
+	/* Reserved ahead of use by the background thread, kept from
+	 * memory reclaim until the first chunk is taken from it.
+	 */
+	bool			reserved;
 
 	/* hardware may be accessing this memory but at some future,
 	 * undetermined time, it might cease to do so.
@@ -1770,6 +1845,7 @@ dr_ptrn_cache_get_pattern(struct dr_ptrn_mngr *mngr,
 void dr_ptrn_cache_put_pattern(struct dr_ptrn_mngr *mngr,
 			       struct dr_ptrn_obj *pattern);
 int dr_ptrn_sync_pool(struct dr_ptrn_mngr *ptrn_mngr);
+int dr_ptrn_bg_sync_pool(struct dr_ptrn_mngr *ptrn_mngr);
 
 struct dr_arg_mngr*
 dr_arg_mngr_create(struct mlx5dv_dr_domain *dmn);
@@ -1783,6 +1859,7 @@ bool dr_domain_is_support_sw_encap(struct mlx5dv_dr_domain *dmn);
 
 int dr_buddy_init(struct dr_icm_buddy_mem *buddy, uint32_t max_order);
 void dr_buddy_cleanup(struct dr_icm_buddy_mem *buddy);
+bool dr_buddy_has_free(struct dr_icm_buddy_mem *buddy, int order);
 int dr_buddy_alloc_mem(struct dr_icm_buddy_mem *buddy, int order);
 void dr_buddy_free_mem(struct dr_icm_buddy_mem *buddy, uint32_t seg, int order);
 
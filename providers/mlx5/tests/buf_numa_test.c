@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: (GPL-2.0 OR Linux-OpenIB)
+/*
+ * Memory locality of mlx5 queue buffers.
+ *
+ * WQ, CQ and doorbell buffers only need a context to be allocated, not a
+ * device, so synthetic buffers of queue like sizes are allocated for every
+ * online node and for the node of the calling thread, written to like a
+ * queue being filled, and the node each page landed on is read back with
+ * move_pages().  Any page off the requested node fails the test.
+ */
+
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "../mlx5.h"
+
+uint32_t mlx5_debug_mask;
+
+static const size_t sizes[] = { 4096, 65536, 1 << 20, 4 << 20 };
+static int count = 16;
+
+struct placement {
+	unsigned long pages;
+	unsigned long local;
+	unsigned long absent;
+};
+
+static int check_buf(struct mlx5_buf *buf, int node, struct placement *p)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	unsigned long i, npages = buf->length / page_size;
+	void **pages;
+	int *status;
+	int ret = 0;
+
+	pages = calloc(npages, sizeof(*pages));
+	status = calloc(npages, sizeof(*status));
+	if (!pages || !status) {
+		ret = -1;
+		goto out;
+	}
+
+	for (i = 0; i < npages; i++)
+		pages[i] = buf->buf + i * page_size;
+
+	if (syscall(SYS_move_pages, 0, npages, pages, NULL, status, 0)) {
+		perror("move_pages");
+		ret = -1;
+		goto out;
+	}
+
+	for (i = 0; i < npages; i++) {
+		if (status[i] < 0)
+			p->absent++;
+		else if (status[i] == node)
+			p->local++;
+	}
+	p->pages += npages;
+
+out:
+	free(status);
+	free(pages);
+	return ret;
+}
+
+static int run(struct mlx5_context *ctx, int node, enum mlx5_alloc_type type,
+	       const char *name)
+{
+	struct mlx5_buf *bufs;
+	unsigned int cpu, cur_node;
+	int s, i, n, ret = 0;
+
+	ctx->buf_numa_node = node;
+	if (node == MLX5DV_BUF_NUMA_NODE_LOCAL) {
+		if (syscall(SYS_getcpu, &cpu, &cur_node, NULL))
+			return -1;
+		node = cur_node;
+	}
+
+	bufs = calloc(count, sizeof(*bufs));
+	if (!bufs)
+		return -1;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		struct placement p = {};
+		bool fallback = false;
+
+		for (n = 0; n < count; n++) {
+			if (mlx5_alloc_prefered_buf(ctx, &bufs[n], sizes[s],
+						    sysconf(_SC_PAGESIZE),
+						    type, "MLX5_TEST")) {
+				fprintf(stderr, "allocation of %zu failed\n",
+					sizes[s]);
+				ret = -1;
+				break;
+			}
+			memset(bufs[n].buf, 0xff, bufs[n].length);
+			/* without hugetlb pages the buffer falls back to anon */
+			if (type == MLX5_ALLOC_TYPE_PREFER_HUGE &&
+			    bufs[n].type != MLX5_ALLOC_TYPE_HUGE)
+				fallback = true;
+		}
+
+		for (i = 0; i < n && !ret && !fallback; i++)
+			ret = check_buf(&bufs[i], node, &p);
+
+		for (i = 0; i < n; i++)
+			mlx5_free_actual_buf(ctx, &bufs[i]);
+		if (ret)
+			break;
+
+		if (fallback) {
+			printf("%-5s node %2d %8zu bytes: skipped, no hugetlb pages\n",
+			       name, node, sizes[s]);
+			continue;
+		}
+
+		printf("%-5s node %2d %8zu bytes: %6lu pages, %6.2f%% local, %lu absent\n",
+		       name, node, sizes[s], p.pages,
+		       100.0 * p.local / p.pages, p.absent);
+		if (p.local != p.pages)
+			ret = 1;
+	}
+
+	free(bufs);
+	return ret;
+}
+
+/* /sys/devices/system/node/online is a list like "0-1,3" */
+static int max_online_node(void)
+{
+	char buf[256], *p;
+	int max = 0;
+	FILE *fp;
+
+	fp = fopen("/sys/devices/system/node/online", "r");
+	if (!fp)
+		return 0;
+	if (fgets(buf, sizeof(buf), fp)) {
+		p = strrchr(buf, ',');
+		p = p ? p + 1 : buf;
+		if (strchr(p, '-'))
+			p = strchr(p, '-') + 1;
+		max = atoi(p);
+	}
+	fclose(fp);
+	return max;
+}
+
+int main(int argc, char *argv[])
+{
+	struct mlx5_context *ctx;
+	char path[64];
+	cpu_set_t cpus;
+	int node, max_node, ch, ret = 0;
+
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n buffers per size]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (count <= 0) {
+		fprintf(stderr, "count must be positive\n");
+		return 1;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return 1;
+	ctx->dbg_fp = stderr;
+	mlx5_spinlock_init(&ctx->hugetlb_lock, 1);
+	list_head_init(&ctx->hugetlb_list);
+
+	/* keep the thread on one cpu so that its local node is stable */
+	CPU_ZERO(&cpus);
+	CPU_SET(sched_getcpu(), &cpus);
+	sched_setaffinity(0, sizeof(cpus), &cpus);
+
+	max_node = max_online_node();
+	for (node = 0; node <= max_node; node++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d",
+			 node);
+		if (node && access(path, F_OK))
+			continue;
+		ret |= run(ctx, node, MLX5_ALLOC_TYPE_ANON, "anon");
+		ret |= run(ctx, node, MLX5_ALLOC_TYPE_PREFER_HUGE, "huge");
+	}
+	ret |= run(ctx, MLX5DV_BUF_NUMA_NODE_LOCAL, MLX5_ALLOC_TYPE_ANON,
+		   "anon");
+	ret |= run(ctx, MLX5DV_BUF_NUMA_NODE_LOCAL, MLX5_ALLOC_TYPE_PREFER_HUGE,
+		   "huge");
+
+	free(ctx);
+	if (ret)
+		printf("FAIL: buffers not placed on the requested node\n");
+	return ret ? 1 : 0;
+}
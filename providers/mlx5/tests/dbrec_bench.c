@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: (GPL-2.0 OR Linux-OpenIB)
+/*
+ * Doorbell record allocation rate at large queue counts.
+ *
+ * Doorbell records only need a context and the device page size, so a
+ * synthetic context stands in for the device.  A pool of records is
+ * allocated like an application creating many DC initiators, then random
+ * records are freed and reallocated like queues coming and going.  Every
+ * record is checked to be distinct from the live ones.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include "../mlx5.h"
+
+uint32_t mlx5_debug_mask;
+
+static int count = 256 * 1024;
+static int churn = 1000000;
+static int dbr_size = 64;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_ptr(const void *a, const void *b)
+{
+	uintptr_t x = *(uintptr_t *)a, y = *(uintptr_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* live records must not overlap and must keep their stride alignment */
+static int check(__be32 **dbs)
+{
+	uintptr_t *sorted;
+	int i, ret = 0;
+
+	sorted = malloc(count * sizeof(*sorted));
+	if (!sorted)
+		return -1;
+	for (i = 0; i < count; i++)
+		sorted[i] = (uintptr_t)dbs[i];
+	qsort(sorted, count, sizeof(*sorted), cmp_ptr);
+
+	for (i = 0; i < count; i++) {
+		if (sorted[i] % dbr_size ||
+		    (i && sorted[i] - sorted[i - 1] < dbr_size)) {
+			fprintf(stderr, "bad doorbell record %#" PRIxPTR "\n",
+				sorted[i]);
+			ret = -1;
+			break;
+		}
+	}
+	free(sorted);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct mlx5_device *mdev;
+	struct mlx5_context *ctx;
+	bool custom = false;
+	__be32 **dbs;
+	double t, alloc, reuse, release;
+	int i, j, ch;
+
+	while ((ch = getopt(argc, argv, "n:c:s:")) != -1) {
+		switch (ch) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'c':
+			churn = atoi(optarg);
+			break;
+		case 's':
+			dbr_size = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-n records] [-c churn] [-s record size]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (count <= 0 || churn < 0 || dbr_size < 8 || dbr_size > 64 ||
+	    (dbr_size & (dbr_size - 1))) {
+		fprintf(stderr,
+			"records must be positive, record size a power of 2 in 8..64\n");
+		return 1;
+	}
+
+	mdev = calloc(1, sizeof(*mdev));
+	ctx = calloc(1, sizeof(*ctx));
+	dbs = calloc(count, sizeof(*dbs));
+	if (!mdev || !ctx || !dbs)
+		return 1;
+
+	mdev->page_size = sysconf(_SC_PAGESIZE);
+	ctx->ibv_ctx.context.device = &mdev->verbs_dev.device;
+	ctx->dbg_fp = stderr;
+	ctx->cache_line_size = 64;
+	ctx->dbr_size = dbr_size;
+	ctx->buf_numa_node = MLX5DV_BUF_NUMA_NODE_ANY;
+	list_head_init(&ctx->dbr_available_pages);
+	cl_qmap_init(&ctx->dbr_map);
+	pthread_mutex_init(&ctx->dbr_map_mutex, NULL);
+
+	t = now();
+	for (i = 0; i < count; i++) {
+		dbs[i] = mlx5_alloc_dbrec(ctx, NULL, &custom);
+		if (!dbs[i]) {
+			fprintf(stderr, "allocation %d failed\n", i);
+			return 1;
+		}
+	}
+	alloc = now() - t;
+
+	srand(1);
+	t = now();
+	for (i = 0; i < churn; i++) {
+		j = rand() % count;
+		mlx5_free_db(ctx, dbs[j], NULL, false);
+		dbs[j] = mlx5_alloc_dbrec(ctx, NULL, &custom);
+		if (!dbs[j]) {
+			fprintf(stderr, "reallocation %d failed\n", i);
+			return 1;
+		}
+	}
+	reuse = now() - t;
+
+	if (check(dbs))
+		return 1;
+
+	printf("%d records of %d bytes, %u pages\n", count, dbr_size,
+	       cl_qmap_count(&ctx->dbr_map));
+
+	t = now();
+	for (i = 0; i < count; i++)
+		mlx5_free_db(ctx, dbs[i], NULL, false);
+	release = now() - t;
+
+	printf("alloc:         %8.1f ns/record\n", alloc * 1e9 / count);
+	if (churn)
+		printf("free + alloc:  %8.1f ns/record\n", reuse * 1e9 / churn);
+	printf("free:          %8.1f ns/record\n", release * 1e9 / count);
+
+	if (cl_qmap_count(&ctx->dbr_map)) {
+		fprintf(stderr, "pages left after freeing every record\n");
+		return 1;
+	}
+
+	free(dbs);
+	free(ctx);
+	free(mdev);
+	return 0;
+}
@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: (GPL-2.0 OR Linux-OpenIB)
+/*
+ * Throughput and fragmentation of the DR ICM buddy allocator.
+ *
+ * The buddy only hands out segment numbers, so it is exercised without a
+ * device: random allocations of mixed orders and frees of random live
+ * ones keep the pool around the target fill level, like STE hash tables
+ * of many matchers growing and shrinking.  Every allocation is checked
+ * not to overlap a live one.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <time.h>
+#include <util/bitmap.h>
+#include "../mlx5dv_dr.h"
+
+/* STE tables are mostly small, larger orders get rarer */
+#define MAX_ALLOC_ORDER 10
+
+struct live {
+	uint32_t seg;
+	int order;
+};
+
+static int max_order = 20;
+static long count = 1000000;
+static int fill = 75;
+static unsigned int seed = 1;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int rand_order(void)
+{
+	int order = 0;
+
+	while (order < MAX_ALLOC_ORDER && rand_r(&seed) % 2)
+		order++;
+	return order;
+}
+
+static int largest_free_order(struct dr_icm_buddy_mem *buddy)
+{
+	int order, seg;
+
+	for (order = max_order; order >= 0; order--) {
+		seg = dr_buddy_alloc_mem(buddy, order);
+		if (seg >= 0) {
+			dr_buddy_free_mem(buddy, seg, order);
+			return order;
+		}
+	}
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	double t, alloc_time = 0, free_time = 0;
+	long allocs = 0, frees = 0, failed = 0;
+	struct dr_icm_buddy_mem buddy = {};
+	uint64_t total, used = 0, target;
+	unsigned long *owner;
+	struct live *live;
+	long num_live = 0, i;
+	int ch, order, seg;
+
+	while ((ch = getopt(argc, argv, "o:n:f:s:")) != -1) {
+		switch (ch) {
+		case 'o':
+			max_order = atoi(optarg);
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'f':
+			fill = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-o max_order] [-n count] [-f fill%%] [-s seed]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (max_order < MAX_ALLOC_ORDER || max_order > 30 || count <= 0 ||
+	    fill <= 0 || fill >= 100) {
+		fprintf(stderr, "max_order %d..30, count positive, fill 1..99\n",
+			MAX_ALLOC_ORDER);
+		return 1;
+	}
+
+	total = 1ULL << max_order;
+	target = total * fill / 100;
+	owner = bitmap_alloc0(total);
+	live = calloc(total, sizeof(*live));
+	if (!owner || !live || dr_buddy_init(&buddy, max_order)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (num_live && (used >= target || rand_r(&seed) % 4 == 0)) {
+			struct live *l = &live[rand_r(&seed) % num_live];
+
+			t = now();
+			dr_buddy_free_mem(&buddy, l->seg, l->order);
+			free_time += now() - t;
+			bitmap_zero_region(owner, l->seg, l->seg + (1 << l->order));
+			used -= 1 << l->order;
+			*l = live[--num_live];
+			frees++;
+			continue;
+		}
+
+		order = rand_order();
+		t = now();
+		seg = dr_buddy_alloc_mem(&buddy, order);
+		alloc_time += now() - t;
+		if (seg < 0) {
+			failed++;
+			continue;
+		}
+		if (bitmap_find_first_bit(owner, seg, seg + (1 << order)) !=
+		    seg + (1 << order)) {
+			fprintf(stderr, "segment %d order %d is in use\n", seg,
+				order);
+			return 1;
+		}
+		bitmap_fill_region(owner, seg, seg + (1 << order));
+		used += 1 << order;
+		live[num_live].seg = seg;
+		live[num_live].order = order;
+		num_live++;
+		allocs++;
+	}
+
+	printf("max order %d, %ld ops, fill %d%%\n", max_order, count, fill);
+	printf("alloc: %8.1f ns/op (%ld, %ld failed)\n",
+	       alloc_time * 1e9 / (allocs + failed), allocs, failed);
+	printf("free:  %8.1f ns/op (%ld)\n", free_time * 1e9 / frees, frees);
+	printf("used %.1f%%, largest free order %d of %" PRIu64 " free segments\n",
+	       used * 100.0 / total, largest_free_order(&buddy), total - used);
+
+	dr_buddy_cleanup(&buddy);
+	free(live);
+	free(owner);
+	return 0;
+}
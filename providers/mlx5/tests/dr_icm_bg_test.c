@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: (GPL-2.0 OR Linux-OpenIB)
+/*
+ * ICM pool work of the background sync thread, without a device.
+ *
+ * With background sync enabled, freed memory past a lower threshold wakes
+ * the thread, which syncs it so it can be reused before the inline sync
+ * threshold is reached.  A hash table half way to its resize asks the pool
+ * to reserve a chunk of the next size, and the thread adds a buddy when no
+ * buddy has room for it, so the later allocation does not create one
+ * inline.  The device memory and its registration are faked, the rest is
+ * the real pool and buddy allocator.  The side effect free
+ * dr_buddy_has_free() probe the reservation relies on is checked against
+ * allocating on random states.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../mlx5dv_dr.h"
+
+#define POOL_LOG_SZ	DR_CHUNK_SIZE_1K
+
+static int wakes;
+static int syncs;
+static uint64_t next_va = 1ULL << 32;
+
+#define check(cond)							\
+	({								\
+		bool __ok = (cond);					\
+		if (!__ok)						\
+			fprintf(stderr, "%s:%d: %s failed\n",		\
+				__func__, __LINE__, #cond);		\
+		!__ok;							\
+	})
+
+static struct ibv_mr *fake_reg_dm_mr(struct ibv_pd *pd, struct ibv_dm *dm,
+				     uint64_t dm_offset, size_t length,
+				     unsigned int access)
+{
+	struct ibv_mr *mr = calloc(1, sizeof(*mr));
+
+	if (mr)
+		mr->addr = (void *)(uintptr_t)dm_offset;
+	return mr;
+}
+
+static int check_not_enabled(struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_icm_pool *pool;
+	int err = 0;
+
+	pool = dr_icm_pool_create(dmn, DR_ICM_TYPE_STE);
+	if (!pool)
+		return 1;
+
+	wakes = 0;
+	dr_icm_pool_request_reserve(pool, POOL_LOG_SZ);
+	err |= check(wakes == 0);
+	err |= check(!dr_icm_pool_bg_reserve(pool));
+	err |= check(dmn->num_buddies[DR_ICM_TYPE_STE] == 0);
+
+	dr_icm_pool_destroy(pool);
+	return err;
+}
+
+static int check_bg_sync(struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_icm_chunk *chunk[4];
+	struct dr_icm_pool *pool;
+	int i, err = 0;
+
+	atomic_store(&dmn->bg_sync.enabled, true);
+	pool = dr_icm_pool_create(dmn, DR_ICM_TYPE_STE);
+	if (!pool)
+		return 1;
+
+	/* Fill the buddy, each chunk is a quarter of it */
+	for (i = 0; i < 4; i++) {
+		chunk[i] = dr_icm_alloc_chunk(pool, POOL_LOG_SZ - 2);
+		if (check(chunk[i]))
+			return 1;
+	}
+	err |= check(dmn->num_buddies[DR_ICM_TYPE_STE] == 1);
+
+	/* A quarter hot wakes the thread, half would sync inline */
+	wakes = 0;
+	syncs = 0;
+	dr_icm_free_chunk(chunk[0]);
+	err |= check(wakes == 1);
+	err |= check(syncs == 0);
+
+	/* The thread reclaims it, no new buddy is needed to reuse it */
+	err |= check(!dr_icm_pool_bg_sync_pool(pool));
+	err |= check(syncs == 1);
+	chunk[0] = dr_icm_alloc_chunk(pool, POOL_LOG_SZ - 2);
+	err |= check(chunk[0]);
+	err |= check(dmn->num_buddies[DR_ICM_TYPE_STE] == 1);
+
+	/* Nothing asked for, the thread leaves the pool alone */
+	err |= check(!dr_icm_pool_bg_sync_pool(pool));
+	err |= check(syncs == 1);
+
+	/* The thread fell behind, the free syncs inline */
+	wakes = 0;
+	dr_icm_free_chunk(chunk[1]);
+	dr_icm_free_chunk(chunk[2]);
+	err |= check(wakes == 1);
+	err |= check(syncs == 2);
+
+	dr_icm_pool_destroy(pool);
+	atomic_store(&dmn->bg_sync.enabled, false);
+	return err;
+}
+
+static int check_reserve(struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_icm_chunk *chunk[3];
+	struct dr_icm_pool *pool;
+	int err = 0;
+
+	atomic_store(&dmn->bg_sync.enabled, true);
+	pool = dr_icm_pool_create(dmn, DR_ICM_TYPE_STE);
+	if (!pool)
+		return 1;
+
+	/* The first allocation has no buddy to take from */
+	chunk[0] = dr_icm_alloc_chunk(pool, POOL_LOG_SZ - 1);
+	err |= check(chunk[0]);
+	err |= check(dmn->num_buddies[DR_ICM_TYPE_STE] == 1);
+
+	/* Room left in the buddy, the probe must not take it */
+	wakes = 0;
+	dr_icm_pool_request_reserve(pool, POOL_LOG_SZ - 1);
+	err |= check(wakes == 1);
+	err |= check(!dr_icm_pool_bg_reserve(pool));
+	err |= check(dmn->num_buddies[DR_ICM_TYPE_STE] == 1);
+	chunk[1] = dr_icm_alloc_chunk(pool, POOL_LOG_SZ - 1);
+	err |= check(chunk[1]);
+	err |= check(dmn->num_buddies[DR_ICM_TYPE_STE] == 1);
+
+	/* The buddy is full, only the first request of a round wakes the
+	 * thread and the biggest size asked for is kept.
+	 */
+	wakes = 0;
+	dr_icm_pool_request_reserve(pool, POOL_LOG_SZ - 2);
+	dr_icm_pool_request_reserve(pool, POOL_LOG_SZ);
+	dr_icm_pool_request_reserve(pool, POOL_LOG_SZ - 1);
+	err |= check(wakes == 1);
+	err |= check(!dr_icm_pool_bg_reserve(pool));
+	err |= check(dmn->num_buddies[DR_ICM_TYPE_STE] == 2);
+
+	/* Served from the reserved buddy, none created inline */
+	chunk[2] = dr_icm_alloc_chunk(pool, POOL_LOG_SZ);
+	err |= check(chunk[2]);
+	err |= check(dmn->num_buddies[DR_ICM_TYPE_STE] == 2);
+	err |= check(chunk[2] && !chunk[2]->buddy_mem->reserved);
+
+	/* Bigger than the pool chunks, nothing to reserve */
+	wakes = 0;
+	dr_icm_pool_request_reserve(pool, POOL_LOG_SZ + 1);
+	err |= check(wakes == 0);
+	err |= check(!dr_icm_pool_bg_reserve(pool));
+	err |= check(dmn->num_buddies[DR_ICM_TYPE_STE] == 2);
+
+	dr_icm_pool_destroy(pool);
+	err |= check(dmn->num_buddies[DR_ICM_TYPE_STE] == 0);
+	atomic_store(&dmn->bg_sync.enabled, false);
+	return err;
+}
+
+static int check_has_free(void)
+{
+	struct dr_icm_buddy_mem buddy = {};
+	struct {
+		int seg;
+		int order;
+	} used[1 << POOL_LOG_SZ];
+	int i, n = 0, err = 0;
+	int order, seg;
+
+	if (dr_buddy_init(&buddy, POOL_LOG_SZ))
+		return 1;
+
+	srand(1);
+	for (i = 0; i < 20000 && !err; i++) {
+		order = rand() % (POOL_LOG_SZ + 1);
+
+		if (n && rand() % 2) {
+			int j = rand() % n;
+
+			dr_buddy_free_mem(&buddy, used[j].seg, used[j].order);
+			used[j] = used[--n];
+			continue;
+		}
+
+		if (!dr_buddy_has_free(&buddy, order)) {
+			err |= check(dr_buddy_alloc_mem(&buddy, order) == -1);
+			continue;
+		}
+
+		seg = dr_buddy_alloc_mem(&buddy, order);
+		err |= check(seg != -1);
+		used[n].seg = seg;
+		used[n++].order = order;
+	}
+
+	dr_buddy_cleanup(&buddy);
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	struct mlx5dv_dr_domain *dmn;
+	struct mlx5_context *ctx;
+	struct ibv_pd pd = {};
+	int ret = 0;
+
+	ctx = calloc(1, sizeof(*ctx));
+	dmn = calloc(1, sizeof(*dmn));
+	if (!ctx || !dmn)
+		return 1;
+	ctx->dbg_fp = stderr;
+	ctx->ibv_ctx.sz = sizeof(ctx->ibv_ctx);
+	ctx->ibv_ctx.context.abi_compat = __VERBS_ABI_IS_EXTENDED;
+	ctx->ibv_ctx.reg_dm_mr = fake_reg_dm_mr;
+	pd.context = &ctx->ibv_ctx.context;
+	dmn->ctx = &ctx->ibv_ctx.context;
+	dmn->pd = &pd;
+	dmn->info.max_log_sw_icm_sz = POOL_LOG_SZ;
+	dmn->info.caps.sw_format_ver = MLX5_HW_CONNECTX_6DX;
+
+	ret |= check_not_enabled(dmn);
+	ret |= check_bg_sync(dmn);
+	ret |= check_reserve(dmn);
+	ret |= check_has_free();
+
+	free(dmn);
+	free(ctx);
+	if (ret)
+		printf("FAIL: ICM pool background work\n");
+	return ret ? 1 : 0;
+}
+
+/* The device memory is never accessed, only its addresses are computed */
+struct ibv_dm *mlx5dv_alloc_dm(struct ibv_context *context,
+			       struct ibv_alloc_dm_attr *dm_attr,
+			       struct mlx5dv_alloc_dm_attr *mlx5_dm_attr)
+{
+	struct mlx5_dm *dm = calloc(1, sizeof(*dm));
+
+	if (!dm) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* Aligned to its size, as the pool asks for */
+	next_va = align(next_va, dm_attr->length);
+	dm->remote_va = next_va;
+	dm->length = dm_attr->length;
+	dm->verbs_dm.dm.context = context;
+	next_va += dm_attr->length;
+	return &dm->verbs_dm.dm;
+}
+
+int mlx5_free_dm(struct ibv_dm *ibdm)
+{
+	free(to_mdm(ibdm));
+	return 0;
+}
+
+int ibv_dereg_mr(struct ibv_mr *mr)
+{
+	free(mr);
+	return 0;
+}
+
+int dr_devx_sync_steering(struct ibv_context *ctx)
+{
+	syncs++;
+	return 0;
+}
+
+int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn)
+{
+	return 0;
+}
+
+void dr_domain_bg_sync_wake(struct mlx5dv_dr_domain *dmn)
+{
+	wakes++;
+}
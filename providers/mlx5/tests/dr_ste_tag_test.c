@@ -0,0 +1,541 @@
+// SPDX-License-Identifier: (GPL-2.0 OR Linux-OpenIB)
+/*
+ * Compiled DR tag builders against the builders they replace.
+ *
+ * The tags of a matcher only depend on its mask and the STE format, so the
+ * builders of several masks are set up for every STE format without a
+ * device, the way dr_matcher_set_ste_builders() does, and compiled with
+ * dr_ste_build_compile_tags().  Every STE built from the programs must be
+ * bit-exact with the one the builders give for the same value.  Values are
+ * every single mask bit, every value of each mask byte with the rest
+ * random, and random values within the mask, far more than the samples
+ * the compile time check runs.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "../mlx5dv_dr.h"
+
+static int count = 20000;
+static unsigned int seed = 1;
+
+struct tag_case {
+	const char *name;
+	uint8_t match_criteria;
+	void (*set_mask)(struct dr_match_param *mask);
+	/* false when a builder depends on more than the bits set */
+	bool compiles;
+};
+
+static void set_ipv4(struct dr_match_spec *spec)
+{
+	spec->ip_protocol = 0xff;
+	spec->frag = 1;
+	spec->ip_dscp = 0x3f;
+	spec->ip_ecn = 0x3;
+	spec->tcp_flags = 0x1ff;
+	spec->tcp_sport = 0xffff;
+	spec->tcp_dport = 0xffff;
+	spec->src_ip_31_0 = 0xffffffff;
+	spec->dst_ip_31_0 = 0xffffffff;
+}
+
+static void set_l2_src_dst(struct dr_match_param *mask)
+{
+	mask->outer.smac_47_16 = 0xffffffff;
+	mask->outer.smac_15_0 = 0xffff;
+	mask->outer.dmac_47_16 = 0xffffffff;
+	mask->outer.dmac_15_0 = 0xffff;
+	mask->outer.ethertype = 0xffff;
+}
+
+static void set_vlan(struct dr_match_param *mask)
+{
+	mask->outer.smac_47_16 = 0xffffffff;
+	mask->outer.smac_15_0 = 0xffff;
+	mask->outer.first_vid = 0xfff;
+	mask->outer.first_cfi = 1;
+	mask->outer.first_prio = 0x7;
+	mask->outer.cvlan_tag = 1;
+	mask->misc.outer_second_vid = 0xfff;
+	mask->misc.outer_second_cvlan_tag = 1;
+}
+
+/* The VLAN qualifier is C-VLAN when both tags are set, not both bits */
+static void set_vlan_qualifier(struct dr_match_param *mask)
+{
+	set_vlan(mask);
+	mask->outer.svlan_tag = 1;
+}
+
+static void set_ipv4_5_tuple(struct dr_match_param *mask)
+{
+	set_ipv4(&mask->outer);
+	mask->outer.ip_version = 4;
+	mask->outer.ip_ttl_hoplimit = 0xff;
+}
+
+static void set_ipv6(struct dr_match_param *mask)
+{
+	mask->outer.ip_version = 6;
+	mask->outer.ip_protocol = 0xff;
+	mask->outer.ip_ttl_hoplimit = 0xff;
+	mask->outer.udp_sport = 0xffff;
+	mask->outer.udp_dport = 0xffff;
+	mask->outer.src_ip_127_96 = 0xffffffff;
+	mask->outer.src_ip_95_64 = 0xffffffff;
+	mask->outer.src_ip_63_32 = 0xffffffff;
+	mask->outer.src_ip_31_0 = 0xffffffff;
+	mask->outer.dst_ip_127_96 = 0xffffffff;
+	mask->outer.dst_ip_95_64 = 0xffffffff;
+	mask->outer.dst_ip_63_32 = 0xffffffff;
+	mask->outer.dst_ip_31_0 = 0xffffffff;
+	mask->misc.outer_ipv6_flow_label = 0xfffff;
+}
+
+static void set_gre(struct dr_match_param *mask)
+{
+	mask->outer.ip_version = 4;
+	mask->outer.ip_protocol = 0xff;
+	mask->outer.dst_ip_31_0 = 0xffffffff;
+	mask->misc.gre_c_present = 1;
+	mask->misc.gre_k_present = 1;
+	mask->misc.gre_s_present = 1;
+	mask->misc.gre_protocol = 0xffff;
+	mask->misc.gre_key_h = 0xffffff;
+	mask->misc.gre_key_l = 0xff;
+	set_ipv4(&mask->inner);
+	mask->inner.ip_version = 4;
+}
+
+static void set_vxlan(struct dr_match_param *mask)
+{
+	mask->outer.ip_version = 4;
+	mask->outer.udp_dport = 0xffff;
+	mask->misc.vxlan_vni = 0xffffff;
+	mask->inner.dmac_47_16 = 0xffffffff;
+	mask->inner.dmac_15_0 = 0xffff;
+	mask->inner.ethertype = 0xffff;
+	mask->inner.cvlan_tag = 1;
+	set_ipv4(&mask->inner);
+	mask->inner.ip_version = 4;
+}
+
+static const struct tag_case cases[] = {
+	{ "l2 src/dst", DR_MATCHER_CRITERIA_OUTER, set_l2_src_dst, true },
+	{ "vlan", DR_MATCHER_CRITERIA_OUTER | DR_MATCHER_CRITERIA_MISC,
+	  set_vlan, true },
+	{ "vlan c/s", DR_MATCHER_CRITERIA_OUTER | DR_MATCHER_CRITERIA_MISC,
+	  set_vlan_qualifier, false },
+	{ "ipv4 5-tuple", DR_MATCHER_CRITERIA_OUTER, set_ipv4_5_tuple, true },
+	{ "ipv6", DR_MATCHER_CRITERIA_OUTER | DR_MATCHER_CRITERIA_MISC,
+	  set_ipv6, true },
+	{ "gre", DR_MATCHER_CRITERIA_OUTER | DR_MATCHER_CRITERIA_MISC |
+	  DR_MATCHER_CRITERIA_INNER, set_gre, true },
+	{ "vxlan", DR_MATCHER_CRITERIA_OUTER | DR_MATCHER_CRITERIA_MISC |
+	  DR_MATCHER_CRITERIA_INNER, set_vxlan, true },
+};
+
+static bool is_set(const void *p, size_t len)
+{
+	const uint8_t *b = p;
+
+	while (len--)
+		if (*b++)
+			return true;
+	return false;
+}
+
+/* The l2 and l3 builders of dr_matcher_set_ste_builders() for one side */
+static int set_spec_builders(struct dr_ste_ctx *ste_ctx,
+			     struct dr_ste_build *sb,
+			     struct dr_match_param *mask,
+			     uint8_t ipv, bool inner, bool rx)
+{
+	struct dr_match_spec *spec = inner ? &mask->inner : &mask->outer;
+	int idx = 0;
+	bool smac, dmac;
+
+	smac = spec->smac_47_16 || spec->smac_15_0;
+	dmac = spec->dmac_47_16 || spec->dmac_15_0;
+	if (smac && dmac)
+		dr_ste_build_eth_l2_src_dst(ste_ctx, &sb[idx++], mask,
+					    inner, rx);
+
+	if (spec->smac_47_16 || spec->smac_15_0)
+		dr_ste_build_eth_l2_src(ste_ctx, &sb[idx++], mask, inner, rx);
+
+	if (spec->first_vid || spec->first_cfi || spec->first_prio ||
+	    spec->cvlan_tag || spec->svlan_tag || spec->dmac_47_16 ||
+	    spec->dmac_15_0 || spec->ethertype || spec->ip_version ||
+	    (!inner && (mask->misc.outer_second_vid ||
+			mask->misc.outer_second_cvlan_tag ||
+			mask->misc.outer_second_svlan_tag)))
+		dr_ste_build_eth_l2_dst(ste_ctx, &sb[idx++], mask, inner, rx);
+
+	if (ipv == 4) {
+		if (spec->ip_ttl_hoplimit || spec->ipv4_ihl)
+			dr_ste_build_eth_l3_ipv4_misc(ste_ctx, &sb[idx++],
+						      mask, inner, rx);
+
+		if (spec->ip_protocol || spec->frag || spec->tcp_flags ||
+		    spec->ip_ecn || spec->ip_dscp || spec->tcp_sport ||
+		    spec->tcp_dport || spec->udp_sport || spec->udp_dport ||
+		    spec->src_ip_31_0 || spec->dst_ip_31_0)
+			dr_ste_build_eth_l3_ipv4_5_tuple(ste_ctx, &sb[idx++],
+							 mask, inner, rx);
+	} else if (ipv == 6) {
+		if (spec->dst_ip_127_96 || spec->dst_ip_95_64 ||
+		    spec->dst_ip_63_32 || spec->dst_ip_31_0)
+			dr_ste_build_eth_l3_ipv6_dst(ste_ctx, &sb[idx++],
+						     mask, inner, rx);
+
+		if (spec->src_ip_127_96 || spec->src_ip_95_64 ||
+		    spec->src_ip_63_32 || spec->src_ip_31_0)
+			dr_ste_build_eth_l3_ipv6_src(ste_ctx, &sb[idx++],
+						     mask, inner, rx);
+
+		if (spec->ip_protocol || spec->frag || spec->tcp_flags ||
+		    spec->ip_ecn || spec->ip_dscp || spec->tcp_sport ||
+		    spec->tcp_dport || spec->udp_sport || spec->udp_dport ||
+		    spec->ip_ttl_hoplimit ||
+		    (inner ? mask->misc.inner_ipv6_flow_label :
+			     mask->misc.outer_ipv6_flow_label))
+			dr_ste_build_eth_ipv6_l3_l4(ste_ctx, &sb[idx++],
+						    mask, inner, rx);
+	}
+
+	return idx;
+}
+
+static int set_builders(struct mlx5dv_dr_matcher *matcher,
+			struct dr_matcher_rx_tx *nic_matcher, bool rx)
+{
+	struct dr_ste_ctx *ste_ctx = matcher->tbl->dmn->ste_ctx;
+	struct dr_ste_build *sb = nic_matcher->ste_builder;
+	struct dr_match_param mask = matcher->mask;
+	uint8_t inner_ipv = mask.inner.ip_version;
+	int idx;
+
+	idx = set_spec_builders(ste_ctx, sb, &mask, mask.outer.ip_version,
+				false, rx);
+
+	if (mask.misc.gre_c_present || mask.misc.gre_k_present ||
+	    mask.misc.gre_s_present || mask.misc.gre_protocol ||
+	    mask.misc.gre_key_h || mask.misc.gre_key_l)
+		dr_ste_build_tnl_gre(ste_ctx, &sb[idx++], &mask, false, rx);
+
+	if (mask.misc.vxlan_vni)
+		dr_ste_build_eth_l2_tnl(ste_ctx, &sb[idx++], &mask, true, rx);
+
+	idx += set_spec_builders(ste_ctx, &sb[idx], &mask, inner_ipv, true, rx);
+
+	/* The builders must use the whole mask, like a matcher would */
+	if (is_set(&mask, sizeof(mask))) {
+		fprintf(stderr, "mask not fully used by the builders\n");
+		return -1;
+	}
+
+	return idx;
+}
+
+/* The compiled STEs of value against the builder ones */
+static int check_value(struct mlx5dv_dr_matcher *matcher,
+		       struct dr_matcher_rx_tx *nic_matcher,
+		       struct dr_match_param *value)
+{
+	struct dr_ste_tag_prog *prog[DR_RULE_MAX_STES];
+	uint8_t prog_ste[DR_RULE_MAX_STES * DR_STE_SIZE];
+	uint8_t ste[DR_RULE_MAX_STES * DR_STE_SIZE];
+	struct dr_match_param v;
+	int i, n = nic_matcher->num_of_builders;
+	int prog_ret, ret;
+
+	/* Rules of another IP version are rejected before building */
+	value->outer.ip_version = matcher->mask.outer.ip_version;
+	value->inner.ip_version = matcher->mask.inner.ip_version;
+
+	memset(prog_ste, 0, sizeof(prog_ste));
+	v = *value;
+	prog_ret = dr_ste_build_ste_arr(matcher, nic_matcher, &v, prog_ste);
+
+	for (i = 0; i < n; i++) {
+		prog[i] = nic_matcher->ste_builder[i].tag_prog;
+		nic_matcher->ste_builder[i].tag_prog = NULL;
+	}
+	memset(ste, 0, sizeof(ste));
+	v = *value;
+	ret = dr_ste_build_ste_arr(matcher, nic_matcher, &v, ste);
+	for (i = 0; i < n; i++)
+		nic_matcher->ste_builder[i].tag_prog = prog[i];
+
+	if (prog_ret != ret)
+		return -1;
+	return memcmp(prog_ste, ste, n * DR_STE_SIZE) ? -1 : 0;
+}
+
+static void rand_value(struct dr_match_param *value,
+		       struct dr_match_param *mask)
+{
+	uint8_t *v = (uint8_t *)value, *m = (uint8_t *)mask;
+	int i;
+
+	for (i = 0; i < sizeof(*value); i++)
+		v[i] = rand_r(&seed) & m[i];
+}
+
+static int check_values(struct mlx5dv_dr_matcher *matcher,
+			struct dr_matcher_rx_tx *nic_matcher, long *checked)
+{
+	struct dr_match_param value = {}, *mask = &matcher->mask;
+	uint8_t *v = (uint8_t *)&value, *m = (uint8_t *)mask;
+	int i, b;
+
+	if (check_value(matcher, nic_matcher, &value))
+		return -1;
+	value = *mask;
+	if (check_value(matcher, nic_matcher, &value))
+		return -1;
+	*checked += 2;
+
+	for (i = 0; i < sizeof(value) * 8; i++) {
+		if (!(m[i / 8] & (1 << (i % 8))))
+			continue;
+		memset(&value, 0, sizeof(value));
+		v[i / 8] = 1 << (i % 8);
+		if (check_value(matcher, nic_matcher, &value))
+			return -1;
+		(*checked)++;
+	}
+
+	/* Catches builders that compare a field to a constant */
+	for (i = 0; i < sizeof(value); i++) {
+		if (!m[i])
+			continue;
+		for (b = 0; b < 256; b++) {
+			if (b & ~m[i])
+				continue;
+			rand_value(&value, mask);
+			v[i] = b;
+			if (check_value(matcher, nic_matcher, &value))
+				return -1;
+			(*checked)++;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		rand_value(&value, mask);
+		if (check_value(matcher, nic_matcher, &value))
+			return -1;
+		(*checked)++;
+	}
+
+	return 0;
+}
+
+static int run(struct mlx5dv_dr_domain *dmn, const struct tag_case *tc,
+	       bool rx)
+{
+	struct dr_domain_rx_tx nic_dmn = {
+		.type = rx ? DR_DOMAIN_NIC_TYPE_RX : DR_DOMAIN_NIC_TYPE_TX,
+	};
+	struct dr_table_rx_tx nic_tbl = { .nic_dmn = &nic_dmn };
+	struct mlx5dv_dr_table tbl = { .dmn = dmn };
+	struct mlx5dv_dr_matcher *matcher;
+	struct dr_matcher_rx_tx *nic_matcher;
+	int i, n, compiled = 0, ret = 0;
+	long checked = 0;
+
+	matcher = calloc(1, sizeof(*matcher));
+	if (!matcher)
+		return -1;
+	matcher->tbl = &tbl;
+	matcher->match_criteria = tc->match_criteria;
+	tc->set_mask(&matcher->mask);
+	nic_matcher = rx ? &matcher->rx : &matcher->tx;
+	nic_matcher->nic_tbl = &nic_tbl;
+
+	n = set_builders(matcher, nic_matcher, rx);
+	if (n <= 0) {
+		free(matcher);
+		return -1;
+	}
+	nic_matcher->num_of_builders = n;
+
+	dr_ste_build_compile_tags(matcher, nic_matcher);
+	for (i = 0; i < n; i++)
+		compiled += !!nic_matcher->ste_builder[i].tag_prog;
+
+	if (!!compiled != tc->compiles)
+		ret = -1;
+	else if (compiled)
+		ret = check_values(matcher, nic_matcher, &checked);
+
+	printf("v%d %-12s %s: %d builders, %s, %ld values%s\n",
+	       dmn->info.caps.sw_format_ver, tc->name, rx ? "rx" : "tx", n,
+	       compiled ? "compiled" : "not compiled", checked,
+	       ret ? ", FAILED" : "");
+
+	dr_ste_build_free_tags(nic_matcher);
+	free(matcher);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint8_t versions[] = {
+		MLX5_HW_CONNECTX_5, MLX5_HW_CONNECTX_6DX,
+		MLX5_HW_CONNECTX_7, MLX5_HW_CONNECTX_8,
+	};
+	struct mlx5dv_dr_domain *dmn;
+	struct mlx5_context *ctx;
+	int v, c, ch, ret = 0;
+
+	while ((ch = getopt(argc, argv, "n:s:")) != -1) {
+		switch (ch) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-n random values] [-s seed]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (count < 0) {
+		fprintf(stderr, "random values must not be negative\n");
+		return 1;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	dmn = calloc(1, sizeof(*dmn));
+	if (!ctx || !dmn)
+		return 1;
+	ctx->dbg_fp = stderr;
+	dmn->ctx = &ctx->ibv_ctx.context;
+	dmn->type = MLX5DV_DR_DOMAIN_TYPE_NIC_RX;
+	dmn->info.caps.gvmi = 1;
+
+	for (v = 0; v < sizeof(versions) / sizeof(versions[0]); v++) {
+		dmn->info.caps.sw_format_ver = versions[v];
+		dmn->ste_ctx = dr_ste_get_ctx(versions[v]);
+		if (!dmn->ste_ctx)
+			return 1;
+
+		for (c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+			ret |= run(dmn, &cases[c], true);
+			ret |= run(dmn, &cases[c], false);
+		}
+	}
+
+	free(dmn);
+	free(ctx);
+	if (ret)
+		printf("FAIL: compiled tags do not match the builders\n");
+	return ret ? 1 : 0;
+}
+
+/* Only needed to link dr_ste*.c, building tags never gets to them */
+struct dr_arg_obj *dr_arg_get_obj(struct dr_arg_mngr *mngr,
+				  uint16_t num_of_actions, uint8_t *data)
+{
+	return NULL;
+}
+
+void dr_arg_put_obj(struct dr_arg_mngr *mngr, struct dr_arg_obj *arg_obj)
+{
+}
+
+struct dr_icm_chunk *dr_icm_alloc_chunk(struct dr_icm_pool *pool,
+					enum dr_icm_chunk_size chunk_size)
+{
+	return NULL;
+}
+
+void dr_icm_free_chunk(struct dr_icm_chunk *chunk)
+{
+}
+
+uint64_t dr_icm_pool_get_chunk_icm_addr(struct dr_icm_chunk *chunk)
+{
+	return 0;
+}
+
+uint64_t dr_icm_pool_get_chunk_mr_addr(struct dr_icm_chunk *chunk)
+{
+	return 0;
+}
+
+struct dr_ptrn_obj *dr_ptrn_cache_get_pattern(struct dr_ptrn_mngr *mngr,
+					      enum dr_ptrn_type type,
+					      uint16_t num_of_actions,
+					      uint8_t *data)
+{
+	return NULL;
+}
+
+void dr_ptrn_cache_put_pattern(struct dr_ptrn_mngr *mngr,
+			       struct dr_ptrn_obj *pattern)
+{
+}
+
+int dr_rule_send_update_list(struct list_head *send_ste_list,
+			     struct mlx5dv_dr_domain *dmn,
+			     bool is_reverse, uint8_t send_ring_idx)
+{
+	return EOPNOTSUPP;
+}
+
+void dr_rule_set_last_member(struct dr_rule_rx_tx *nic_rule,
+			     struct dr_ste *ste, bool force)
+{
+}
+
+void dr_send_fill_and_append_ste_send_info(struct dr_ste *ste, uint16_t size,
+					   uint16_t offset, uint8_t *data,
+					   struct dr_ste_send_info *ste_info,
+					   struct list_head *send_list,
+					   bool copy_data)
+{
+}
+
+int dr_send_postsend_action(struct mlx5dv_dr_domain *dmn,
+			    struct mlx5dv_dr_action *action)
+{
+	return EOPNOTSUPP;
+}
+
+int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
+				   struct dr_ste_htbl *htbl,
+				   uint8_t *ste_init_data,
+				   bool update_hw_ste,
+				   uint8_t send_ring_idx)
+{
+	return EOPNOTSUPP;
+}
+
+int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
+			 uint8_t *data, uint16_t size, uint16_t offset,
+			 uint8_t ring_idx)
+{
+	return EOPNOTSUPP;
+}
+
+struct dr_devx_vport_cap *dr_vports_table_get_vport_cap(struct dr_devx_caps *caps,
+							uint16_t vport)
+{
+	return NULL;
+}
+
+int mlx5dv_dr_domain_sync(struct mlx5dv_dr_domain *domain, uint32_t flags)
+{
+	return EOPNOTSUPP;
+}
@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: (GPL-2.0 OR Linux-OpenIB)
+"""
+Latency percentiles of mlx5 SW steering control path operations.
+
+These are timing runs, not tests: run them on an otherwise idle device and
+compare the modes each one reports, e.g.
+    mlx5_dr_bench.py -d mlx5_0 churn
+"""
+
+import argparse
+import struct
+import time
+
+from pyverbs.providers.mlx5.dr_action import DrActionDrop, DrActionModify, \
+    DrActionDestTable
+from pyverbs.providers.mlx5.mlx5dv_flow import Mlx5FlowMatchParameters
+from pyverbs.providers.mlx5.dr_matcher import DrMatcher
+from pyverbs.providers.mlx5.dr_domain import DrDomain
+from pyverbs.providers.mlx5.dr_table import DrTable
+from pyverbs.providers.mlx5.dr_rule import DrRule
+import pyverbs.providers.mlx5.mlx5_enums as dve
+from pyverbs.device import Context
+
+MATCH_CRITERIA_OUTER = 1
+SET_ACTION = 0x1
+META_DATA_REG_C_0 = 0x51
+META_DATA_REG_C_1 = 0x52
+
+
+def percentiles_us(samples_ns):
+    samples = sorted(samples_ns)
+    pct = lambda p: samples[min(int(p * len(samples)), len(samples) - 1)] / 1000
+    return 'p50 {:.1f} p99 {:.1f} p99.9 {:.1f} max {:.1f} usec'.format(
+        pct(0.5), pct(0.99), pct(0.999), samples[-1] / 1000)
+
+
+def smac_param(i):
+    value = i.to_bytes(6, 'big') + bytes(2)
+    return Mlx5FlowMatchParameters(len(value), value)
+
+
+def smac_matcher(table):
+    mask = bytes([0xff] * 6) + bytes(2)
+    return DrMatcher(table, 0, MATCH_CRITERIA_OUTER,
+                     Mlx5FlowMatchParameters(len(mask), mask))
+
+
+def bench_churn(ctx):
+    """
+    Create and destroy rounds of rules, syncing the freed memory inline and
+    in the background sync thread.
+    """
+    rules_per_round = 1000
+    rounds = 20
+    for bg_sync in (False, True):
+        domain = DrDomain(ctx, dve.MLX5DV_DR_DOMAIN_TYPE_NIC_RX)
+        domain.set_background_sync(bg_sync)
+        table = DrTable(domain, 1)
+        matcher = smac_matcher(table)
+        drop_action = DrActionDrop()
+        create_ns, destroy_ns = [], []
+        for _ in range(rounds):
+            rules = []
+            for i in range(rules_per_round):
+                value = smac_param(i)
+                start = time.perf_counter_ns()
+                rules.append(DrRule(matcher, value, [drop_action]))
+                create_ns.append(time.perf_counter_ns() - start)
+            for rule in rules:
+                start = time.perf_counter_ns()
+                rule.close()
+                destroy_ns.append(time.perf_counter_ns() - start)
+        print('{} sync: create {}, destroy {}'.format(
+            'background' if bg_sync else 'inline',
+            percentiles_us(create_ns), percentiles_us(destroy_ns)))
+        matcher.close()
+        table.close()
+        drop_action.close()
+        domain.close()
+
+
+def bench_rehash(ctx):
+    """
+    Insert enough rules into one matcher for its hash table to grow several
+    times, with and without the background thread preparing the memory of
+    the next table size.
+    """
+    num_rules = 100000
+    for bg_sync in (False, True):
+        domain = DrDomain(ctx, dve.MLX5DV_DR_DOMAIN_TYPE_NIC_RX)
+        domain.set_background_sync(bg_sync)
+        table = DrTable(domain, 1)
+        matcher = smac_matcher(table)
+        drop_action = DrActionDrop()
+        create_ns, rules = [], []
+        for i in range(num_rules):
+            value = smac_param(i)
+            start = time.perf_counter_ns()
+            rules.append(DrRule(matcher, value, [drop_action]))
+            create_ns.append(time.perf_counter_ns() - start)
+        print('{} reserve: create {}'.format(
+            'background' if bg_sync else 'inline', percentiles_us(create_ns)))
+        for rule in rules:
+            rule.close()
+        matcher.close()
+        table.close()
+        drop_action.close()
+        domain.close()
+
+
+def bench_dump(ctx):
+    """
+    Dump a domain holding many rules.
+    """
+    num_rules = 10000
+    dump_file = '/tmp/mlx5_dr_bench_dump.txt'
+    domain = DrDomain(ctx, dve.MLX5DV_DR_DOMAIN_TYPE_NIC_RX)
+    table = DrTable(domain, 1)
+    matcher = smac_matcher(table)
+    drop_action = DrActionDrop()
+    rules = [DrRule(matcher, smac_param(i), [drop_action]) for i in range(num_rules)]
+    start = time.perf_counter()
+    domain.dump(dump_file)
+    print('dumped {} rules in {:.3f} sec'.format(num_rules, time.perf_counter() - start))
+    for rule in rules:
+        rule.close()
+    matcher.close()
+    table.close()
+    drop_action.close()
+    domain.close()
+
+
+def bench_modify(ctx):
+    """
+    Move rules between a drop and a go to table action, by destroying and
+    creating each rule and by modifying its actions in place.
+    """
+    num_rules = 1000
+    rounds = 10
+    domain = DrDomain(ctx, dve.MLX5DV_DR_DOMAIN_TYPE_NIC_RX)
+    table = DrTable(domain, 1)
+    dest_table = DrTable(domain, 2)
+    matcher = smac_matcher(table)
+    targets = [[DrActionDrop()], [DrActionDestTable(dest_table)]]
+    values = [smac_param(i) for i in range(num_rules)]
+    rules = [DrRule(matcher, value, targets[0]) for value in values]
+    churn_ns, modify_ns = [], []
+    for rnd in range(1, rounds + 1):
+        actions = targets[rnd % 2]
+        for i, value in enumerate(values):
+            start = time.perf_counter_ns()
+            rules[i].close()
+            rules[i] = DrRule(matcher, value, actions)
+            churn_ns.append(time.perf_counter_ns() - start)
+    for rnd in range(1, rounds + 1):
+        actions = targets[rnd % 2]
+        for rule in rules:
+            start = time.perf_counter_ns()
+            rule.modify_actions(actions)
+            modify_ns.append(time.perf_counter_ns() - start)
+    print('destroy/create: {}'.format(percentiles_us(churn_ns)))
+    print('modify actions: {}'.format(percentiles_us(modify_ns)))
+    for rule in rules:
+        rule.close()
+    matcher.close()
+    for actions in targets:
+        actions[0].close()
+    dest_table.close()
+    table.close()
+    domain.close()
+
+
+def set_action(field, offset, length, data):
+    """PRM set_action_in, a length of 0 stands for 32 bits"""
+    return struct.pack('!II', SET_ACTION << 28 | field << 16 | offset << 8 | length,
+                       data & 0xffffffff)
+
+
+def bench_pattern(ctx):
+    """
+    Create modify header actions with many distinct patterns, destroy them
+    and create them again, while the patterns are cold and cached.
+    """
+    domain = DrDomain(ctx, dve.MLX5DV_DR_DOMAIN_TYPE_NIC_RX)
+    bits = [(off, length) for off in range(32) for length in range(1, 32 - off)]
+    num_patterns = 2000
+    for rnd in ('cold', 'cached'):
+        create_ns, actions = [], []
+        for n in range(num_patterns):
+            off0, len0 = bits[n % len(bits)]
+            off1, len1 = bits[n // len(bits) % len(bits)]
+            set_regs = [set_action(META_DATA_REG_C_0, off0, len0, n),
+                        set_action(META_DATA_REG_C_1, off1, len1, n)]
+            start = time.perf_counter_ns()
+            actions.append(DrActionModify(domain, 0, set_regs))
+            create_ns.append(time.perf_counter_ns() - start)
+        print('{} patterns ({}): create {}'.format(
+            num_patterns, rnd, percentiles_us(create_ns)))
+        for action in actions:
+            action.close()
+    domain.close()
+
+
+BENCHES = {
+    'churn': bench_churn,
+    'dump': bench_dump,
+    'modify': bench_modify,
+    'pattern': bench_pattern,
+    'rehash': bench_rehash,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument('-d', '--dev', required=True, help='RDMA device to use')
+    parser.add_argument('bench', choices=sorted(BENCHES))
+    args = parser.parse_args()
+
+    ctx = Context(name=args.dev)
+    BENCHES[args.bench](ctx)
+    ctx.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -36,6 +36,16 @@ cdef class DrDomain(PyverbsCM):
         """
         dv.mlx5dv_dr_domain_allow_duplicate_rules(self.domain, allow)
 
+    def set_background_sync(self, enable):
+        """
+        Starts or stops a thread that syncs freed device memory in the
+        background, by default this feature is disabled.
+        :param enable: Boolean to start or stop the thread
+        """
+        rc = dv.mlx5dv_dr_domain_set_background_sync(self.domain, enable)
+        if rc:
+            raise PyverbsRDMAError('Failed to set background sync.', rc)
+
     cdef add_ref(self, obj):
         if isinstance(obj, DrTable):
             self.dr_tables.add(obj)
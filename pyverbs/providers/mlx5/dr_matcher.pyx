@@ -7,6 +7,7 @@ from pyverbs.providers.mlx5.dr_table cimport DrTable
 from pyverbs.providers.mlx5.dr_rule cimport DrRule
 from pyverbs.base import PyverbsRDMAErrno
 from pyverbs.base cimport close_weakrefs
+cimport libc.stdio as s
 import weakref
 
 
@@ -57,6 +58,24 @@ cdef class DrMatcher(PyverbsCM):
         if rc:
             raise PyverbsRDMAError('Setting matcher layout failed.', rc)
 
+    def dump_lookup(self, filepath, Mlx5FlowMatchParameters value):
+        """
+        Evaluates the matcher in software for a packet and dumps the hash
+        tables visited and the rule hit, if any, into a file.
+        :param filepath: Path to the file
+        :param value: Header values of the packet
+        """
+        cdef s.FILE *fp
+        fp = s.fopen(filepath.encode('utf-8'), 'w+')
+        if fp == NULL:
+            raise PyverbsError('Opening dump file failed.')
+        rc = dv.mlx5dv_dump_dr_matcher_lookup(fp, self.matcher, value.params)
+        if rc != 0:
+            s.fclose(fp)
+            raise PyverbsRDMAError('Matcher lookup dump failed.', rc)
+        if s.fclose(fp) != 0:
+            raise PyverbsError('Closing dump file failed.')
+
     def __dealloc__(self):
         self.close()
 
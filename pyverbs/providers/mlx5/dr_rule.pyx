@@ -38,6 +38,25 @@ cdef class DrRule(PyverbsCM):
         matcher.add_ref(self)
         self.dr_matcher = matcher
 
+    def modify_actions(self, actions):
+        """
+        Replace the actions of the rule in place.
+        :param actions: List of actions to perform
+        """
+        cdef dv.mlx5dv_dr_action**actions_arr
+        actions_arr = <dv.mlx5dv_dr_action**>calloc(len(actions),
+                                                    sizeof(dv.mlx5dv_dr_action*))
+        if actions_arr == NULL:
+            raise PyverbsError('Failed to allocate memory.')
+        for i in range(0, len(actions)):
+            actions_arr[i] = <dv.mlx5dv_dr_action*>(<DrAction>actions[i]).action
+        rc = dv.mlx5dv_dr_rule_modify_actions(self.rule, len(actions), actions_arr)
+        free(actions_arr)
+        if rc:
+            raise PyverbsRDMAError('Failed to modify DrRule actions.', rc)
+        for i in range(0, len(actions)):
+            (<DrAction>actions[i]).add_ref(self)
+
     def __dealloc__(self):
         self.close()
 
@@ -498,6 +498,8 @@ cdef extern from 'infiniband/mlx5dv.h':
                                                 mlx5dv_flow_match_parameters *mask)
     int mlx5dv_dr_matcher_set_layout(mlx5dv_dr_matcher *matcher, mlx5dv_dr_matcher_layout *layout)
     int mlx5dv_dr_matcher_destroy(mlx5dv_dr_matcher *matcher)
+    int mlx5dv_dump_dr_matcher_lookup(s.FILE *fout, mlx5dv_dr_matcher *matcher,
+                                      mlx5dv_flow_match_parameters *value)
     mlx5dv_dr_action *mlx5dv_dr_action_create_dest_ibv_qp(v.ibv_qp *ibqp)
     mlx5dv_dr_action *mlx5dv_dr_action_create_tag(uint32_t tag_value)
     mlx5dv_dr_action *mlx5dv_dr_action_create_dest_table(mlx5dv_dr_table *tbl)
@@ -527,7 +529,10 @@ cdef extern from 'infiniband/mlx5dv.h':
                                                               unsigned char reformat_type,
                                                               size_t data_sz, void *data)
     int mlx5dv_dr_rule_destroy(mlx5dv_dr_rule *rule)
+    int mlx5dv_dr_rule_modify_actions(mlx5dv_dr_rule *rule, size_t num_actions,
+                                      mlx5dv_dr_action *actions[])
     void mlx5dv_dr_domain_allow_duplicate_rules(mlx5dv_dr_domain *dmn, bool allow)
+    int mlx5dv_dr_domain_set_background_sync(mlx5dv_dr_domain *dmn, bool enable)
 
     uint64_t mlx5dv_ts_to_ns(mlx5dv_clock_info *clock_info,
                              uint64_t device_timestamp)
@@ -530,6 +530,8 @@ fi
 %{_mandir}/man8/ibportstate*
 %{_sbindir}/ibroute
 %{_mandir}/man8/ibroute.*
+%{_sbindir}/ibroutecheck
+%{_mandir}/man8/ibroutecheck*
 %{_sbindir}/ibstat
 %{_mandir}/man8/ibstat.*
 %{_sbindir}/ibsysstat
@@ -647,6 +649,7 @@ fi
 %{_bindir}/rdma_xserver
 %{_bindir}/riostream
 %{_bindir}/rping
+%{_bindir}/rsbench
 %{_bindir}/rstream
 %{_bindir}/ucmatose
 %{_bindir}/udaddy
@@ -660,6 +663,7 @@ fi
 %{_mandir}/man1/rdma_xserver.*
 %{_mandir}/man1/riostream.*
 %{_mandir}/man1/rping.*
+%{_mandir}/man1/rsbench.*
 %{_mandir}/man1/rstream.*
 %{_mandir}/man1/ucmatose.*
 %{_mandir}/man1/udaddy.*
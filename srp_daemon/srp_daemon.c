@@ -60,6 +60,7 @@
 #include <string.h>
 #include <signal.h>
 #include <sys/syslog.h>
+#include <ccan/list.h>
 #include <infiniband/umad.h>
 #include <infiniband/umad_types.h>
 #include <infiniband/umad_sa.h>
@@ -215,7 +216,7 @@ static int srpd_sys_read_uint64(const char *dir_name, const char *file_name,
 
 static void usage(const char *argv0)
 {
-	fprintf(stderr, "Usage: %s [-vVcaeon] [-d <umad device> | -i <infiniband device> [-p <port_num>]] [-t <timeout (ms)>] [-r <retries>] [-R <rescan time>] [-f <rules file>\n", argv0);
+	fprintf(stderr, "Usage: %s [-vVcaeon] [-d <umad device> | -i <infiniband device> [-p <port_num>]] [-t <timeout (ms)>] [-r <retries>] [-m <max MADs>] [-R <rescan time>] [-f <rules file>\n", argv0);
 	fprintf(stderr, "-v 			Verbose\n");
 	fprintf(stderr, "-V 			debug Verbose\n");
 	fprintf(stderr, "-c 			prints connection Commands\n");
@@ -232,6 +233,8 @@ static void usage(const char *argv0)
 	fprintf(stderr, "-f <rules file>	use rules File to set to which target(s) to connect (default: " SRP_DAEMON_CONFIG_FILE ")\n");
 	fprintf(stderr, "-t <timeout>		Timeout for mad response in milliseconds\n");
 	fprintf(stderr, "-r <retries>		number of send Retries for each mad\n");
+	fprintf(stderr, "-m <max MADs>		Maximum number of outstanding DM mads during discovery (default %d)\n",
+		SRP_DEF_MAX_DM_MADS);
 	fprintf(stderr, "-n 			New connection command format - use also initiator extension\n");
 	fprintf(stderr, "--systemd		Enable systemd integration.\n");
 	fprintf(stderr, "\nExample: srp_daemon -e -n -i mthca0 -p 1 -R 60\n");
@@ -651,6 +654,16 @@ static int add_non_exist_target(struct target_details *target)
 	return 1;
 }
 
+static uint32_t next_mad_tid(void)
+{
+	static uint32_t tid;
+
+	/* Skip tid 0 because OpenSM ignores it. */
+	if (++tid == 0)
+		++tid;
+	return tid;
+}
+
 static int send_and_get(int portid, int agent, struct srp_ib_user_mad *out_mad,
 		 struct srp_ib_user_mad *in_mad, int in_mad_size)
 {
@@ -659,13 +672,11 @@ static int send_and_get(int portid, int agent, struct srp_ib_user_mad *out_mad,
 	int i, len;
 	int in_agent;
 	int ret;
-	static uint32_t tid;
+	uint32_t tid;
 	uint32_t received_tid;
 
 	for (i = 0; i < config->mad_retries; ++i) {
-		/* Skip tid 0 because OpenSM ignores it. */
-		if (++tid == 0)
-			++tid;
+		tid = next_mad_tid();
 		out_dm_mad->mad_hdr.tid = htobe64(tid);
 
 		ret = umad_send(portid, agent, out_mad, MAD_BLOCK_SIZE,
@@ -880,23 +891,76 @@ static int pkey_to_pkey_index(struct umad_resources *umad_res, uint16_t h_pkey,
 	return res;
 }
 
-static int set_class_port_info(struct umad_resources *umad_res, uint16_t dlid, uint16_t h_pkey)
+/*
+ * DM discovery engine: the ClassPortInfo, IOUnitInfo, IOControllerProfile
+ * and ServiceEntries queries of all the ports being scanned are kept in
+ * flight together (up to config->max_dm_mads) instead of being sent one at
+ * a time. The kernel MAD layer reports a send that got no response after
+ * config->timeout with an ETIMEDOUT status, so every query only has to
+ * track its own transaction id and retry count.
+ */
+enum srp_dm_query_type {
+	SRP_DM_QUERY_CLASS_PORT_INFO,
+	SRP_DM_QUERY_IOU_INFO,
+	SRP_DM_QUERY_IOC_PROF,
+	SRP_DM_QUERY_SVC_ENTRIES,
+};
+
+struct srp_dm_ioc {
+	bool				valid;
+	struct srp_dm_ioc_prof		ioc_prof;
+	struct srp_dm_svc_entries      *svc_entries;
+	bool			       *svc_valid;
+};
+
+struct srp_dm_port {
+	struct list_node		entry;
+	uint16_t			pkey;
+	uint16_t			dlid;
+	uint16_t			pkey_index;
+	uint64_t			subnet_prefix;
+	uint64_t			h_guid;
+	bool				valid;
+	struct srp_dm_iou_info		iou_info;
+	struct srp_dm_ioc	       *iocs;
+};
+
+struct srp_dm_query {
+	struct list_node		entry;
+	struct srp_dm_port	       *port;
+	enum srp_dm_query_type		type;
+	int				ioc;
+	int				start;
+	int				end;
+	uint32_t			tid;
+	int				retries;
+	struct srp_ib_user_mad		out_mad;
+};
+
+struct srp_dm_engine {
+	struct umad_resources	       *umad_res;
+	struct list_head		ports;
+	struct list_head		queued;
+	struct list_head		inflight;
+	int				num_inflight;
+};
+
+static int ioc_state(struct srp_dm_iou_info *iou_info, int i)
+{
+	return (iou_info->controller_list[i / 2] >> (4 * (1 - i % 2))) & 0xf;
+}
+
+static int init_class_port_info_mad(struct umad_resources *umad_res,
+				    struct srp_ib_user_mad *out_mad, uint16_t dlid)
 {
-	struct srp_ib_user_mad		in_mad, out_mad;
-	struct umad_dm_packet	       *out_dm_mad, *in_dm_mad;
+	struct umad_dm_packet	       *out_dm_mad;
 	struct umad_class_port_info    *cpi;
 	char val[64];
 	int i;
 
-	init_srp_dm_mad(&out_mad, umad_res->agent, dlid, UMAD_ATTR_CLASS_PORT_INFO, 0);
-
-	if (pkey_to_pkey_index(umad_res, h_pkey, &out_mad.hdr.addr.pkey_index)
-	    < 0) {
-		pr_err("set_class_port_info: Unable to find pkey_index for pkey %#x\n", h_pkey);
-		return -1;
-	}
+	init_srp_dm_mad(out_mad, umad_res->agent, dlid, UMAD_ATTR_CLASS_PORT_INFO, 0);
 
-	out_dm_mad = get_data_ptr(out_mad);
+	out_dm_mad = get_data_ptr(*out_mad);
 	out_dm_mad->mad_hdr.method = UMAD_METHOD_SET;
 
 	cpi                = (void *) out_dm_mad->data;
@@ -916,152 +980,386 @@ static int set_class_port_info(struct umad_resources *umad_res, uint16_t dlid, u
 	for (i = 0; i < 8; ++i)
 		cpi->trapgid.raw_be16[i] = htobe16(strtol(val + i * 5, NULL, 16));
 
-	if (send_and_get(umad_res->portid, umad_res->agent, &out_mad, &in_mad, 0) < 0)
-		return -1;
+	return 0;
+}
 
-	in_dm_mad = get_data_ptr(in_mad);
-	if (in_dm_mad->mad_hdr.status) {
-		pr_err("Class Port Info set returned status 0x%04x\n",
-			be16toh(in_dm_mad->mad_hdr.status));
-		return -1;
-	}
+static void srp_dm_engine_init(struct srp_dm_engine *engine,
+			       struct umad_resources *umad_res)
+{
+	engine->umad_res = umad_res;
+	list_head_init(&engine->ports);
+	list_head_init(&engine->queued);
+	list_head_init(&engine->inflight);
+	engine->num_inflight = 0;
+}
 
-	return 0;
+static void srp_dm_engine_destroy(struct srp_dm_engine *engine)
+{
+	struct srp_dm_query *query;
+	struct srp_dm_port *port;
+	int i;
+
+	while ((query = list_pop(&engine->queued, struct srp_dm_query, entry)))
+		free(query);
+	while ((query = list_pop(&engine->inflight, struct srp_dm_query, entry)))
+		free(query);
+
+	while ((port = list_pop(&engine->ports, struct srp_dm_port, entry))) {
+		if (port->iocs) {
+			for (i = 0; i < port->iou_info.max_controllers; ++i) {
+				free(port->iocs[i].svc_entries);
+				free(port->iocs[i].svc_valid);
+			}
+			free(port->iocs);
+		}
+		free(port);
+	}
 }
 
-static int get_iou_info(struct umad_resources *umad_res, uint16_t dlid,
-			uint16_t h_pkey, struct srp_dm_iou_info *iou_info)
+static int srp_dm_queue(struct srp_dm_engine *engine, struct srp_dm_port *port,
+			enum srp_dm_query_type type, int ioc, int start, int end)
 {
-	struct srp_ib_user_mad		in_mad, out_mad;
-	struct umad_dm_packet	       *in_dm_mad;
+	struct umad_resources *umad_res = engine->umad_res;
+	struct srp_dm_query *query;
 
-	init_srp_dm_mad(&out_mad, umad_res->agent, dlid, SRP_DM_ATTR_IO_UNIT_INFO, 0);
-	if (pkey_to_pkey_index(umad_res, h_pkey, &out_mad.hdr.addr.pkey_index)
-	    < 0) {
-		pr_err("get_iou_info: Unable to find pkey_index for pkey %#x\n", h_pkey);
-		return -1;
+	query = calloc(1, sizeof(*query));
+	if (!query) {
+		pr_err("Unable to allocate a DM query for dlid %#x\n", port->dlid);
+		return -ENOMEM;
 	}
 
-	if (send_and_get(umad_res->portid, umad_res->agent, &out_mad, &in_mad, 0) < 0)
-		return -1;
+	query->port  = port;
+	query->type  = type;
+	query->ioc   = ioc;
+	query->start = start;
+	query->end   = end;
 
-	in_dm_mad = get_data_ptr(in_mad);
-	if (in_dm_mad->mad_hdr.status) {
-		pr_err("IO Unit Info query returned status 0x%04x\n",
-			be16toh(in_dm_mad->mad_hdr.status));
-		return -1;
+	switch (type) {
+	case SRP_DM_QUERY_CLASS_PORT_INFO:
+		if (init_class_port_info_mad(umad_res, &query->out_mad, port->dlid)) {
+			free(query);
+			return -1;
+		}
+		break;
+	case SRP_DM_QUERY_IOU_INFO:
+		init_srp_dm_mad(&query->out_mad, umad_res->agent, port->dlid,
+				SRP_DM_ATTR_IO_UNIT_INFO, 0);
+		break;
+	case SRP_DM_QUERY_IOC_PROF:
+		init_srp_dm_mad(&query->out_mad, umad_res->agent, port->dlid,
+				SRP_DM_ATTR_IO_CONTROLLER_PROFILE, ioc);
+		break;
+	case SRP_DM_QUERY_SVC_ENTRIES:
+		init_srp_dm_mad(&query->out_mad, umad_res->agent, port->dlid,
+				SRP_DM_ATTR_SERVICE_ENTRIES,
+				(ioc << 16) | (end << 8) | start);
+		break;
 	}
+	query->out_mad.hdr.addr.pkey_index = port->pkey_index;
 
-	memcpy(iou_info, in_dm_mad->data, sizeof *iou_info);
-/*
-	pr_debug("iou_info->max_controllers is %d\n", iou_info->max_controllers);
-*/
+	list_add_tail(&engine->queued, &query->entry);
 	return 0;
 }
 
-static int get_ioc_prof(struct umad_resources *umad_res, uint16_t h_dlid, uint16_t h_pkey, int ioc,
-			struct srp_dm_ioc_prof *ioc_prof)
+static void srp_dm_queue_iou_info(struct srp_dm_engine *engine,
+				  struct srp_dm_port *port)
 {
-	struct srp_ib_user_mad		in_mad, out_mad;
-	struct umad_dm_packet	       *in_dm_mad;
+	if (srp_dm_queue(engine, port, SRP_DM_QUERY_IOU_INFO, 0, 0, 0))
+		pr_err("failed to get iou info for dlid %#x\n", port->dlid);
+}
 
-	init_srp_dm_mad(&out_mad, umad_res->agent, h_dlid, SRP_DM_ATTR_IO_CONTROLLER_PROFILE, ioc);
+static void srp_dm_iou_info_done(struct srp_dm_engine *engine,
+				 struct srp_dm_port *port,
+				 struct umad_dm_packet *in_dm_mad)
+{
+	int i;
 
-	if (pkey_to_pkey_index(umad_res, h_pkey, &out_mad.hdr.addr.pkey_index)
-	    < 0) {
-		pr_err("get_ioc_prof: Unable to find pkey_index for pkey %#x\n",
-		       h_pkey);
-		return -1;
+	memcpy(&port->iou_info, in_dm_mad->data, sizeof(port->iou_info));
+/*
+	pr_debug("iou_info->max_controllers is %d\n", port->iou_info.max_controllers);
+*/
+	port->iocs = calloc(port->iou_info.max_controllers, sizeof(*port->iocs));
+	if (port->iou_info.max_controllers && !port->iocs) {
+		pr_err("failed to get iou info for dlid %#x\n", port->dlid);
+		return;
 	}
+	port->valid = true;
 
-	if (send_and_get(umad_res->portid, umad_res->agent, &out_mad, &in_mad, 0) < 0)
-		return -1;
+	for (i = 0; i < port->iou_info.max_controllers; ++i)
+		if (ioc_state(&port->iou_info, i) == SRP_DM_IOC_PRESENT)
+			srp_dm_queue(engine, port, SRP_DM_QUERY_IOC_PROF,
+				     i + 1, 0, 0);
+}
 
-	in_dm_mad = get_data_ptr(in_mad);
-	if (in_dm_mad->mad_hdr.status) {
-		pr_err("IO Controller Profile query returned status 0x%04x for %d\n",
-			be16toh(in_dm_mad->mad_hdr.status), ioc);
-		return -1;
+static void srp_dm_ioc_prof_done(struct srp_dm_engine *engine,
+				 struct srp_dm_port *port, int ioc_num,
+				 struct umad_dm_packet *in_dm_mad)
+{
+	struct srp_dm_ioc *ioc = &port->iocs[ioc_num - 1];
+	int j, n, num_chunks;
+
+	memcpy(&ioc->ioc_prof, in_dm_mad->data, sizeof(ioc->ioc_prof));
+
+	num_chunks = (ioc->ioc_prof.service_entries + 3) / 4;
+	if (num_chunks) {
+		ioc->svc_entries = calloc(num_chunks, sizeof(*ioc->svc_entries));
+		ioc->svc_valid = calloc(num_chunks, sizeof(*ioc->svc_valid));
+		if (!ioc->svc_entries || !ioc->svc_valid) {
+			pr_err("Unable to allocate service entries for %d\n",
+			       ioc_num);
+			free(ioc->svc_entries);
+			free(ioc->svc_valid);
+			ioc->svc_entries = NULL;
+			ioc->svc_valid = NULL;
+			return;
+		}
 	}
+	ioc->valid = true;
 
-	memcpy(ioc_prof, in_dm_mad->data, sizeof *ioc_prof);
+	for (j = 0; j < ioc->ioc_prof.service_entries; j += 4) {
+		n = j + 3;
+		if (n >= ioc->ioc_prof.service_entries)
+			n = ioc->ioc_prof.service_entries - 1;
 
-	return 0;
+		srp_dm_queue(engine, port, SRP_DM_QUERY_SVC_ENTRIES,
+			     ioc_num, j, n);
+	}
 }
 
-static int get_svc_entries(struct umad_resources *umad_res, uint16_t dlid, uint16_t h_pkey, int ioc,
-			   int start, int end, struct srp_dm_svc_entries *svc_entries)
+/*
+ * Called once per query, with in_dm_mad set to NULL if the query failed.
+ * Advances the port to its next discovery step and frees the query.
+ */
+static void srp_dm_complete(struct srp_dm_engine *engine,
+			    struct srp_dm_query *query,
+			    struct umad_dm_packet *in_dm_mad)
 {
-	struct srp_ib_user_mad		in_mad, out_mad;
-	struct umad_dm_packet	       *in_dm_mad;
+	struct srp_dm_port *port = query->port;
+	struct srp_dm_ioc *ioc;
+
+	if (in_dm_mad && in_dm_mad->mad_hdr.status) {
+		switch (query->type) {
+		case SRP_DM_QUERY_CLASS_PORT_INFO:
+			pr_err("Class Port Info set returned status 0x%04x\n",
+			       be16toh(in_dm_mad->mad_hdr.status));
+			break;
+		case SRP_DM_QUERY_IOU_INFO:
+			pr_err("IO Unit Info query returned status 0x%04x\n",
+			       be16toh(in_dm_mad->mad_hdr.status));
+			break;
+		case SRP_DM_QUERY_IOC_PROF:
+			pr_err("IO Controller Profile query returned status 0x%04x for %d\n",
+			       be16toh(in_dm_mad->mad_hdr.status), query->ioc);
+			break;
+		case SRP_DM_QUERY_SVC_ENTRIES:
+			pr_err("Service Entries query returned status 0x%04x\n",
+			       be16toh(in_dm_mad->mad_hdr.status));
+			break;
+		}
+		in_dm_mad = NULL;
+	}
+
+	switch (query->type) {
+	case SRP_DM_QUERY_CLASS_PORT_INFO:
+		if (!in_dm_mad)
+			pr_err("Warning: set of ClassPortInfo failed\n");
+		srp_dm_queue_iou_info(engine, port);
+		break;
+	case SRP_DM_QUERY_IOU_INFO:
+		if (!in_dm_mad)
+			pr_err("failed to get iou info for dlid %#x\n", port->dlid);
+		else
+			srp_dm_iou_info_done(engine, port, in_dm_mad);
+		break;
+	case SRP_DM_QUERY_IOC_PROF:
+		if (in_dm_mad)
+			srp_dm_ioc_prof_done(engine, port, query->ioc, in_dm_mad);
+		break;
+	case SRP_DM_QUERY_SVC_ENTRIES:
+		if (in_dm_mad) {
+			ioc = &port->iocs[query->ioc - 1];
+			memcpy(&ioc->svc_entries[query->start / 4], in_dm_mad->data,
+			       sizeof(*ioc->svc_entries));
+			ioc->svc_valid[query->start / 4] = true;
+		}
+		break;
+	}
 
-	init_srp_dm_mad(&out_mad, umad_res->agent, dlid, SRP_DM_ATTR_SERVICE_ENTRIES,
-			(ioc << 16) | (end << 8) | start);
+	free(query);
+}
 
-	if (pkey_to_pkey_index(umad_res, h_pkey, &out_mad.hdr.addr.pkey_index)
-	    < 0) {
-		pr_err("get_svc_entries: Unable to find pkey_index for pkey %#x\n",
-		       h_pkey);
-		return -1;
+static void srp_dm_retry(struct srp_dm_engine *engine, struct srp_dm_query *query)
+{
+	if (++query->retries < config->mad_retries) {
+		pr_debug("retrying DM query to dlid %#x (attempt %d)\n",
+			 query->port->dlid, query->retries + 1);
+		list_add(&engine->queued, &query->entry);
+	} else {
+		pr_err("DM query to dlid %#x timed out\n", query->port->dlid);
+		srp_dm_complete(engine, query, NULL);
 	}
+}
 
-	if (send_and_get(umad_res->portid, umad_res->agent, &out_mad, &in_mad, 0) < 0)
-		return -1;
+static void srp_dm_post(struct srp_dm_engine *engine)
+{
+	struct umad_resources *umad_res = engine->umad_res;
+	struct umad_dm_packet *out_dm_mad;
+	struct srp_dm_query *query;
+	int ret;
 
-	in_dm_mad = get_data_ptr(in_mad);
-	if (in_dm_mad->mad_hdr.status) {
-		pr_err("Service Entries query returned status 0x%04x\n",
-			be16toh(in_dm_mad->mad_hdr.status));
-		return -1;
+	while (engine->num_inflight < config->max_dm_mads &&
+	       (query = list_pop(&engine->queued, struct srp_dm_query, entry))) {
+		query->tid = next_mad_tid();
+		out_dm_mad = get_data_ptr(query->out_mad);
+		out_dm_mad->mad_hdr.tid = htobe64(query->tid);
+
+		ret = umad_send(umad_res->portid, umad_res->agent, &query->out_mad,
+				MAD_BLOCK_SIZE, config->timeout, 0);
+		if (ret < 0) {
+			pr_err("umad_send to %u failed\n", query->port->dlid);
+			srp_dm_complete(engine, query, NULL);
+			continue;
+		}
+
+		list_add_tail(&engine->inflight, &query->entry);
+		engine->num_inflight++;
 	}
+}
 
-	memcpy(svc_entries, in_dm_mad->data, sizeof *svc_entries);
+static struct srp_dm_query *srp_dm_find_inflight(struct srp_dm_engine *engine,
+						 uint32_t tid)
+{
+	struct srp_dm_query *query;
 
-	return 0;
+	list_for_each(&engine->inflight, query, entry)
+		if (query->tid == tid)
+			return query;
+	return NULL;
 }
 
-static int do_port(struct resources *res, uint16_t pkey, uint16_t dlid,
-		   uint64_t subnet_prefix, uint64_t h_guid)
+/*
+ * Drive all the queued queries (and the ones they spawn) to completion.
+ */
+static void srp_dm_run(struct srp_dm_engine *engine)
 {
-	struct umad_resources 	       *umad_res = res->umad_res;
-	struct srp_dm_iou_info		iou_info;
-	struct srp_dm_svc_entries	svc_entries;
-	int				i, j, k, ret;
+	struct umad_resources *umad_res = engine->umad_res;
+	struct srp_ib_user_mad in_mad;
+	struct umad_dm_packet *in_dm_mad = get_data_ptr(in_mad);
+	struct srp_dm_query *query;
+	uint32_t received_tid;
+	int in_agent, len, ret;
+
+	for (srp_dm_post(engine); engine->num_inflight; srp_dm_post(engine)) {
+		len = MAD_BLOCK_SIZE;
+		/* every send is timed out by the kernel, allow for some slack */
+		in_agent = umad_recv(umad_res->portid, (struct ib_user_mad *) &in_mad,
+				     &len, 2 * config->timeout);
+		if (in_agent < 0) {
+			pr_err("umad_recv failed - %d\n", in_agent);
+			while ((query = list_pop(&engine->inflight,
+						 struct srp_dm_query, entry))) {
+				engine->num_inflight--;
+				srp_dm_retry(engine, query);
+			}
+			continue;
+		}
+		if (in_agent != umad_res->agent) {
+			pr_debug("umad_recv returned different agent\n");
+			continue;
+		}
+
+		received_tid = be64toh(in_dm_mad->mad_hdr.tid);
+		query = srp_dm_find_inflight(engine, received_tid);
+		if (!query) {
+			pr_debug("umad_recv returned unknown transaction id %d\n",
+				 received_tid);
+			continue;
+		}
+		list_del(&query->entry);
+		engine->num_inflight--;
+
+		ret = umad_status(&in_mad);
+		if (ret == ETIMEDOUT) {
+			srp_dm_retry(engine, query);
+		} else if (ret) {
+			pr_err("bad MAD status (%u) from lid %#x\n",
+			       ret, query->port->dlid);
+			srp_dm_complete(engine, query, NULL);
+		} else {
+			srp_dm_complete(engine, query, in_dm_mad);
+		}
+	}
+}
+
+static int srp_dm_add_port(struct srp_dm_engine *engine, uint16_t pkey,
+			   uint16_t dlid, uint64_t subnet_prefix, uint64_t h_guid)
+{
+	struct srp_dm_port *port;
 
 	static const uint64_t topspin_oui = 0x0005ad0000000000ull;
 	static const uint64_t oui_mask    = 0xffffff0000000000ull;
 
-	struct target_details *target = (struct target_details *)
-		malloc(sizeof(struct target_details));
-
-	target->subnet_prefix = subnet_prefix;
-	target->h_guid = h_guid;
-	target->options = NULL;
+	port = calloc(1, sizeof(*port));
+	if (!port) {
+		pr_err("failed to get iou info for dlid %#x\n", dlid);
+		return -ENOMEM;
+	}
 
- 	pr_debug("enter do_port\n");
-	if ((target->h_guid & oui_mask) == topspin_oui &&
-	    set_class_port_info(umad_res, dlid, pkey))
-		pr_err("Warning: set of ClassPortInfo failed\n");
+	port->pkey = pkey;
+	port->dlid = dlid;
+	port->subnet_prefix = subnet_prefix;
+	port->h_guid = h_guid;
+	list_add_tail(&engine->ports, &port->entry);
 
-	ret = get_iou_info(umad_res, dlid, pkey, &iou_info);
-	if (ret < 0) {
+	pr_debug("queue port %#x for discovery\n", dlid);
+	if (pkey_to_pkey_index(engine->umad_res, pkey, &port->pkey_index) < 0) {
+		pr_err("Unable to find pkey_index for pkey %#x\n", pkey);
 		pr_err("failed to get iou info for dlid %#x\n", dlid);
-		goto out;
+		return 0;
+	}
+
+	if ((h_guid & oui_mask) == topspin_oui) {
+		if (!srp_dm_queue(engine, port, SRP_DM_QUERY_CLASS_PORT_INFO,
+				  0, 0, 0))
+			return 0;
+		pr_err("Warning: set of ClassPortInfo failed\n");
 	}
+	srp_dm_queue_iou_info(engine, port);
+
+	return 0;
+}
+
+static void report_port(struct resources *res, struct srp_dm_port *port)
+{
+	struct srp_dm_iou_info	       *iou_info = &port->iou_info;
+	struct srp_dm_svc_entries      *svc_entries;
+	struct target_details	       *target;
+	struct srp_dm_ioc	       *ioc;
+	int				i, j, k, n;
+
+	if (!port->valid)
+		return;
+
+	target = malloc(sizeof(struct target_details));
+	if (!target)
+		return;
+
+	target->subnet_prefix = port->subnet_prefix;
+	target->h_guid = port->h_guid;
+	target->options = NULL;
 
 	pr_human("IO Unit Info:\n");
-	pr_human("    port LID:        %04x\n", dlid);
+	pr_human("    port LID:        %04x\n", port->dlid);
 	pr_human("    port GID:        %016llx%016llx\n",
 		 (unsigned long long) target->subnet_prefix,
 		 (unsigned long long) target->h_guid);
-	pr_human("    change ID:       %04x\n", be16toh(iou_info.change_id));
-	pr_human("    max controllers: 0x%02x\n", iou_info.max_controllers);
+	pr_human("    change ID:       %04x\n", be16toh(iou_info->change_id));
+	pr_human("    max controllers: 0x%02x\n", iou_info->max_controllers);
 
 	if (config->verbose > 0)
-		for (i = 0; i < iou_info.max_controllers; ++i) {
+		for (i = 0; i < iou_info->max_controllers; ++i) {
 			pr_human("    controller[%3d]: ", i + 1);
-			switch ((iou_info.controller_list[i / 2] >>
-				 (4 * (1 - i % 2))) & 0xf) {
+			switch (ioc_state(iou_info, i)) {
 			case SRP_DM_NO_IOC:      pr_human("not installed\n"); break;
 			case SRP_DM_IOC_PRESENT: pr_human("present\n");       break;
 			case SRP_DM_NO_SLOT:     pr_human("no slot\n");       break;
@@ -1069,57 +1367,58 @@ static int do_port(struct resources *res, uint16_t pkey, uint16_t dlid,
 			}
 		}
 
-	for (i = 0; i < iou_info.max_controllers; ++i) {
-		if (((iou_info.controller_list[i / 2] >> (4 * (1 - i % 2))) & 0xf) ==
-		    SRP_DM_IOC_PRESENT) {
-			pr_human("\n");
+	for (i = 0; i < iou_info->max_controllers; ++i) {
+		if (ioc_state(iou_info, i) != SRP_DM_IOC_PRESENT)
+			continue;
 
-			if (get_ioc_prof(umad_res, dlid, pkey, i + 1, &target->ioc_prof))
-				continue;
+		pr_human("\n");
+
+		ioc = &port->iocs[i];
+		if (!ioc->valid)
+			continue;
+
+		target->ioc_prof = ioc->ioc_prof;
+
+		pr_human("    controller[%3d]\n", i + 1);
 
-			pr_human("    controller[%3d]\n", i + 1);
+		pr_human("        GUID:      %016llx\n",
+			 (unsigned long long) be64toh(target->ioc_prof.guid));
+		pr_human("        vendor ID: %06x\n", be32toh(target->ioc_prof.vendor_id) >> 8);
+		pr_human("        device ID: %06x\n", be32toh(target->ioc_prof.device_id));
+		pr_human("        IO class : %04hx\n", be16toh(target->ioc_prof.io_class));
+		pr_human("        Maximum size of Send Messages in bytes: %d\n",
+			 be32toh(target->ioc_prof.send_size));
+		pr_human("        ID:        %s\n", target->ioc_prof.id);
+		pr_human("        service entries: %d\n", target->ioc_prof.service_entries);
 
-			pr_human("        GUID:      %016llx\n",
-				 (unsigned long long) be64toh(target->ioc_prof.guid));
-			pr_human("        vendor ID: %06x\n", be32toh(target->ioc_prof.vendor_id) >> 8);
-			pr_human("        device ID: %06x\n", be32toh(target->ioc_prof.device_id));
-			pr_human("        IO class : %04hx\n", be16toh(target->ioc_prof.io_class));
-			pr_human("        Maximum size of Send Messages in bytes: %d\n",
-				 be32toh(target->ioc_prof.send_size));
-			pr_human("        ID:        %s\n", target->ioc_prof.id);
-			pr_human("        service entries: %d\n", target->ioc_prof.service_entries);
+		for (j = 0; j < target->ioc_prof.service_entries; j += 4) {
+			n = j + 3;
+			if (n >= target->ioc_prof.service_entries)
+				n = target->ioc_prof.service_entries - 1;
 
-			for (j = 0; j < target->ioc_prof.service_entries; j += 4) {
-				int n;
+			if (!ioc->svc_valid[j / 4])
+				continue;
+			svc_entries = &ioc->svc_entries[j / 4];
 
-				n = j + 3;
-				if (n >= target->ioc_prof.service_entries)
-					n = target->ioc_prof.service_entries - 1;
+			for (k = 0; k <= n - j; ++k) {
 
-				if (get_svc_entries(umad_res, dlid, pkey, i + 1,
-						    j, n, &svc_entries))
+				if (sscanf(svc_entries->service[k].name,
+					   "SRP.T10:%16s",
+					   target->id_ext) != 1)
 					continue;
 
-				for (k = 0; k <= n - j; ++k) {
-
-					if (sscanf(svc_entries.service[k].name,
-						   "SRP.T10:%16s",
-						   target->id_ext) != 1)
-						continue;
-
-					pr_human("            service[%3d]: %016llx / %s\n",
-						 j + k,
-						 (unsigned long long) be64toh(svc_entries.service[k].id),
-						 svc_entries.service[k].name);
-
-					target->h_service_id = be64toh(svc_entries.service[k].id);
-					target->pkey = pkey;
-					if (is_enabled_by_rules_file(target)) {
-						if (!add_non_exist_target(target) && !config->once) {
-							target->retry_time =
-								time(NULL) + config->retry_timeout;
-							push_to_retry_list(res->sync_res, target);
-						}
+				pr_human("            service[%3d]: %016llx / %s\n",
+					 j + k,
+					 (unsigned long long) be64toh(svc_entries->service[k].id),
+					 svc_entries->service[k].name);
+
+				target->h_service_id = be64toh(svc_entries->service[k].id);
+				target->pkey = port->pkey;
+				if (is_enabled_by_rules_file(target)) {
+					if (!add_non_exist_target(target) && !config->once) {
+						target->retry_time =
+							time(NULL) + config->retry_timeout;
+						push_to_retry_list(res->sync_res, target);
 					}
 				}
 			}
@@ -1128,9 +1427,21 @@ static int do_port(struct resources *res, uint16_t pkey, uint16_t dlid,
 
 	pr_human("\n");
 
-out:
 	free(target);
-	return ret;
+}
+
+/*
+ * Run the discovery of all the ports added to the engine and report
+ * (and connect to) the targets found, in the order the ports were added.
+ */
+static void srp_dm_discover(struct resources *res, struct srp_dm_engine *engine)
+{
+	struct srp_dm_port *port;
+
+	srp_dm_run(engine);
+
+	list_for_each(&engine->ports, port, entry)
+		report_port(res, port);
 }
 
 int get_node(struct umad_resources *umad_res, uint16_t dlid, uint64_t *guid)
@@ -1258,11 +1569,13 @@ static int do_dm_port_list(struct resources *res)
 	struct ib_user_mad	       *in_mad;
 	struct umad_sa_packet	       *out_sa_mad, *in_sa_mad;
 	struct srp_sa_port_info_rec    *port_info;
+	struct srp_dm_engine		engine;
 	ssize_t len;
 	int size;
 	int i, j,num_pkeys;
 	uint16_t pkeys[SRP_MAX_SHARED_PKEYS];
 	uint64_t guid;
+	int ret = 0;
 
 	in_mad_buf = malloc(sizeof(struct ib_user_mad) +
 			    node_table_response_size);
@@ -1300,6 +1613,8 @@ static int do_dm_port_list(struct resources *res)
 		return 0;
 	}
 
+	srp_dm_engine_init(&engine, umad_res);
+
 	for (i = 0; (i + 1) * size <= len - MAD_RMPP_HDR_SIZE; ++i) {
 		port_info = (void *) in_sa_mad->data + i * size;
 		if (get_node(umad_res, be16toh(port_info->endport_lid), &guid))
@@ -1310,33 +1625,51 @@ static int do_dm_port_list(struct resources *res)
 		if (num_pkeys < 0) {
 			pr_err("failed to get shared P_Keys with LID %#x\n",
 			       be16toh(port_info->endport_lid));
-			free(in_mad_buf);
-			return num_pkeys;
+			ret = num_pkeys;
+			break;
 		}
 
-		for (j = 0; j < num_pkeys; ++j)
-			do_port(res, pkeys[j], be16toh(port_info->endport_lid),
-				be64toh(port_info->subnet_prefix), guid);
+		for (j = 0; j < num_pkeys && !ret; ++j)
+			ret = srp_dm_add_port(&engine, pkeys[j],
+					      be16toh(port_info->endport_lid),
+					      be64toh(port_info->subnet_prefix),
+					      guid);
+		if (ret)
+			break;
 	}
 
+	/* discover the ports collected so far, even after an error */
+	srp_dm_discover(res, &engine);
+	srp_dm_engine_destroy(&engine);
+
 	free(in_mad_buf);
-	return 0;
+	return ret;
 }
 
-void handle_port(struct resources *res, uint16_t pkey, uint16_t lid, uint64_t h_guid)
+static int add_port_if_dm(struct srp_dm_engine *engine, uint16_t pkey,
+			  uint16_t lid, uint64_t h_guid)
 {
-	struct umad_resources *umad_res = res->umad_res;
 	uint64_t subnet_prefix;
 	int isdm;
 
 	pr_debug("enter handle_port for lid %#x\n", lid);
-	if (get_port_info(umad_res, lid, &subnet_prefix, &isdm))
-		return;
+	if (get_port_info(engine->umad_res, lid, &subnet_prefix, &isdm))
+		return 0;
 
 	if (!isdm)
-		return;
+		return 0;
 
-	do_port(res, pkey, lid, subnet_prefix, h_guid);
+	return srp_dm_add_port(engine, pkey, lid, subnet_prefix, h_guid);
+}
+
+void handle_port(struct resources *res, uint16_t pkey, uint16_t lid, uint64_t h_guid)
+{
+	struct srp_dm_engine engine;
+
+	srp_dm_engine_init(&engine, res->umad_res);
+	if (!add_port_if_dm(&engine, pkey, lid, h_guid))
+		srp_dm_discover(res, &engine);
+	srp_dm_engine_destroy(&engine);
 }
 
 
@@ -1348,10 +1681,12 @@ static int do_full_port_list(struct resources *res)
 	struct ib_user_mad	       *in_mad;
 	struct umad_sa_packet	       *out_sa_mad, *in_sa_mad;
 	struct srp_sa_node_rec	       *node;
+	struct srp_dm_engine		engine;
 	ssize_t len;
 	int size;
 	int i, j, num_pkeys;
 	uint16_t pkeys[SRP_MAX_SHARED_PKEYS];
+	int ret = 0;
 
 	in_mad_buf = malloc(sizeof(struct ib_user_mad) +
 			    node_table_response_size);
@@ -1380,6 +1715,8 @@ static int do_full_port_list(struct resources *res)
 
 	size = be16toh(in_sa_mad->attr_offset) * 8;
 
+	srp_dm_engine_init(&engine, umad_res);
+
 	for (i = 0; (i + 1) * size <= len - MAD_RMPP_HDR_SIZE; ++i) {
 		node = (void *) in_sa_mad->data + i * size;
 
@@ -1388,17 +1725,23 @@ static int do_full_port_list(struct resources *res)
 		if (num_pkeys < 0) {
 			pr_err("failed to get shared P_Keys with LID %#x\n",
 			       be16toh(node->lid));
-			free(in_mad_buf);
-			return num_pkeys;
+			ret = num_pkeys;
+			break;
 		}
 
-		for (j = 0; j < num_pkeys; ++j)
-			(void) handle_port(res, pkeys[j], be16toh(node->lid),
-					   be64toh(node->port_guid));
+		for (j = 0; j < num_pkeys && !ret; ++j)
+			ret = add_port_if_dm(&engine, pkeys[j], be16toh(node->lid),
+					     be64toh(node->port_guid));
+		if (ret)
+			break;
 	}
 
+	/* discover the ports collected so far, even after an error */
+	srp_dm_discover(res, &engine);
+	srp_dm_engine_destroy(&engine);
+
 	free(in_mad_buf);
-	return 0;
+	return ret;
 }
 
 struct config_t *config;
@@ -1412,6 +1755,7 @@ static void print_config(struct config_t *conf)
 	printf(" IB port                    		: %u\n", conf->port_num);
 	printf(" Mad Retries                		: %d\n", conf->mad_retries);
 	printf(" Number of outstanding WR   		: %u\n", conf->num_of_oust);
+	printf(" Max outstanding DM MADs    		: %d\n", conf->max_dm_mads);
 	printf(" Mad timeout (msec)	     		: %u\n", conf->timeout);
 	printf(" Prints add target command  		: %d\n", conf->cmd);
  	printf(" Executes add target command		: %d\n", conf->execute);
@@ -1693,7 +2037,7 @@ static const struct option long_opts[] = {
 	{ "systemd",        0, NULL, 'S' },
 	{}
 };
-static const char short_opts[] = "caveod:i:j:p:t:r:R:T:l:Vhnf:";
+static const char short_opts[] = "caveod:i:j:p:t:r:m:R:T:l:Vhnf:";
 
 /* Check if the --systemd options was passed in very early so we can setup
  * logging properly.
@@ -1730,6 +2074,7 @@ static int get_config(struct config_t *conf, int argc, char *argv[])
 	conf->debug_verbose    		= 0;
 	conf->timeout	 		= 5000;
 	conf->mad_retries 		= 3;
+	conf->max_dm_mads		= SRP_DEF_MAX_DM_MADS;
 	conf->recalc_time 		= 0;
 	conf->retry_timeout 		= 20;
 	conf->add_target_file  		= NULL;
@@ -1812,6 +2157,13 @@ static int get_config(struct config_t *conf, int argc, char *argv[])
 				return -1;
 			}
 			break;
+		case 'm':
+			conf->max_dm_mads = atoi(optarg);
+			if (conf->max_dm_mads <= 0) {
+				pr_err("Bad number of outstanding MADs - %s\n", optarg);
+				return -1;
+			}
+			break;
 		case 'R':
 			conf->recalc_time = atoi(optarg);
 			if (conf->recalc_time == 0) {
@@ -2147,6 +2499,7 @@ static int ibsrpdm(int argc, char *argv[])
 	config->num_of_oust = 10;
 	config->timeout = 5000;
 	config->mad_retries = 3;
+	config->max_dm_mads = SRP_DEF_MAX_DM_MADS;
 	config->all = 1;
 	config->once = 1;
 
@@ -178,6 +178,7 @@ struct rule {
 };
 
 #define  SRP_MAX_SHARED_PKEYS 127
+#define  SRP_DEF_MAX_DM_MADS 64
 #define  MAX_ID_EXT_STRING_LENGTH 17
 
 struct target_details {
@@ -197,6 +198,7 @@ struct config_t {
 	int		port_num;
 	char	       *add_target_file;
 	int		mad_retries;
+	int		max_dm_mads;
 	int		num_of_oust;
 	int		cmd;
 	int		once;
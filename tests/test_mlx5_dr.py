@@ -179,6 +179,41 @@ class Mlx5DrTirResources(Mlx5DrResources):
             self.tir = Mlx5DevxObj(self.ctx, CreateTirIn(tir_context=tir_ctx), len(CreateTirOut()))
 
 
+def smac_match_param(smac):
+    """
+    Match value on the outer source MAC, padded to a multiple of 4 bytes.
+    :param smac: The source MAC as bytes, or an int for synthetic rules
+    :return: Mlx5FlowMatchParameters of the source MAC
+    """
+    if isinstance(smac, int):
+        smac = smac.to_bytes(6, 'big')
+    value = smac + bytes(2)
+    return Mlx5FlowMatchParameters(len(value), value)
+
+
+def create_smac_matcher(table, priority=0):
+    """
+    Create a matcher on the outer source MAC.
+    :param table: The table to create the matcher on
+    :param priority: The matcher priority
+    :return: The matcher
+    """
+    smac_mask = bytes([0xff] * 6) + bytes(2)
+    mask_param = Mlx5FlowMatchParameters(len(smac_mask), smac_mask)
+    return DrMatcher(table, priority, u.MatchCriteriaEnable.OUTER, mask_param)
+
+
+def create_smac_rules(matcher, actions, smacs):
+    """
+    Create a rule with the given actions for every source MAC.
+    :param matcher: A source MAC matcher, see create_smac_matcher()
+    :param actions: The actions of the rules
+    :param smacs: Source MACs to match, as accepted by smac_match_param()
+    :return: List of the rules
+    """
+    return [DrRule(matcher, smac_match_param(smac), actions) for smac in smacs]
+
+
 class Mlx5DrTest(Mlx5RDMATestCase):
     def setUp(self):
         super().setUp()
@@ -193,6 +228,39 @@ class Mlx5DrTest(Mlx5RDMATestCase):
         if self.client:
             self.client.ctx.close()
 
+    def create_smac_qp_rule(self, background_sync=False):
+        """
+        Create the players and, on the server RX domain, forward the packets
+        from the root table to a source MAC matcher on a non-root table, with
+        a rule sending the client source MAC to the QP through a counter.
+        The matcher, the QP rule and its actions, a drop action and the
+        counter are kept on the test.
+        :param background_sync: Enable the domain background sync thread
+        """
+        self.create_players(Mlx5DrResources)
+        self.counter, self.flow_counter_id = self.create_counter(self.server.ctx)
+        self.domain_rx = DrDomain(self.server.ctx, dve.MLX5DV_DR_DOMAIN_TYPE_NIC_RX)
+        if background_sync:
+            self.domain_rx.set_background_sync(True)
+        root_table = DrTable(self.domain_rx, 0)
+        table = DrTable(self.domain_rx, 1)
+        self.fwd_packets_to_table(root_table, table)
+        self.smac_matcher = create_smac_matcher(table)
+        self.qp_actions = [DrActionQp(self.server.qp), DrActionFlowCounter(self.counter)]
+        self.drop_action = DrActionDrop()
+        src_mac = bytes.fromhex(PacketConsts.SRC_MAC.replace(':', ''))
+        self.qp_rule = create_smac_rules(self.smac_matcher, self.qp_actions, [src_mac])[0]
+        self.rules.append(self.qp_rule)
+
+    def verify_smac_qp_rule(self, expected):
+        """
+        Send traffic to the QP and verify the QP rule counter.
+        :param expected: The number of packets the counter should have counted
+        """
+        u.raw_traffic(self.client, self.server, self.iters)
+        recv_packets = self.query_counter_packets(self.counter, self.flow_counter_id)
+        self.assertEqual(recv_packets, expected, 'Counter missed some recv packets')
+
     @skip_unsupported
     def create_rx_recv_rules_based_on_match_params(self, mask_param, val_param, actions,
                                                    match_criteria=u.MatchCriteriaEnable.OUTER,
@@ -613,6 +681,47 @@ class Mlx5DrTest(Mlx5RDMATestCase):
         """
         self.add_counter_action_and_send_pkts()
 
+    @skip_unsupported
+    def test_tbl_5tuple_rule(self):
+        """
+        Match on the IPv4 5-tuple of the packets in a matcher that holds many
+        rules differing only in the UDP destination port, and verify by a
+        counter that every packet hit the rule of its own port.
+        """
+        from tests.mlx5_prm_structs import FlowTableEntryMatchParamSW
+
+        self.create_players(Mlx5DrResources)
+        counter, flow_counter_id = self.create_counter(self.server.ctx)
+        mask = FlowTableEntryMatchParamSW()
+        mask.outer_headers.ip_version = PacketConsts.IP_V4
+        mask.outer_headers.ip_protocol = 0xff
+        mask.outer_headers.src_ip4 = '255.255.255.255'
+        mask.outer_headers.dst_ip4 = '255.255.255.255'
+        mask.outer_headers.udp_sport = 0xffff
+        mask.outer_headers.udp_dport = 0xffff
+        mask_param = Mlx5FlowMatchParameters(len(mask), mask)
+        value = FlowTableEntryMatchParamSW()
+        value.outer_headers.ip_version = PacketConsts.IP_V4
+        value.outer_headers.ip_protocol = socket.IPPROTO_UDP
+        value.outer_headers.src_ip4 = PacketConsts.SRC_IP
+        value.outer_headers.dst_ip4 = PacketConsts.DST_IP
+        value.outer_headers.udp_sport = PacketConsts.SRC_PORT
+        value.outer_headers.udp_dport = PacketConsts.DST_PORT
+        value_param = Mlx5FlowMatchParameters(len(value), value)
+        self.qp_action = DrActionQp(self.server.qp)
+        self.server_counter_action = DrActionFlowCounter(counter)
+        self.create_rx_recv_rules_based_on_match_params(mask_param, value_param,
+                                                        [self.qp_action,
+                                                         self.server_counter_action])
+        self.drop_action = DrActionDrop()
+        for port in range(1, 1025):
+            value.outer_headers.udp_dport = (PacketConsts.DST_PORT + port) & 0xffff
+            self.rules.append(DrRule(self.matcher, Mlx5FlowMatchParameters(len(value), value),
+                                     [self.drop_action]))
+        u.raw_traffic(self.client, self.server, self.iters)
+        recv_packets = self.query_counter_packets(counter, flow_counter_id)
+        self.assertEqual(recv_packets, self.iters, 'Counter missed some recv packets')
+
 
     @skip_unsupported
     def test_prevent_duplicate_rule(self):
@@ -635,6 +744,86 @@ class Mlx5DrTest(Mlx5RDMATestCase):
             self.rules.append(DrRule(matcher, empty_param, [self.drop_action]))
             self.assertEqual(ex.exception.error_code, errno.EEXIST)
 
+    @skip_unsupported
+    def test_rule_churn_background_sync(self):
+        """
+        With the background sync thread enabled, create and destroy many rules
+        in the matcher of a rule that forwards to the QP, and verify by a
+        counter that this rule still gets all the packets.
+        """
+        self.create_smac_qp_rule(background_sync=True)
+        for _ in range(5):
+            for rule in create_smac_rules(self.smac_matcher, [self.drop_action], range(1000)):
+                rule.close()
+        self.verify_smac_qp_rule(self.iters)
+
+    @skip_unsupported
+    def test_rule_modify_actions(self):
+        """
+        Move a rule between a QP path and a drop path by modifying its actions
+        in place, each path with its own counter, and verify after every
+        modification that the packets take the path of the new actions.
+        """
+        self.create_smac_qp_rule()
+        drop_counter, drop_counter_id = self.create_counter(self.server.ctx)
+        drop_actions = [DrActionFlowCounter(drop_counter), self.drop_action]
+        # Neighbouring rules must keep their actions
+        self.rules += create_smac_rules(self.smac_matcher, [self.drop_action], range(100))
+
+        self.verify_smac_qp_rule(self.iters)
+
+        self.qp_rule.modify_actions(drop_actions)
+        self.send_client_raw_packets(self.iters)
+        self.assertEqual(self.query_counter_packets(drop_counter, drop_counter_id), self.iters,
+                         'Packets did not take the drop path after modifying the actions')
+        self.assertEqual(self.query_counter_packets(self.counter, self.flow_counter_id),
+                         self.iters, 'Packets took the QP path after modifying the actions')
+
+        self.qp_rule.modify_actions(self.qp_actions)
+        self.verify_smac_qp_rule(2 * self.iters)
+        self.assertEqual(self.query_counter_packets(drop_counter, drop_counter_id), self.iters,
+                         'Packets took the drop path after modifying the actions back')
+
+    @skip_unsupported
+    def test_modify_action_pattern_cache(self):
+        """
+        Create modify header actions that set the same bits with different
+        data and one that sets other bits, use them in rules and verify from
+        the domain dump that the actions setting the same bits share a single
+        cached pattern.
+        """
+        from tests.mlx5_prm_structs import SetActionIn
+        dump_file = '/tmp/dump_ptrn.txt'
+        self.server = Mlx5DrResources(**self.dev_info)
+        domain = DrDomain(self.server.ctx, dve.MLX5DV_DR_DOMAIN_TYPE_NIC_RX)
+        table = DrTable(domain, 1)
+        matcher = create_smac_matcher(table)
+        drop_action = DrActionDrop()
+        # Only the fields, offsets and lengths make up the pattern, the data
+        # is kept in the action argument.
+        offsets = [0, 0, 0, 16]
+        modify_actions = []
+        for data, offset in enumerate(offsets):
+            modify_actions.append(DrActionModify(domain, 0, [
+                SetActionIn(field=ModifyFields.META_DATA_REG_C_0, offset=offset,
+                            length=16, data=data),
+                SetActionIn(field=ModifyFields.META_DATA_REG_C_1, offset=offset,
+                            length=16, data=data)]))
+        for i, action in enumerate(modify_actions):
+            self.rules += create_smac_rules(matcher, [action, drop_action], [i])
+        domain.dump(dump_file)
+        with open(dump_file) as f:
+            ptrns = [int(line.split(',')[6], 16) for line in f
+                     if line.startswith('3402,')]
+        self.assertEqual(len(ptrns), len(offsets), 'Not all modify header actions were dumped')
+        if not any(ptrns):
+            raise unittest.SkipTest('Modify header patterns are not used by the device')
+        self.assertEqual(sorted(ptrns.count(ptrn) for ptrn in set(ptrns)), [1, 3],
+                         'Actions setting the same bits do not share their pattern')
+        for obj in self.rules + [matcher, drop_action] + modify_actions + [table, domain]:
+            obj.close()
+        self.rules = []
+
     def _drop_action(self, root_only=False):
         self.create_players(Mlx5DrResources)
         # Initiate the sender side
@@ -1412,3 +1601,52 @@ class Mlx5DrDumpTest(PyverbsAPITestCase):
         self.domain_rx.dump(dump_file)
         self.assertTrue(path.isfile(dump_file), 'Dump file does not exist.')
         self.assertGreater(path.getsize(dump_file), 0, 'Dump file is empty')
+
+    @skip_unsupported
+    def test_domain_dump_rules(self):
+        """
+        Dump a domain holding many rules and check every rule is in the dump.
+        """
+        dump_file = '/tmp/dump_rules.txt'
+        num_rules = 10000
+        self.res = Mlx5DrResources(self.dev_name, self.ib_port)
+        self.domain_rx = DrDomain(self.res.ctx, dve.MLX5DV_DR_DOMAIN_TYPE_NIC_RX)
+        table = DrTable(self.domain_rx, 1)
+        matcher = create_smac_matcher(table)
+        drop_action = DrActionDrop()
+        rules = create_smac_rules(matcher, [drop_action], range(num_rules))
+        self.domain_rx.dump(dump_file)
+        self.assertEqual(len(self._lookup_records(dump_file, 3300)), num_rules,
+                         'Not all rules were dumped')
+        for obj in rules + [matcher, drop_action, table, self.domain_rx]:
+            obj.close()
+
+    @staticmethod
+    def _lookup_records(dump_file, rec_type):
+        with open(dump_file) as f:
+            return [line.strip().split(',') for line in f
+                    if line.startswith('{},'.format(rec_type))]
+
+    @skip_unsupported
+    def test_matcher_lookup_dump(self):
+        """
+        Insert rules matching on the source MAC, then evaluate the matcher in
+        software for packets that hit and miss them and check the reported
+        result.
+        """
+        dump_file = '/tmp/lookup_dump.txt'
+        num_rules = 1000
+        self.res = Mlx5DrResources(self.dev_name, self.ib_port)
+        self.domain_rx = DrDomain(self.res.ctx, dve.MLX5DV_DR_DOMAIN_TYPE_NIC_RX)
+        table = DrTable(self.domain_rx, 1)
+        matcher = create_smac_matcher(table)
+        drop_action = DrActionDrop()
+        rules = create_smac_rules(matcher, [drop_action], range(num_rules))
+        for i in range(num_rules * 2):
+            matcher.dump_lookup(dump_file, smac_match_param(i))
+            result = self._lookup_records(dump_file, 3500)
+            self.assertEqual(len(result), 1, 'Expected one RX lookup record')
+            self.assertEqual(int(result[0][3]), 1 if i < num_rules else 0,
+                             'Wrong lookup result for smac {}'.format(i))
+        for obj in rules + [matcher, drop_action, table, self.domain_rx]:
+            obj.close()
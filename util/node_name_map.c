@@ -32,11 +32,17 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <config.h>
 
+#include <stdbool.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <errno.h>
@@ -46,66 +52,163 @@
 #include <ccan/minmax.h>
 
 #include <util/node_name_map.h>
-#include <util/cl_qmap.h>
 
 #define PARSE_NODE_MAP_BUFLEN  256
 
-typedef struct _name_map_item {
-        cl_map_item_t item;
-        uint64_t guid;
-        char *name;
-} name_map_item_t;
+/*
+ * The text map is compiled into a sorted GUID array plus a string pool.
+ * The compiled form is saved in the user's cache directory, under a name
+ * derived from the text file's path, and mmapped by later users as long as
+ * the text file's size and mtime still match the ones recorded in the
+ * header.
+ */
+#define NN_MAP_CACHE_DIR	"rdma-core"
+#define NN_MAP_CACHE_MAGIC	"IBNNMAP"
+#define NN_MAP_CACHE_VERSION	1
+
+struct nn_map_cache_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_entries;
+	uint64_t src_size;
+	int64_t src_mtime_sec;
+	int64_t src_mtime_nsec;
+	uint64_t pool_size;
+};
+
+struct nn_map_entry {
+	uint64_t guid;
+	uint32_t name_off;
+	uint32_t seq;	/* line order, only used while compiling */
+};
 
 struct nn_map {
-	cl_qmap_t map;
+	const struct nn_map_entry *entries;
+	uint32_t num_entries;
+	const char *pool;
+	/* set when backed by the compiled file */
+	void *mmap_addr;
+	size_t mmap_len;
+	/* set when compiled in memory */
+	struct nn_map_entry *alloc_entries;
+	char *alloc_pool;
+	uint64_t pool_size;
+	uint64_t pool_alloc;
+	uint32_t entries_size;
 };
 
 static int map_name(void *cxt, uint64_t guid, char *p)
 {
-	cl_qmap_t *map = cxt;
-	name_map_item_t *item;
+	struct nn_map *map = cxt;
+	struct nn_map_entry *entry;
+	char *pool;
+	size_t len;
 
 	p = strtok(p, "\"#");
 	if (!p)
 		return 0;
 
-	item = malloc(sizeof(*item));
-	if (!item)
+	if (map->num_entries == map->entries_size) {
+		uint32_t size = map->entries_size ? map->entries_size * 2 : 1024;
+
+		entry = realloc(map->alloc_entries, size * sizeof(*entry));
+		if (!entry)
+			return -1;
+		map->alloc_entries = entry;
+		map->entries_size = size;
+	}
+
+	len = strlen(p) + 1;
+	if (map->pool_size + len > UINT32_MAX)
 		return -1;
-	item->guid = guid;
-	item->name = strdup(p);
-	cl_qmap_insert(map, item->guid, (cl_map_item_t *) item);
+	if (map->pool_size + len > map->pool_alloc) {
+		uint64_t size = map->pool_alloc ? map->pool_alloc * 2 : 16384;
+
+		while (size < map->pool_size + len)
+			size *= 2;
+		pool = realloc(map->alloc_pool, size);
+		if (!pool)
+			return -1;
+		map->alloc_pool = pool;
+		map->pool_alloc = size;
+	}
+	memcpy(map->alloc_pool + map->pool_size, p, len);
+
+	entry = &map->alloc_entries[map->num_entries];
+	entry->guid = guid;
+	entry->name_off = map->pool_size;
+	entry->seq = map->num_entries++;
+	map->pool_size += len;
 	return 0;
 }
 
-void close_node_name_map(nn_map_t * map)
+static int cmp_entry(const void *a, const void *b)
+{
+	const struct nn_map_entry *ea = a, *eb = b;
+
+	if (ea->guid != eb->guid)
+		return ea->guid < eb->guid ? -1 : 1;
+	return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+}
+
+/* Sort by GUID, the first line of a duplicated GUID wins */
+static void compile_map(struct nn_map *map)
 {
-	name_map_item_t *item = NULL;
+	uint32_t i, n = 0;
 
+	qsort(map->alloc_entries, map->num_entries,
+	      sizeof(*map->alloc_entries), cmp_entry);
+	for (i = 0; i < map->num_entries; i++) {
+		if (n && map->alloc_entries[n - 1].guid ==
+			 map->alloc_entries[i].guid)
+			continue;
+		map->alloc_entries[n++] = map->alloc_entries[i];
+	}
+	map->num_entries = n;
+	map->entries = map->alloc_entries;
+	map->pool = map->alloc_pool;
+}
+
+void close_node_name_map(nn_map_t * map)
+{
 	if (!map)
 		return;
 
-	item = (name_map_item_t *) cl_qmap_head(&map->map);
-	while (item != (name_map_item_t *) cl_qmap_end(&map->map)) {
-		item = (name_map_item_t *) cl_qmap_remove(&map->map, item->guid);
-		free(item->name);
-		free(item);
-		item = (name_map_item_t *) cl_qmap_head(&map->map);
-	}
+	if (map->mmap_addr)
+		munmap(map->mmap_addr, map->mmap_len);
+	free(map->alloc_entries);
+	free(map->alloc_pool);
 	free(map);
 }
 
+static const char *lookup_name(nn_map_t *map, uint64_t guid)
+{
+	uint32_t lo = 0, hi = map->num_entries;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (map->entries[mid].guid == guid)
+			return map->pool + map->entries[mid].name_off;
+		if (map->entries[mid].guid < guid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
 char *remap_node_name(nn_map_t * map, uint64_t target_guid, const char *nodedesc)
 {
 	char *rc = NULL;
-	name_map_item_t *item = NULL;
+	const char *name;
 
 	if (!map)
 		goto done;
 
-	item = (name_map_item_t *) cl_qmap_get(&map->map, target_guid);
-	if (item != (name_map_item_t *) cl_qmap_end(&map->map))
-		rc = strdup(item->name);
+	name = lookup_name(map, target_guid);
+	if (name)
+		rc = strdup(name);
 
 done:
 	if (rc == NULL) {
@@ -188,22 +291,227 @@ static int parse_node_map_wrap(const char *file_name,
 	return 0;
 }
 
+/* $XDG_CACHE_HOME/rdma-core, or ~/.cache/rdma-core, created if asked to */
+static char *cache_dir_name(bool create)
+{
+	const char *base = secure_getenv("XDG_CACHE_HOME");
+	char *dir;
+
+	if (base && base[0] == '/') {
+		if (asprintf(&dir, "%s/" NN_MAP_CACHE_DIR, base) < 0)
+			return NULL;
+	} else {
+		base = secure_getenv("HOME");
+		if (!base || base[0] != '/')
+			return NULL;
+		if (asprintf(&dir, "%s/.cache", base) < 0)
+			return NULL;
+		if (create && mkdir(dir, 0700) && errno != EEXIST) {
+			free(dir);
+			return NULL;
+		}
+		free(dir);
+		if (asprintf(&dir, "%s/.cache/" NN_MAP_CACHE_DIR, base) < 0)
+			return NULL;
+	}
+
+	if (create && mkdir(dir, 0700) && errno != EEXIST) {
+		free(dir);
+		return NULL;
+	}
+	return dir;
+}
+
+/* One compiled file per text map path, named after its FNV-1a hash */
+static char *cache_file_name(const char *dir, const char *node_name_map)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	char *path, *name;
+	const char *p;
+
+	path = realpath(node_name_map, NULL);
+	if (!path)
+		return NULL;
+	for (p = path; *p; p++) {
+		hash ^= (uint8_t)*p;
+		hash *= 0x100000001b3ULL;
+	}
+	free(path);
+
+	if (asprintf(&name, "%s/node-name-map-%016" PRIx64, dir, hash) < 0)
+		return NULL;
+	return name;
+}
+
+static bool cache_matches(const struct nn_map_cache_hdr *hdr,
+			  const struct stat *src)
+{
+	return !memcmp(hdr->magic, NN_MAP_CACHE_MAGIC, sizeof(NN_MAP_CACHE_MAGIC)) &&
+	       hdr->version == NN_MAP_CACHE_VERSION &&
+	       hdr->src_size == (uint64_t)src->st_size &&
+	       hdr->src_mtime_sec == src->st_mtim.tv_sec &&
+	       hdr->src_mtime_nsec == src->st_mtim.tv_nsec;
+}
+
+/*
+ * The cache file is only trusted as far as it is checked: every name must
+ * be a NUL terminated string inside the pool and the GUIDs must be strictly
+ * ascending for the binary search in lookup_name().
+ */
+static bool cache_entries_valid(const struct nn_map_entry *entries,
+				uint32_t num_entries, const char *pool,
+				uint64_t pool_size)
+{
+	uint32_t i;
+
+	for (i = 0; i < num_entries; i++) {
+		if (entries[i].name_off >= pool_size ||
+		    !memchr(pool + entries[i].name_off, '\0',
+			    pool_size - entries[i].name_off))
+			return false;
+		if (i && entries[i - 1].guid >= entries[i].guid)
+			return false;
+	}
+	return true;
+}
+
+/* mmap the compiled map if it is valid for the current text file */
+static int load_map_cache(nn_map_t *map, const char *node_name_map,
+			  const struct stat *src)
+{
+	const struct nn_map_cache_hdr *hdr;
+	char *cache_dir, *cache_name;
+	struct stat buf;
+	uint64_t entries_len;
+	void *addr;
+	int fd;
+
+	cache_dir = cache_dir_name(false);
+	if (!cache_dir)
+		return -1;
+	cache_name = cache_file_name(cache_dir, node_name_map);
+	free(cache_dir);
+	if (!cache_name)
+		return -1;
+	fd = open(cache_name, O_RDONLY | O_CLOEXEC);
+	free(cache_name);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &buf) || buf.st_size < sizeof(*hdr)) {
+		close(fd);
+		return -1;
+	}
+
+	addr = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return -1;
+
+	hdr = addr;
+	entries_len = (uint64_t)hdr->num_entries * sizeof(struct nn_map_entry);
+	if (!cache_matches(hdr, src) ||
+	    hdr->pool_size > UINT64_MAX - sizeof(*hdr) - entries_len ||
+	    buf.st_size != sizeof(*hdr) + entries_len + hdr->pool_size ||
+	    !cache_entries_valid((const void *)(hdr + 1), hdr->num_entries,
+				 (const char *)(hdr + 1) + entries_len,
+				 hdr->pool_size)) {
+		munmap(addr, buf.st_size);
+		return -1;
+	}
+
+	map->mmap_addr = addr;
+	map->mmap_len = buf.st_size;
+	map->num_entries = hdr->num_entries;
+	map->entries = (const void *)(hdr + 1);
+	map->pool = (const char *)map->entries + entries_len;
+	map->pool_size = hdr->pool_size;
+	return 0;
+}
+
+/*
+ * Best effort: without a usable cache directory the compiled map is only
+ * used by this process.  The file is written unnamed and only linked in
+ * once complete, so a crash never leaves a partial or temporary file.
+ */
+static void save_map_cache(nn_map_t *map, const char *node_name_map,
+			   const struct stat *src)
+{
+#ifdef O_TMPFILE
+	struct nn_map_cache_hdr hdr = {
+		.magic = NN_MAP_CACHE_MAGIC,
+		.version = NN_MAP_CACHE_VERSION,
+		.num_entries = map->num_entries,
+		.src_size = src->st_size,
+		.src_mtime_sec = src->st_mtim.tv_sec,
+		.src_mtime_nsec = src->st_mtim.tv_nsec,
+		.pool_size = map->pool_size,
+	};
+	char *cache_dir, *cache_name;
+	char fd_path[32];
+	FILE *f;
+	int fd;
+
+	cache_dir = cache_dir_name(true);
+	if (!cache_dir)
+		return;
+	cache_name = cache_file_name(cache_dir, node_name_map);
+	if (!cache_name)
+		goto out_dir;
+
+	fd = open(cache_dir, O_TMPFILE | O_WRONLY | O_CLOEXEC, 0600);
+	if (fd < 0)
+		goto out;
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		goto out;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(map->entries, sizeof(*map->entries), map->num_entries, f) !=
+		    map->num_entries ||
+	    fwrite(map->pool, 1, map->pool_size, f) != map->pool_size ||
+	    fflush(f))
+		goto out_close;
+
+	/* Replace a stale compiled map, readers check it before use anyway */
+	snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
+	if (linkat(AT_FDCWD, fd_path, AT_FDCWD, cache_name,
+		   AT_SYMLINK_FOLLOW) && errno == EEXIST &&
+	    !unlink(cache_name))
+		linkat(AT_FDCWD, fd_path, AT_FDCWD, cache_name,
+		       AT_SYMLINK_FOLLOW);
+
+out_close:
+	fclose(f);
+out:
+	free(cache_name);
+out_dir:
+	free(cache_dir);
+#endif
+}
+
 nn_map_t *open_node_name_map(const char *node_name_map)
 {
 	nn_map_t *map;
 	char linebuf[PARSE_NODE_MAP_BUFLEN + 1];
+	struct stat src;
+	bool have_src;
 
 	if (!node_name_map) {
-		struct stat buf;
 		node_name_map = IBDIAG_NODENAME_MAP_PATH;
-		if (stat(node_name_map, &buf))
+		if (stat(node_name_map, &src))
 			return NULL;
 	}
 
-	map = malloc(sizeof(*map));
+	map = calloc(1, sizeof(*map));
 	if (!map)
 		return NULL;
-	cl_qmap_init(&map->map);
+
+	have_src = !stat(node_name_map, &src);
+	if (have_src && !load_map_cache(map, node_name_map, &src))
+		return map;
 
 	memset(linebuf, '\0', PARSE_NODE_MAP_BUFLEN + 1);
 	if (parse_node_map_wrap(node_name_map, map_name, map,
@@ -226,5 +534,8 @@ nn_map_t *open_node_name_map(const char *node_name_map)
 		return NULL;
 	}
 
+	compile_map(map);
+	if (have_src)
+		save_map_cache(map, node_name_map, &src);
 	return map;
 }
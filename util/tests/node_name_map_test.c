@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: (GPL-2.0 OR Linux-OpenIB)
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <util/node_name_map.h>
+
+static int failed_tests;
+
+#define EXPECT_STREQ(expected, actual) \
+	({ \
+		const char *_expected = (expected); \
+		char *_actual = (actual); \
+		if (!_actual || strcmp(_expected, _actual)) { \
+			printf("  FAIL at line %d: %s not %s\n", __LINE__, \
+				#expected, #actual); \
+			printf("\tExpected: %s\n", _expected); \
+			printf("\t  Actual: %s\n", _actual ? _actual : "(null)"); \
+			failed_tests++; \
+		} \
+		free(_actual); \
+	})
+
+#define EXPECT_TRUE(actual) \
+	({ \
+		if (!(actual)) { \
+			printf("  FAIL at line %d: %s\n", __LINE__, #actual); \
+			failed_tests++; \
+		} \
+	})
+
+#define GUID_BASE 0x0002c90300000000ULL
+
+static uint64_t test_guid(unsigned int i)
+{
+	/* spread the entries so the text file is not already sorted */
+	return GUID_BASE + ((i * 2654435761U) & 0xffffffff);
+}
+
+static int write_map(const char *path, unsigned int num_entries)
+{
+	FILE *f = fopen(path, "w");
+
+	if (!f)
+		return -1;
+	fprintf(f, "# generated by node_name_map_test\n\n");
+	for (unsigned int i = 0; i < num_entries; i++)
+		fprintf(f, "0x%016" PRIx64 " \"node-%u\"  # comment\n",
+			test_guid(i), i);
+	/* a duplicated GUID keeps the name of its first line */
+	fprintf(f, "0x%016" PRIx64 " \"duplicate\"\n", test_guid(0));
+	return fclose(f);
+}
+
+static void check_lookups(nn_map_t *map, unsigned int num_entries)
+{
+	char name[32];
+
+	for (unsigned int i = 1; i < num_entries; i++) {
+		snprintf(name, sizeof(name), "node-%u", i);
+		EXPECT_STREQ(name, remap_node_name(map, test_guid(i), "desc"));
+	}
+
+	EXPECT_STREQ("node-0", remap_node_name(map, test_guid(0), "desc"));
+	EXPECT_STREQ("not in map", remap_node_name(map, 1, "not in map"));
+}
+
+/* the compiled map must be the only file left in the cache directory */
+static char *find_cache(const char *cache_dir)
+{
+	struct dirent *ent;
+	char *cache = NULL;
+	int found = 0;
+	DIR *d;
+
+	d = opendir(cache_dir);
+	if (!d)
+		return NULL;
+	while ((ent = readdir(d))) {
+		if (ent->d_name[0] == '.')
+			continue;
+		if (!found++ &&
+		    asprintf(&cache, "%s/%s", cache_dir, ent->d_name) < 0)
+			cache = NULL;
+	}
+	closedir(d);
+	if (found != 1) {
+		free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+/* offsets into the compiled file, see struct nn_map_cache_hdr */
+#define CACHE_HDR_SIZE 48
+#define CACHE_ENTRY_SIZE 16
+#define CACHE_NAME_OFF 8
+
+static int corrupt_cache(const char *cache, off_t off, const void *data,
+			 size_t len)
+{
+	int fd = open(cache, O_WRONLY);
+	ssize_t ret;
+
+	if (fd < 0)
+		return -1;
+	ret = pwrite(fd, data, len, off);
+	close(fd);
+	return ret == len ? 0 : -1;
+}
+
+/* a damaged compiled map must be rebuilt from the text one */
+static void check_corrupt_cache(const char *path, const char *cache,
+				unsigned int num_entries)
+{
+	uint32_t bad_off = UINT32_MAX;
+	uint64_t bad_guid = 0;
+	nn_map_t *map;
+	char name[32];
+
+	snprintf(name, sizeof(name), "node-%u", num_entries - 1);
+
+	EXPECT_TRUE(!corrupt_cache(cache, CACHE_HDR_SIZE + CACHE_NAME_OFF,
+				   &bad_off, sizeof(bad_off)));
+	map = open_node_name_map(path);
+	EXPECT_TRUE(map != NULL);
+	EXPECT_STREQ(name, remap_node_name(map, test_guid(num_entries - 1),
+					   "desc"));
+	close_node_name_map(map);
+
+	/* the second GUID sorting below the first one */
+	EXPECT_TRUE(!corrupt_cache(cache, CACHE_HDR_SIZE + CACHE_ENTRY_SIZE,
+				   &bad_guid, sizeof(bad_guid)));
+	map = open_node_name_map(path);
+	EXPECT_TRUE(map != NULL);
+	EXPECT_STREQ(name, remap_node_name(map, test_guid(num_entries - 1),
+					   "desc"));
+	close_node_name_map(map);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int num_entries = argc > 1 ? atoi(argv[1]) : 50000;
+	char dir[] = "/tmp/nn_map_test.XXXXXX";
+	char *path, *cache_dir, *cache;
+	nn_map_t *map;
+
+	if (!mkdtemp(dir) || asprintf(&path, "%s/ib-node-name-map", dir) < 0 ||
+	    asprintf(&cache_dir, "%s/rdma-core", dir) < 0)
+		return 1;
+	if (setenv("XDG_CACHE_HOME", dir, 1) || write_map(path, num_entries))
+		return 1;
+
+	map = open_node_name_map(path);
+	EXPECT_TRUE(map != NULL);
+	cache = find_cache(cache_dir);
+	EXPECT_TRUE(cache != NULL);
+	check_lookups(map, num_entries);
+	close_node_name_map(map);
+	if (!cache)
+		goto out;
+
+	map = open_node_name_map(path);
+	EXPECT_TRUE(map != NULL);
+	check_lookups(map, num_entries);
+	close_node_name_map(map);
+
+	/* rewriting the text map must invalidate the compiled one */
+	if (write_map(path, num_entries / 2))
+		return 1;
+	map = open_node_name_map(path);
+	EXPECT_TRUE(map != NULL);
+	EXPECT_STREQ("desc", remap_node_name(map, test_guid(num_entries - 1),
+					     "desc"));
+	close_node_name_map(map);
+
+	check_corrupt_cache(path, cache, num_entries / 2);
+
+	/* rebuilding replaced the compiled map instead of adding one */
+	free(cache);
+	cache = find_cache(cache_dir);
+	EXPECT_TRUE(cache != NULL);
+
+	if (cache)
+		unlink(cache);
+	free(cache);
+out:
+	rmdir(cache_dir);
+	unlink(path);
+	rmdir(dir);
+	free(cache_dir);
+	free(path);
+
+	if (failed_tests) {
+		printf("%d tests failed\n", failed_tests);
+		return 1;
+	}
+
+	return 0;
+}